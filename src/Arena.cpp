@@ -0,0 +1,67 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <algorithm>
+#include <functional>
+
+#include "Arena.h"
+
+using namespace tlhttp;
+
+void* Arena::allocate(size_t size, size_t alignment)
+{
+	while(true)
+	{
+		if(m_block < m_blocks.size())
+		{
+			Block& block = m_blocks[m_block];
+			size_t offset = (m_offset + alignment - 1) & ~(alignment - 1);
+			if(offset + size <= block.size)
+			{
+				m_offset = offset + size;
+				return block.data.get() + offset;
+			}
+
+			// Blocks left behind by a reset are used before growing
+			m_block++;
+			m_offset = 0;
+			continue;
+		}
+
+		size_t blockSize = std::max(m_blockSize, size + alignment);
+		if(m_capacity + blockSize > m_limit)
+			return nullptr;
+
+		// new[] aligns for any fundamental type
+		m_blocks.push_back(Block{std::unique_ptr<char[]>(new char[blockSize]), blockSize});
+		m_capacity += blockSize;
+		m_block = m_blocks.size() - 1;
+		m_offset = 0;
+	}
+}
+
+bool Arena::owns(const void* data) const
+{
+	// Pointers into unrelated objects can't be compared with <
+	std::less<const void*> less;
+	for(const Block& block : m_blocks)
+	{
+		if(!less(data, block.data.get()) && less(data, block.data.get() + block.size))
+			return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,133 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_ARENA_H
+#define TLHTTP_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace tlhttp
+{
+
+/**
+ * @brief A monotonic allocator for data which dies all at once.
+ *
+ * Memory is handed out from blocks by bumping an offset, freeing single
+ * allocations does nothing. reset() makes all blocks available again
+ * without returning them to the system, so an arena which is reset between
+ * requests stops allocating once it has grown to the size one request needs.
+ *
+ * The arena never grows beyond its limit, allocate() returns nullptr then.
+ * Not thread-safe.
+ */
+class Arena
+{
+	struct Block
+	{
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+
+	std::vector<Block> m_blocks;
+	size_t m_block = 0, m_offset = 0;
+	size_t m_capacity = 0;
+	size_t m_blockSize, m_limit;
+
+public:
+	/**
+	 * @param blockSize The size of the blocks memory is taken from.
+	 * @param limit The maximum number of bytes in all blocks.
+	 */
+	Arena(size_t blockSize = 4096, size_t limit = 65536)
+		: m_blockSize(blockSize), m_limit(limit) {}
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	/**
+	 * @brief Allocates memory which stays valid until the next reset().
+	 * @return The memory, nullptr if the limit would be exceeded.
+	 */
+	void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	/**
+	 * @brief Checks if memory was handed out by this arena.
+	 */
+	bool owns(const void* data) const;
+
+	/**
+	 * @brief Makes all memory available again.
+	 * @note Everything allocated before must not be used anymore.
+	 */
+	void reset()
+	{
+		m_block = 0;
+		m_offset = 0;
+	}
+
+	/**
+	 * @brief Returns the number of bytes in all blocks.
+	 */
+	size_t getCapacity() const { return m_capacity; }
+};
+
+/**
+ * @brief Lets standard containers allocate from an arena.
+ *
+ * Allocations the arena has no room for go to the heap, so a container
+ * keeps working when it outgrows the arena.
+ */
+template<typename T>
+class ArenaAllocator
+{
+	template<typename U> friend class ArenaAllocator;
+	Arena* m_arena;
+
+public:
+	typedef T value_type;
+
+	explicit ArenaAllocator(Arena* arena) : m_arena(arena) {}
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& allocator) : m_arena(allocator.m_arena) {}
+
+	T* allocate(size_t count)
+	{
+		if(void* data = m_arena->allocate(count * sizeof(T), alignof(T)))
+			return static_cast<T*>(data);
+
+		return static_cast<T*>(::operator new(count * sizeof(T)));
+	}
+
+	void deallocate(T* data, size_t)
+	{
+		if(!m_arena->owns(data))
+			::operator delete(data);
+	}
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& allocator) const { return m_arena == allocator.m_arena; }
+
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U>& allocator) const { return m_arena != allocator.m_arena; }
+};
+
+}
+
+#endif //TLHTTP_ARENA_H
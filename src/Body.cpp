@@ -0,0 +1,246 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+#include "Body.h"
+
+using namespace tlhttp;
+
+namespace
+{
+std::atomic<size_t> defaultMemoryLimit(1024 * 1024);
+
+std::mutex spillMutex;
+std::string spillDirectory = (getenv("TMPDIR") && *getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+
+int createTemporaryFile(const std::string& directory)
+{
+	// An unnamed file is removed by the kernel once it is closed
+	int fd = open(directory.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+	if(fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL))
+		return fd;
+
+	std::string path = directory + "/tlhttp-XXXXXX";
+	fd = mkostemp(&path[0], O_CLOEXEC);
+	if(fd >= 0)
+		unlink(path.c_str());
+
+	return fd;
+}
+}
+
+Body::Body() : m_memoryLimit(defaultMemoryLimit) {}
+
+Body::~Body()
+{
+	if(m_fd >= 0)
+		close(m_fd);
+}
+
+Body::Body(Body&& body) noexcept
+	: m_memory(std::move(body.m_memory)),
+	  m_fd(std::exchange(body.m_fd, -1)),
+	  m_size(std::exchange(body.m_size, 0)),
+	  m_memoryLimit(body.m_memoryLimit) {}
+
+Body& Body::operator=(Body&& body) noexcept
+{
+	if(this != &body)
+	{
+		if(m_fd >= 0)
+			close(m_fd);
+
+		m_memory = std::move(body.m_memory);
+		m_fd = std::exchange(body.m_fd, -1);
+		m_size = std::exchange(body.m_size, 0);
+		m_memoryLimit = body.m_memoryLimit;
+	}
+
+	return *this;
+}
+
+void Body::setDefaultMemoryLimit(size_t limit)
+{
+	defaultMemoryLimit = limit;
+}
+
+size_t Body::getDefaultMemoryLimit()
+{
+	return defaultMemoryLimit;
+}
+
+void Body::setSpillDirectory(const std::string& directory)
+{
+	std::lock_guard<std::mutex> lock(spillMutex);
+	spillDirectory = directory;
+}
+
+std::string Body::getSpillDirectory()
+{
+	std::lock_guard<std::mutex> lock(spillMutex);
+	return spillDirectory;
+}
+
+void Body::spill()
+{
+	std::string directory = getSpillDirectory();
+	if(directory.empty())
+		throw std::runtime_error("Body exceeds the memory limit!");
+
+	int fd = createTemporaryFile(directory);
+	if(fd < 0)
+		throw std::runtime_error("Could not create temporary file for body: " + std::string(strerror(errno)));
+
+	m_fd = fd;
+	std::string memory = std::move(m_memory);
+	m_memory = std::string();
+	m_size = 0;
+
+	try
+	{
+		append(memory.data(), memory.size());
+	}
+	catch(...)
+	{
+		close(m_fd);
+		m_fd = -1;
+		m_memory = std::move(memory);
+		m_size = m_memory.size();
+		throw;
+	}
+}
+
+void Body::append(const char* data, size_t size)
+{
+	if(m_fd < 0 && m_memory.size() + size > m_memoryLimit)
+		spill();
+
+	if(m_fd < 0)
+	{
+		m_memory.append(data, size);
+		m_size += size;
+		return;
+	}
+
+	while(size)
+	{
+		ssize_t count = ::write(m_fd, data, size);
+		if(count < 0 && errno == EINTR)
+			continue;
+
+		if(count < 0)
+			throw std::runtime_error("Could not write body to temporary file: " + std::string(strerror(errno)));
+
+		data += count;
+		size -= count;
+		m_size += count;
+	}
+}
+
+std::string_view Body::view() const
+{
+	if(m_fd >= 0)
+		throw std::runtime_error("Body is not kept in memory!");
+
+	return m_memory;
+}
+
+std::string Body::str() const
+{
+	if(m_fd < 0)
+		return m_memory;
+
+	std::string result(m_size, '\0');
+	size_t offset = 0;
+	while(offset < m_size)
+	{
+		size_t count = read(offset, &result[offset], m_size - offset);
+		if(!count)
+			break;
+
+		offset += count;
+	}
+
+	result.resize(offset);
+	return result;
+}
+
+size_t Body::read(size_t offset, char* buffer, size_t size) const
+{
+	if(offset >= m_size)
+		return 0;
+
+	size = std::min(size, m_size - offset);
+	if(m_fd < 0)
+	{
+		memcpy(buffer, m_memory.data() + offset, size);
+		return size;
+	}
+
+	while(true)
+	{
+		ssize_t count = pread(m_fd, buffer, size, offset);
+		if(count < 0 && errno == EINTR)
+			continue;
+
+		if(count < 0)
+			throw std::runtime_error("Could not read body from temporary file: " + std::string(strerror(errno)));
+
+		return count;
+	}
+}
+
+void Body::forEach(const std::function<void(const char*, size_t)>& sink) const
+{
+	if(m_fd < 0)
+	{
+		if(!m_memory.empty())
+			sink(m_memory.data(), m_memory.size());
+
+		return;
+	}
+
+	char buffer[65536];
+	size_t offset = 0, count;
+	while((count = read(offset, buffer, sizeof(buffer))) > 0)
+	{
+		sink(buffer, count);
+		offset += count;
+	}
+}
+
+void Body::clear()
+{
+	if(m_fd >= 0)
+	{
+		close(m_fd);
+		m_fd = -1;
+	}
+
+	m_memory.clear();
+	m_size = 0;
+}
@@ -0,0 +1,168 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_BODY_H
+#define TLHTTP_BODY_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace tlhttp
+{
+
+/**
+ * @brief Holds the body of a message.
+ *
+ * Small bodies are kept in memory. Once a body grows beyond the memory
+ * limit it is moved to an anonymous temporary file, so large uploads and
+ * downloads do not have to fit into RAM. Without a spill directory such
+ * bodies are rejected instead.
+ *
+ * Bodies are read in pieces with read() or forEach(), str() copies the
+ * whole body and is meant for small ones.
+ */
+class Body
+{
+	std::string m_memory;
+	int m_fd = -1;
+	size_t m_size = 0;
+	size_t m_memoryLimit;
+
+	void spill();
+
+public:
+	Body();
+	~Body();
+
+	Body(Body&& body) noexcept;
+	Body& operator=(Body&& body) noexcept;
+
+	Body(const Body&) = delete;
+	Body& operator=(const Body&) = delete;
+
+	/**
+	 * @brief Sets the memory limit of bodies created afterwards.
+	 * @param limit The number of bytes kept in memory, 1 MiB by default.
+	 */
+	static void setDefaultMemoryLimit(size_t limit);
+	static size_t getDefaultMemoryLimit();
+
+	/**
+	 * @brief Sets where bodies above the memory limit are stored.
+	 *
+	 * Defaults to $TMPDIR or /tmp. An empty string disables spilling, appending
+	 * beyond the memory limit then throws.
+	 *
+	 * @note Should be set before any server or connection is started.
+	 */
+	static void setSpillDirectory(const std::string& directory);
+	static std::string getSpillDirectory();
+
+	/**
+	 * @brief Sets the memory limit of this body.
+	 */
+	void setMemoryLimit(size_t limit) { m_memoryLimit = limit; }
+	size_t getMemoryLimit() const { return m_memoryLimit; }
+
+	/**
+	 * @brief Appends data to the body.
+	 * @throws std::runtime_error when the body can not be spilled to disk.
+	 */
+	void append(const char* data, size_t size);
+	void append(std::string_view data) { append(data.data(), data.size()); }
+
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	/**
+	 * @brief Checks if the body was moved to a temporary file.
+	 */
+	bool isSpilled() const { return m_fd >= 0; }
+
+	/**
+	 * @brief Returns the file descriptor of a spilled body, -1 otherwise.
+	 */
+	int getFd() const { return m_fd; }
+
+	/**
+	 * @brief Returns a view of a body which is kept in memory.
+	 * @throws std::runtime_error if the body was spilled.
+	 */
+	std::string_view view() const;
+
+	/**
+	 * @brief Copies the whole body into a string.
+	 */
+	std::string str() const;
+
+	/**
+	 * @brief Reads a part of the body.
+	 * @param offset The position in the body to start at.
+	 * @param buffer Receives the data.
+	 * @param size The size of the buffer.
+	 * @return The number of bytes read, 0 at the end of the body.
+	 * @throws std::runtime_error on I/O errors.
+	 */
+	size_t read(size_t offset, char* buffer, size_t size) const;
+
+	/**
+	 * @brief Passes the body in consecutive pieces to a sink.
+	 */
+	void forEach(const std::function<void(const char*, size_t)>& sink) const;
+
+	/**
+	 * @brief Empties the body, a temporary file is removed.
+	 */
+	void clear();
+
+	Body& operator<<(std::string_view data)
+	{
+		append(data);
+		return *this;
+	}
+
+	Body& operator<<(const std::string& data)
+	{
+		append(data);
+		return *this;
+	}
+
+	Body& operator<<(const char* data)
+	{
+		append(std::string_view(data));
+		return *this;
+	}
+
+	Body& operator<<(char c)
+	{
+		append(&c, 1);
+		return *this;
+	}
+
+	template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+	Body& operator<<(T value)
+	{
+		append(std::to_string(value));
+		return *this;
+	}
+};
+
+}
+
+#endif //TLHTTP_BODY_H
@@ -0,0 +1,169 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include "Body.h"
+#include "Chunked.h"
+
+using namespace tlhttp;
+
+namespace
+{
+int hexValue(char c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+
+	if(c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+}
+
+size_t ChunkedDecoder::decode(const char* data, size_t size, Body& body)
+{
+	size_t position = 0;
+	while(position < size && m_state != State::Done)
+	{
+		char c = data[position];
+		switch(m_state)
+		{
+			case State::Size:
+			{
+				int value = hexValue(c);
+				if(value >= 0)
+				{
+					// 15 digits keep the size far from overflowing
+					if(++m_digits > 15)
+						throw std::runtime_error("Invalid chunked body: Chunk is too large!");
+
+					m_chunkSize = m_chunkSize * 16 + value;
+				}
+				else if(m_digits == 0)
+					throw std::runtime_error("Invalid chunked body: Chunk size is missing!");
+				else if(c == ';' || c == ' ' || c == '\t')
+					m_state = State::Extension;
+				else if(c == '\r')
+					m_state = State::SizeLineEnd;
+				else if(c == '\n')
+				{
+					m_state = State::SizeLineEnd;
+					continue;
+				}
+				else
+					throw std::runtime_error("Invalid chunked body: Chunk size is invalid!");
+
+				position++;
+				break;
+			}
+
+			case State::Extension:
+				if(c == '\r' || c == '\n')
+				{
+					m_state = State::SizeLineEnd;
+					if(c == '\n')
+						continue;
+				}
+
+				position++;
+				break;
+
+			case State::SizeLineEnd:
+				if(c != '\n')
+					throw std::runtime_error("Invalid chunked body: Expected line feed!");
+
+				position++;
+				m_remaining = m_chunkSize;
+				m_state = (m_chunkSize ? State::Data : State::Trailer);
+				m_chunkSize = 0;
+				m_digits = 0;
+				m_lineLength = 0;
+				break;
+
+			case State::Data:
+			{
+				size_t count = std::min<uint64_t>(m_remaining, size - position);
+				body.append(data + position, count);
+				position += count;
+				m_remaining -= count;
+
+				if(!m_remaining)
+					m_state = State::DataEnd;
+
+				break;
+			}
+
+			case State::DataEnd:
+				if(c == '\r')
+				{
+					m_state = State::DataLineEnd;
+					position++;
+					break;
+				}
+
+				m_state = State::DataLineEnd;
+				continue;
+
+			case State::DataLineEnd:
+				if(c != '\n')
+					throw std::runtime_error("Invalid chunked body: Chunk is longer than its size!");
+
+				position++;
+				m_state = State::Size;
+				break;
+
+			case State::Trailer:
+				position++;
+				if(c == '\n')
+				{
+					// The empty line ends the trailer
+					if(m_lineLength == 0)
+						m_state = State::Done;
+
+					m_lineLength = 0;
+				}
+				else if(c != '\r')
+					m_lineLength++;
+
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return position;
+}
+
+std::string ChunkedDecoder::encode(std::string_view data)
+{
+	char size[20];
+	int length = snprintf(size, sizeof(size), "%zx\r\n", data.size());
+
+	std::string result;
+	result.reserve(length + data.size() + 2);
+	result.append(size, length);
+	result.append(data);
+	result.append("\r\n");
+	return result;
+}
@@ -0,0 +1,83 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_CHUNKED_H
+#define TLHTTP_CHUNKED_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace tlhttp
+{
+
+class Body;
+
+/**
+ * @brief Incrementally decodes a body with the chunked transfer coding.
+ *
+ * Consumes the encoded data as it arrives and appends the decoded data
+ * to a body, so the encoded form never has to be buffered as a whole.
+ * Chunk extensions and trailer fields are skipped.
+ */
+class ChunkedDecoder
+{
+	enum class State
+	{
+		Size,
+		Extension,
+		SizeLineEnd,
+		Data,
+		DataEnd,
+		DataLineEnd,
+		Trailer,
+		Done
+	};
+
+	State m_state = State::Size;
+
+	uint64_t m_chunkSize = 0, m_remaining = 0;
+	unsigned int m_digits = 0;
+	size_t m_lineLength = 0;
+
+public:
+	/**
+	 * @brief Continues decoding.
+	 * @param data The encoded data which was not consumed yet.
+	 * @param size The size of the data.
+	 * @param body Receives the decoded data.
+	 * @return The number of bytes consumed, all of them unless the end of the body was reached.
+	 * @throws std::runtime_error when the coding is malformed.
+	 */
+	size_t decode(const char* data, size_t size, Body& body);
+
+	bool isDone() const { return m_state == State::Done; }
+
+	/**
+	 * @brief Frames data as one chunk.
+	 * @param data The data, must not be empty since that marks the end.
+	 */
+	static std::string encode(std::string_view data);
+
+	/**
+	 * @brief The last chunk with an empty trailer.
+	 */
+	static constexpr std::string_view LAST_CHUNK = "0\r\n\r\n";
+};
+
+}
+
+#endif //TLHTTP_CHUNKED_H
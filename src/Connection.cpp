@@ -20,7 +20,12 @@
 #include <openssl/err.h>
 
 #include <sys/types.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstdint>
@@ -28,12 +33,15 @@
 #include <cstring>
 #include <exception>
 #include <stdexcept>
-#include <sstream>
 
 #include <iostream>
 #include <thread>
 
 #include "Connection.h"
+#include "Http2.h"
+#include "EventLoop.h"
+#include "Pool.h"
+#include "Resolver.h"
 
 using namespace tlhttp;
 
@@ -50,6 +58,206 @@ public:
 };
 
 static InitSSL initSSL;
+
+/**
+ * @brief Races non-blocking connects to a list of addresses as in RFC 8305.
+ *
+ * The attempts start in interleaved order, the next one once the previous
+ * had its head start or failed. The sockets of the losing attempts are
+ * closed with the race.
+ */
+class ConnectRace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	Addresses m_candidates;
+	size_t m_next = 0;
+	std::vector<int> m_pending;
+	Connection::ConnectOptions m_options;
+	Clock::time_point m_nextStart, m_deadline;
+	int m_error = 0;
+
+	// Watches the pending sockets for asynchronous connects
+	EventLoop* m_loop;
+	std::function<void(int)> m_onReady;
+
+	void forget(int fd)
+	{
+		m_pending.erase(std::find(m_pending.begin(), m_pending.end(), fd));
+		if(m_loop)
+			m_loop->remove(fd);
+	}
+
+public:
+	/**
+	 * @param loop The loop notifying onReady of sockets done connecting, nullptr for wait().
+	 */
+	ConnectRace(const Addresses& addresses, const Connection::ConnectOptions& options,
+				EventLoop* loop = nullptr, const std::function<void(int)>& onReady = nullptr)
+		: m_candidates(Resolver::interleave(addresses)), m_options(options), m_nextStart(Clock::now()),
+		  m_deadline(options.timeout.count() > 0 ? m_nextStart + options.timeout : Clock::time_point::max()),
+		  m_loop(loop), m_onReady(onReady)
+	{
+	}
+
+	~ConnectRace()
+	{
+		while(!m_pending.empty())
+		{
+			int fd = m_pending.back();
+			forget(fd);
+			::close(fd);
+		}
+	}
+
+	bool isDone() const
+	{
+		return (m_pending.empty() && m_next == m_candidates.size()) || Clock::now() >= m_deadline;
+	}
+
+	/**
+	 * @brief Returns why no attempt succeeded.
+	 */
+	int getError() const
+	{
+		return (m_pending.empty() && m_next == m_candidates.size()) ? m_error : ETIMEDOUT;
+	}
+
+	/**
+	 * @brief Returns the milliseconds until the next attempt or the deadline is due, -1 if neither is.
+	 */
+	int getWaitTime() const
+	{
+		auto until = m_deadline;
+		if(m_next < m_candidates.size())
+			until = std::min(until, m_nextStart);
+
+		if(until == Clock::time_point::max())
+			return -1;
+
+		auto wait = std::chrono::ceil<std::chrono::milliseconds>(until - Clock::now());
+		return std::max<int>(0, wait.count());
+	}
+
+	/**
+	 * @brief Starts the attempts which are due.
+	 * @return A socket which connected right away, -1 otherwise.
+	 */
+	int start()
+	{
+		auto now = Clock::now();
+		while(m_next < m_candidates.size() && (m_pending.empty() || now >= m_nextStart))
+		{
+			const Address& target = m_candidates[m_next++];
+			int fd = socket(target.getFamily(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			if(fd < 0)
+			{
+				m_error = errno;
+				continue;
+			}
+
+#ifdef TCP_FASTOPEN_CONNECT
+			// Connects right away if the kernel has a cookie of the server,
+			// the SYN is then sent along with the first write
+			int one = 1;
+			if(m_options.fastOpen)
+				setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one));
+#endif
+
+			if(::connect(fd, target.get(), target.length) == 0)
+				return fd;
+
+			if(errno != EINPROGRESS)
+			{
+				m_error = errno;
+				::close(fd);
+				continue;
+			}
+
+			m_pending.push_back(fd);
+			m_nextStart = now + m_options.attemptDelay;
+
+			if(m_loop)
+			{
+				auto onReady = m_onReady;
+				m_loop->add(fd, EPOLLOUT, [onReady, fd](uint32_t) { onReady(fd); });
+			}
+		}
+
+		return -1;
+	}
+
+	/**
+	 * @brief Checks a pending attempt whose socket became writable.
+	 * @return The socket if it connected, -1 otherwise.
+	 */
+	int check(int fd)
+	{
+		if(std::find(m_pending.begin(), m_pending.end(), fd) == m_pending.end())
+			return -1;
+
+		int error = 0;
+		socklen_t length = sizeof(error);
+		if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+			error = errno;
+
+		forget(fd);
+		if(!error)
+			return fd;
+
+		// A failed attempt lets the next address start right away
+		m_error = error;
+		m_nextStart = Clock::now();
+		::close(fd);
+		return -1;
+	}
+
+	/**
+	 * @brief Runs the race with poll().
+	 * @return The connected socket, -1 if all attempts failed or the deadline passed.
+	 */
+	int wait()
+	{
+		std::vector<struct pollfd> fds;
+		while(true)
+		{
+			int fd = start();
+			if(fd >= 0)
+				return fd;
+
+			if(isDone())
+				return -1;
+
+			fds.clear();
+			for(int pending : m_pending)
+				fds.push_back({pending, POLLOUT, 0});
+
+			if(::poll(fds.data(), fds.size(), getWaitTime()) < 0 && errno != EINTR)
+			{
+				m_error = errno;
+				return -1;
+			}
+
+			for(const struct pollfd& ready : fds)
+			{
+				if(ready.revents && (fd = check(ready.fd)) >= 0)
+					return fd;
+			}
+		}
+	}
+};
+}
+
+Connection::Connection()
+	: Connection(0)
+{
+}
+
+Connection::Connection(int fd)
+	: m_port(0), m_socketFd(fd)
+{
+	m_readTimer.setCallback([this]() { close(); });
+	m_writeTimer.setCallback([this]() { close(); });
 }
 
 Connection::~Connection()
@@ -57,7 +265,7 @@ Connection::~Connection()
 	if (m_socketFd > 0)
 	{
 		shutdown(m_socketFd, SHUT_WR);
-		close(m_socketFd);
+		::close(m_socketFd);
 	}
 }
 
@@ -68,27 +276,20 @@ void Connection::connect(const std::string& address, uint16_t port)
 
 	if(m_socketFd)
 	{
-		close(m_socketFd);
+		::close(m_socketFd);
 	}
 
-	struct addrinfo hints, *sockaddr;
-	memset(&hints, 0, sizeof(struct addrinfo));
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_flags = 0;
-	hints.ai_protocol = 0;
-
-	m_socket = getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &sockaddr);
+	m_socketFd = 0;
 
-	int err;
-	m_socketFd = socket(sockaddr->ai_family, sockaddr->ai_socktype, sockaddr->ai_protocol);
-	if(m_socketFd < 0)
-		throw std::runtime_error("Could not create socket to " + address + ": " + gai_strerror(m_socketFd));
+	Resolver& resolver = (m_connectOptions.resolver ? *m_connectOptions.resolver : Resolver::getDefault());
+	ConnectRace race(resolver.resolve(address, port), m_connectOptions);
 
-	if((err = ::connect(m_socketFd, sockaddr->ai_addr, sockaddr->ai_addrlen)) < 0)
-		throw std::runtime_error("Could not connect to " + address + ": " + gai_strerror(err));
+	int fd = race.wait();
+	if(fd < 0)
+		throw std::runtime_error("Could not connect to " + address + ": " + strerror(race.getError()));
 
-	freeaddrinfo(sockaddr);
+	m_socketFd = fd;
+	setNonBlocking(false);
 }
 
 void Connection::send(const std::string& message)
@@ -96,7 +297,19 @@ void Connection::send(const std::string& message)
 	if(!m_socketFd)
 		throw std::runtime_error("Not connected!");
 
-	::send(m_socketFd, message.c_str(), message.size(), 0);
+	// The peer may have closed a reused connection, which must not raise SIGPIPE
+	size_t sent = 0;
+	while(sent < message.size())
+	{
+		ssize_t count = ::send(m_socketFd, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+		if(count < 0 && errno == EINTR)
+			continue;
+
+		if(count < 0)
+			throw std::runtime_error(std::string("Error while sending data: ") + strerror(errno));
+
+		sent += count;
+	}
 }
 
 std::string Connection::receive()
@@ -104,21 +317,25 @@ std::string Connection::receive()
 	if(!m_socketFd)
 		throw std::runtime_error("Not connected!");
 
-	char buffer[512];
-	buffer[511] = 0;
-
-	int err = 0;
-	std::stringstream ss;
-	while((err = ::recv(m_socketFd, buffer, sizeof(buffer) - 1, 0)) > 0)
+	// Received straight into the buffer, which may contain any byte
+	ssize_t count;
+	do
 	{
-		buffer[err] = 0;
-		ss << buffer;
+		char* free = m_input.prepare();
+		if((count = receiveSome(free, m_input.getFree())) > 0)
+			m_input.commit(count);
 	}
+	while(count > 0);
 
-	if(err != 0)
+	if(count != 0)
+	{
+		m_input.shrink();
 		throw std::runtime_error("Error while receiving data!");
+	}
 
-	return ss.str();
+	std::string result(m_input.view());
+	m_input.clear();
+	return result;
 }
 
 Request Connection::get()
@@ -126,35 +343,60 @@ Request Connection::get()
 	if(!m_socketFd)
 		throw std::runtime_error("Not connected!");
 
-	char buffer[4096];
-	buffer[4095] = 0;
-
-	int err = 0;
+	bool eof = false;
 	Request req;
 
-	// Get header
-	if((err = ::recv(m_socketFd, buffer, sizeof(buffer) - 1, 0)) <= 0)
-		throw std::runtime_error("Could not fetch HTTP header!");
+	// The header may arrive in any number of pieces, the parser continues
+	// where it stopped. Data behind the message stays buffered.
+	while(true)
+	{
+		// Responses start with the version instead of a method
+		if(m_parser.getHeaderSize() < 5)
+			m_parser = Parser(m_input.view().substr(0, 5) == "HTTP/");
 
-	req = Request::parse(std::string(buffer, err));
+		if(!m_input.empty() && Request::extract(m_input, m_parser, req, eof))
+			return req;
 
-	// Calculate remaining size
-	std::string contentSize = req["Content-Length"];
-	if(contentSize.empty())
-		return req;
-	
-	size_t bytecount = std::stoll(contentSize) - req.getBody().str().size();
-	while((err = ::recv(m_socketFd, buffer, sizeof(buffer) - 1, 0)) > 0 && bytecount > 0)
-	{
-		bytecount -= err;
-		buffer[err] = 0;
-		req << buffer;
+		if(eof)
+			throw std::runtime_error(m_input.empty() ? "Could not fetch HTTP header!" : "Error while receiving data!");
+
+		char* free = m_input.prepare();
+		ssize_t count = receiveSome(free, m_input.getFree());
+		if(count < 0)
+		{
+			m_input.shrink();
+			throw std::runtime_error("Error while receiving data!");
+		}
+
+		eof = (count == 0);
+		m_input.commit(count);
+		m_input.shrink();
 	}
+}
 
-	if(err != 0)
-		throw std::runtime_error("Error while receiving data!");
+bool Connection::isReusable() const
+{
+	if(!m_socketFd || !m_input.empty() || m_closeAfterWrite)
+		return false;
+
+	if(m_loop)
+		return !m_eof && isIdle();
+
+	// A closed connection or unexpected data make the socket readable
+	struct pollfd pfd = {m_socketFd, POLLIN, 0};
+	return ::poll(&pfd, 1, 0) == 0;
+}
+
+ssize_t Connection::receiveSome(char* buffer, size_t size)
+{
+	ssize_t count;
+	do
+	{
+		count = ::recv(m_socketFd, buffer, size, 0);
+	}
+	while(count < 0 && errno == EINTR);
 
-	return req;
+	return count;
 }
 
 Request Connection::get(const std::string& url, const std::string& str)
@@ -162,114 +404,823 @@ Request Connection::get(const std::string& url, const std::string& str)
 	Request req(m_address, url, false);
 	req << str;
 	send(req.toString());
-	return Request::parse(receive());
+	return get();
 }
 
-SSLConnection::~SSLConnection()
+void Connection::setNonBlocking(bool value)
+{
+	int flags = fcntl(m_socketFd, F_GETFL, 0);
+	if(flags < 0)
+		throw std::runtime_error(std::string("Could not get socket flags: ") + strerror(errno));
+
+	flags = value ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	if(fcntl(m_socketFd, F_SETFL, flags) < 0)
+		throw std::runtime_error(std::string("Could not set socket flags: ") + strerror(errno));
+}
+
+void Connection::attach(EventLoop& loop, const Callback& onData, const Callback& onClose)
 {
-	if(m_sslHandle != nullptr)
+	if(!m_socketFd)
+		throw std::runtime_error("Not connected!");
+
+	setNonBlocking(true);
+
+	m_loop = &loop;
+	m_lastActivity = std::chrono::steady_clock::now();
+	m_onData = onData;
+	m_onClose = onClose;
+
+	// The loop only holds a weak reference so it does not keep closed
+	// connections alive.
+	m_loop->attach(m_socketFd, std::weak_ptr<EventLoop::SocketHandler>(shared_from_this()));
+}
+
+void Connection::attachSecure(EventLoop& loop, const std::shared_ptr<TlsContext>& context,
+							  const Callback& onData, const Callback& onClose)
+{
+	if(!m_socketFd)
+		throw std::runtime_error("Not connected!");
+
+	setNonBlocking(true);
+
+	m_loop = &loop;
+	m_lastActivity = std::chrono::steady_clock::now();
+	m_onData = onData;
+	m_onClose = onClose;
+
+	// The stream attaches the socket once the handshake is done
+	std::weak_ptr<Connection> weak = shared_from_this();
+	m_tls = std::make_shared<TlsStream>(context, m_socketFd, true);
+	m_tls->handshake(loop, std::weak_ptr<EventLoop::SocketHandler>(shared_from_this()), [weak](bool success) {
+		auto self = weak.lock();
+		if(!self)
+			return;
+
+		if(!success)
+			self->close();
+		else
+			self->updateReadTimer();
+	});
+}
+
+void Connection::onReceive(const char* data, size_t size)
+{
+	m_input.append(data, size);
+	m_lastActivity = std::chrono::steady_clock::now();
+}
+
+void Connection::onReceiveDone(bool eof)
+{
+	auto self = shared_from_this();
+	m_eof = m_eof || eof;
+	m_lastActivity = std::chrono::steady_clock::now();
+
+	if(!m_input.empty() && m_onData && !m_paused)
+		m_onData(self);
+
+	wake(m_readWaiter);
+
+	// A peer which shut down its side still gets the answers to
+	// requests which are being processed.
+	if(eof && m_socketFd)
 	{
-		SSL_shutdown(m_sslHandle);
-		SSL_free(m_sslHandle);
+		if(isIdle())
+			close();
+		else
+			m_closeAfterWrite = true;
 	}
 
-	if(m_sslContext != nullptr)
+	updateReadTimer();
+}
+
+void Connection::setTimeouts(const Timeouts& timeouts)
+{
+	m_timeouts = timeouts;
+	m_readTimer.cancel();
+	m_readPhase = ReadPhase::None;
+	updateReadTimer();
+}
+
+void Connection::updateReadTimer()
+{
+	if(!m_socketFd || !m_loop)
+		return;
+
+	// Pipelined requests waiting for earlier responses are the server's fault
+	ReadPhase phase = ReadPhase::None;
+	if(getPendingRequests() > 0 || m_paused || m_closeAfterWrite)
+		phase = ReadPhase::None;
+	else if(m_parser.isDone())
+		phase = ReadPhase::Body;
+	else if(!m_input.empty() || (m_tls && !m_tls->isEstablished()))
+		phase = ReadPhase::Header;
+	else if(isIdle())
+		phase = ReadPhase::Idle;
+
+	// Every read of a body extends its timeout, the other phases run out
+	if(phase == m_readPhase && phase != ReadPhase::Body)
+		return;
+
+	m_readPhase = phase;
+
+	std::chrono::milliseconds timeout(0);
+	switch(phase)
 	{
-		SSL_CTX_free(m_sslContext);
+		case ReadPhase::Idle: timeout = m_timeouts.idle; break;
+		case ReadPhase::Header: timeout = m_timeouts.header; break;
+		case ReadPhase::Body: timeout = m_timeouts.body; break;
+		case ReadPhase::None: break;
 	}
+
+	if(timeout.count() > 0)
+		m_loop->schedule(m_readTimer, timeout);
+	else
+		m_readTimer.cancel();
 }
 
-void SSLConnection::connect(const std::string& address, uint16_t port)
+void Connection::cancelTimers()
 {
-	Connection::connect(address, port);
-	m_sslContext = SSL_CTX_new(SSLv23_method());
+	m_readTimer.cancel();
+	m_writeTimer.cancel();
+	m_readPhase = ReadPhase::None;
+}
+
+void Connection::pause()
+{
+	m_paused = true;
+	if(m_loop && m_socketFd)
+		m_loop->setReceiving(m_socketFd, false);
+}
+
+void Connection::resume()
+{
+	m_paused = false;
+	if(m_loop && m_socketFd)
+		m_loop->setReceiving(m_socketFd, true);
+
+	if(!m_input.empty() && m_onData)
+		m_onData(shared_from_this());
+}
+
+void Connection::write(const std::string& data)
+{
+	if(!m_socketFd)
+		return;
+
+	write(Segments(std::string(data)));
+}
+
+void Connection::write(Segments&& data)
+{
+	if(!m_socketFd)
+		return;
 
-	if(!m_sslContext) throw std::runtime_error(std::string("Could not create SSL context: ") + ERR_error_string(0, nullptr));
-	//SSL_CTX_set_options(m_sslContext, SSL_OP_NO_COMPRESSION );
+	auto self = shared_from_this();
+	m_output.append(std::move(data));
+	flush();
 
-	m_sslHandle = SSL_new(m_sslContext);
-	if(!m_sslContext)
+	if(m_socketFd && m_closeAfterWrite && isIdle())
+		close();
+}
+
+void Connection::flush()
+{
+	if(m_sending || m_output.empty())
+		return;
+
+	// The loop owns the buffer until the write completed
+	auto data = std::make_shared<Segments>();
+	data->swap(m_output);
+	m_sending = data;
+
+	if(m_timeouts.write.count() > 0)
+		m_loop->schedule(m_writeTimer, m_timeouts.write);
+
+	if(m_tls)
+		m_tls->send(data);
+	else
+		m_loop->send(m_socketFd, data);
+}
+
+void Connection::onSent(int error)
+{
+	auto self = shared_from_this();
+	m_sending.reset();
+
+	if(error)
 	{
-		SSL_CTX_free(m_sslContext);
-		m_sslContext = nullptr;
+		m_output.clear();
+		close();
+		return;
+	}
+
+	m_lastActivity = std::chrono::steady_clock::now();
+	flush();
 
-		throw std::runtime_error(std::string("Could not create SSL handle: ") + ERR_error_string(0, nullptr));
+	if(!m_sending)
+	{
+		m_writeTimer.cancel();
+		wake(m_writeWaiter);
 	}
 
-	if(!SSL_set_fd(m_sslHandle, getSocket()))
+	if(m_socketFd && m_closeAfterWrite && isIdle())
+		close();
+
+	updateReadTimer();
+}
+
+void Connection::closeAfterWrite()
+{
+	m_closeAfterWrite = true;
+	if(isIdle())
+		close();
+}
+
+void Connection::endStream()
+{
+	m_activeStreams--;
+	if(m_socketFd && m_closeAfterWrite && isIdle())
+		close();
+
+	updateReadTimer();
+}
+
+uint64_t Connection::beginRequest(bool last)
+{
+	m_lastRequest = m_lastRequest || last;
+	return m_nextRequest++;
+}
+
+void Connection::writeResponse(uint64_t sequence, Segments&& data, bool closeConnection, bool complete)
+{
+	// Requests behind one which closed the connection get no response
+	if(!m_socketFd || sequence < m_nextResponse || (m_closeAfterWrite && sequence >= m_nextRequest))
+		return;
+
+	auto self = shared_from_this();
+
+	PendingResponse& pending = m_responses[sequence];
+	pending.data.append(std::move(data));
+	pending.close = pending.close || closeConnection;
+	pending.complete = complete;
+
+	for(auto iter = m_responses.find(m_nextResponse); iter != m_responses.end(); iter = m_responses.find(m_nextResponse))
 	{
-		SSL_free(m_sslHandle);
-		m_sslHandle = nullptr;
+		m_output.append(std::move(iter->second.data));
+
+		// Later responses wait until the streamed one is finished
+		if(!iter->second.complete)
+			break;
 
-		SSL_CTX_free(m_sslContext);
-		m_sslContext = nullptr;
+		bool last = iter->second.close;
+		m_responses.erase(iter);
+		m_nextResponse++;
 
-		throw std::runtime_error(std::string("Could not create SSL socket: ") + ERR_error_string(0, nullptr));
+		if(last)
+		{
+			// Responses to later requests are never sent
+			m_responses.clear();
+			m_nextRequest = m_nextResponse;
+			m_closeAfterWrite = true;
+			break;
+		}
 	}
 
-	for(int error = SSL_connect(m_sslHandle); error != 1; error = SSL_connect(m_sslHandle))
+	// Nothing refers to the arena between requests
+	if(m_responses.empty())
+		m_arena.reset();
+
+	flush();
+	if(m_socketFd && m_closeAfterWrite && isIdle())
+		close();
+
+	// Pipelined requests may have been held back until now
+	if(m_socketFd && m_paused && !isDraining())
+		resume();
+
+	updateReadTimer();
+}
+
+void Connection::close()
+{
+	if(!m_socketFd)
+		return;
+
+	auto self = shared_from_this();
+	if(m_loop)
+		m_loop->remove(m_socketFd);
+
+	if(m_tls && !m_sending)
+		m_tls->shutdown();
+
+	::close(m_socketFd);
+	m_socketFd = 0;
+	cancelTimers();
+
+	Callback onClose;
+	std::swap(onClose, m_onClose);
+	m_onData = nullptr;
+
+	if(onClose)
+		onClose(self);
+
+	wake(m_readWaiter);
+	wake(m_writeWaiter);
+}
+
+void Connection::wake(std::coroutine_handle<>& waiter)
+{
+	if(waiter)
+		std::exchange(waiter, nullptr).resume();
+}
+
+Task<int> Connection::connectSocket(EventLoop& loop, const std::string& address, uint16_t port)
+{
+	m_address = address;
+	m_port = port;
+
+	if(m_socketFd)
+		throw std::runtime_error("Already connected!");
+
+	Resolver& resolver = (m_connectOptions.resolver ? *m_connectOptions.resolver : Resolver::getDefault());
+	Addresses addresses = co_await resolver.asyncResolve(loop, address, port);
+
+	// The loop reports sockets done connecting, the timer when the next
+	// attempt or the deadline is due
+	std::coroutine_handle<> waiter;
+	std::vector<int> ready;
+	Timer timer;
+	timer.setCallback([&waiter]() { wake(waiter); });
+
+	ConnectRace race(addresses, m_connectOptions, &loop, [&ready, &waiter](int fd) {
+		ready.push_back(fd);
+		wake(waiter);
+	});
+
+	while(true)
 	{
-		switch(SSL_get_error(m_sslHandle, error))
+		int fd = race.start();
+		if(fd >= 0)
+			co_return fd;
+
+		if(race.isDone())
+			break;
+
+		if(ready.empty())
+		{
+			int wait = race.getWaitTime();
+			if(wait >= 0)
+				loop.schedule(timer, std::chrono::milliseconds(wait));
+
+			co_await Waiter{waiter};
+			timer.cancel();
+		}
+
+		for(int candidate : std::exchange(ready, {}))
 		{
-			case SSL_ERROR_WANT_READ:
-			case SSL_ERROR_WANT_WRITE:
-				std::this_thread::sleep_for(std::chrono::milliseconds(200));
-				break;
-			default:
-				SSL_free(m_sslHandle);
-				SSL_CTX_free(m_sslContext);
-
-				m_sslContext = nullptr;
-				m_sslHandle = nullptr;
-
-				throw std::runtime_error(std::string("SSL handshake error: ") + ERR_error_string(error, nullptr));
-				break;
+			if((fd = race.check(candidate)) >= 0)
+				co_return fd;
 		}
 	}
+
+	throw std::runtime_error("Could not connect to " + address + ": " + strerror(race.getError()));
 }
 
-void SSLConnection::send(const std::string& message)
+Task<void> Connection::asyncConnect(EventLoop& loop, const std::string& address, uint16_t port)
 {
-	if(!m_sslHandle)
+	m_socketFd = co_await connectSocket(loop, address, port);
+	m_eof = false;
+	attach(loop, nullptr, nullptr);
+}
+
+Task<void> Connection::asyncConnectSecure(EventLoop& loop, const std::string& address, uint16_t port,
+										  std::shared_ptr<TlsContext> context)
+{
+	if(!context)
+		context = TlsContext::getDefaultClient();
+
+	m_socketFd = co_await connectSocket(loop, address, port);
+	m_eof = false;
+	m_loop = &loop;
+	m_lastActivity = std::chrono::steady_clock::now();
+
+	m_tls = std::make_shared<TlsStream>(context, m_socketFd, false);
+	context->prepareClient(m_tls->getHandle(), address, port);
+
+	// The stream attaches the socket once the handshake is done, closing
+	// the connection wakes the coroutine as well
+	std::weak_ptr<Connection> weak = shared_from_this();
+	m_tls->handshake(loop, std::weak_ptr<EventLoop::SocketHandler>(shared_from_this()), [weak](bool) {
+		if(auto self = weak.lock())
+			wake(self->m_readWaiter);
+	});
+
+	auto tls = m_tls;
+	if(tls->isHandshaking())
+		co_await waitForData();
+
+	if(!tls->isEstablished())
+	{
+		std::string error = TlsContext::getHandshakeError(tls->getHandle());
+		close();
+		throw std::runtime_error("TLS handshake with " + address + " failed: " + error);
+	}
+}
+
+Task<void> Connection::asyncSend(const std::string& message)
+{
+	if(!m_socketFd || !m_loop)
 		throw std::runtime_error("Not connected!");
 
-	SSL_write(m_sslHandle, message.c_str(), message.size());
+	write(message);
+	while(m_sending)
+	{
+		co_await waitForWrite();
+		if(!m_socketFd)
+			throw std::runtime_error("Connection closed while sending data!");
+	}
+}
+
+Task<Request> Connection::asyncGet(const std::string& url, const std::string& str)
+{
+	// Sends the body as POST so it is framed, the connection stays open
+	Request req(m_address, url, !str.empty());
+	req["Connection"] = "keep-alive";
+	req << str;
+	co_await asyncSend(req.toString());
+	co_return co_await asyncResponse();
+}
+
+Task<Request> Connection::asyncResponse()
+{
+	if(!m_parser.isResponse())
+		m_parser = Parser(true);
+
+	Request response;
+	while(!Request::extract(m_input, m_parser, response, m_eof || !m_socketFd))
+	{
+		if(m_eof || !m_socketFd)
+			throw std::runtime_error("Connection closed before the response was complete!");
+
+		co_await waitForData();
+	}
+
+	co_return response;
+}
+
+Task<std::shared_ptr<Request>> Connection::readRequest()
+{
+	auto request = makePooled<Request>();
+	while(!Request::extract(m_input, m_parser, *request))
+	{
+		if(m_eof || !m_socketFd)
+			co_return nullptr;
+
+		co_await waitForData();
+	}
+
+	co_return request;
+}
+
+namespace
+{
+std::string_view connectionField(bool close, bool legacy)
+{
+	if(close)
+		return "Connection: close\r\n";
+
+	// HTTP/1.0 connections are only kept open when the response says so
+	return legacy ? "Connection: keep-alive\r\n" : "";
+}
+}
+
+Responder::Responder(Http2Session& session, uint32_t stream, bool head)
+	: m_connection(session.getConnection()), m_sequence(stream), m_keepAlive(true), m_legacy(false), m_head(head),
+	  m_session(session.shared_from_this())
+{
+}
+
+void Responder::send(const Request& response) const
+{
+	if(m_observer)
+		(*m_observer)(response);
+
+	if(m_session)
+	{
+		// HEAD responses announce the length of the body they leave out
+		queueStream(response, m_head ? Segment() : response.getBodySegment(), response.getBody().size(), true);
+		return;
+	}
+
+	Segments data;
+	if(m_head)
+		response.serializeHeader(data, connectionField(!m_keepAlive, m_legacy), true, response.getBody().size());
+	else
+		response.serialize(data, connectionField(!m_keepAlive, m_legacy), true);
+
+	queue(std::move(data), !m_keepAlive, true);
+}
+
+void Responder::send(Request&& response) const
+{
+	if(m_head)
+	{
+		send(response);
+		return;
+	}
+
+	if(m_observer)
+		(*m_observer)(response);
+
+	if(m_session)
+	{
+		size_t length = response.getBody().size();
+		Segment body = std::move(response).getBodySegment();
+		queueStream(response, std::move(body), length, true);
+		return;
+	}
+
+	Segments data;
+	std::move(response).serialize(data, connectionField(!m_keepAlive, m_legacy), true);
+	queue(std::move(data), !m_keepAlive, true);
+}
+
+void Responder::send(const Request& response, Segment&& body) const
+{
+	if(m_session)
+	{
+		size_t length = body.size;
+		queueStream(response, m_head ? Segment() : std::move(body), length, true);
+		return;
+	}
+
+	Segments data;
+	if(m_head)
+		response.serializeHeader(data, connectionField(!m_keepAlive, m_legacy), true, body.size);
+	else
+		response.serialize(data, connectionField(!m_keepAlive, m_legacy), true, std::move(body));
+
+	queue(std::move(data), !m_keepAlive, true);
+}
+
+void Responder::sendSerialized(Segment&& header, std::string_view fields, Segment&& body) const
+{
+	if(m_session)
+	{
+		// The header was serialized for HTTP/1 and is parsed again
+		Request response = Request::parse(std::string(header.data, header.size) + std::string(fields) + "\r\n");
+		size_t length = body.size;
+		queueStream(response, m_head ? Segment() : std::move(body), length, true);
+		return;
+	}
+
+	Segments data;
+	data.append(std::move(header));
+	data.append(std::string(fields) + std::string(connectionField(!m_keepAlive, m_legacy)));
+	data.append(Request::getDateField());
+	data.append(Segment::fromStatic("\r\n"));
+
+	if(!m_head)
+		data.append(std::move(body));
+
+	queue(std::move(data), !m_keepAlive, true);
+}
+
+Responder Responder::observe(const Observer& observer) const
+{
+	Responder responder(*this);
+	auto previous = m_observer;
+	responder.m_observer = std::make_shared<const Observer>([previous, observer](const Request& response) {
+		if(previous)
+			(*previous)(response);
+
+		observer(response);
+	});
+
+	return responder;
+}
+
+void Responder::begin(const Request& response) const
+{
+	if(m_session)
+	{
+		queueStream(response, Segment(), 0, false);
+		response.getBody().forEach([this](const char* data, size_t size) {
+			write(std::string(data, size));
+		});
+
+		return;
+	}
+
+	std::string header = response.toHeaderString();
+
+	// HTTP/1.0 has no chunked coding, the end of the connection ends the body
+	if(m_legacy)
+		header += "Connection: close\r\n";
+	else
+	{
+		if(!m_keepAlive)
+			header += "Connection: close\r\n";
+
+		if(!response.isChunked())
+			header += "Transfer-Encoding: chunked\r\n";
+	}
+
+	Segments data(std::move(header));
+	if(response.getHeader(HeaderId::Date).empty())
+		data.append(Request::getDateField());
+
+	data.append(Segment::fromStatic("\r\n"));
+	queue(std::move(data), false, false);
+
+	response.getBody().forEach([this](const char* data, size_t size) {
+		write(std::string(data, size));
+	});
+}
+
+void Responder::write(const std::string& data) const
+{
+	write(std::string(data));
+}
+
+void Responder::write(std::string&& data) const
+{
+	if(data.empty() || m_head)
+		return;
+
+	if(m_session)
+	{
+		queueStreamData(Segments(std::move(data)), false);
+		return;
+	}
+
+	if(m_legacy)
+	{
+		queue(Segments(std::move(data)), false, false);
+		return;
+	}
+
+	// The chunk is framed around the data instead of copying it
+	char size[20];
+	int length = snprintf(size, sizeof(size), "%zx\r\n", data.size());
+
+	Segments chunk(std::string(size, length));
+	chunk.append(std::move(data));
+	chunk.append(Segment::fromStatic("\r\n"));
+	queue(std::move(chunk), false, false);
+}
+
+void Responder::end() const
+{
+	if(m_session)
+	{
+		queueStreamData(Segments(), true);
+		return;
+	}
+
+	Segments data;
+	if(!m_legacy && !m_head)
+		data.append(Segment::fromStatic(ChunkedDecoder::LAST_CHUNK));
+
+	queue(std::move(data), !m_keepAlive || m_legacy, true);
+}
+
+void Responder::queue(Segments&& data, bool closeConnection, bool complete) const
+{
+	auto conn = m_connection;
+	auto shared = std::make_shared<Segments>(std::move(data));
+	uint64_t sequence = m_sequence;
+
+	EventLoop* loop = conn->getEventLoop();
+	auto write = [conn, shared, sequence, closeConnection, complete]() {
+		conn->writeResponse(sequence, std::move(*shared), closeConnection, complete);
+	};
+
+	if(loop)
+		loop->dispatch(write);
+	else
+		write();
+}
+
+void Responder::queueStream(const Request& response, Segment&& body, size_t contentLength, bool endStream) const
+{
+	// The fields are compressed on the loop thread, which owns the encoder
+	auto session = m_session;
+	auto fields = std::make_shared<Headers>(response.getHeaders());
+	auto data = std::make_shared<Segments>();
+	data->append(std::move(body));
+
+	uint32_t stream = uint32_t(m_sequence);
+	uint16_t status = response.getResponse();
+
+	session->getEventLoop()->dispatch([session, fields, data, stream, status, contentLength, endStream]() {
+		bool headersOnly = endStream && data->empty();
+		session->sendHeaders(stream, status, *fields, endStream ? contentLength : UINT64_MAX, headersOnly);
+
+		if(!headersOnly && !data->empty())
+			session->sendData(stream, std::move(*data), endStream);
+	});
+}
+
+void Responder::queueStreamData(Segments&& data, bool endStream) const
+{
+	auto session = m_session;
+	auto shared = std::make_shared<Segments>(std::move(data));
+	uint32_t stream = uint32_t(m_sequence);
+
+	session->getEventLoop()->dispatch([session, shared, stream, endStream]() {
+		session->sendData(stream, std::move(*shared), endStream);
+	});
 }
 
-std::string SSLConnection::receive()
-{	
+SSLConnection::~SSLConnection()
+{
 	if(!m_sslHandle)
-		throw std::runtime_error("Not connected!");
+		return;
 
-	char buffer[512];
-	buffer[511] = 0;
+	// Marks the session as closed properly so it stays resumable. The alert
+	// is not sent, the peer may be gone already.
+	SSL_set_quiet_shutdown(m_sslHandle, 1);
+	SSL_shutdown(m_sslHandle);
+	SSL_free(m_sslHandle);
+}
 
-	int err = 0;
-	std::stringstream ss;
-	
-	
-	while((err = SSL_read(m_sslHandle, buffer, sizeof(buffer) - 1)) > 0)
+void SSLConnection::connect(const std::string& address, uint16_t port)
+{
+	if(m_sslHandle)
 	{
-		switch(SSL_get_error(m_sslHandle, err))
-		{
-			case SSL_ERROR_NONE:
-				buffer[err] = 0;
-				ss << buffer;
-				break;
+		SSL_free(m_sslHandle);
+		m_sslHandle = nullptr;
+	}
 
-			case SSL_ERROR_WANT_READ:
-				continue;
+	Connection::connect(address, port);
+
+	m_sslHandle = SSL_new(m_context->get());
+	if(!m_sslHandle)
+		throw std::runtime_error("Could not create TLS session: " + TlsContext::getError());
 
-			case SSL_ERROR_SYSCALL:
-			case SSL_ERROR_ZERO_RETURN:
-				return ss.str();
+	SSL_set_fd(m_sslHandle, getSocket());
+	m_context->prepareClient(m_sslHandle, address, port);
 
-			default: throw std::runtime_error(std::string("Error while receiving data: ") + ERR_error_string(err, nullptr));
-		}
+	// Waits for the socket instead of retrying after a fixed delay
+	setNonBlocking(true);
+	auto deadline = std::chrono::steady_clock::now() + m_handshakeTimeout;
+
+	while(true)
+	{
+		ERR_clear_error();
+		int result = SSL_connect(m_sslHandle);
+		if(result == 1)
+			break;
+
+		int error = SSL_get_error(m_sslHandle, result);
+		if(error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+			throw std::runtime_error("TLS handshake with " + address + " failed: " + TlsContext::getHandshakeError(m_sslHandle));
+
+		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+
+		struct pollfd pfd = {getSocket(), short(error == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT), 0};
+		int ready = (remaining.count() > 0 ? ::poll(&pfd, 1, remaining.count()) : 0);
+		if(ready < 0 && errno == EINTR)
+			continue;
+
+		if(ready <= 0)
+			throw std::runtime_error("TLS handshake with " + address + " timed out!");
+	}
+
+	setNonBlocking(false);
+}
+
+void SSLConnection::send(const std::string& message)
+{
+	if(!m_sslHandle)
+		throw std::runtime_error("Not connected!");
+
+	size_t sent = 0;
+	while(sent < message.size())
+	{
+		ERR_clear_error();
+		int count = SSL_write(m_sslHandle, message.data() + sent, message.size() - sent);
+		if(count <= 0)
+			throw std::runtime_error("Error while sending data: " + TlsContext::getError());
+
+		sent += count;
 	}
+}
+
+ssize_t SSLConnection::receiveSome(char* buffer, size_t size)
+{
+	if(!m_sslHandle)
+		return -1;
+
+	ERR_clear_error();
+	int count = SSL_read(m_sslHandle, buffer, size);
+	if(count > 0)
+		return count;
 
-	if(err != 0)
-		throw std::runtime_error(std::string("Error while receiving data: ") + ERR_error_string(err, nullptr));
+	if(SSL_get_error(m_sslHandle, count) == SSL_ERROR_ZERO_RETURN)
+		return 0;
 
-	return ss.str();
+	ERR_clear_error();
+	return -1;
 }
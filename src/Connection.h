@@ -23,31 +23,198 @@
 #include <netdb.h>
 #include <openssl/ssl.h>
 
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+
+#include "Arena.h"
 #include "Request.h"
+#include "EventLoop.h"
+#include "Task.h"
+#include "Tls.h"
 
 namespace tlhttp
 {
 
+class Http2Session;
+class Resolver;
+
 /**
  * @brief Implements a TCP socket.
  * 
  * This class allows to send and receive bytes as well as HTTP
  * requests.
+ *
+ * A connection can either be used with the blocking methods or be attached
+ * to an EventLoop. Attached connections are non-blocking and report incoming
+ * data through a callback.
  */
-class Connection
+class Connection : public std::enable_shared_from_this<Connection>, public EventLoop::SocketHandler
 {
+public:
+	typedef std::function<void(const std::shared_ptr<Connection>&)> Callback;
+
+	/**
+	 * @brief Limits how long an attached connection may make no progress.
+	 *
+	 * A timeout of 0 disables the respective limit.
+	 */
+	struct Timeouts
+	{
+		/// The time from the first byte of a request until its header is complete
+		std::chrono::milliseconds header{0};
+
+		/// The time between two reads of a request body
+		std::chrono::milliseconds body{0};
+
+		/// The time a persistent connection may wait for the next request
+		std::chrono::milliseconds idle{0};
+
+		/// The time one batch of queued output may take to be written
+		std::chrono::milliseconds write{0};
+	};
+
+	/**
+	 * @brief Controls how client connections are established.
+	 *
+	 * Addresses of both families are raced as in RFC 8305: the next one is
+	 * tried after attemptDelay while earlier attempts are still pending, or
+	 * right away once one failed. The first to connect wins.
+	 */
+	struct ConnectOptions
+	{
+		/// The time the whole connect may take, 0 leaves it to the kernel
+		std::chrono::milliseconds timeout{0};
+
+		/// The head start of every attempt before the next address is tried
+		std::chrono::milliseconds attemptDelay{250};
+
+		/// Uses TCP Fast Open, so the first data goes out with the SYN
+		bool fastOpen = false;
+
+		/// Looks up host names, nullptr uses Resolver::getDefault()
+		Resolver* resolver = nullptr;
+	};
+
+private:
 	uint16_t m_port;
 	std::string m_address;
-	int m_socket, m_socketFd;
+	int m_socketFd;
+
+	EventLoop* m_loop = nullptr;
+	Callback m_onData, m_onClose;
+	IoBuffer m_input;
+	Segments m_output;
+	Parser m_parser;
+	std::shared_ptr<const Segments> m_sending;
+	bool m_closeAfterWrite = false, m_paused = false;
+	std::chrono::steady_clock::time_point m_lastActivity;
+
+	enum class ReadPhase
+	{
+		None, ///< A request is being handled, only writing is limited
+		Idle,
+		Header,
+		Body
+	};
+
+	// Encrypts the connection unless records are handled by the kernel
+	std::shared_ptr<TlsStream> m_tls;
+
+	Timeouts m_timeouts;
+	ConnectOptions m_connectOptions;
+	ReadPhase m_readPhase = ReadPhase::None;
+	Timer m_readTimer, m_writeTimer;
+
+	/**
+	 * @brief Arms the read timer for what the connection is waiting for.
+	 *
+	 * The header timer is not extended by partial headers, so a client
+	 * trickling in a byte at a time is still cut off.
+	 */
+	void updateReadTimer();
+
+	struct PendingResponse
+	{
+		Segments data;
+		bool close = false;
+		bool complete = false;
+	};
+
+	typedef std::map<uint64_t, PendingResponse, std::less<uint64_t>,
+			ArenaAllocator<std::pair<const uint64_t, PendingResponse>>> ResponseMap;
+
+	// Holds the bookkeeping of the requests in flight, it is reset once
+	// all of them were answered.
+	Arena m_arena{1024, 16384};
+
+	// Responses which have to wait for earlier pipelined ones, streamed
+	// responses stay here until they are complete.
+	ResponseMap m_responses{ResponseMap::allocator_type(&m_arena)};
+	uint64_t m_nextRequest = 0, m_nextResponse = 0;
+
+	// Requests answered in any order, such as HTTP/2 streams
+	uint64_t m_activeStreams = 0;
+	bool m_lastRequest = false;
+
+	// Coroutines waiting for input or for the output to drain
+	std::coroutine_handle<> m_readWaiter, m_writeWaiter;
+	bool m_eof = false;
+
+	struct Waiter
+	{
+		std::coroutine_handle<>& slot;
+
+		bool await_ready() noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) noexcept { slot = handle; }
+		void await_resume() noexcept {}
+	};
+
+	static void wake(std::coroutine_handle<>& waiter);
+	Waiter waitForData() { return Waiter{m_readWaiter}; }
+	Waiter waitForWrite() { return Waiter{m_writeWaiter}; }
+
+	void flush();
+	void cancelTimers();
+
+	/**
+	 * @brief Resolves and connects a non-blocking socket without blocking the loop.
+	 *
+	 * The addresses are raced according to the connect options.
+	 *
+	 * @return The connected socket.
+	 */
+	Task<int> connectSocket(EventLoop& loop, const std::string& address, uint16_t port);
+
+	void onReceive(const char* data, size_t size) override;
+	IoBuffer* getReceiveBuffer() override { return &m_input; }
+	void onReceiveDone(bool eof) override;
+	void onSent(int error) override;
+
+protected:
+	/**
+	 * @brief Reads what is available from a blocking connection.
+	 * @return The number of bytes read, 0 at the end of the stream, -1 on errors.
+	 */
+	virtual ssize_t receiveSome(char* buffer, size_t size);
 	
 public:
-	Connection() : m_port(0), m_socket(0), m_socketFd(0) {}
-	Connection(int fd) : m_socketFd(fd) {}
+	Connection();
+	Connection(int fd);
+
+	Connection(const Connection&) = delete;
+	Connection& operator=(const Connection&) = delete;
 
 	~Connection();
 
 	/**
 	 * @brief Connects to a remote TCP server.
+	 *
+	 * The name is looked up by the Resolver of the connect options, so
+	 * repeated connects are served from its cache. The addresses are
+	 * raced according to the connect options.
+	 *
 	 * @param address The DNS name or IP of the server.
 	 * @param port The port to connect to.
 	 * @throws std::runtime_error on failure.
@@ -94,27 +261,431 @@ public:
 	{
 		return m_socketFd;
 	}
+
+	/**
+	 * @brief Switches the socket between blocking and non-blocking mode.
+	 * @throws std::runtime_error on failure.
+	 */
+	void setNonBlocking(bool value);
+
+	/**
+	 * @brief Attaches the connection to an event loop.
+	 *
+	 * The socket is made non-blocking and all further events are handled
+	 * on the loop thread.
+	 *
+	 * @param loop The loop to register with.
+	 * @param onData Called whenever new data was appended to the input buffer.
+	 * @param onClose Called once the connection was closed.
+	 * @throws std::runtime_error on failure.
+	 */
+	void attach(EventLoop& loop, const Callback& onData, const Callback& onClose);
+
+	/**
+	 * @brief Replaces the data callback, e.g. when the protocol changes.
+	 * @note Must be called on the loop thread.
+	 */
+	void setDataCallback(const Callback& onData) { m_onData = onData; }
+
+	/**
+	 * @brief Attaches an accepted connection and secures it with TLS.
+	 *
+	 * The handshake runs on the loop, the data callback is only invoked
+	 * with decrypted data. A failed handshake closes the connection.
+	 *
+	 * @param loop The loop to register with.
+	 * @param context The server context with the certificate.
+	 * @param onData Called whenever new data was appended to the input buffer.
+	 * @param onClose Called once the connection was closed.
+	 * @throws std::runtime_error on failure.
+	 */
+	void attachSecure(EventLoop& loop, const std::shared_ptr<TlsContext>& context,
+					  const Callback& onData, const Callback& onClose);
+
+	/**
+	 * @brief Returns the TLS state, nullptr for plain connections.
+	 */
+	const std::shared_ptr<TlsStream>& getTls() const { return m_tls; }
+
+	/**
+	 * @brief Sets the timeouts of an attached connection.
+	 *
+	 * The connection is closed once one of them expired.
+	 *
+	 * @note Must be called on the loop thread.
+	 */
+	void setTimeouts(const Timeouts& timeouts);
+	const Timeouts& getTimeouts() const { return m_timeouts; }
+
+	/**
+	 * @brief Sets how the following connects are established.
+	 */
+	void setConnectOptions(const ConnectOptions& options) { m_connectOptions = options; }
+	const ConnectOptions& getConnectOptions() const { return m_connectOptions; }
+
+	/**
+	 * @brief Queues data to be written to an attached connection.
+	 * @note Must be called on the loop thread.
+	 */
+	void write(const std::string& data);
+
+	/**
+	 * @brief Queues segments to be written to an attached connection.
+	 *
+	 * Everything queued until the socket is writable again goes out with
+	 * one vectored write.
+	 *
+	 * @note Must be called on the loop thread.
+	 */
+	void write(Segments&& data);
+
+	/**
+	 * @brief Stops reading and reporting incoming data.
+	 *
+	 * The socket is not read until resume() is called, so the peer is held
+	 * back by the receive window. The data callback is not invoked for the
+	 * data which was already buffered either.
+	 *
+	 * @note Must be called on the loop thread.
+	 */
+	void pause();
+
+	/**
+	 * @brief Reads and reports data again.
+	 * @note Must be called on the loop thread.
+	 */
+	void resume();
+
+	/**
+	 * @brief Closes the connection once all queued data was written.
+	 * @note Must be called on the loop thread.
+	 */
+	void closeAfterWrite();
+
+	/**
+	 * @brief Closes an attached connection immediately.
+	 * @note Must be called on the loop thread.
+	 */
+	void close();
+
+	/**
+	 * @brief Returns the data received on an attached connection.
+	 *
+	 * The data callback is expected to remove what it consumed.
+	 */
+	IoBuffer& getInput() { return m_input; }
+
+	/**
+	 * @brief Returns the parser state of the receive buffer.
+	 */
+	Parser& getParser() { return m_parser; }
+
+	EventLoop* getEventLoop() const { return m_loop; }
+
+	/**
+	 * @brief Reserves the position of the next response on the connection.
+	 * @param last Whether no further requests are read after this one.
+	 * @return The sequence number to pass to writeResponse().
+	 */
+	uint64_t beginRequest(bool last);
+
+	/**
+	 * @brief Queues a response for a pipelined request.
+	 *
+	 * Responses are written in the order their requests arrived, no matter
+	 * in which order they complete.
+	 *
+	 * @param sequence The number returned by beginRequest().
+	 * @param data The serialized response, referenced until it was written.
+	 * @param closeConnection Whether to close the connection after the response.
+	 * @param complete Whether the response is complete, otherwise more
+	 * data for the same sequence follows.
+	 * @note Must be called on the loop thread.
+	 */
+	void writeResponse(uint64_t sequence, Segments&& data, bool closeConnection, bool complete = true);
+
+	/**
+	 * @brief Counts a request which is answered out of order.
+	 *
+	 * Such requests keep the connection busy like pipelined ones, but
+	 * their responses are written with write() as they come.
+	 *
+	 * @note Must be called on the loop thread.
+	 */
+	void beginStream() { m_activeStreams++; }
+
+	/**
+	 * @brief Finishes a request started with beginStream().
+	 * @note Must be called on the loop thread.
+	 */
+	void endStream();
+
+	/**
+	 * @brief Returns the number of requests still waiting for their response.
+	 */
+	uint64_t getPendingRequests() const { return m_nextRequest - m_nextResponse + m_activeStreams; }
+
+	/**
+	 * @brief Returns the number of requests read from the connection.
+	 */
+	uint64_t getRequestCount() const { return m_nextRequest; }
+
+	/**
+	 * @brief Checks if no further requests are accepted on the connection.
+	 */
+	bool isDraining() const { return m_lastRequest || m_closeAfterWrite; }
+
+	/**
+	 * @brief Checks if the connection has nothing to do.
+	 */
+	bool isIdle() const { return m_output.empty() && !m_sending && getPendingRequests() == 0; }
+
+	/**
+	 * @brief Checks if another request may be sent over the connection.
+	 *
+	 * The connection has to be open, without unread data and not closed
+	 * by the peer.
+	 */
+	bool isReusable() const;
+
+	/**
+	 * @brief Returns the time data was last read or written.
+	 */
+	std::chrono::steady_clock::time_point getLastActivity() const { return m_lastActivity; }
+
+	/**
+	 * @brief Connects to a remote TCP server without blocking the loop.
+	 *
+	 * The connection is attached to the loop afterwards, so it has to be
+	 * owned by a std::shared_ptr.
+	 *
+	 * @param loop The loop to use, the coroutine has to run on its thread.
+	 * @param address The DNS name or IP of the server.
+	 * @param port The port to connect to.
+	 * @throws std::runtime_error on failure.
+	 */
+	Task<void> asyncConnect(EventLoop& loop, const std::string& address, uint16_t port = 80);
+
+	/**
+	 * @brief Connects to a remote TLS server without blocking the loop.
+	 *
+	 * The handshake is driven by the loop, a session kept by the context
+	 * for the same host and port is resumed.
+	 *
+	 * @param loop The loop to use, the coroutine has to run on its thread.
+	 * @param address The DNS name or IP of the server.
+	 * @param port The port to connect to.
+	 * @param context The client context, nullptr uses TlsContext::getDefaultClient().
+	 * @throws std::runtime_error on failure.
+	 */
+	Task<void> asyncConnectSecure(EventLoop& loop, const std::string& address, uint16_t port = 443,
+								  std::shared_ptr<TlsContext> context = nullptr);
+
+	/**
+	 * @brief Sends a string over an attached connection.
+	 *
+	 * Completes once everything was handed to the kernel.
+	 *
+	 * @throws std::runtime_error if the connection was closed.
+	 */
+	Task<void> asyncSend(const std::string& message);
+
+	/**
+	 * @brief Sends a request over an attached connection.
+	 *
+	 * Unlike get() the connection is kept alive, so several requests
+	 * can be made one after another.
+	 *
+	 * @param url The parameter.
+	 * @param str The body, requests with a body are sent as POST.
+	 * @return The parsed response.
+	 * @throws std::runtime_error on failure.
+	 */
+	Task<Request> asyncGet(const std::string& url, const std::string& str);
+
+	/**
+	 * @brief Waits for the next response on an attached client connection.
+	 *
+	 * Responses to pipelined requests are read one after another.
+	 *
+	 * @throws std::runtime_error if the connection closes before the response is complete.
+	 */
+	Task<Request> asyncResponse();
+
+	/**
+	 * @brief Waits for the next request on an attached server connection.
+	 * @return The request, nullptr once the peer closed the connection.
+	 * @throws std::runtime_error when the request can not be parsed.
+	 */
+	Task<std::shared_ptr<Request>> readRequest();
+};
+
+/**
+ * @brief Completes a request received by an asynchronous server.
+ *
+ * A responder may be copied and kept around in order to answer the
+ * request later, possibly from a different thread.
+ */
+class Responder
+{
+public:
+	typedef std::function<void(const Request&)> Observer;
+
+private:
+	std::shared_ptr<Connection> m_connection;
+	uint64_t m_sequence;
+	bool m_keepAlive, m_legacy, m_head;
+	std::shared_ptr<const Observer> m_observer;
+
+	// Set for requests received over HTTP/2, m_sequence is the stream then
+	std::shared_ptr<Http2Session> m_session;
+
+	void queue(Segments&& data, bool closeConnection, bool complete) const;
+
+	/**
+	 * @brief Sends the header and the body of a response on an HTTP/2 stream.
+	 * @param endStream Whether the response is complete, otherwise it is streamed.
+	 */
+	void queueStream(const Request& response, Segment&& body, size_t contentLength, bool endStream) const;
+	void queueStreamData(Segments&& data, bool endStream) const;
+
+public:
+	/**
+	 * @param connection The connection the request came from.
+	 * @param sequence The value returned by Connection::beginRequest().
+	 * @param keepAlive Whether the connection stays open after the response.
+	 * @param legacy Whether the request was made with HTTP/1.0.
+	 * @param head Whether the request was a HEAD request, responses then
+	 * only announce their body.
+	 */
+	Responder(const std::shared_ptr<Connection>& connection, uint64_t sequence, bool keepAlive,
+			  bool legacy = false, bool head = false)
+		: m_connection(connection), m_sequence(sequence), m_keepAlive(keepAlive), m_legacy(legacy), m_head(head) {}
+
+	/**
+	 * @param session The HTTP/2 session the request came from, kept alive by the responder.
+	 * @param stream The stream of the request.
+	 * @param head Whether the request was a HEAD request.
+	 */
+	Responder(Http2Session& session, uint32_t stream, bool head);
+
+	/**
+	 * @brief Sends the response.
+	 *
+	 * Adds a Connection header when the connection is closed afterwards or
+	 * when an HTTP/1.0 client asked to keep it open.
+	 *
+	 * @param response The response to send.
+	 */
+	void send(const Request& response) const;
+
+	/**
+	 * @brief Sends the response without copying its body.
+	 *
+	 * The body is moved out of the response and written in place.
+	 */
+	void send(Request&& response) const;
+
+	/**
+	 * @brief Sends the response with a body given as a segment.
+	 *
+	 * Used to send files with sendfile(), the body of the response is ignored.
+	 */
+	void send(const Request& response, Segment&& body) const;
+
+	/**
+	 * @brief Sends a response which was serialized before.
+	 *
+	 * The Connection and Date fields are added, so the serialized form can
+	 * be sent on any connection.
+	 *
+	 * @param header The start line and fields without the empty line.
+	 * @param fields Additional fields, each ending with CRLF.
+	 * @param body The body, its length has to be given in the header.
+	 */
+	void sendSerialized(Segment&& header, std::string_view fields, Segment&& body) const;
+
+	/**
+	 * @brief Returns a responder which passes every response to a function before sending it.
+	 *
+	 * Only responses sent with send(const Request&) or send(Request&&) are
+	 * passed on, not streamed ones.
+	 */
+	Responder observe(const Observer& observer) const;
+
+	/**
+	 * @brief Starts a response whose body is streamed.
+	 *
+	 * The body is sent with the chunked transfer coding, HTTP/1.0 clients
+	 * get it unframed and the connection is closed afterwards. Any body
+	 * already in the response is sent as the first chunk.
+	 *
+	 * @param response The status and fields of the response.
+	 */
+	void begin(const Request& response) const;
+
+	/**
+	 * @brief Sends the next part of a streamed body.
+	 * @param data The data, empty strings are ignored.
+	 */
+	void write(const std::string& data) const;
+	void write(std::string&& data) const;
+
+	/**
+	 * @brief Finishes a streamed response.
+	 */
+	void end() const;
+
+	const std::shared_ptr<Connection>& getConnection() const { return m_connection; }
 };
 
 /**
  * @brief Implements an SSL secured TCP socket.
  * 
  * This class allows to do HTTPS requests.
+ *
+ * All connections share one client context, so a connection to a host
+ * which was connected to before resumes the earlier session.
  */
 class SSLConnection : public Connection
 {
+	std::shared_ptr<TlsContext> m_context;
 	SSL* m_sslHandle;
-	SSL_CTX* m_sslContext;
+	std::chrono::milliseconds m_handshakeTimeout = std::chrono::seconds(30);
+
+protected:
+	ssize_t receiveSome(char* buffer, size_t size) override;
 
 public:
-	SSLConnection()
-		: m_sslHandle(nullptr), m_sslContext(nullptr)
+	/**
+	 * @param context The client context, nullptr uses TlsContext::getDefaultClient().
+	 */
+	SSLConnection(const std::shared_ptr<TlsContext>& context = nullptr)
+		: m_context(context ? context : TlsContext::getDefaultClient()), m_sslHandle(nullptr)
 	{}
 
 	~SSLConnection();
+
+	/**
+	 * @brief Connects and performs the handshake.
+	 *
+	 * The handshake waits for the socket with poll() and fails once the
+	 * handshake timeout passed.
+	 *
+	 * @throws std::runtime_error on failure.
+	 */
 	void connect(const std::string& address, uint16_t port = 443) override;
 	void send(const std::string& message) override;
-	std::string receive() override;
+
+	/**
+	 * @brief Limits how long connect() waits for the handshake.
+	 */
+	void setHandshakeTimeout(std::chrono::milliseconds timeout) { m_handshakeTimeout = timeout; }
+
+	/**
+	 * @brief Checks if the handshake resumed an earlier session.
+	 */
+	bool isResumed() const { return m_sslHandle && SSL_session_reused(m_sslHandle); }
 };
 
 }
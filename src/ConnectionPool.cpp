@@ -0,0 +1,289 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "ConnectionPool.h"
+
+using namespace tlhttp;
+
+Endpoint Endpoint::fromUrl(const std::string& url, std::string& target)
+{
+	Endpoint endpoint;
+	size_t schemeEnd = url.find("://");
+	if(schemeEnd == std::string::npos)
+		throw std::runtime_error("URL is not absolute: " + url);
+
+	endpoint.scheme = url.substr(0, schemeEnd);
+	std::transform(endpoint.scheme.begin(), endpoint.scheme.end(), endpoint.scheme.begin(), ::tolower);
+	if(endpoint.scheme != "http" && endpoint.scheme != "https")
+		throw std::runtime_error("Unsupported URL scheme: " + endpoint.scheme);
+
+	size_t authorityStart = schemeEnd + 3;
+	size_t authorityEnd = url.find_first_of("/?#", authorityStart);
+	std::string authority = url.substr(authorityStart, authorityEnd - authorityStart);
+
+	target = (authorityEnd == std::string::npos ? "/" : url.substr(authorityEnd));
+	target = target.substr(0, target.find('#'));
+	if(target.empty() || target[0] != '/')
+		target.insert(0, "/");
+
+	// IPv6 literals are enclosed in brackets
+	size_t hostEnd = (!authority.empty() && authority[0] == '[') ? authority.find(']') : authority.rfind(':');
+	if(!authority.empty() && authority[0] == '[')
+	{
+		if(hostEnd == std::string::npos)
+			throw std::runtime_error("Invalid host in URL: " + url);
+
+		endpoint.host = authority.substr(1, hostEnd - 1);
+		hostEnd = (hostEnd + 1 < authority.size() && authority[hostEnd + 1] == ':') ? hostEnd + 1 : std::string::npos;
+	}
+	else
+		endpoint.host = authority.substr(0, hostEnd);
+
+	endpoint.port = endpoint.isSecure() ? 443 : 80;
+	if(hostEnd != std::string::npos)
+	{
+		std::string port = authority.substr(hostEnd + 1);
+		if(port.empty() || port.size() > 5 || port.find_first_not_of("0123456789") != std::string::npos || std::stoul(port) > 65535)
+			throw std::runtime_error("Invalid port in URL: " + url);
+
+		endpoint.port = std::stoul(port);
+	}
+
+	if(endpoint.host.empty())
+		throw std::runtime_error("URL has no host: " + url);
+
+	return endpoint;
+}
+
+std::shared_ptr<Connection> ConnectionPool::connect(const Endpoint& endpoint) const
+{
+	std::shared_ptr<Connection> connection;
+	if(endpoint.isSecure())
+		connection = std::make_shared<SSLConnection>(m_tls);
+	else
+		connection = std::make_shared<Connection>();
+
+	connection->setConnectOptions(m_connectOptions);
+	connection->connect(endpoint.host, endpoint.port);
+	return connection;
+}
+
+std::shared_ptr<Connection> ConnectionPool::takeIdle(Host& host)
+{
+	auto now = std::chrono::steady_clock::now();
+	while(!host.idle.empty())
+	{
+		IdleConnection idle = std::move(host.idle.front());
+		host.idle.pop_front();
+		m_idleCount--;
+
+		if(now - idle.since < m_limits.idleTimeout && idle.connection->isReusable())
+			return idle.connection;
+
+		idle.connection->close();
+		host.count--;
+	}
+
+	return nullptr;
+}
+
+bool ConnectionPool::reserve(Host& host)
+{
+	if(m_limits.maxPerHost && host.count >= m_limits.maxPerHost)
+		return false;
+
+	host.count++;
+	return true;
+}
+
+std::shared_ptr<Connection> ConnectionPool::acquire(const Endpoint& endpoint, bool* reused)
+{
+	std::string key = endpoint.getKey();
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while(true)
+		{
+			Host& host = m_hosts[key];
+			if(auto connection = takeIdle(host))
+			{
+				if(reused)
+					*reused = true;
+
+				return connection;
+			}
+
+			if(reserve(host))
+				break;
+
+			m_released.wait_for(lock, std::chrono::milliseconds(100));
+		}
+	}
+
+	if(reused)
+		*reused = false;
+
+	// Connecting may take a while, other endpoints are not blocked meanwhile
+	try
+	{
+		return connect(endpoint);
+	}
+	catch(...)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_hosts[key].count--;
+		m_released.notify_all();
+		throw;
+	}
+}
+
+std::shared_ptr<Connection> ConnectionPool::tryAcquire(const Endpoint& endpoint, bool& reserved)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Host& host = m_hosts[endpoint.getKey()];
+
+	auto connection = takeIdle(host);
+	reserved = !connection && reserve(host);
+	return connection;
+}
+
+void ConnectionPool::release(const Endpoint& endpoint, const std::shared_ptr<Connection>& connection, bool reusable)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Host& host = m_hosts[endpoint.getKey()];
+
+	if(reusable && connection && m_limits.maxIdle > 0 && connection->isReusable())
+	{
+		if(m_idleCount >= m_limits.maxIdle)
+			evictOldest();
+
+		host.idle.push_front(IdleConnection{connection, std::chrono::steady_clock::now()});
+		m_idleCount++;
+	}
+	else
+	{
+		if(connection)
+			connection->close();
+
+		host.count--;
+	}
+
+	m_released.notify_all();
+}
+
+void ConnectionPool::evictOldest()
+{
+	Host* oldest = nullptr;
+	for(auto& host : m_hosts)
+	{
+		if(!host.second.idle.empty() && (!oldest || host.second.idle.back().since < oldest->idle.back().since))
+			oldest = &host.second;
+	}
+
+	if(!oldest)
+		return;
+
+	oldest->idle.back().connection->close();
+	oldest->idle.pop_back();
+	oldest->count--;
+	m_idleCount--;
+}
+
+Request ConnectionPool::get(const std::string& url, const std::string& body)
+{
+	std::string target;
+	Endpoint endpoint = Endpoint::fromUrl(url, target);
+
+	std::string message = formatRequest(endpoint, target, body);
+
+	for(int attempt = 0;; attempt++)
+	{
+		bool reused = false;
+		auto connection = acquire(endpoint, &reused);
+
+		Request response;
+		try
+		{
+			connection->send(message);
+			response = connection->get();
+		}
+		catch(std::runtime_error&)
+		{
+			release(endpoint, connection, false);
+
+			// The server may have closed the connection just before it was
+			// used. Requests with a body may have been processed anyway, so
+			// only bodiless ones are sent again.
+			if(reused && attempt == 0 && body.empty())
+				continue;
+
+			throw;
+		}
+
+		release(endpoint, connection, isReusable(response));
+		return response;
+	}
+}
+
+std::string ConnectionPool::formatRequest(const Endpoint& endpoint, const std::string& target, const std::string& body)
+{
+	// IPv6 literals are enclosed in brackets again
+	std::string host = endpoint.host.find(':') != std::string::npos ? "[" + endpoint.host + "]" : endpoint.host;
+	if(endpoint.port != (endpoint.isSecure() ? 443 : 80))
+		host += ":" + std::to_string(endpoint.port);
+
+	Request request(host, target, !body.empty());
+	request[HeaderId::Connection] = "keep-alive";
+
+	request << body;
+	return request.toString();
+}
+
+bool ConnectionPool::isReusable(const Request& response)
+{
+	if(!response.isKeepAlive())
+		return false;
+
+	// Bodies delimited by the end of the connection leave nothing to reuse
+	uint16_t status = response.getResponse();
+	return status < 200 || status == 204 || status == 304 || response.isChunked()
+		|| !response.getHeader(HeaderId::ContentLength).empty();
+}
+
+void ConnectionPool::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for(auto& host : m_hosts)
+	{
+		for(auto& idle : host.second.idle)
+			idle.connection->close();
+
+		host.second.count -= host.second.idle.size();
+		host.second.idle.clear();
+	}
+
+	m_idleCount = 0;
+	m_released.notify_all();
+}
+
+size_t ConnectionPool::getIdleCount() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_idleCount;
+}
@@ -0,0 +1,199 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_CONNECTIONPOOL_H
+#define TLHTTP_CONNECTIONPOOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "Connection.h"
+
+namespace tlhttp
+{
+
+/**
+ * @brief The scheme, host and port a connection goes to.
+ */
+struct Endpoint
+{
+	std::string scheme = "http";
+	std::string host;
+	uint16_t port = 80;
+
+	bool isSecure() const { return scheme == "https"; }
+	std::string getKey() const { return scheme + "://" + host + ":" + std::to_string(port); }
+
+	/**
+	 * @brief Splits an absolute http or https URL.
+	 * @param url The URL.
+	 * @param target Receives the path and query, "/" if there is none.
+	 * @throws std::runtime_error if the URL is not absolute.
+	 */
+	static Endpoint fromUrl(const std::string& url, std::string& target);
+};
+
+/**
+ * @brief Keeps idle client connections for reuse.
+ *
+ * Connections are kept per endpoint and the most recently used one is
+ * handed out first. Before that it is checked to still be open, servers
+ * close idle connections at any time.
+ *
+ * All methods are thread-safe.
+ */
+class ConnectionPool
+{
+public:
+	struct Limits
+	{
+		/// The number of idle connections kept over all endpoints
+		size_t maxIdle = 64;
+
+		/// The number of connections to one endpoint, in use or idle, 0 means unlimited
+		size_t maxPerHost = 16;
+
+		/// The time after which an idle connection is closed
+		std::chrono::milliseconds idleTimeout = std::chrono::seconds(30);
+	};
+
+private:
+	struct IdleConnection
+	{
+		std::shared_ptr<Connection> connection;
+		std::chrono::steady_clock::time_point since;
+	};
+
+	struct Host
+	{
+		std::deque<IdleConnection> idle; ///< The most recently used connection first
+		size_t count = 0; ///< Connections in use or idle
+	};
+
+	Limits m_limits;
+	std::shared_ptr<TlsContext> m_tls;
+	Connection::ConnectOptions m_connectOptions;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_released;
+	std::unordered_map<std::string, Host> m_hosts;
+	size_t m_idleCount = 0;
+
+	// Called with the mutex locked
+	void evictOldest();
+	std::shared_ptr<Connection> takeIdle(Host& host);
+	bool reserve(Host& host);
+
+	std::shared_ptr<Connection> connect(const Endpoint& endpoint) const;
+
+public:
+	ConnectionPool() {}
+	explicit ConnectionPool(const Limits& limits) : m_limits(limits) {}
+
+	/**
+	 * @brief Sets the context of https connections.
+	 * @param context The context, nullptr uses TlsContext::getDefaultClient().
+	 */
+	void setTlsContext(const std::shared_ptr<TlsContext>& context) { m_tls = context; }
+
+	/**
+	 * @brief Sets how new connections are established.
+	 * @note Must not be called while other threads use the pool.
+	 */
+	void setConnectOptions(const Connection::ConnectOptions& options) { m_connectOptions = options; }
+
+	/**
+	 * @brief Hands out a connection to an endpoint.
+	 *
+	 * Reuses an idle connection if possible and connects otherwise. Waits
+	 * while the endpoint has the maximum number of connections.
+	 *
+	 * @param endpoint The endpoint to connect to.
+	 * @param reused Set to whether the connection was used before.
+	 * @return The connection, it has to be given back with release().
+	 * @throws std::runtime_error if connecting fails.
+	 */
+	std::shared_ptr<Connection> acquire(const Endpoint& endpoint, bool* reused = nullptr);
+
+	/**
+	 * @brief Hands out an idle connection without waiting or connecting.
+	 *
+	 * Used by asynchronous clients, which make new connections themselves.
+	 *
+	 * @param endpoint The endpoint.
+	 * @param reserved Set if there was no idle connection but a new one may
+	 * be made. The new connection has to be given back with release().
+	 * @return The idle connection, nullptr if there is none.
+	 */
+	std::shared_ptr<Connection> tryAcquire(const Endpoint& endpoint, bool& reserved);
+
+	/**
+	 * @brief Gives a connection back.
+	 *
+	 * Connections which are not kept are closed.
+	 *
+	 * @param endpoint The endpoint passed to acquire().
+	 * @param connection The connection, nullptr gives back a reservation
+	 * of tryAcquire() whose connect failed.
+	 * @param reusable Whether the last response left the connection open
+	 * and was read completely.
+	 */
+	void release(const Endpoint& endpoint, const std::shared_ptr<Connection>& connection, bool reusable);
+
+	/**
+	 * @brief Sends a request over a pooled connection.
+	 *
+	 * A request without a body on a reused connection which turns out to
+	 * be closed is retried once on a new one. Requests with a body are not
+	 * repeated, since the server may have processed them already.
+	 *
+	 * @param url The absolute URL.
+	 * @param body The body, requests with a body are sent as POST.
+	 * @return The response.
+	 * @throws std::runtime_error on failure.
+	 */
+	Request get(const std::string& url, const std::string& body = "");
+
+	/**
+	 * @brief Closes all idle connections.
+	 * @note Pools of attached connections have to be cleared on the loop thread.
+	 */
+	void clear();
+
+	size_t getIdleCount() const;
+
+	/**
+	 * @brief Checks if a response leaves its connection usable for another request.
+	 */
+	static bool isReusable(const Request& response);
+
+	/**
+	 * @brief Serializes a keep-alive request for an endpoint.
+	 * @param endpoint The endpoint the request goes to.
+	 * @param target The path and query.
+	 * @param body The body, requests with a body are sent as POST.
+	 */
+	static std::string formatRequest(const Endpoint& endpoint, const std::string& target, const std::string& body);
+};
+
+}
+
+#endif //TLHTTP_CONNECTIONPOOL_H
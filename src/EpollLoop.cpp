@@ -0,0 +1,428 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// Needs the definition of timespec
+#include <linux/errqueue.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "EpollLoop.h"
+
+using namespace tlhttp;
+
+EpollLoop::EpollLoop()
+{
+	m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if(m_epollFd < 0)
+		throw std::runtime_error(std::string("Could not create epoll instance: ") + strerror(errno));
+
+	add(m_wakeFd, EPOLLIN, [this](uint32_t) { handleWakeup(); });
+}
+
+EpollLoop::~EpollLoop()
+{
+	for(int fd : m_lingering)
+		close(fd);
+
+	close(m_epollFd);
+}
+
+void EpollLoop::add(int fd, uint32_t events, const Callback& callback)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events | EPOLLET;
+	ev.data.fd = fd;
+
+	if(epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		throw std::runtime_error(std::string("Could not watch file descriptor: ") + strerror(errno));
+
+	auto watch = std::make_shared<Watch>();
+	watch->callback = callback;
+	m_watches[fd] = watch;
+}
+
+void EpollLoop::modify(int fd, uint32_t events)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events | EPOLLET;
+	ev.data.fd = fd;
+
+	if(epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &ev) < 0)
+		throw std::runtime_error(std::string("Could not modify file descriptor: ") + strerror(errno));
+}
+
+void EpollLoop::remove(int fd)
+{
+	epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+
+	auto iter = m_watches.find(fd);
+	if(iter == m_watches.end())
+		return;
+
+	auto watch = iter->second;
+	m_watches.erase(iter);
+
+	// The kernel may still reference the data of zerocopy sends
+	if(!watch->zerocopyPending.empty())
+		reapZerocopy(fd, *watch);
+
+	if(!watch->zerocopyPending.empty())
+		linger(fd, *watch);
+}
+
+void EpollLoop::linger(int fd, Watch& watch)
+{
+	// The duplicate keeps the socket open when the caller closes it,
+	// its error queue still receives the completions.
+	int lingerFd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if(lingerFd < 0)
+		return;
+
+	try
+	{
+		add(lingerFd, 0, [this, lingerFd](uint32_t) { finishLinger(lingerFd, false); });
+	}
+	catch(std::exception&)
+	{
+		close(lingerFd);
+		return;
+	}
+
+	auto& lingering = *m_watches[lingerFd];
+	lingering.zerocopySends = watch.zerocopySends;
+	lingering.zerocopyPending = std::move(watch.zerocopyPending);
+	lingering.linger.setCallback([this, lingerFd]() { finishLinger(lingerFd, true); });
+	schedule(lingering.linger, ZEROCOPY_LINGER);
+	m_lingering.insert(lingerFd);
+}
+
+void EpollLoop::finishLinger(int fd, bool abort)
+{
+	auto iter = m_watches.find(fd);
+	if(iter == m_watches.end())
+		return;
+
+	if(abort)
+	{
+		// Dropping the send queue releases the last references to the pages
+		struct linger option = {1, 0};
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, &option, sizeof(option));
+	}
+	else
+	{
+		reapZerocopy(fd, *iter->second);
+		if(!iter->second->zerocopyPending.empty())
+			return;
+	}
+
+	epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+	m_watches.erase(iter);
+	m_lingering.erase(fd);
+	close(fd);
+}
+
+void EpollLoop::listen(int fd, const AcceptCallback& callback)
+{
+	add(fd, EPOLLIN, [fd, callback](uint32_t) {
+		while(true)
+		{
+			int client = ::accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if(client < 0)
+			{
+				if(errno == EINTR || errno == ECONNABORTED)
+					continue;
+
+				// EAGAIN means the backlog is drained, other errors like EMFILE
+				// are temporary and must not take down the whole loop.
+				return;
+			}
+
+			callback(client);
+		}
+	});
+}
+
+void EpollLoop::attach(int fd, const std::weak_ptr<SocketHandler>& handler)
+{
+	add(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP, [this, fd](uint32_t events) {
+		handleSocket(fd, events);
+	});
+
+	m_watches[fd]->handler = handler;
+}
+
+void EpollLoop::setReceiving(int fd, bool enabled)
+{
+	auto iter = m_watches.find(fd);
+	if(iter == m_watches.end() || iter->second->receiving == enabled)
+		return;
+
+	// Re-adding EPOLLIN reports data which arrived in the meantime
+	iter->second->receiving = enabled;
+	modify(fd, EPOLLOUT | EPOLLRDHUP | (enabled ? uint32_t(EPOLLIN) : 0));
+}
+
+void EpollLoop::handleSocket(int fd, uint32_t events)
+{
+	auto iter = m_watches.find(fd);
+	if(iter == m_watches.end())
+		return;
+
+	auto watch = iter->second;
+	auto handler = watch->handler.lock();
+	if(!handler)
+		return;
+
+	if(watch->receiving && (events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)))
+	{
+		char buffer[16384];
+		bool eof = false;
+		size_t received = 0;
+
+		// Handlers with a buffer of their own get the data without a copy
+		IoBuffer* input = handler->getReceiveBuffer();
+
+		while(true)
+		{
+			char* data = (input ? input->prepare() : buffer);
+			ssize_t count = ::recv(fd, data, (input ? input->getFree() : sizeof(buffer)), 0);
+			if(count > 0)
+			{
+				received += count;
+				if(input)
+					input->commit(count);
+				else
+					handler->onReceive(data, count);
+
+				// A peer sending faster than it is read would never let the loop end,
+				// the handler gets the data in batches and may pause in between.
+				if(received >= RECEIVE_BATCH)
+				{
+					received = 0;
+					handler->onReceiveDone(false);
+					if(!m_watches.count(fd) || !watch->receiving)
+						break;
+				}
+
+				continue;
+			}
+
+			if(count < 0 && errno == EINTR)
+				continue;
+
+			if(count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+
+			eof = true;
+			break;
+		}
+
+		if(input)
+			input->shrink();
+
+		if((received || eof) && m_watches.count(fd))
+			handler->onReceiveDone(eof);
+	}
+
+	// Completions of zerocopy sends are queued as socket errors
+	if((events & EPOLLERR) && !watch->zerocopyPending.empty() && m_watches.count(fd))
+		reapZerocopy(fd, *watch);
+
+	// The handler may have removed the socket
+	if((events & EPOLLOUT) && m_watches.count(fd) && watch->sending)
+		flush(fd, *watch);
+}
+
+void EpollLoop::send(int fd, const std::shared_ptr<const Segments>& data)
+{
+	auto iter = m_watches.find(fd);
+	if(iter == m_watches.end())
+		return;
+
+	auto watch = iter->second;
+	watch->sending = data;
+	watch->sent = 0;
+	flush(fd, *watch);
+}
+
+void EpollLoop::flush(int fd, Watch& watch)
+{
+	const Segments& data = *watch.sending;
+	int error = 0;
+
+	while(watch.sent < data.size())
+	{
+		size_t offset = watch.sent;
+		const Segment& segment = data.locate(offset);
+
+		ssize_t count;
+		if(segment.isFile())
+		{
+			off_t position = segment.offset + offset;
+			count = ::sendfile(fd, segment.fd, &position, segment.size - offset);
+
+			// The file was truncated after the response was built
+			if(count == 0)
+			{
+				error = EIO;
+				break;
+			}
+		}
+		else
+		{
+			struct iovec iov[Segments::IOV_BATCH];
+			struct msghdr message = {};
+			message.msg_iov = iov;
+			message.msg_iovlen = data.fill(watch.sent, iov, Segments::IOV_BATCH);
+
+			size_t length = 0;
+			for(size_t i = 0; i < message.msg_iovlen; i++)
+				length += iov[i].iov_len;
+
+			bool zerocopy = useZerocopy(fd, watch, length);
+			count = ::sendmsg(fd, &message, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+
+			// Without enough option memory to pin the pages the data is copied
+			if(count < 0 && zerocopy && errno == ENOBUFS)
+				count = ::sendmsg(fd, &message, MSG_NOSIGNAL);
+			else if(count >= 0 && zerocopy)
+			{
+				// Every successful send gets a number, completions report ranges of them
+				if(watch.zerocopyPending.empty() || watch.zerocopyPending.back().second != watch.sending)
+					watch.zerocopyPending.emplace_back(watch.zerocopySends, watch.sending);
+				else
+					watch.zerocopyPending.back().first = watch.zerocopySends;
+
+				watch.zerocopySends++;
+			}
+		}
+
+		if(count >= 0)
+		{
+			watch.sent += count;
+			continue;
+		}
+
+		if(errno == EINTR)
+			continue;
+
+		// Continued once EPOLLOUT is reported
+		if(errno == EAGAIN || errno == EWOULDBLOCK)
+			return;
+
+		error = errno;
+		break;
+	}
+
+	watch.sending.reset();
+	if(auto handler = watch.handler.lock())
+		handler->onSent(error);
+}
+
+bool EpollLoop::useZerocopy(int fd, Watch& watch, size_t size)
+{
+	if(size < ZEROCOPY_THRESHOLD || watch.zerocopy == Watch::Zerocopy::Unsupported)
+		return false;
+
+	if(watch.zerocopy == Watch::Zerocopy::Untried)
+	{
+		int one = 1;
+		bool enabled = (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0);
+		watch.zerocopy = (enabled ? Watch::Zerocopy::Enabled : Watch::Zerocopy::Unsupported);
+	}
+
+	return watch.zerocopy == Watch::Zerocopy::Enabled;
+}
+
+void EpollLoop::reapZerocopy(int fd, Watch& watch)
+{
+	char control[256];
+	while(!watch.zerocopyPending.empty())
+	{
+		struct msghdr message = {};
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		if(recvmsg(fd, &message, MSG_ERRQUEUE) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		for(struct cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+		{
+			bool recverr = (header->cmsg_level == SOL_IP && header->cmsg_type == IP_RECVERR)
+				|| (header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR);
+			if(!recverr)
+				continue;
+
+			auto* error = reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(header));
+			if(error->ee_errno != 0 || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			// TCP completes the sends in order, ee_data is the last one of the range
+			uint32_t last = error->ee_data;
+			while(!watch.zerocopyPending.empty() && int32_t(last - watch.zerocopyPending.front().first) >= 0)
+				watch.zerocopyPending.pop_front();
+		}
+	}
+}
+
+void EpollLoop::run()
+{
+	beginRun();
+
+	struct epoll_event events[128];
+	while(m_running)
+	{
+		int count = epoll_wait(m_epollFd, events, sizeof(events) / sizeof(*events), -1);
+		if(count < 0)
+		{
+			if(errno == EINTR)
+				continue;
+
+			throw std::runtime_error(std::string("Could not wait for events: ") + strerror(errno));
+		}
+
+		for(int i = 0; i < count; i++)
+		{
+			auto iter = m_watches.find(events[i].data.fd);
+			if(iter == m_watches.end())
+				continue;
+
+			// Keep the watch alive in case the callback removes it
+			auto watch = iter->second;
+			watch->callback(events[i].events);
+		}
+	}
+
+	endRun();
+}
@@ -0,0 +1,143 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_EPOLLLOOP_H
+#define TLHTTP_EPOLLLOOP_H
+
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include "EventLoop.h"
+
+namespace tlhttp
+{
+
+/**
+ * @brief Implements the event loop with an edge-triggered epoll instance.
+ *
+ * Attached sockets are drained with recv until EAGAIN and written with
+ * send whenever they become writable.
+ *
+ * Large writes from memory use MSG_ZEROCOPY where the socket supports it.
+ * The loop keeps their data alive until the kernel reports that it no
+ * longer references the pages, which may be long after onSent() or even
+ * after the socket was removed and closed.
+ */
+class EpollLoop : public EventLoop
+{
+	struct Watch
+	{
+		Callback callback;
+		std::weak_ptr<SocketHandler> handler;
+		std::shared_ptr<const Segments> sending;
+		size_t sent = 0;
+		bool receiving = true;
+
+		enum class Zerocopy
+		{
+			Untried,
+			Enabled,
+			Unsupported
+		} zerocopy = Zerocopy::Untried;
+
+		// The data of zerocopy sends, with the number of the last send using it
+		uint32_t zerocopySends = 0;
+		std::deque<std::pair<uint32_t, std::shared_ptr<const Segments>>> zerocopyPending;
+
+		// Limits how long a removed socket waits for its completions
+		Timer linger;
+	};
+
+	int m_epollFd;
+	std::unordered_map<int, std::shared_ptr<Watch>> m_watches;
+
+	// Duplicates of removed sockets which still have zerocopy sends in flight
+	std::unordered_set<int> m_lingering;
+
+	void handleSocket(int fd, uint32_t events);
+	void flush(int fd, Watch& watch);
+
+	/**
+	 * @brief Releases the data of completed zerocopy sends.
+	 */
+	void reapZerocopy(int fd, Watch& watch);
+
+	/**
+	 * @brief Keeps the data of a removed socket alive until its zerocopy sends completed.
+	 */
+	void linger(int fd, Watch& watch);
+
+	/**
+	 * @brief Closes a lingering socket once its sends completed.
+	 * @param abort Resets the connection instead, which drops the data still queued.
+	 */
+	void finishLinger(int fd, bool abort);
+
+	/**
+	 * @brief Decides if a write of the given size is sent with MSG_ZEROCOPY.
+	 */
+	static bool useZerocopy(int fd, Watch& watch, size_t size);
+
+public:
+	/**
+	 * @brief The size from which writes are sent with MSG_ZEROCOPY.
+	 *
+	 * Pinning the pages and handling the completion cost more than copying
+	 * smaller writes.
+	 */
+	static constexpr size_t ZEROCOPY_THRESHOLD = 65536;
+
+	/**
+	 * @brief The amount of data after which the handler is notified while
+	 * the socket is still being drained.
+	 */
+	static constexpr size_t RECEIVE_BATCH = 65536;
+
+	/**
+	 * @brief How long a removed socket may wait for its zerocopy sends to complete.
+	 *
+	 * The connection is reset afterwards, a peer which doesn't acknowledge
+	 * the data would otherwise keep it alive for as long as TCP retries.
+	 */
+	static constexpr std::chrono::seconds ZEROCOPY_LINGER{10};
+
+	/**
+	 * @brief Creates the epoll instance.
+	 * @throws std::runtime_error on failure.
+	 */
+	EpollLoop();
+	~EpollLoop();
+
+	Backend getBackend() const override { return Backend::Epoll; }
+
+	void add(int fd, uint32_t events, const Callback& callback) override;
+	void modify(int fd, uint32_t events) override;
+	void remove(int fd) override;
+
+	void listen(int fd, const AcceptCallback& callback) override;
+	void attach(int fd, const std::weak_ptr<SocketHandler>& handler) override;
+	void setReceiving(int fd, bool enabled) override;
+	using EventLoop::send;
+	void send(int fd, const std::shared_ptr<const Segments>& data) override;
+
+	void run() override;
+};
+
+}
+
+#endif //TLHTTP_EPOLLLOOP_H
@@ -0,0 +1,205 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "EventLoop.h"
+#include "EpollLoop.h"
+#include "UringLoop.h"
+
+using namespace tlhttp;
+
+EventLoop::EventLoop()
+	: m_wakeFd(-1), m_running(false), m_timers(TIMER_RESOLUTION)
+{
+	m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(m_wakeFd < 0)
+		throw std::runtime_error(std::string("Could not create eventfd: ") + strerror(errno));
+}
+
+EventLoop::~EventLoop()
+{
+	close(m_wakeFd);
+	if(m_timerFd >= 0)
+		close(m_timerFd);
+}
+
+std::unique_ptr<EventLoop> EventLoop::create(Backend backend)
+{
+	switch(backend)
+	{
+		case Backend::Epoll:
+			return std::unique_ptr<EventLoop>(new EpollLoop());
+
+		case Backend::IoUring:
+			return std::unique_ptr<EventLoop>(new UringLoop());
+
+		case Backend::Auto:
+		default:
+			if(isUringSupported())
+			{
+				try
+				{
+					return std::unique_ptr<EventLoop>(new UringLoop());
+				}
+				catch(std::exception&) {}
+			}
+
+			return std::unique_ptr<EventLoop>(new EpollLoop());
+	}
+}
+
+bool EventLoop::isUringSupported()
+{
+	return UringLoop::isSupported();
+}
+
+void EventLoop::handleWakeup()
+{
+	uint64_t value;
+	while(read(m_wakeFd, &value, sizeof(value)) > 0);
+	runPending();
+}
+
+void EventLoop::send(int fd, const std::shared_ptr<const std::string>& data)
+{
+	auto segments = std::make_shared<Segments>();
+	segments->append(Segment::fromShared(data));
+	send(fd, segments);
+}
+
+void EventLoop::schedule(Timer& timer, std::chrono::milliseconds delay)
+{
+	if(m_timerFd < 0)
+	{
+		// Created on first use since add() is not available in the constructor
+		m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if(m_timerFd < 0)
+			throw std::runtime_error(std::string("Could not create timerfd: ") + strerror(errno));
+
+		add(m_timerFd, EPOLLIN, [this](uint32_t) { handleTimer(); });
+	}
+
+	m_timers.schedule(timer, delay);
+	if(!m_ticking)
+		setTicking(true);
+}
+
+void EventLoop::handleTimer()
+{
+	uint64_t expirations;
+	while(read(m_timerFd, &expirations, sizeof(expirations)) > 0);
+
+	m_timers.advance();
+
+	// An idle loop does not wake up for nothing
+	if(m_timers.empty())
+		setTicking(false);
+}
+
+void EventLoop::setTicking(bool value)
+{
+	struct itimerspec spec = {};
+	if(value)
+	{
+		spec.it_interval.tv_nsec = std::chrono::nanoseconds(TIMER_RESOLUTION).count();
+		spec.it_value = spec.it_interval;
+	}
+
+	timerfd_settime(m_timerFd, 0, &spec, nullptr);
+	m_ticking = value;
+}
+
+void EventLoop::post(const std::function<void()>& fn)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_pendingMutex);
+		m_pending.push_back(fn);
+	}
+
+	uint64_t one = 1;
+	if(write(m_wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		throw std::runtime_error(std::string("Could not wake up event loop: ") + strerror(errno));
+}
+
+void EventLoop::dispatch(const std::function<void()>& fn)
+{
+	if(isInLoopThread())
+		fn();
+	else
+		post(fn);
+}
+
+void EventLoop::runPending()
+{
+	std::vector<std::function<void()>> pending;
+	{
+		std::lock_guard<std::mutex> lock(m_pendingMutex);
+		pending.swap(m_pending);
+	}
+
+	for(auto& fn : pending)
+		fn();
+}
+
+void EventLoop::beginRun()
+{
+	m_thread = std::this_thread::get_id();
+	m_running = true;
+
+	// sendfile() has no MSG_NOSIGNAL, writing to a closed peer must not
+	// raise SIGPIPE on the loop thread
+	sigset_t pipe;
+	sigemptyset(&pipe);
+	sigaddset(&pipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipe, &m_signalMask);
+}
+
+void EventLoop::endRun()
+{
+	// Functions posted during shutdown still need to run to release their resources
+	runPending();
+	m_thread = std::thread::id();
+
+	// Discards the signals raised while blocked before restoring the mask
+	sigset_t pipe;
+	sigemptyset(&pipe);
+	sigaddset(&pipe, SIGPIPE);
+
+	struct timespec timeout = {};
+	if(!sigismember(&m_signalMask, SIGPIPE))
+	{
+		while(sigtimedwait(&pipe, nullptr, &timeout) == SIGPIPE)
+			continue;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &m_signalMask, nullptr);
+}
+
+void EventLoop::stop()
+{
+	post([this]() { m_running = false; });
+}
@@ -0,0 +1,262 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_EVENTLOOP_H
+#define TLHTTP_EVENTLOOP_H
+
+#include <signal.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "IoBuffer.h"
+#include "Segments.h"
+#include "TimerWheel.h"
+
+namespace tlhttp
+{
+
+/**
+ * @brief Dispatches I/O events on a single thread.
+ *
+ * There are two kinds of registrations: plain file descriptors are watched
+ * for readiness and get a callback with the ready epoll events, sockets are
+ * attached together with a SocketHandler and the loop does the actual
+ * receiving and sending. The latter allows completion based backends like
+ * io_uring to avoid one syscall per operation.
+ *
+ * All callbacks run on the thread calling run().
+ */
+class EventLoop
+{
+public:
+	typedef std::function<void(uint32_t)> Callback;
+	typedef std::function<void(int)> AcceptCallback;
+
+	/**
+	 * @brief The I/O backends available.
+	 */
+	enum class Backend
+	{
+		Auto, ///< io_uring if supported by the kernel, epoll otherwise
+		Epoll,
+		IoUring
+	};
+
+	/**
+	 * @brief Receives the I/O results of an attached socket.
+	 */
+	class SocketHandler
+	{
+	public:
+		virtual ~SocketHandler() {}
+
+		/**
+		 * @brief Called with received data.
+		 * @note The data is only valid during the call.
+		 */
+		virtual void onReceive(const char* data, size_t size) = 0;
+
+		/**
+		 * @brief Returns a buffer the loop may receive into directly.
+		 *
+		 * Data received into it is not passed to onReceive(), only
+		 * onReceiveDone() is called. Loops which receive into buffers of
+		 * their own call onReceive() regardless.
+		 *
+		 * @return The buffer, nullptr to get the data through onReceive().
+		 */
+		virtual IoBuffer* getReceiveBuffer() { return nullptr; }
+
+		/**
+		 * @brief Called after a batch of onReceive() calls.
+		 * @param eof Whether the peer closed the connection or an error occurred.
+		 */
+		virtual void onReceiveDone(bool eof) = 0;
+
+		/**
+		 * @brief Called once all data passed to EventLoop::send() was written.
+		 * @param error 0 on success, the errno value otherwise.
+		 */
+		virtual void onSent(int error) = 0;
+	};
+
+protected:
+	int m_wakeFd;
+	std::atomic<bool> m_running;
+	std::thread::id m_thread;
+	sigset_t m_signalMask;
+
+	std::mutex m_pendingMutex;
+	std::vector<std::function<void()>> m_pending;
+
+	// One timerfd ticks the wheel while timers are armed
+	TimerWheel m_timers;
+	int m_timerFd = -1;
+	bool m_ticking = false;
+
+	void handleTimer();
+	void setTicking(bool value);
+
+	/**
+	 * @brief Drains the wakeup eventfd and runs the posted functions.
+	 */
+	void handleWakeup();
+	void runPending();
+
+	void beginRun();
+	void endRun();
+
+public:
+	/**
+	 * @brief Creates the wakeup eventfd.
+	 * @throws std::runtime_error on failure.
+	 */
+	EventLoop();
+	virtual ~EventLoop();
+
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator=(const EventLoop&) = delete;
+
+	/**
+	 * @brief Creates an event loop.
+	 * @param backend The backend to use.
+	 * @return The new loop.
+	 * @throws std::runtime_error if the backend is not supported.
+	 */
+	static std::unique_ptr<EventLoop> create(Backend backend = Backend::Auto);
+
+	/**
+	 * @brief Checks if the running kernel supports the io_uring backend.
+	 */
+	static bool isUringSupported();
+
+	virtual Backend getBackend() const = 0;
+
+	/**
+	 * @brief Registers a file descriptor.
+	 * @param fd The file descriptor to watch.
+	 * @param events The epoll events to wait for, events are edge-triggered.
+	 * @param callback The function called with the ready events.
+	 * @throws std::runtime_error on failure.
+	 */
+	virtual void add(int fd, uint32_t events, const Callback& callback) = 0;
+
+	/**
+	 * @brief Changes the events a file descriptor is watched for.
+	 * @throws std::runtime_error on failure.
+	 */
+	virtual void modify(int fd, uint32_t events) = 0;
+
+	/**
+	 * @brief Stops watching a file descriptor, socket or listener.
+	 * @note It is safe to call this from within a callback.
+	 */
+	virtual void remove(int fd) = 0;
+
+	/**
+	 * @brief Accepts connections on a non-blocking listening socket.
+	 * @param fd The listening socket.
+	 * @param callback Called with every accepted, non-blocking client socket.
+	 * @throws std::runtime_error on failure.
+	 */
+	virtual void listen(int fd, const AcceptCallback& callback) = 0;
+
+	/**
+	 * @brief Starts receiving on a non-blocking socket.
+	 * @param fd The socket.
+	 * @param handler Gets the I/O results as long as it is alive.
+	 * @throws std::runtime_error on failure.
+	 */
+	virtual void attach(int fd, const std::weak_ptr<SocketHandler>& handler) = 0;
+
+	/**
+	 * @brief Stops or restarts receiving on an attached socket.
+	 *
+	 * Data arriving meanwhile stays in the socket, so the peer is slowed
+	 * down by the receive window instead of filling the handler's buffer.
+	 * A receive already in flight may still be reported after stopping.
+	 */
+	virtual void setReceiving(int fd, bool enabled) = 0;
+
+	/**
+	 * @brief Writes data to an attached socket.
+	 *
+	 * The segments are written with vectored writes, so they don't have to
+	 * be copied into one buffer first. The handler's onSent() is called once
+	 * everything was written, only one send may be in flight per socket.
+	 * The loop keeps the data alive until then.
+	 */
+	virtual void send(int fd, const std::shared_ptr<const Segments>& data) = 0;
+	void send(int fd, const std::shared_ptr<const std::string>& data);
+
+	/**
+	 * @brief Arms a timer on the loop's timer wheel.
+	 *
+	 * The callback runs on the loop thread. Timers are only as accurate
+	 * as TIMER_RESOLUTION and have to be cancelled before the loop is
+	 * destroyed.
+	 *
+	 * @param timer The timer, an armed timer is moved to the new expiry.
+	 * @param delay The time until the timer expires.
+	 * @note Must be called on the loop thread.
+	 * @throws std::runtime_error if the timerfd can not be created.
+	 */
+	void schedule(Timer& timer, std::chrono::milliseconds delay);
+
+	/**
+	 * @brief The length of one tick of the timer wheel.
+	 */
+	static constexpr std::chrono::milliseconds TIMER_RESOLUTION{10};
+
+	/**
+	 * @brief Queues a function to be run on the loop thread.
+	 * @note May be called from any thread.
+	 */
+	void post(const std::function<void()>& fn);
+
+	/**
+	 * @brief Runs the function immediately when called from the loop
+	 * thread, posts it otherwise.
+	 */
+	void dispatch(const std::function<void()>& fn);
+
+	bool isInLoopThread() const { return m_thread == std::this_thread::get_id(); }
+	bool isRunning() const { return m_running; }
+
+	/**
+	 * @brief Dispatches events until stop() is called.
+	 * @throws std::runtime_error on failure.
+	 */
+	virtual void run() = 0;
+
+	/**
+	 * @brief Makes run() return after the current iteration.
+	 * @note May be called from any thread.
+	 */
+	void stop();
+};
+
+}
+
+#endif //TLHTTP_EVENTLOOP_H
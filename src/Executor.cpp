@@ -0,0 +1,137 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <algorithm>
+#include <chrono>
+
+#include "Executor.h"
+
+using namespace tlhttp;
+
+namespace
+{
+// Identifies the worker running on the current thread
+thread_local const void* currentExecutor = nullptr;
+thread_local size_t currentWorker = 0;
+}
+
+WorkStealingExecutor::WorkStealingExecutor(unsigned int threads)
+	: m_running(true), m_next(0), m_queued(0), m_sleepers(0)
+{
+	if(threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for(unsigned int i = 0; i < threads; i++)
+		m_workers.emplace_back(new Worker);
+
+	for(size_t i = 0; i < m_workers.size(); i++)
+		m_workers[i]->thread = std::thread([this, i]() { run(i); });
+}
+
+WorkStealingExecutor::~WorkStealingExecutor()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_running = false;
+	}
+
+	m_wakeup.notify_all();
+	for(auto& worker : m_workers)
+		worker->thread.join();
+}
+
+void WorkStealingExecutor::submit(const std::function<void()>& task)
+{
+	size_t index;
+	if(currentExecutor == this)
+		index = currentWorker;
+	else
+		index = m_next++ % m_workers.size();
+
+	// Counted before the task is published, a stealing worker could
+	// run it and decrement the counter first otherwise
+	m_queued++;
+
+	{
+		Worker& worker = *m_workers[index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.tasks.push_back(task);
+	}
+
+	// A worker which is not counted as sleeper yet still sees the task when
+	// it checks m_queued. One which is counted only releases the mutex by
+	// waiting, so taking it here makes sure the notification reaches it.
+	if(m_sleepers > 0)
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_wakeup.notify_one();
+	}
+}
+
+bool WorkStealingExecutor::pop(size_t index, std::function<void()>& task)
+{
+	{
+		Worker& own = *m_workers[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if(!own.tasks.empty())
+		{
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for(size_t i = 1; i < m_workers.size(); i++)
+	{
+		Worker& victim = *m_workers[(index + i) % m_workers.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if(!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void WorkStealingExecutor::run(size_t index)
+{
+	currentExecutor = this;
+	currentWorker = index;
+
+	std::function<void()> task;
+	while(true)
+	{
+		if(pop(index, task))
+		{
+			m_queued--;
+			task();
+			task = nullptr;
+			continue;
+		}
+
+		// The timeout lets idle workers look for stealable tasks now and then
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_sleepers++;
+		m_wakeup.wait_for(lock, std::chrono::milliseconds(100), [this]() { return m_queued > 0 || !m_running; });
+		m_sleepers--;
+
+		if(!m_running && m_queued == 0)
+			break;
+	}
+}
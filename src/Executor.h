@@ -0,0 +1,95 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_EXECUTOR_H
+#define TLHTTP_EXECUTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tlhttp
+{
+
+/**
+ * @brief Runs tasks on some other thread.
+ */
+class Executor
+{
+public:
+	virtual ~Executor() {}
+
+	/**
+	 * @brief Queues a task for execution.
+	 * @note May be called from any thread.
+	 */
+	virtual void submit(const std::function<void()>& task) = 0;
+};
+
+/**
+ * @brief Implements a thread pool with one task deque per worker.
+ *
+ * Workers take tasks from the back of their own deque and steal from the
+ * front of the others once it runs empty. Tasks submitted by a worker are
+ * kept on its own deque, other threads distribute them round robin.
+ */
+class WorkStealingExecutor : public Executor
+{
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+		std::thread thread;
+	};
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::atomic<bool> m_running;
+	std::atomic<unsigned int> m_next;
+	std::atomic<size_t> m_queued;
+
+	// Submitters only take the mutex to notify if a worker is asleep
+	std::atomic<size_t> m_sleepers;
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wakeup;
+
+	bool pop(size_t index, std::function<void()>& task);
+	void run(size_t index);
+
+public:
+	/**
+	 * @brief Starts the worker threads.
+	 * @param threads The number of workers, 0 uses one per core.
+	 */
+	explicit WorkStealingExecutor(unsigned int threads = 0);
+
+	/**
+	 * @brief Runs all remaining tasks and joins the workers.
+	 */
+	~WorkStealingExecutor();
+
+	void submit(const std::function<void()>& task) override;
+
+	size_t getThreadCount() const { return m_workers.size(); }
+};
+
+}
+
+#endif //TLHTTP_EXECUTOR_H
@@ -0,0 +1,169 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <algorithm>
+
+#include "Headers.h"
+
+using namespace tlhttp;
+
+std::string_view Headers::Field::getName() const
+{
+	return id == HeaderId::Unknown ? std::string_view(name) : Headers::getName(id);
+}
+
+size_t Headers::findIndex(HeaderId id, std::string_view name) const
+{
+	if(id != HeaderId::Unknown)
+		return m_index[size_t(id)] == NOT_FOUND ? m_size : m_index[size_t(id)];
+
+	for(size_t i = 0; i < m_size; i++)
+	{
+		const Field& field = at(i);
+		if(field.id == HeaderId::Unknown && equalsIgnoreCase(field.name, name))
+			return i;
+	}
+
+	return m_size;
+}
+
+Headers::Field& Headers::append(HeaderId id, std::string_view name)
+{
+	if(m_size >= INLINE_FIELDS)
+		m_overflow.emplace_back();
+
+	Field& field = at(m_size);
+	field.id = id;
+	if(id == HeaderId::Unknown)
+		field.name = name;
+	else if(m_index[size_t(id)] == NOT_FOUND)
+		m_index[size_t(id)] = uint16_t(m_size);
+
+	m_size++;
+	return field;
+}
+
+const std::string* Headers::find(std::string_view name) const
+{
+	size_t index = findIndex(lookup(name), name);
+	return index == m_size ? nullptr : &at(index).value;
+}
+
+const std::string* Headers::find(HeaderId id) const
+{
+	size_t index = findIndex(id, std::string_view());
+	return index == m_size ? nullptr : &at(index).value;
+}
+
+std::string_view Headers::get(std::string_view name) const
+{
+	const std::string* value = find(name);
+	return value ? std::string_view(*value) : std::string_view();
+}
+
+std::string_view Headers::get(HeaderId id) const
+{
+	const std::string* value = find(id);
+	return value ? std::string_view(*value) : std::string_view();
+}
+
+std::string& Headers::operator[](std::string_view name)
+{
+	HeaderId id = lookup(name);
+	size_t index = findIndex(id, name);
+	return index == m_size ? append(id, name).value : at(index).value;
+}
+
+std::string& Headers::operator[](HeaderId id)
+{
+	size_t index = findIndex(id, std::string_view());
+	return index == m_size ? append(id, std::string_view()).value : at(index).value;
+}
+
+void Headers::add(std::string_view name, std::string_view value)
+{
+	add(lookup(name), name, value);
+}
+
+void Headers::add(HeaderId id, std::string_view name, std::string_view value)
+{
+	append(id, name).value = value;
+}
+
+bool Headers::erase(std::string_view name)
+{
+	HeaderId id = lookup(name);
+	size_t count = 0;
+
+	// Compacts the remaining fields in place
+	for(size_t i = 0; i < m_size; i++)
+	{
+		Field& field = at(i);
+		bool match = (id != HeaderId::Unknown ? field.id == id
+				: field.id == HeaderId::Unknown && equalsIgnoreCase(field.name, name));
+
+		if(match)
+			continue;
+
+		if(count != i)
+			at(count) = std::move(field);
+
+		count++;
+	}
+
+	if(count == m_size)
+		return false;
+
+	for(size_t i = count; i < m_size; i++)
+	{
+		at(i).name.clear();
+		at(i).value.clear();
+	}
+
+	m_size = count;
+	if(m_overflow.size() > (m_size > INLINE_FIELDS ? m_size - INLINE_FIELDS : 0))
+		m_overflow.resize(m_size > INLINE_FIELDS ? m_size - INLINE_FIELDS : 0);
+
+	m_index.fill(NOT_FOUND);
+	for(size_t i = m_size; i-- > 0;)
+	{
+		if(at(i).id != HeaderId::Unknown)
+			m_index[size_t(at(i).id)] = uint16_t(i);
+	}
+
+	return true;
+}
+
+void Headers::clear()
+{
+	// Keeps the capacity of the inline values for the next message
+	for(size_t i = 0; i < std::min(m_size, INLINE_FIELDS); i++)
+	{
+		m_inline[i].name.clear();
+		m_inline[i].value.clear();
+	}
+
+	m_overflow.clear();
+	m_index.fill(NOT_FOUND);
+	m_size = 0;
+}
+
+bool Headers::hasToken(std::string_view list, std::string_view token)
+{
+	bool found = false;
+	forEachToken(list, [&found, token](std::string_view item) { found = found || equalsIgnoreCase(item, token); });
+	return found;
+}
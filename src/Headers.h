@@ -0,0 +1,285 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_HEADERS_H
+#define TLHTTP_HEADERS_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tlhttp
+{
+
+/**
+ * @brief Header fields which are looked up without comparing strings.
+ */
+enum class HeaderId : uint8_t
+{
+	Accept,
+	AcceptEncoding,
+	AcceptLanguage,
+	AcceptRanges,
+	Age,
+	Authorization,
+	CacheControl,
+	Connection,
+	ContentEncoding,
+	ContentLength,
+	ContentRange,
+	ContentType,
+	Cookie,
+	Date,
+	ETag,
+	Expect,
+	Expires,
+	Host,
+	IfModifiedSince,
+	IfNoneMatch,
+	IfRange,
+	KeepAlive,
+	LastModified,
+	Location,
+	Pragma,
+	Range,
+	Referer,
+	Server,
+	SetCookie,
+	TransferEncoding,
+	Upgrade,
+	UserAgent,
+	Vary,
+	Count,
+	Unknown = Count
+};
+
+namespace detail
+{
+constexpr std::array<std::string_view, size_t(HeaderId::Count)> HEADER_NAMES = {
+	"Accept", "Accept-Encoding", "Accept-Language", "Accept-Ranges", "Age", "Authorization",
+	"Cache-Control", "Connection", "Content-Encoding", "Content-Length", "Content-Range",
+	"Content-Type", "Cookie", "Date", "ETag", "Expect", "Expires", "Host", "If-Modified-Since",
+	"If-None-Match", "If-Range", "Keep-Alive", "Last-Modified", "Location", "Pragma", "Range",
+	"Referer", "Server", "Set-Cookie", "Transfer-Encoding", "Upgrade", "User-Agent", "Vary"
+};
+
+constexpr char toLower(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// Collision free for the names above, checked at compile time
+constexpr size_t hashHeaderName(std::string_view name)
+{
+	return (toLower(name.front()) + 6 * name.size() + toLower(name[name.size() / 2])) & 127;
+}
+
+constexpr std::array<uint8_t, 128> createHeaderTable()
+{
+	std::array<uint8_t, 128> table{};
+	for(auto& entry : table)
+		entry = uint8_t(HeaderId::Unknown);
+
+	for(size_t i = 0; i < HEADER_NAMES.size(); i++)
+	{
+		// Throwing makes the constant evaluation fail on collisions
+		if(table[hashHeaderName(HEADER_NAMES[i])] != uint8_t(HeaderId::Unknown))
+			throw "Header name hash collision";
+
+		table[hashHeaderName(HEADER_NAMES[i])] = uint8_t(i);
+	}
+
+	return table;
+}
+
+constexpr std::array<uint8_t, 128> HEADER_TABLE = createHeaderTable();
+}
+
+/**
+ * @brief Stores the header fields of a message.
+ *
+ * Fields are kept in insertion order in a flat array with room for the
+ * usual number of fields, so small messages need no allocation besides
+ * the values. Well-known fields are found with a compile-time perfect
+ * hash of their name and an index table, other fields by a linear scan.
+ * All names are compared case insensitively.
+ */
+class Headers
+{
+public:
+	static constexpr size_t INLINE_FIELDS = 12;
+
+	struct Field
+	{
+		HeaderId id = HeaderId::Unknown;
+
+		// Only set for unknown fields, see getName()
+		std::string name;
+		std::string value;
+
+		std::string_view getName() const;
+	};
+
+private:
+	static constexpr size_t KNOWN_COUNT = detail::HEADER_NAMES.size();
+	static constexpr uint16_t NOT_FOUND = 0xffff;
+
+	std::array<Field, INLINE_FIELDS> m_inline;
+	std::vector<Field> m_overflow;
+	size_t m_size = 0;
+
+	// Position of each well-known field
+	std::array<uint16_t, KNOWN_COUNT> m_index;
+
+	Field& at(size_t index) { return index < INLINE_FIELDS ? m_inline[index] : m_overflow[index - INLINE_FIELDS]; }
+	const Field& at(size_t index) const { return index < INLINE_FIELDS ? m_inline[index] : m_overflow[index - INLINE_FIELDS]; }
+
+	size_t findIndex(HeaderId id, std::string_view name) const;
+	Field& append(HeaderId id, std::string_view name);
+
+public:
+	Headers() { m_index.fill(NOT_FOUND); }
+
+	/**
+	 * @brief Maps a field name to its id.
+	 * @return The id, HeaderId::Unknown if the field is not well-known.
+	 */
+	static constexpr HeaderId lookup(std::string_view name)
+	{
+		if(name.empty())
+			return HeaderId::Unknown;
+
+		uint8_t id = detail::HEADER_TABLE[detail::hashHeaderName(name)];
+		if(id == uint8_t(HeaderId::Unknown) || !equalsIgnoreCase(name, detail::HEADER_NAMES[id]))
+			return HeaderId::Unknown;
+
+		return HeaderId(id);
+	}
+
+	/**
+	 * @brief Returns the canonical name of a well-known field.
+	 */
+	static constexpr std::string_view getName(HeaderId id) { return detail::HEADER_NAMES[size_t(id)]; }
+
+	/**
+	 * @brief Compares two strings ignoring the case of ASCII letters.
+	 */
+	static constexpr bool equalsIgnoreCase(std::string_view a, std::string_view b)
+	{
+		if(a.size() != b.size())
+			return false;
+
+		for(size_t i = 0; i < a.size(); i++)
+		{
+			if(detail::toLower(a[i]) != detail::toLower(b[i]))
+				return false;
+		}
+
+		return true;
+	}
+
+	/**
+	 * @brief Calls a function with every element of a comma separated list.
+	 *
+	 * Whitespace around the elements is removed, empty ones are skipped.
+	 */
+	template<typename F>
+	static void forEachToken(std::string_view list, F&& function)
+	{
+		while(!list.empty())
+		{
+			size_t end = list.find(',');
+			std::string_view token = list.substr(0, end);
+			list = (end == std::string_view::npos ? std::string_view() : list.substr(end + 1));
+
+			while(!token.empty() && (token.front() == ' ' || token.front() == '\t'))
+				token.remove_prefix(1);
+
+			while(!token.empty() && (token.back() == ' ' || token.back() == '\t'))
+				token.remove_suffix(1);
+
+			if(!token.empty())
+				function(token);
+		}
+	}
+
+	/**
+	 * @brief Checks if a comma separated list contains a token, ignoring case.
+	 */
+	static bool hasToken(std::string_view list, std::string_view token);
+
+	/**
+	 * @brief Looks up a field without inserting it.
+	 * @return The value, nullptr if the field is not set.
+	 */
+	const std::string* find(std::string_view name) const;
+	const std::string* find(HeaderId id) const;
+
+	/**
+	 * @brief Returns the value of a field, an empty string if it is not set.
+	 */
+	std::string_view get(std::string_view name) const;
+	std::string_view get(HeaderId id) const;
+
+	bool contains(std::string_view name) const { return find(name) != nullptr; }
+	bool contains(HeaderId id) const { return find(id) != nullptr; }
+
+	/**
+	 * @brief Returns the value of a field, inserting an empty one if it is not set.
+	 */
+	std::string& operator[](std::string_view name);
+	std::string& operator[](HeaderId id);
+
+	/**
+	 * @brief Adds a field even if one with the same name exists, e.g. for Set-Cookie.
+	 *
+	 * Lookups return the first field of a name.
+	 */
+	void add(std::string_view name, std::string_view value);
+	void add(HeaderId id, std::string_view name, std::string_view value);
+
+	/**
+	 * @brief Removes all fields with the given name.
+	 * @return true if a field was removed.
+	 */
+	bool erase(std::string_view name);
+
+	void clear();
+
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	const Field& field(size_t index) const { return at(index); }
+
+	/**
+	 * @brief Calls a function with the name and value of every field in insertion order.
+	 */
+	template<typename F>
+	void forEach(F&& function) const
+	{
+		for(size_t i = 0; i < m_size; i++)
+		{
+			const Field& field = at(i);
+			function(field.getName(), std::string_view(field.value));
+		}
+	}
+};
+
+}
+
+#endif //TLHTTP_HEADERS_H
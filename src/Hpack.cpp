@@ -0,0 +1,522 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "Hpack.h"
+
+using namespace tlhttp;
+
+namespace
+{
+constexpr uint16_t EOS = 256;
+
+// The code length of every symbol, the last one is EOS
+constexpr uint8_t CODE_LENGTHS[257] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30
+};
+
+/**
+ * @brief The codes of all symbols and the decoding state machine.
+ *
+ * Every state is an inner node of the code tree. A transition consumes
+ * four bits, which complete at most one symbol since the shortest code
+ * has five.
+ */
+class HuffmanCode
+{
+public:
+	enum Flags : uint8_t
+	{
+		EMIT = 1,
+		FAIL = 2,
+
+		// The bits since the last symbol are a valid padding
+		ACCEPT = 4
+	};
+
+	struct Transition
+	{
+		uint16_t state;
+		uint8_t symbol;
+		uint8_t flags;
+	};
+
+	std::array<uint32_t, 257> codes;
+	std::vector<std::array<Transition, 16>> transitions;
+	std::vector<bool> accepting;
+
+	HuffmanCode()
+	{
+		// Canonical codes are assigned in order of length, then symbol
+		std::array<uint16_t, 257> order;
+		for(uint16_t i = 0; i < order.size(); i++)
+			order[i] = i;
+
+		std::stable_sort(order.begin(), order.end(), [](uint16_t a, uint16_t b) {
+			return CODE_LENGTHS[a] < CODE_LENGTHS[b];
+		});
+
+		uint32_t code = 0;
+		uint8_t length = CODE_LENGTHS[order[0]];
+		for(uint16_t symbol : order)
+		{
+			code <<= CODE_LENGTHS[symbol] - length;
+			length = CODE_LENGTHS[symbol];
+			codes[symbol] = code++;
+		}
+
+		// Inner nodes have two children, leaves store ~symbol
+		struct Node
+		{
+			int children[2] = {0, 0};
+			bool accepting = false;
+		};
+
+		std::vector<Node> nodes(1);
+		nodes[0].accepting = true;
+
+		for(uint16_t symbol = 0; symbol < codes.size(); symbol++)
+		{
+			size_t node = 0;
+			for(int bit = CODE_LENGTHS[symbol] - 1; bit > 0; bit--)
+			{
+				int direction = (codes[symbol] >> bit) & 1;
+				if(!nodes[node].children[direction])
+				{
+					nodes[node].children[direction] = int(nodes.size());
+
+					// Padding consists of at most seven bits of the EOS prefix
+					int depth = CODE_LENGTHS[symbol] - bit;
+					bool ones = nodes[node].accepting && direction == 1 && depth <= 7;
+
+					nodes.emplace_back();
+					nodes.back().accepting = ones;
+				}
+
+				node = nodes[node].children[direction];
+			}
+
+			nodes[node].children[codes[symbol] & 1] = ~int(symbol);
+		}
+
+		transitions.resize(nodes.size());
+		accepting.resize(nodes.size());
+
+		for(size_t state = 0; state < nodes.size(); state++)
+		{
+			accepting[state] = nodes[state].accepting;
+			for(uint8_t nibble = 0; nibble < 16; nibble++)
+			{
+				Transition transition{};
+				int node = int(state);
+
+				for(int bit = 3; bit >= 0; bit--)
+				{
+					node = nodes[node].children[(nibble >> bit) & 1];
+					if(node >= 0)
+						continue;
+
+					if(~node == EOS)
+					{
+						transition.flags |= FAIL;
+						break;
+					}
+
+					transition.flags |= EMIT;
+					transition.symbol = uint8_t(~node);
+					node = 0;
+				}
+
+				if(!(transition.flags & FAIL))
+				{
+					transition.state = uint16_t(node);
+					if(nodes[node].accepting)
+						transition.flags |= ACCEPT;
+				}
+
+				transitions[state][nibble] = transition;
+			}
+		}
+	}
+
+	static const HuffmanCode& get()
+	{
+		static const HuffmanCode code;
+		return code;
+	}
+};
+
+constexpr std::pair<std::string_view, std::string_view> STATIC_TABLE[HpackTable::STATIC_COUNT] = {
+	{":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+	{":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+	{":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+	{":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+	{"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+	{"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+	{"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+	{"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+	{"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+	{"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+	{"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+	{"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+	{"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+	{"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+	{"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+	{"www-authenticate", ""}
+};
+
+/**
+ * @brief Returns the first static index of a name, 0 if it is not in the table.
+ *
+ * Entries with the same name are next to each other.
+ */
+size_t findStaticName(std::string_view name)
+{
+	static const std::unordered_map<std::string_view, size_t> names = []() {
+		std::unordered_map<std::string_view, size_t> result;
+		for(size_t i = HpackTable::STATIC_COUNT; i > 0; i--)
+			result[STATIC_TABLE[i - 1].first] = i;
+
+		return result;
+	}();
+
+	auto iter = names.find(name);
+	return iter == names.end() ? 0 : iter->second;
+}
+
+void encodeInteger(std::string& out, uint8_t first, int prefix, uint64_t value)
+{
+	uint64_t max = (1u << prefix) - 1;
+	if(value < max)
+	{
+		out += char(first | value);
+		return;
+	}
+
+	out += char(first | max);
+	for(value -= max; value >= 128; value >>= 7)
+		out += char(0x80 | (value & 0x7f));
+
+	out += char(value);
+}
+
+uint64_t decodeInteger(const uint8_t*& position, const uint8_t* end, int prefix)
+{
+	uint64_t max = (1u << prefix) - 1;
+	uint64_t value = *position++ & max;
+	if(value < max)
+		return value;
+
+	for(int shift = 0; ; shift += 7)
+	{
+		// Nothing in a header block comes close to 2^32
+		if(position == end || shift > 28)
+			throw std::runtime_error("Invalid integer in header block!");
+
+		uint8_t byte = *position++;
+		value += uint64_t(byte & 0x7f) << shift;
+		if(!(byte & 0x80))
+			return value;
+	}
+}
+
+void encodeString(std::string& out, std::string_view data)
+{
+	size_t size = Huffman::getEncodedSize(data);
+	if(size < data.size())
+	{
+		encodeInteger(out, 0x80, 7, size);
+		Huffman::encode(data, out);
+		return;
+	}
+
+	encodeInteger(out, 0, 7, data.size());
+	out += data;
+}
+
+std::string decodeString(const uint8_t*& position, const uint8_t* end)
+{
+	if(position == end)
+		throw std::runtime_error("Truncated header block!");
+
+	bool huffman = (*position & 0x80);
+	uint64_t size = decodeInteger(position, end, 7);
+	if(size > uint64_t(end - position))
+		throw std::runtime_error("Truncated header block!");
+
+	std::string result;
+	if(huffman)
+		Huffman::decode(position, size, result);
+	else
+		result.assign(reinterpret_cast<const char*>(position), size);
+
+	position += size;
+	return result;
+}
+}
+
+size_t Huffman::getEncodedSize(std::string_view data)
+{
+	size_t bits = 0;
+	for(unsigned char c : data)
+		bits += CODE_LENGTHS[c];
+
+	return (bits + 7) / 8;
+}
+
+void Huffman::encode(std::string_view data, std::string& out)
+{
+	const HuffmanCode& code = HuffmanCode::get();
+
+	uint64_t buffer = 0;
+	int count = 0;
+	for(unsigned char c : data)
+	{
+		buffer = (buffer << CODE_LENGTHS[c]) | code.codes[c];
+		count += CODE_LENGTHS[c];
+
+		while(count >= 8)
+		{
+			count -= 8;
+			out += char(buffer >> count);
+		}
+	}
+
+	// The last byte is padded with the most significant bits of EOS
+	if(count > 0)
+		out += char((buffer << (8 - count)) | (0xff >> count));
+}
+
+void Huffman::decode(const uint8_t* data, size_t size, std::string& out)
+{
+	const HuffmanCode& code = HuffmanCode::get();
+
+	uint16_t state = 0;
+	bool accept = true;
+	for(size_t i = 0; i < size; i++)
+	{
+		for(uint8_t nibble : {uint8_t(data[i] >> 4), uint8_t(data[i] & 0xf)})
+		{
+			const HuffmanCode::Transition& transition = code.transitions[state][nibble];
+			if(transition.flags & HuffmanCode::FAIL)
+				throw std::runtime_error("Huffman coded string contains EOS!");
+
+			if(transition.flags & HuffmanCode::EMIT)
+				out += char(transition.symbol);
+
+			state = transition.state;
+			accept = (transition.flags & HuffmanCode::ACCEPT);
+		}
+	}
+
+	if(!accept)
+		throw std::runtime_error("Invalid padding of Huffman coded string!");
+}
+
+void HpackTable::evict(size_t size)
+{
+	while(!m_entries.empty() && m_size + size > m_maxSize)
+	{
+		const HeaderField& oldest = m_entries.back();
+		m_size -= oldest.name.size() + oldest.value.size() + ENTRY_OVERHEAD;
+		m_entries.pop_back();
+	}
+}
+
+void HpackTable::add(std::string_view name, std::string_view value)
+{
+	size_t size = name.size() + value.size() + ENTRY_OVERHEAD;
+	evict(size);
+
+	if(size > m_maxSize)
+		return;
+
+	m_entries.push_front(HeaderField{std::string(name), std::string(value)});
+	m_size += size;
+}
+
+void HpackTable::setMaxSize(size_t size)
+{
+	m_maxSize = size;
+	evict(0);
+}
+
+std::pair<std::string_view, std::string_view> HpackTable::get(size_t index) const
+{
+	if(index == 0 || index > STATIC_COUNT + m_entries.size())
+		throw std::runtime_error("Invalid header table index " + std::to_string(index) + "!");
+
+	if(index <= STATIC_COUNT)
+		return STATIC_TABLE[index - 1];
+
+	const HeaderField& entry = m_entries[index - STATIC_COUNT - 1];
+	return {entry.name, entry.value};
+}
+
+size_t HpackTable::find(std::string_view name, std::string_view value, size_t& nameIndex) const
+{
+	nameIndex = findStaticName(name);
+	for(size_t i = nameIndex; i && i <= STATIC_COUNT && STATIC_TABLE[i - 1].first == name; i++)
+	{
+		if(STATIC_TABLE[i - 1].second == value)
+			return i;
+	}
+
+	for(size_t i = 0; i < m_entries.size(); i++)
+	{
+		if(m_entries[i].name != name)
+			continue;
+
+		if(m_entries[i].value == value)
+			return STATIC_COUNT + 1 + i;
+
+		if(!nameIndex)
+			nameIndex = STATIC_COUNT + 1 + i;
+	}
+
+	return 0;
+}
+
+void HpackEncoder::setMaxTableSize(size_t size)
+{
+	size = std::min(size, HpackTable::DEFAULT_SIZE);
+	if(size == m_table.getMaxSize() && !m_sizeChanged)
+		return;
+
+	m_lowestSize = m_sizeChanged ? std::min(m_lowestSize, size) : std::min(m_table.getMaxSize(), size);
+	m_sizeChanged = true;
+	m_table.setMaxSize(size);
+}
+
+void HpackEncoder::begin(std::string& out)
+{
+	if(!m_sizeChanged)
+		return;
+
+	// A shrink followed by a growth is announced as both, so the peer evicts as well
+	if(m_lowestSize < m_table.getMaxSize())
+		encodeInteger(out, 0x20, 5, m_lowestSize);
+
+	encodeInteger(out, 0x20, 5, m_table.getMaxSize());
+	m_sizeChanged = false;
+}
+
+void HpackEncoder::encode(std::string& out, std::string_view name, std::string_view value, bool index)
+{
+	size_t nameIndex;
+	size_t fieldIndex = m_table.find(name, value, nameIndex);
+	if(fieldIndex)
+	{
+		encodeInteger(out, 0x80, 7, fieldIndex);
+		return;
+	}
+
+	if(index)
+		encodeInteger(out, 0x40, 6, nameIndex);
+	else
+		encodeInteger(out, 0, 4, nameIndex);
+
+	if(!nameIndex)
+		encodeString(out, name);
+
+	encodeString(out, value);
+
+	if(index)
+		m_table.add(name, value);
+}
+
+void HpackDecoder::setMaxTableSize(size_t size)
+{
+	m_maxTableSize = size;
+	m_table.setMaxSize(std::min(m_table.getMaxSize(), size));
+}
+
+size_t HpackDecoder::decode(const uint8_t* data, size_t size, std::vector<HeaderField>& out, size_t maxListSize)
+{
+	const uint8_t* position = data;
+	const uint8_t* end = data + size;
+	size_t listSize = 0;
+	bool fields = false;
+
+	while(position < end)
+	{
+		uint8_t first = *position;
+		if(first & 0x80)
+		{
+			auto entry = m_table.get(decodeInteger(position, end, 7));
+			fields = true;
+			listSize += entry.first.size() + entry.second.size() + HpackTable::ENTRY_OVERHEAD;
+
+			// A single byte can reference a large entry, only copy it while below the limit
+			if(listSize <= maxListSize)
+				out.push_back(HeaderField{std::string(entry.first), std::string(entry.second)});
+			continue;
+		}
+		else if((first & 0xe0) == 0x20)
+		{
+			// Size updates are only allowed before the first field
+			uint64_t tableSize = decodeInteger(position, end, 5);
+			if(fields || tableSize > m_maxTableSize)
+				throw std::runtime_error("Invalid dynamic table size update!");
+
+			m_table.setMaxSize(tableSize);
+			continue;
+		}
+		else
+		{
+			// Literals with incremental indexing, without indexing or never indexed
+			bool index = (first & 0x40);
+			uint64_t nameIndex = decodeInteger(position, end, index ? 6 : 4);
+
+			HeaderField field;
+			if(nameIndex)
+				field.name = m_table.get(nameIndex).first;
+			else
+				field.name = decodeString(position, end);
+
+			field.value = decodeString(position, end);
+			if(index)
+				m_table.add(field.name, field.value);
+
+			fields = true;
+			listSize += field.name.size() + field.value.size() + HpackTable::ENTRY_OVERHEAD;
+			if(listSize <= maxListSize)
+				out.push_back(std::move(field));
+		}
+	}
+
+	return listSize;
+}
@@ -0,0 +1,186 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_HPACK_H
+#define TLHTTP_HPACK_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace tlhttp
+{
+
+/**
+ * @brief The Huffman code of HPACK (RFC 7541 Appendix B).
+ *
+ * The code is canonical, so it is derived from the bit lengths alone.
+ * Decoding follows a state table four bits at a time instead of walking
+ * the tree bit by bit.
+ */
+class Huffman
+{
+public:
+	/**
+	 * @brief Returns the number of bytes the encoded string takes.
+	 */
+	static size_t getEncodedSize(std::string_view data);
+
+	static void encode(std::string_view data, std::string& out);
+
+	/**
+	 * @brief Decodes a string and appends it.
+	 * @throws std::runtime_error on invalid padding or an encoded EOS symbol.
+	 */
+	static void decode(const uint8_t* data, size_t size, std::string& out);
+};
+
+/**
+ * @brief A header field with a lower case name as used by HTTP/2.
+ */
+struct HeaderField
+{
+	std::string name;
+	std::string value;
+};
+
+/**
+ * @brief The static and the dynamic table of one direction of a connection.
+ *
+ * Entries are addressed as in RFC 7541: the 61 static entries come first,
+ * followed by the dynamic ones starting with the newest.
+ */
+class HpackTable
+{
+	// The newest entry is at the front
+	std::deque<HeaderField> m_entries;
+	size_t m_size = 0, m_maxSize = DEFAULT_SIZE;
+
+	void evict(size_t size);
+
+public:
+	static constexpr size_t DEFAULT_SIZE = 4096;
+	static constexpr size_t STATIC_COUNT = 61;
+
+	/**
+	 * @brief The size counted for every entry besides its name and value.
+	 */
+	static constexpr size_t ENTRY_OVERHEAD = 32;
+
+	/**
+	 * @brief Adds an entry, evicting the oldest ones until it fits.
+	 *
+	 * Entries larger than the whole table only empty it.
+	 */
+	void add(std::string_view name, std::string_view value);
+
+	void setMaxSize(size_t size);
+	size_t getMaxSize() const { return m_maxSize; }
+	size_t getSize() const { return m_size; }
+
+	/**
+	 * @brief Returns the number of dynamic entries.
+	 */
+	size_t count() const { return m_entries.size(); }
+
+	/**
+	 * @brief Returns the entry at an index, starting with 1.
+	 * @throws std::runtime_error if there is no such entry.
+	 */
+	std::pair<std::string_view, std::string_view> get(size_t index) const;
+
+	/**
+	 * @brief Looks up a field.
+	 * @param nameIndex Receives the index of an entry with the same name, 0 if there is none.
+	 * @return The index of an entry with the same name and value, 0 if there is none.
+	 */
+	size_t find(std::string_view name, std::string_view value, size_t& nameIndex) const;
+};
+
+/**
+ * @brief Compresses header blocks.
+ *
+ * Fields are added to the dynamic table unless they are sensitive, and
+ * strings are Huffman coded whenever that makes them shorter.
+ */
+class HpackEncoder
+{
+	HpackTable m_table;
+
+	// Size changes which still have to be announced to the peer
+	size_t m_lowestSize = 0;
+	bool m_sizeChanged = false;
+
+public:
+	/**
+	 * @brief Applies the table size the peer allows.
+	 *
+	 * The encoder never uses more than HpackTable::DEFAULT_SIZE, the change
+	 * is announced at the start of the next block.
+	 */
+	void setMaxTableSize(size_t size);
+
+	/**
+	 * @brief Starts a header block.
+	 */
+	void begin(std::string& out);
+
+	/**
+	 * @brief Appends a field to the current block.
+	 * @param name The lower case name.
+	 * @param index Whether the field may be kept in the dynamic table.
+	 */
+	void encode(std::string& out, std::string_view name, std::string_view value, bool index = true);
+
+	const HpackTable& getTable() const { return m_table; }
+};
+
+/**
+ * @brief Decompresses header blocks.
+ *
+ * Every block of a connection has to be decoded in order, even those of
+ * rejected streams, as they change the dynamic table.
+ */
+class HpackDecoder
+{
+	HpackTable m_table;
+	size_t m_maxTableSize = HpackTable::DEFAULT_SIZE;
+
+public:
+	/**
+	 * @brief Sets the table size announced to the peer.
+	 */
+	void setMaxTableSize(size_t size);
+
+	/**
+	 * @brief Decodes a complete header block.
+	 * @param out Receives the fields in order.
+	 * @param maxListSize Once the list grows beyond this size no more fields are appended,
+	 * the rest of the block is still decoded to keep the dynamic table in sync.
+	 * @return The size of the fields as defined for SETTINGS_MAX_HEADER_LIST_SIZE.
+	 * @throws std::runtime_error if the block is malformed, the decoder can not be used afterwards.
+	 */
+	size_t decode(const uint8_t* data, size_t size, std::vector<HeaderField>& out, size_t maxListSize = SIZE_MAX);
+
+	const HpackTable& getTable() const { return m_table; }
+};
+
+}
+
+#endif //TLHTTP_HPACK_H
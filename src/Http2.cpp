@@ -0,0 +1,1045 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <algorithm>
+#include <charconv>
+
+#include "Connection.h"
+#include "Http2.h"
+#include "Pool.h"
+
+using namespace tlhttp;
+
+namespace
+{
+enum Flags : uint8_t
+{
+	END_STREAM = 0x1,
+	ACK = 0x1,
+	END_HEADERS = 0x4,
+	PADDED = 0x8,
+	PRIORITY = 0x20
+};
+
+enum Setting : uint16_t
+{
+	HEADER_TABLE_SIZE = 1,
+	ENABLE_PUSH,
+	MAX_CONCURRENT_STREAMS,
+	INITIAL_WINDOW_SIZE,
+	MAX_FRAME_SIZE,
+	MAX_HEADER_LIST_SIZE
+};
+
+// The window every stream and the connection start with
+constexpr int64_t DEFAULT_WINDOW = 65535;
+
+uint32_t readUint32(const uint8_t* data)
+{
+	return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | data[3];
+}
+
+void appendUint32(std::string& out, uint32_t value)
+{
+	out += char(value >> 24);
+	out += char(value >> 16);
+	out += char(value >> 8);
+	out += char(value);
+}
+
+void appendSetting(std::string& out, Setting id, uint32_t value)
+{
+	out += char(id >> 8);
+	out += char(id);
+	appendUint32(out, value);
+}
+
+/**
+ * @brief Checks for fields which only apply to HTTP/1 connections.
+ */
+bool isConnectionSpecific(std::string_view name)
+{
+	return name == "connection" || name == "keep-alive" || name == "proxy-connection"
+		|| name == "transfer-encoding" || name == "upgrade";
+}
+
+/**
+ * @brief Checks for fields which should not be kept in the dynamic table.
+ */
+bool isSensitive(std::string_view name)
+{
+	return name == "authorization" || name == "set-cookie" || name == "content-length";
+}
+
+bool decodeBase64Url(std::string_view data, std::string& out)
+{
+	uint32_t buffer = 0;
+	int bits = 0;
+	for(char c : data)
+	{
+		int value;
+		if(c >= 'A' && c <= 'Z')
+			value = c - 'A';
+		else if(c >= 'a' && c <= 'z')
+			value = c - 'a' + 26;
+		else if(c >= '0' && c <= '9')
+			value = c - '0' + 52;
+		else if(c == '-')
+			value = 62;
+		else if(c == '_')
+			value = 63;
+		else if(c == '=')
+			break;
+		else
+			return false;
+
+		buffer = (buffer << 6) | value;
+		bits += 6;
+		if(bits >= 8)
+		{
+			bits -= 8;
+			out += char(buffer >> bits);
+		}
+	}
+
+	return true;
+}
+}
+
+Http2Session::Http2Session(const std::shared_ptr<Connection>& connection, const Handler& handler, const Settings& settings)
+	: m_connection(connection), m_loop(connection->getEventLoop()), m_handler(handler), m_settings(settings)
+{
+	// Clients may use the default window before they saw the settings
+	m_settings.initialWindowSize = std::clamp<uint32_t>(m_settings.initialWindowSize, DEFAULT_WINDOW, MAX_WINDOW_SIZE);
+	m_settings.maxConcurrentStreams = std::max<uint32_t>(m_settings.maxConcurrentStreams, 1);
+}
+
+void Http2Session::start(const std::shared_ptr<Request>& upgrade, std::string_view upgradeSettings)
+{
+	auto self = shared_from_this();
+	writeSettings();
+
+	if(m_receiveWindow < m_settings.initialWindowSize)
+	{
+		writeWindowUpdate(0, uint32_t(m_settings.initialWindowSize - m_receiveWindow));
+		m_receiveWindow = m_settings.initialWindowSize;
+	}
+
+	if(upgrade)
+	{
+		ErrorCode error = applySettings(reinterpret_cast<const uint8_t*>(upgradeSettings.data()), upgradeSettings.size());
+		if(error != ErrorCode::NoError)
+		{
+			goAway(error);
+			return;
+		}
+
+		// The request was read as HTTP/1 and is answered on stream 1
+		m_lastStreamId = 1;
+		Stream& stream = m_streams[1];
+		stream.request = upgrade;
+		stream.sendWindow = m_initialSendWindow;
+		stream.remoteClosed = true;
+
+		if(auto connection = m_connection.lock())
+			connection->beginStream();
+
+		dispatch(1, stream);
+	}
+
+	send();
+}
+
+void Http2Session::onData()
+{
+	auto connection = m_connection.lock();
+	if(!connection)
+		return;
+
+	auto self = shared_from_this();
+	IoBuffer& input = connection->getInput();
+
+	if(!m_prefaceReceived)
+	{
+		if(!isPreface(input.view()))
+		{
+			goAway(ErrorCode::ProtocolError);
+			input.clear();
+			return;
+		}
+
+		if(input.size() < PREFACE.size())
+			return;
+
+		input.consume(PREFACE.size());
+		m_prefaceReceived = true;
+	}
+
+	while(!m_failed && connection->getSocket() && input.size() >= FRAME_HEADER_SIZE)
+	{
+		const uint8_t* header = reinterpret_cast<const uint8_t*>(input.data());
+		size_t length = (size_t(header[0]) << 16) | (size_t(header[1]) << 8) | header[2];
+		if(length > MAX_FRAME_SIZE)
+		{
+			goAway(ErrorCode::FrameSizeError);
+			break;
+		}
+
+		if(input.size() < FRAME_HEADER_SIZE + length)
+			break;
+
+		uint32_t streamId = readUint32(header + 5) & 0x7fffffff;
+		ErrorCode error = handleFrame(FrameType(header[3]), header[4], streamId, header + FRAME_HEADER_SIZE, length);
+		input.consume(FRAME_HEADER_SIZE + length);
+
+		if(error != ErrorCode::NoError)
+			goAway(error);
+	}
+
+	// Nothing is read anymore after a connection error
+	if(m_failed)
+		input.clear();
+
+	send();
+}
+
+Http2Session::ErrorCode Http2Session::handleFrame(FrameType type, uint8_t flags, uint32_t streamId,
+												  const uint8_t* payload, size_t length)
+{
+	// Nothing may come between the frames of a header block
+	if(m_headerStream && (type != FrameType::Continuation || streamId != m_headerStream))
+		return ErrorCode::ProtocolError;
+
+	switch(type)
+	{
+		case FrameType::Data:
+			return handleData(flags, streamId, payload, length);
+
+		case FrameType::Headers:
+			return handleHeaders(flags, streamId, payload, length);
+
+		case FrameType::Priority:
+			if(!streamId)
+				return ErrorCode::ProtocolError;
+
+			if(length != 5)
+			{
+				writeReset(streamId, ErrorCode::FrameSizeError);
+				closeStream(streamId);
+			}
+
+			return ErrorCode::NoError;
+
+		case FrameType::RstStream:
+			if(!streamId || streamId > m_lastStreamId)
+				return ErrorCode::ProtocolError;
+
+			if(length != 4)
+				return ErrorCode::FrameSizeError;
+
+			// Opening and resetting streams in a loop costs the client nothing
+			if(auto iter = m_streams.find(streamId); iter != m_streams.end() && !iter->second.reset
+					&& ++m_resetCount > m_settings.maxResets)
+				return ErrorCode::EnhanceYourCalm;
+
+			closeStream(streamId);
+			return ErrorCode::NoError;
+
+		case FrameType::Settings:
+			return handleSettings(flags, streamId, payload, length);
+
+		case FrameType::PushPromise:
+			// Clients can not push
+			return ErrorCode::ProtocolError;
+
+		case FrameType::Ping:
+			if(streamId)
+				return ErrorCode::ProtocolError;
+
+			if(length != 8)
+				return ErrorCode::FrameSizeError;
+
+			if(!(flags & ACK))
+				writeFrame(FrameType::Ping, ACK, 0, std::string_view(reinterpret_cast<const char*>(payload), length));
+
+			return ErrorCode::NoError;
+
+		case FrameType::GoAway:
+			if(streamId)
+				return ErrorCode::ProtocolError;
+
+			if(length < 8)
+				return ErrorCode::FrameSizeError;
+
+			// The client opens no further streams, the open ones are still answered
+			m_peerClosing = true;
+			if(m_streams.empty())
+			{
+				if(auto connection = m_connection.lock())
+					connection->closeAfterWrite();
+			}
+
+			return ErrorCode::NoError;
+
+		case FrameType::WindowUpdate:
+			return handleWindowUpdate(streamId, payload, length);
+
+		case FrameType::Continuation:
+			if(!m_headerStream)
+				return ErrorCode::ProtocolError;
+
+			m_headerBlock.append(reinterpret_cast<const char*>(payload), length);
+			if(m_headerBlock.size() > 2 * size_t(m_settings.maxHeaderListSize))
+				return ErrorCode::EnhanceYourCalm;
+
+			return (flags & END_HEADERS) ? finishHeaders() : ErrorCode::NoError;
+	}
+
+	// Unknown frame types are ignored
+	return ErrorCode::NoError;
+}
+
+Http2Session::ErrorCode Http2Session::handleData(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length)
+{
+	if(!streamId)
+		return ErrorCode::ProtocolError;
+
+	// Flow control counts the whole payload including the padding
+	int64_t frameSize = int64_t(length);
+	if(frameSize > m_receiveWindow)
+		return ErrorCode::FlowControlError;
+
+	m_receiveWindow -= frameSize;
+	if(m_receiveWindow < m_settings.initialWindowSize / 2)
+	{
+		writeWindowUpdate(0, uint32_t(m_settings.initialWindowSize - m_receiveWindow));
+		m_receiveWindow = m_settings.initialWindowSize;
+	}
+
+	if(flags & PADDED)
+	{
+		if(length < 1 || payload[0] >= length)
+			return ErrorCode::ProtocolError;
+
+		length -= 1 + payload[0];
+		payload++;
+	}
+
+	auto iter = m_streams.find(streamId);
+	if(iter == m_streams.end() || iter->second.reset)
+	{
+		if(streamId > m_lastStreamId)
+			return ErrorCode::ProtocolError;
+
+		writeReset(streamId, ErrorCode::StreamClosed);
+		return ErrorCode::NoError;
+	}
+
+	Stream& stream = iter->second;
+	if(stream.remoteClosed)
+	{
+		writeReset(streamId, ErrorCode::StreamClosed);
+		closeStream(streamId);
+		return ErrorCode::NoError;
+	}
+
+	stream.receiveWindow -= frameSize;
+	stream.receivedLength += length;
+
+	ErrorCode error = ErrorCode::NoError;
+	if(stream.receiveWindow < 0)
+		error = ErrorCode::FlowControlError;
+	else if(stream.receivedLength > stream.expectedLength)
+		error = ErrorCode::ProtocolError;
+	else if((flags & END_STREAM) && stream.expectedLength != UINT64_MAX && stream.receivedLength != stream.expectedLength)
+		error = ErrorCode::ProtocolError;
+
+	if(error == ErrorCode::NoError)
+	{
+		try
+		{
+			stream.request->getBody().append(reinterpret_cast<const char*>(payload), length);
+		}
+		catch(std::exception&)
+		{
+			// The body could not be spilled to disk
+			error = ErrorCode::InternalError;
+		}
+	}
+
+	if(error != ErrorCode::NoError)
+	{
+		writeReset(streamId, error);
+		closeStream(streamId);
+		return ErrorCode::NoError;
+	}
+
+	if(stream.receivedLength > m_maxBodySize)
+	{
+		sendError(streamId, 413);
+		return ErrorCode::NoError;
+	}
+
+	if(flags & END_STREAM)
+	{
+		stream.remoteClosed = true;
+		dispatch(streamId, stream);
+	}
+	else if(stream.receiveWindow < m_settings.initialWindowSize / 2)
+	{
+		writeWindowUpdate(streamId, uint32_t(m_settings.initialWindowSize - stream.receiveWindow));
+		stream.receiveWindow = m_settings.initialWindowSize;
+	}
+
+	return ErrorCode::NoError;
+}
+
+Http2Session::ErrorCode Http2Session::handleHeaders(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length)
+{
+	if(!streamId)
+		return ErrorCode::ProtocolError;
+
+	size_t padding = 0;
+	if(flags & PADDED)
+	{
+		if(length < 1)
+			return ErrorCode::FrameSizeError;
+
+		padding = payload[0];
+		payload++;
+		length--;
+	}
+
+	// Priorities are not supported, streams are served in turns
+	if(flags & PRIORITY)
+	{
+		if(length < 5)
+			return ErrorCode::FrameSizeError;
+
+		payload += 5;
+		length -= 5;
+	}
+
+	if(padding > length)
+		return ErrorCode::ProtocolError;
+
+	m_headerStream = streamId;
+	m_headerEndStream = (flags & END_STREAM);
+	m_headerBlock.assign(reinterpret_cast<const char*>(payload), length - padding);
+
+	return (flags & END_HEADERS) ? finishHeaders() : ErrorCode::NoError;
+}
+
+Http2Session::ErrorCode Http2Session::finishHeaders()
+{
+	uint32_t streamId = m_headerStream;
+	m_headerStream = 0;
+
+	std::vector<HeaderField> fields;
+	size_t listSize;
+	try
+	{
+		listSize = m_decoder.decode(reinterpret_cast<const uint8_t*>(m_headerBlock.data()), m_headerBlock.size(), fields, m_settings.maxHeaderListSize);
+	}
+	catch(std::exception&)
+	{
+		return ErrorCode::CompressionError;
+	}
+
+	auto iter = m_streams.find(streamId);
+	if(iter != m_streams.end())
+	{
+		// Trailers end the request, their fields are dropped
+		Stream& stream = iter->second;
+		if(stream.remoteClosed)
+		{
+			writeReset(streamId, ErrorCode::StreamClosed);
+			closeStream(streamId);
+			return ErrorCode::NoError;
+		}
+
+		if(!m_headerEndStream)
+			return ErrorCode::ProtocolError;
+
+		if(stream.expectedLength != UINT64_MAX && stream.receivedLength != stream.expectedLength)
+		{
+			writeReset(streamId, ErrorCode::ProtocolError);
+			closeStream(streamId);
+			return ErrorCode::NoError;
+		}
+
+		stream.remoteClosed = true;
+		dispatch(streamId, stream);
+		return ErrorCode::NoError;
+	}
+
+	if(streamId <= m_lastStreamId)
+		return ErrorCode::StreamClosed;
+
+	if(!(streamId & 1))
+		return ErrorCode::ProtocolError;
+
+	m_lastStreamId = streamId;
+	if(m_streams.size() >= m_settings.maxConcurrentStreams)
+	{
+		writeReset(streamId, ErrorCode::RefusedStream);
+		return ErrorCode::NoError;
+	}
+
+	auto request = makePooled<Request>();
+	if(!buildRequest(fields, *request))
+	{
+		writeReset(streamId, ErrorCode::ProtocolError);
+		return ErrorCode::NoError;
+	}
+
+	uint64_t expectedLength = UINT64_MAX;
+	std::string_view contentLength = request->getHeader(HeaderId::ContentLength);
+	if(!contentLength.empty())
+	{
+		auto result = std::from_chars(contentLength.data(), contentLength.data() + contentLength.size(), expectedLength);
+		if(result.ec != std::errc() || result.ptr != contentLength.data() + contentLength.size())
+		{
+			writeReset(streamId, ErrorCode::ProtocolError);
+			return ErrorCode::NoError;
+		}
+	}
+
+	Stream& stream = m_streams[streamId];
+	stream.request = request;
+	stream.expectedLength = expectedLength;
+	stream.sendWindow = m_initialSendWindow;
+	stream.receiveWindow = m_settings.initialWindowSize;
+	stream.remoteClosed = m_headerEndStream;
+
+	if(auto connection = m_connection.lock())
+		connection->beginStream();
+
+	if(listSize > m_settings.maxHeaderListSize)
+	{
+		sendError(streamId, 431);
+		return ErrorCode::NoError;
+	}
+
+	if(expectedLength != UINT64_MAX && expectedLength > m_maxBodySize)
+	{
+		sendError(streamId, 413);
+		return ErrorCode::NoError;
+	}
+
+	if(stream.remoteClosed)
+	{
+		if(expectedLength != UINT64_MAX && expectedLength != 0)
+		{
+			writeReset(streamId, ErrorCode::ProtocolError);
+			closeStream(streamId);
+			return ErrorCode::NoError;
+		}
+
+		dispatch(streamId, stream);
+	}
+
+	return ErrorCode::NoError;
+}
+
+bool Http2Session::buildRequest(std::vector<HeaderField>& fields, Request& request)
+{
+	std::string method, path, scheme, authority, cookie;
+	bool regular = false;
+
+	for(HeaderField& field : fields)
+	{
+		if(!field.name.empty() && field.name[0] == ':')
+		{
+			// Pseudo fields come first and only once
+			std::string* target = nullptr;
+			if(field.name == ":method")
+				target = &method;
+			else if(field.name == ":path")
+				target = &path;
+			else if(field.name == ":scheme")
+				target = &scheme;
+			else if(field.name == ":authority")
+				target = &authority;
+
+			if(regular || !target || !target->empty())
+				return false;
+
+			*target = std::move(field.value);
+			continue;
+		}
+
+		regular = true;
+		if(std::any_of(field.name.begin(), field.name.end(), [](char c) { return c >= 'A' && c <= 'Z'; }))
+			return false;
+
+		if(isConnectionSpecific(field.name) || (field.name == "te" && field.value != "trailers"))
+			return false;
+
+		// Cookies may be split into several fields to compress better
+		if(field.name == "cookie")
+		{
+			if(!cookie.empty())
+				cookie += "; ";
+
+			cookie += field.value;
+			continue;
+		}
+
+		request.getHeaders().add(field.name, field.value);
+	}
+
+	if(method.empty() || path.empty() || scheme.empty())
+		return false;
+
+	if(!cookie.empty())
+		request.getHeaders().add(HeaderId::Cookie, "cookie", cookie);
+
+	if(!authority.empty() && !request.getHeaders().contains(HeaderId::Host))
+		request[HeaderId::Host] = authority;
+
+	request.setMethod(method);
+	request.setUrl(path);
+	request.setVersion("HTTP/2");
+	return true;
+}
+
+Http2Session::ErrorCode Http2Session::handleSettings(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length)
+{
+	if(streamId)
+		return ErrorCode::ProtocolError;
+
+	if(flags & ACK)
+		return length ? ErrorCode::FrameSizeError : ErrorCode::NoError;
+
+	if(length % 6)
+		return ErrorCode::FrameSizeError;
+
+	ErrorCode error = applySettings(payload, length);
+	if(error != ErrorCode::NoError)
+		return error;
+
+	writeFrame(FrameType::Settings, ACK, 0, {});
+
+	// A larger initial window may unblock streams
+	flushData();
+	return ErrorCode::NoError;
+}
+
+Http2Session::ErrorCode Http2Session::applySettings(const uint8_t* payload, size_t length)
+{
+	if(length % 6)
+		return ErrorCode::FrameSizeError;
+
+	for(size_t i = 0; i < length; i += 6)
+	{
+		uint16_t id = (uint16_t(payload[i]) << 8) | payload[i + 1];
+		uint32_t value = readUint32(payload + i + 2);
+
+		switch(id)
+		{
+			case HEADER_TABLE_SIZE:
+				m_encoder.setMaxTableSize(value);
+				break;
+
+			case ENABLE_PUSH:
+				if(value > 1)
+					return ErrorCode::ProtocolError;
+				break;
+
+			case INITIAL_WINDOW_SIZE:
+				if(value > MAX_WINDOW_SIZE)
+					return ErrorCode::FlowControlError;
+
+				// Applies to the windows of all open streams
+				for(auto& entry : m_streams)
+				{
+					entry.second.sendWindow += int64_t(value) - m_initialSendWindow;
+					if(entry.second.sendWindow > MAX_WINDOW_SIZE)
+						return ErrorCode::FlowControlError;
+				}
+
+				m_initialSendWindow = value;
+				break;
+
+			case MAX_FRAME_SIZE:
+				if(value < MAX_FRAME_SIZE || value > 0xffffff)
+					return ErrorCode::ProtocolError;
+
+				m_maxSendFrame = value;
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return ErrorCode::NoError;
+}
+
+Http2Session::ErrorCode Http2Session::handleWindowUpdate(uint32_t streamId, const uint8_t* payload, size_t length)
+{
+	if(length != 4)
+		return ErrorCode::FrameSizeError;
+
+	uint32_t increment = readUint32(payload) & 0x7fffffff;
+	if(!streamId)
+	{
+		if(!increment)
+			return ErrorCode::ProtocolError;
+
+		m_sendWindow += increment;
+		if(m_sendWindow > MAX_WINDOW_SIZE)
+			return ErrorCode::FlowControlError;
+	}
+	else
+	{
+		auto iter = m_streams.find(streamId);
+		if(iter == m_streams.end() || iter->second.reset)
+			return streamId > m_lastStreamId ? ErrorCode::ProtocolError : ErrorCode::NoError;
+
+		iter->second.sendWindow += increment;
+		if(!increment || iter->second.sendWindow > MAX_WINDOW_SIZE)
+		{
+			writeReset(streamId, increment ? ErrorCode::FlowControlError : ErrorCode::ProtocolError);
+			closeStream(streamId);
+			return ErrorCode::NoError;
+		}
+	}
+
+	flushData();
+	return ErrorCode::NoError;
+}
+
+void Http2Session::dispatch(uint32_t streamId, Stream& stream)
+{
+	// The stream only keeps what is needed to answer
+	std::shared_ptr<Request> request;
+	request.swap(stream.request);
+	stream.dispatched = true;
+
+	bool head = (request->getMethod() == "HEAD");
+	m_handler(request, Responder(*this, streamId, head));
+}
+
+void Http2Session::sendError(uint32_t streamId, uint16_t status)
+{
+	sendHeaders(streamId, status, Headers(), 0, true);
+}
+
+void Http2Session::sendHeaders(uint32_t streamId, uint16_t status, const Headers& fields, uint64_t contentLength, bool endStream)
+{
+	auto iter = m_streams.find(streamId);
+	if(m_failed || iter == m_streams.end())
+		return;
+
+	if(iter->second.reset)
+	{
+		if(endStream)
+			removeStream(streamId);
+
+		return;
+	}
+
+	std::string block;
+	m_encoder.begin(block);
+
+	char statusText[8];
+	auto result = std::to_chars(statusText, statusText + sizeof(statusText), status);
+	m_encoder.encode(block, ":status", std::string_view(statusText, result.ptr - statusText));
+
+	bool hasLength = (contentLength != UINT64_MAX && status >= 200 && status != 204 && status != 304);
+	bool date = false;
+	std::string name;
+
+	fields.forEach([&](std::string_view fieldName, std::string_view value) {
+		name.assign(fieldName);
+		std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+		if(isConnectionSpecific(name) || (hasLength && name == "content-length"))
+			return;
+
+		date = date || name == "date";
+		m_encoder.encode(block, name, value, !isSensitive(name));
+	});
+
+	if(hasLength)
+	{
+		char length[24];
+		result = std::to_chars(length, length + sizeof(length), contentLength);
+		m_encoder.encode(block, "content-length", std::string_view(length, result.ptr - length), false);
+	}
+
+	if(!date)
+	{
+		// The cached field without "Date: " and CRLF
+		Segment field = Request::getDateField();
+		m_encoder.encode(block, "date", std::string_view(field.data + 6, field.size - 8));
+	}
+
+	// Blocks larger than a frame continue in CONTINUATION frames
+	FrameType type = FrameType::Headers;
+	size_t offset = 0;
+	do
+	{
+		size_t size = std::min(block.size() - offset, m_maxSendFrame);
+		uint8_t flags = (offset + size == block.size() ? END_HEADERS : 0);
+		if(type == FrameType::Headers && endStream)
+			flags |= END_STREAM;
+
+		writeFrame(type, flags, streamId, std::string_view(block).substr(offset, size));
+		type = FrameType::Continuation;
+		offset += size;
+	}
+	while(offset < block.size());
+
+	if(endStream)
+		finishStream(streamId);
+
+	send();
+}
+
+void Http2Session::sendData(uint32_t streamId, Segments&& data, bool endStream)
+{
+	auto iter = m_streams.find(streamId);
+	if(m_failed || iter == m_streams.end())
+		return;
+
+	Stream& stream = iter->second;
+	if(stream.reset)
+	{
+		if(endStream)
+			removeStream(streamId);
+
+		return;
+	}
+
+	stream.pending.append(std::move(data));
+	stream.endQueued = stream.endQueued || endStream;
+
+	if(!stream.queued && (stream.endQueued || !stream.pending.empty()))
+	{
+		stream.queued = true;
+		m_ready.push_back(streamId);
+	}
+
+	flushData();
+	send();
+}
+
+void Http2Session::flushData()
+{
+	// Every stream sends one frame per turn, so large responses do not hold up small ones
+	size_t stalled = 0;
+	while(!m_ready.empty() && stalled < m_ready.size())
+	{
+		uint32_t streamId = m_ready.front();
+		m_ready.pop_front();
+
+		auto iter = m_streams.find(streamId);
+		if(iter == m_streams.end() || iter->second.reset)
+			continue;
+
+		Stream& stream = iter->second;
+		int64_t window = std::min(stream.sendWindow, m_sendWindow);
+		size_t size = (window > 0 ? std::min({stream.pending.size(), size_t(window), m_maxSendFrame}) : 0);
+		bool end = (stream.endQueued && size == stream.pending.size());
+
+		if(!size && !end)
+		{
+			// Waits for a WINDOW_UPDATE
+			m_ready.push_back(streamId);
+			stalled++;
+			continue;
+		}
+
+		stalled = 0;
+		writeFrameHeader(FrameType::Data, end ? END_STREAM : 0, streamId, size);
+		if(size)
+		{
+			flushFrames();
+			m_output.append(stream.pending.take(size));
+		}
+
+		stream.sendWindow -= int64_t(size);
+		m_sendWindow -= int64_t(size);
+
+		if(end)
+			finishStream(streamId);
+		else if(stream.pending.empty())
+			stream.queued = false;
+		else
+			m_ready.push_back(streamId);
+	}
+}
+
+void Http2Session::finishStream(uint32_t streamId)
+{
+	auto iter = m_streams.find(streamId);
+	if(iter == m_streams.end())
+		return;
+
+	// A client still sending a body is told to stop
+	if(!iter->second.remoteClosed)
+		writeReset(streamId, ErrorCode::NoError);
+
+	removeStream(streamId);
+}
+
+void Http2Session::closeStream(uint32_t streamId)
+{
+	auto iter = m_streams.find(streamId);
+	if(iter == m_streams.end())
+		return;
+
+	Stream& stream = iter->second;
+	if(!stream.dispatched)
+	{
+		removeStream(streamId);
+		return;
+	}
+
+	stream.reset = true;
+	stream.queued = false;
+	stream.pending.clear();
+}
+
+void Http2Session::removeStream(uint32_t streamId)
+{
+	if(!m_streams.erase(streamId))
+		return;
+
+	auto connection = m_connection.lock();
+	if(!connection)
+		return;
+
+	connection->endStream();
+	if(m_peerClosing && m_streams.empty())
+		connection->closeAfterWrite();
+}
+
+void Http2Session::goAway(ErrorCode code)
+{
+	if(m_failed)
+		return;
+
+	std::string payload;
+	appendUint32(payload, m_lastStreamId);
+	appendUint32(payload, uint32_t(code));
+	writeFrame(FrameType::GoAway, 0, 0, payload);
+
+	m_failed = true;
+	send();
+
+	// Responses still being prepared are dropped
+	auto connection = m_connection.lock();
+	std::unordered_map<uint32_t, Stream> streams;
+	streams.swap(m_streams);
+	m_ready.clear();
+
+	if(!connection)
+		return;
+
+	for(size_t i = 0; i < streams.size(); i++)
+		connection->endStream();
+
+	connection->closeAfterWrite();
+}
+
+void Http2Session::writeFrameHeader(FrameType type, uint8_t flags, uint32_t stream, size_t length)
+{
+	m_frames += char(length >> 16);
+	m_frames += char(length >> 8);
+	m_frames += char(length);
+	m_frames += char(type);
+	m_frames += char(flags);
+	appendUint32(m_frames, stream);
+}
+
+void Http2Session::writeFrame(FrameType type, uint8_t flags, uint32_t stream, std::string_view payload)
+{
+	writeFrameHeader(type, flags, stream, payload.size());
+	m_frames += payload;
+}
+
+void Http2Session::writeSettings()
+{
+	std::string payload;
+	appendSetting(payload, MAX_CONCURRENT_STREAMS, m_settings.maxConcurrentStreams);
+	appendSetting(payload, INITIAL_WINDOW_SIZE, m_settings.initialWindowSize);
+	appendSetting(payload, MAX_HEADER_LIST_SIZE, m_settings.maxHeaderListSize);
+	appendSetting(payload, ENABLE_PUSH, 0);
+	writeFrame(FrameType::Settings, 0, 0, payload);
+}
+
+void Http2Session::writeWindowUpdate(uint32_t stream, uint32_t increment)
+{
+	std::string payload;
+	appendUint32(payload, increment);
+	writeFrame(FrameType::WindowUpdate, 0, stream, payload);
+}
+
+void Http2Session::writeReset(uint32_t stream, ErrorCode code)
+{
+	std::string payload;
+	appendUint32(payload, uint32_t(code));
+	writeFrame(FrameType::RstStream, 0, stream, payload);
+}
+
+void Http2Session::flushFrames()
+{
+	if(m_frames.empty())
+		return;
+
+	m_output.append(std::move(m_frames));
+	m_frames.clear();
+}
+
+void Http2Session::send()
+{
+	flushFrames();
+
+	auto connection = m_connection.lock();
+	if(!connection)
+	{
+		m_output.clear();
+		return;
+	}
+
+	if(m_output.empty())
+		return;
+
+	Segments output;
+	output.swap(m_output);
+	connection->write(std::move(output));
+}
+
+bool Http2Session::isPreface(std::string_view data)
+{
+	size_t size = std::min(data.size(), PREFACE.size());
+	return data.substr(0, size) == PREFACE.substr(0, size);
+}
+
+bool Http2Session::isUpgrade(const Request& request, std::string& settings)
+{
+	if(request.getVersion() != "HTTP/1.1" || !Headers::hasToken(request.getHeader(HeaderId::Upgrade), "h2c"))
+		return false;
+
+	const std::string* encoded = request.getHeaders().find("HTTP2-Settings");
+	settings.clear();
+
+	return encoded && decodeBase64Url(*encoded, settings) && settings.size() % 6 == 0;
+}
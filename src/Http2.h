@@ -0,0 +1,306 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_HTTP2_H
+#define TLHTTP_HTTP2_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Hpack.h"
+#include "Headers.h"
+#include "Segments.h"
+
+namespace tlhttp
+{
+
+class Connection;
+class EventLoop;
+class Request;
+class Responder;
+
+/**
+ * @brief Serves HTTP/2 (RFC 9113) on one server connection.
+ *
+ * The session takes over the input of the connection once the client
+ * preface arrived, either right away, after an h2c upgrade or after "h2"
+ * was negotiated with ALPN. Every stream is dispatched to the handler as
+ * soon as its request is complete, and answered through a Responder like
+ * an HTTP/1 request, so many requests share one socket and respond in any
+ * order.
+ *
+ * Response data is sent as the flow control windows of the peer allow,
+ * streams waiting for window take turns. Request bodies are acknowledged
+ * as they arrive, they are buffered by their Body anyway.
+ *
+ * All methods have to be called on the loop thread of the connection.
+ */
+class Http2Session : public std::enable_shared_from_this<Http2Session>
+{
+public:
+	typedef std::function<void(const std::shared_ptr<Request>&, const Responder&)> Handler;
+
+	/**
+	 * @brief The first bytes a client sends on an HTTP/2 connection.
+	 */
+	static constexpr std::string_view PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+	static constexpr size_t FRAME_HEADER_SIZE = 9;
+
+	/**
+	 * @brief The largest frame payload accepted, the protocol's default.
+	 */
+	static constexpr size_t MAX_FRAME_SIZE = 16384;
+
+	static constexpr int64_t MAX_WINDOW_SIZE = 0x7fffffff;
+
+	enum class FrameType : uint8_t
+	{
+		Data,
+		Headers,
+		Priority,
+		RstStream,
+		Settings,
+		PushPromise,
+		Ping,
+		GoAway,
+		WindowUpdate,
+		Continuation
+	};
+
+	enum class ErrorCode : uint32_t
+	{
+		NoError,
+		ProtocolError,
+		InternalError,
+		FlowControlError,
+		SettingsTimeout,
+		StreamClosed,
+		FrameSizeError,
+		RefusedStream,
+		Cancel,
+		CompressionError,
+		ConnectError,
+		EnhanceYourCalm,
+		InadequateSecurity,
+		Http11Required
+	};
+
+	/**
+	 * @brief The settings announced to clients and the limits of a session.
+	 */
+	struct Settings
+	{
+		/// The number of streams a client may have open at once, including
+		/// reset ones whose handler did not respond yet
+		uint32_t maxConcurrentStreams = 128;
+
+		/// The window of every stream and of the connection for request bodies
+		uint32_t initialWindowSize = 1024 * 1024;
+
+		/// The size of all fields of a request, larger ones are answered with 431
+		uint32_t maxHeaderListSize = 64 * 1024;
+
+		/// The number of streams a client may reset before the connection
+		/// is closed with ENHANCE_YOUR_CALM
+		uint32_t maxResets = 1000;
+	};
+
+private:
+	struct Stream
+	{
+		std::shared_ptr<Request> request;
+
+		// Content-Length of the request, checked against the DATA received
+		uint64_t expectedLength = UINT64_MAX, receivedLength = 0;
+
+		int64_t sendWindow = 0, receiveWindow = 0;
+
+		// Response data waiting for window, END_STREAM follows once it is sent
+		Segments pending;
+		bool endQueued = false;
+
+		// Whether the stream waits in m_ready
+		bool queued = false;
+
+		bool remoteClosed = false;
+
+		// Whether the request was passed to the handler
+		bool dispatched = false;
+
+		// Set when a dispatched stream was reset, it is kept until the
+		// responder completes but sends nothing anymore
+		bool reset = false;
+	};
+
+	std::weak_ptr<Connection> m_connection;
+	EventLoop* m_loop;
+	Handler m_handler;
+	Settings m_settings;
+	uint64_t m_maxBodySize = UINT64_MAX;
+
+	HpackEncoder m_encoder;
+	HpackDecoder m_decoder;
+
+	std::unordered_map<uint32_t, Stream> m_streams;
+
+	// Streams with response data, served in turns
+	std::deque<uint32_t> m_ready;
+
+	uint32_t m_lastStreamId = 0, m_resetCount = 0;
+	int64_t m_sendWindow = 65535, m_receiveWindow = 65535;
+	int64_t m_initialSendWindow = 65535;
+	size_t m_maxSendFrame = MAX_FRAME_SIZE;
+
+	// A header block continued by CONTINUATION frames
+	uint32_t m_headerStream = 0;
+	bool m_headerEndStream = false;
+	std::string m_headerBlock;
+
+	bool m_prefaceReceived = false;
+
+	// Set once a GOAWAY was sent because of an error, or received
+	bool m_failed = false, m_peerClosing = false;
+
+	// Frames are collected and written with one vectored write
+	Segments m_output;
+	std::string m_frames;
+
+	void writeFrameHeader(FrameType type, uint8_t flags, uint32_t stream, size_t length);
+	void writeFrame(FrameType type, uint8_t flags, uint32_t stream, std::string_view payload);
+	void writeSettings();
+	void writeWindowUpdate(uint32_t stream, uint32_t increment);
+	void writeReset(uint32_t stream, ErrorCode code);
+	void flushFrames();
+	void send();
+
+	ErrorCode handleFrame(FrameType type, uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length);
+	ErrorCode handleData(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length);
+	ErrorCode handleHeaders(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length);
+	ErrorCode handleSettings(uint8_t flags, uint32_t streamId, const uint8_t* payload, size_t length);
+	ErrorCode handleWindowUpdate(uint32_t streamId, const uint8_t* payload, size_t length);
+	ErrorCode applySettings(const uint8_t* payload, size_t length);
+	ErrorCode finishHeaders();
+
+	/**
+	 * @brief Turns a decoded header block into a request.
+	 * @return false if the fields do not form a valid request.
+	 */
+	static bool buildRequest(std::vector<HeaderField>& fields, Request& request);
+
+	void dispatch(uint32_t streamId, Stream& stream);
+	void sendError(uint32_t streamId, uint16_t status);
+
+	/**
+	 * @brief Closes a stream once its response was sent.
+	 */
+	void finishStream(uint32_t streamId);
+
+	/**
+	 * @brief Closes a stream before its response was sent.
+	 *
+	 * A stream whose request is being handled keeps counting against
+	 * maxConcurrentStreams until its responder completes, so resetting
+	 * streams does not queue unlimited work.
+	 */
+	void closeStream(uint32_t streamId);
+	void removeStream(uint32_t streamId);
+	void goAway(ErrorCode code);
+
+	/**
+	 * @brief Sends response data as far as the windows allow.
+	 */
+	void flushData();
+
+public:
+	/**
+	 * @param connection The server connection, attached to its loop.
+	 * @param handler Called with every complete request.
+	 * @param settings The settings announced to the client.
+	 */
+	Http2Session(const std::shared_ptr<Connection>& connection, const Handler& handler, const Settings& settings);
+
+	/**
+	 * @brief Sends the server preface.
+	 *
+	 * An h2c upgrade request is answered on stream 1 with the settings
+	 * the client sent along.
+	 *
+	 * @param upgrade The request which asked for the upgrade, nullptr otherwise.
+	 * @param upgradeSettings The decoded HTTP2-Settings field of the upgrade request.
+	 */
+	void start(const std::shared_ptr<Request>& upgrade = nullptr, std::string_view upgradeSettings = {});
+
+	/**
+	 * @brief Processes the frames in the input buffer of the connection.
+	 */
+	void onData();
+
+	/**
+	 * @brief Sends the status and fields of a response.
+	 *
+	 * Fields specific to HTTP/1 connections are left out and a Date field
+	 * is added unless one is set.
+	 *
+	 * @param streamId The stream of the request.
+	 * @param status The status code.
+	 * @param fields The fields of the response.
+	 * @param contentLength The length of the body, UINT64_MAX if it is streamed.
+	 * @param endStream Whether the response has no body.
+	 */
+	void sendHeaders(uint32_t streamId, uint16_t status, const Headers& fields, uint64_t contentLength, bool endStream);
+
+	/**
+	 * @brief Queues data of a response.
+	 * @param endStream Whether the response is complete afterwards.
+	 */
+	void sendData(uint32_t streamId, Segments&& data, bool endStream);
+
+	/**
+	 * @brief Limits the size of request bodies, larger ones are answered with 413.
+	 */
+	void setMaxBodySize(uint64_t size) { m_maxBodySize = size; }
+
+	EventLoop* getEventLoop() const { return m_loop; }
+	std::shared_ptr<Connection> getConnection() const { return m_connection.lock(); }
+
+	/**
+	 * @brief Returns the number of streams which are open or being answered.
+	 */
+	size_t getStreamCount() const { return m_streams.size(); }
+
+	/**
+	 * @brief Checks if data starts like the client preface.
+	 * @param data The start of a connection, may be shorter than the preface.
+	 */
+	static bool isPreface(std::string_view data);
+
+	/**
+	 * @brief Checks if a request asks for an h2c upgrade.
+	 * @param settings Receives the decoded HTTP2-Settings field.
+	 */
+	static bool isUpgrade(const Request& request, std::string& settings);
+};
+
+}
+
+#endif //TLHTTP_HTTP2_H
@@ -0,0 +1,165 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "IoBuffer.h"
+#include "Pool.h"
+
+using namespace tlhttp;
+
+namespace
+{
+template<size_t Size>
+using Slabs = detail::FreeList<Size, SlabPool::MAX_CACHED>;
+}
+
+char* SlabPool::allocate(size_t& size)
+{
+	if(size <= MIN_SIZE)
+	{
+		size = MIN_SIZE;
+		return static_cast<char*>(Slabs<MIN_SIZE>::get().allocate());
+	}
+
+	if(size <= 2 * MIN_SIZE)
+	{
+		size = 2 * MIN_SIZE;
+		return static_cast<char*>(Slabs<2 * MIN_SIZE>::get().allocate());
+	}
+
+	if(size <= MAX_SIZE)
+	{
+		size = MAX_SIZE;
+		return static_cast<char*>(Slabs<MAX_SIZE>::get().allocate());
+	}
+
+	return static_cast<char*>(::operator new(size));
+}
+
+void SlabPool::deallocate(char* data, size_t size)
+{
+	if(size == MIN_SIZE)
+		Slabs<MIN_SIZE>::get().deallocate(data);
+	else if(size == 2 * MIN_SIZE)
+		Slabs<2 * MIN_SIZE>::get().deallocate(data);
+	else if(size == MAX_SIZE)
+		Slabs<MAX_SIZE>::get().deallocate(data);
+	else
+		::operator delete(data);
+}
+
+IoBuffer::IoBuffer(IoBuffer&& buffer) noexcept
+	: m_data(std::exchange(buffer.m_data, nullptr)), m_capacity(std::exchange(buffer.m_capacity, 0)),
+	  m_head(std::exchange(buffer.m_head, 0)), m_tail(std::exchange(buffer.m_tail, 0))
+{
+}
+
+IoBuffer& IoBuffer::operator=(IoBuffer&& buffer) noexcept
+{
+	if(this != &buffer)
+	{
+		free();
+		m_data = std::exchange(buffer.m_data, nullptr);
+		m_capacity = std::exchange(buffer.m_capacity, 0);
+		m_head = std::exchange(buffer.m_head, 0);
+		m_tail = std::exchange(buffer.m_tail, 0);
+	}
+
+	return *this;
+}
+
+void IoBuffer::free()
+{
+	if(m_data)
+		SlabPool::deallocate(m_data, m_capacity);
+
+	m_data = nullptr;
+	m_capacity = m_head = m_tail = 0;
+}
+
+char* IoBuffer::prepare(size_t size)
+{
+	if(getFree() >= size)
+		return m_data + m_tail;
+
+	size_t used = this->size();
+	if(m_capacity - used >= size)
+	{
+		// Reclaims the consumed space in front
+		memmove(m_data, data(), used);
+	}
+	else
+	{
+		size_t capacity = std::max(used + size, 2 * m_capacity);
+		char* data = SlabPool::allocate(capacity);
+		if(used)
+			memcpy(data, this->data(), used);
+
+		free();
+		m_data = data;
+		m_capacity = capacity;
+	}
+
+	m_head = 0;
+	m_tail = used;
+	return m_data + m_tail;
+}
+
+void IoBuffer::append(const char* data, size_t size)
+{
+	if(!size)
+		return;
+
+	memcpy(prepare(size), data, size);
+	commit(size);
+}
+
+void IoBuffer::consume(size_t size)
+{
+	m_head += std::min(size, this->size());
+	shrink();
+}
+
+void IoBuffer::erase(size_t offset, size_t size)
+{
+	if(offset >= this->size())
+		return;
+
+	size = std::min(size, this->size() - offset);
+	if(offset == 0)
+	{
+		consume(size);
+		return;
+	}
+
+	char* start = m_data + m_head + offset;
+	memmove(start, start + size, this->size() - offset - size);
+	m_tail -= size;
+}
+
+void IoBuffer::clear()
+{
+	free();
+}
+
+void IoBuffer::shrink()
+{
+	if(empty())
+		free();
+}
@@ -0,0 +1,127 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_IOBUFFER_H
+#define TLHTTP_IOBUFFER_H
+
+#include <cstddef>
+#include <string_view>
+
+namespace tlhttp
+{
+
+/**
+ * @brief Hands out the large chunks receive buffers are made of.
+ *
+ * Slabs of 16, 32 and 64 KiB are cached per thread like pooled objects,
+ * larger requests are served by the heap.
+ */
+class SlabPool
+{
+public:
+	static constexpr size_t MIN_SIZE = 16384;
+	static constexpr size_t MAX_SIZE = 65536;
+
+	/**
+	 * @brief The number of slabs of each size kept per thread.
+	 */
+	static constexpr size_t MAX_CACHED = 64;
+
+	/**
+	 * @param size The minimum size, receives the actual size of the slab.
+	 */
+	static char* allocate(size_t& size);
+	static void deallocate(char* data, size_t size);
+};
+
+/**
+ * @brief A growable, binary-safe receive buffer made of one slab.
+ *
+ * Data is received straight into the free space at the back and consumed
+ * from the front. Instead of wrapping around once the back is reached, the
+ * remaining bytes move to the front of the slab, so the data stays
+ * contiguous for the parser. Only if that does not free enough space the
+ * buffer moves to a larger slab.
+ *
+ * An empty buffer gives its slab back, so idle connections hold no memory.
+ */
+class IoBuffer
+{
+	char* m_data = nullptr;
+	size_t m_capacity = 0, m_head = 0, m_tail = 0;
+
+	void free();
+
+public:
+	/**
+	 * @brief The free space receives ask for at least.
+	 */
+	static constexpr size_t RECEIVE_SIZE = 8192;
+
+	IoBuffer() = default;
+	IoBuffer(IoBuffer&& buffer) noexcept;
+	IoBuffer& operator=(IoBuffer&& buffer) noexcept;
+	~IoBuffer() { free(); }
+
+	IoBuffer(const IoBuffer&) = delete;
+	IoBuffer& operator=(const IoBuffer&) = delete;
+
+	/**
+	 * @brief Returns the data, never nullptr even if the buffer holds no slab.
+	 */
+	const char* data() const { return m_data ? m_data + m_head : ""; }
+	size_t size() const { return m_tail - m_head; }
+	bool empty() const { return m_tail == m_head; }
+	std::string_view view() const { return std::string_view(data(), size()); }
+
+	size_t getCapacity() const { return m_capacity; }
+	size_t getFree() const { return m_capacity - m_tail; }
+
+	/**
+	 * @brief Makes room for at least size bytes behind the data.
+	 * @return The start of the free space, getFree() bytes may be written.
+	 */
+	char* prepare(size_t size = RECEIVE_SIZE);
+
+	/**
+	 * @brief Adds bytes written into the free space to the data.
+	 */
+	void commit(size_t size) { m_tail += size; }
+
+	void append(const char* data, size_t size);
+	void append(std::string_view data) { append(data.data(), data.size()); }
+
+	/**
+	 * @brief Removes bytes from the front.
+	 */
+	void consume(size_t size);
+
+	/**
+	 * @brief Removes a range of the data, the bytes after it move down.
+	 */
+	void erase(size_t offset, size_t size = std::string_view::npos);
+
+	void clear();
+
+	/**
+	 * @brief Gives the slab back if the buffer is empty.
+	 */
+	void shrink();
+};
+
+}
+
+#endif //TLHTTP_IOBUFFER_H
@@ -0,0 +1,249 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <stdexcept>
+#include <utility>
+
+#include "MultiClient.h"
+
+using namespace tlhttp;
+
+namespace
+{
+struct Suspend
+{
+	std::coroutine_handle<>& slot;
+
+	bool await_ready() noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle) noexcept { slot = handle; }
+	void await_resume() noexcept {}
+};
+}
+
+MultiClient::~MultiClient()
+{
+	m_pool.clear();
+}
+
+void MultiClient::dispatch(Batch& batch)
+{
+	bool starved = false;
+	for(auto& entry : batch.hosts)
+	{
+		Host& host = entry.second;
+		while(!host.requests.empty() && batch.inflight < m_options.concurrency)
+		{
+			bool reserved = false;
+			auto connection = m_pool.tryAcquire(host.endpoint, reserved);
+			if(!connection && !reserved)
+			{
+				// Running connections pick up the requests, without any the
+				// host's connections are busy with other batches
+				starved |= (host.workers == 0);
+				break;
+			}
+
+			std::vector<Pending> requests;
+			take(batch, host, false, requests);
+
+			host.workers++;
+			batch.workers++;
+			spawn(work(batch, host, std::move(connection), std::move(requests)));
+		}
+	}
+
+	if(starved && !batch.retry.isArmed())
+		m_loop.schedule(batch.retry, std::chrono::milliseconds(10));
+}
+
+void MultiClient::take(Batch& batch, Host& host, bool pipeline, std::vector<Pending>& requests)
+{
+	size_t limit = (pipeline ? std::max<size_t>(m_options.pipelineDepth, 1) : 1);
+	while(requests.size() < limit && !host.requests.empty() && batch.inflight < m_options.concurrency)
+	{
+		// Requests with a body are not pipelined, a failure could leave
+		// them processed or not
+		if(!requests.empty() && !host.requests.front().idempotent)
+			break;
+
+		requests.push_back(std::move(host.requests.front()));
+		host.requests.pop_front();
+		batch.inflight++;
+	}
+}
+
+void MultiClient::complete(Batch& batch, Pending& request, Request&& response, const std::string& error)
+{
+	Result result;
+	result.index = request.index;
+	result.url = std::move(request.url);
+	result.response = std::move(response);
+	result.error = error;
+
+	batch.remaining--;
+	batch.onResult(std::move(result));
+}
+
+Task<void> MultiClient::work(Batch& batch, Host& host, std::shared_ptr<Connection> connection, std::vector<Pending> requests)
+{
+	bool reusable = true, pipeline = false;
+	std::string error;
+
+	if(!connection)
+	{
+		connection = std::make_shared<Connection>();
+		connection->setConnectOptions(m_connectOptions);
+
+		try
+		{
+			if(host.endpoint.isSecure())
+				co_await connection->asyncConnectSecure(m_loop, host.endpoint.host, host.endpoint.port, m_tls);
+			else
+				co_await connection->asyncConnect(m_loop, host.endpoint.host, host.endpoint.port);
+		}
+		catch(std::runtime_error& e)
+		{
+			error = e.what();
+			connection->close();
+		}
+	}
+
+	if(!error.empty())
+	{
+		for(Pending& request : requests)
+		{
+			batch.inflight--;
+			complete(batch, request, Request(), error);
+		}
+
+		// Without other connections the waiting requests would fail the same way
+		if(host.workers == 1)
+		{
+			for(Pending& request : host.requests)
+				complete(batch, request, Request(), error);
+
+			host.requests.clear();
+		}
+
+		requests.clear();
+		reusable = false;
+	}
+
+	while(!requests.empty())
+	{
+		size_t answered = 0;
+		try
+		{
+			std::string messages;
+			for(const Pending& request : requests)
+				messages += request.message;
+
+			co_await connection->asyncSend(messages);
+			while(reusable && answered < requests.size())
+			{
+				Request response = co_await connection->asyncResponse();
+				reusable = ConnectionPool::isReusable(response);
+				pipeline = reusable && response.getVersion() == "HTTP/1.1";
+
+				batch.inflight--;
+				complete(batch, requests[answered++], std::move(response), "");
+			}
+		}
+		catch(std::runtime_error& e)
+		{
+			error = e.what();
+			reusable = false;
+		}
+
+		// Requests after a closing response were not processed. After a
+		// failure only those which are safe to repeat are, others may have
+		// been processed already.
+		std::deque<Pending> retry;
+		for(size_t i = answered; i < requests.size(); i++)
+		{
+			Pending& request = requests[i];
+			batch.inflight--;
+
+			if(error.empty() || (request.attempts == 0 && request.idempotent))
+			{
+				request.attempts += !error.empty();
+				retry.push_back(std::move(request));
+			}
+			else
+				complete(batch, request, Request(), error);
+		}
+
+		host.requests.insert(host.requests.begin(), std::make_move_iterator(retry.begin()),
+							 std::make_move_iterator(retry.end()));
+		requests.clear();
+
+		if(!reusable)
+			break;
+
+		take(batch, host, pipeline, requests);
+	}
+
+	m_pool.release(host.endpoint, connection, reusable);
+
+	host.workers--;
+	batch.workers--;
+	dispatch(batch);
+
+	if(!batch.remaining && !batch.workers && batch.waiter)
+		std::exchange(batch.waiter, nullptr).resume();
+}
+
+Task<void> MultiClient::run(const std::vector<Fetch>& requests, const Callback& onResult)
+{
+	Batch batch;
+	batch.onResult = onResult;
+	batch.remaining = requests.size();
+	batch.retry.setCallback([this, &batch]() { dispatch(batch); });
+
+	for(size_t i = 0; i < requests.size(); i++)
+	{
+		Pending pending{i, requests[i].url, {}, requests[i].body.empty()};
+		try
+		{
+			std::string target;
+			Endpoint endpoint = Endpoint::fromUrl(requests[i].url, target);
+			pending.message = ConnectionPool::formatRequest(endpoint, target, requests[i].body);
+
+			Host& host = batch.hosts[endpoint.getKey()];
+			host.endpoint = endpoint;
+			host.requests.push_back(std::move(pending));
+		}
+		catch(std::runtime_error& e)
+		{
+			complete(batch, pending, Request(), e.what());
+		}
+	}
+
+	dispatch(batch);
+	while(batch.remaining || batch.workers)
+		co_await Suspend{batch.waiter};
+}
+
+std::vector<MultiClient::Result> MultiClient::fetch(const std::vector<Fetch>& requests)
+{
+	std::vector<Result> results(requests.size());
+	syncWait(m_loop, run(requests, [&results](Result&& result) {
+		size_t index = result.index;
+		results[index] = std::move(result);
+	}));
+
+	return results;
+}
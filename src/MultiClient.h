@@ -0,0 +1,188 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_MULTICLIENT_H
+#define TLHTTP_MULTICLIENT_H
+
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ConnectionPool.h"
+#include "EventLoop.h"
+#include "Task.h"
+#include "TimerWheel.h"
+
+namespace tlhttp
+{
+
+/**
+ * @brief Fetches batches of URLs concurrently on one event loop.
+ *
+ * Requests are spread over connections per endpoint, which are taken from
+ * and given back to the client's ConnectionPool, so later batches reuse
+ * them. Once a connection answered with persistent HTTP/1.1, bodiless
+ * requests to the same endpoint are pipelined on it. Bodiless requests
+ * which were not answered because a connection failed are retried once.
+ *
+ * The pooled connections stay attached to the loop, so the client has to
+ * be used and destroyed on the loop thread and must not outlive the loop.
+ */
+class MultiClient
+{
+public:
+	struct Options
+	{
+		/// The number of requests of one batch in flight at the same time
+		size_t concurrency = 64;
+
+		/// The number of requests sent on one connection before reading the responses
+		size_t pipelineDepth = 4;
+	};
+
+	/**
+	 * @brief One request of a batch.
+	 */
+	struct Fetch
+	{
+		std::string url; ///< The absolute http or https URL
+		std::string body; ///< Requests with a body are sent as POST
+
+		Fetch(const std::string& url, const std::string& body = "") : url(url), body(body) {}
+	};
+
+	struct Result
+	{
+		size_t index = 0; ///< The position of the request in the batch
+		std::string url;
+		Request response;
+		std::string error; ///< Why the request failed, empty on success
+
+		bool isSuccess() const { return error.empty(); }
+	};
+
+	/**
+	 * @brief Receives every result as soon as its request completed.
+	 * @note Must not throw.
+	 */
+	typedef std::function<void(Result&& result)> Callback;
+
+private:
+	struct Pending
+	{
+		size_t index;
+		std::string url;
+		std::string message; ///< The serialized request
+		bool idempotent; ///< Bodiless requests may be pipelined and retried
+		int attempts = 0;
+	};
+
+	struct Host
+	{
+		Endpoint endpoint;
+		std::deque<Pending> requests;
+		size_t workers = 0;
+	};
+
+	struct Batch
+	{
+		std::unordered_map<std::string, Host> hosts;
+		Callback onResult;
+		size_t remaining = 0; ///< Requests without a result
+		size_t inflight = 0; ///< Requests taken by a connection
+		size_t workers = 0;
+		std::coroutine_handle<> waiter;
+		Timer retry; ///< Dispatches again when the pool had no connection to spare
+	};
+
+	EventLoop& m_loop;
+	Options m_options;
+	ConnectionPool m_pool;
+	std::shared_ptr<TlsContext> m_tls;
+	Connection::ConnectOptions m_connectOptions;
+
+	/**
+	 * @brief Starts connections for waiting requests as far as the limits allow.
+	 */
+	void dispatch(Batch& batch);
+
+	/**
+	 * @brief Moves the next requests of a host to a connection.
+	 * @param pipeline Whether several requests may be taken.
+	 */
+	void take(Batch& batch, Host& host, bool pipeline, std::vector<Pending>& requests);
+
+	void complete(Batch& batch, Pending& request, Request&& response, const std::string& error);
+
+	/**
+	 * @brief Runs requests over one connection until the host has none left.
+	 * @param connection An idle connection from the pool, nullptr to connect.
+	 */
+	Task<void> work(Batch& batch, Host& host, std::shared_ptr<Connection> connection, std::vector<Pending> requests);
+
+public:
+	/**
+	 * @param loop The loop running the requests.
+	 */
+	explicit MultiClient(EventLoop& loop) : m_loop(loop) {}
+	MultiClient(EventLoop& loop, const Options& options, const ConnectionPool::Limits& limits)
+		: m_loop(loop), m_options(options), m_pool(limits)
+	{
+	}
+
+	/**
+	 * @brief Closes the pooled connections.
+	 */
+	~MultiClient();
+
+	MultiClient(const MultiClient&) = delete;
+	MultiClient& operator=(const MultiClient&) = delete;
+
+	/**
+	 * @brief Sets the context of https connections.
+	 * @param context The context, nullptr uses TlsContext::getDefaultClient().
+	 */
+	void setTlsContext(const std::shared_ptr<TlsContext>& context) { m_tls = context; }
+	void setConnectOptions(const Connection::ConnectOptions& options) { m_connectOptions = options; }
+
+	ConnectionPool& getPool() { return m_pool; }
+
+	/**
+	 * @brief Runs a batch of requests.
+	 *
+	 * Failed requests are reported through their result, the task itself
+	 * does not throw.
+	 *
+	 * @param requests The requests, they have to stay alive until the task is done.
+	 * @param onResult Called on the loop thread whenever a request completed.
+	 * @note The coroutine has to run on the loop thread.
+	 */
+	Task<void> run(const std::vector<Fetch>& requests, const Callback& onResult);
+
+	/**
+	 * @brief Runs a batch of requests on a loop which is not running yet.
+	 * @return The results in the order of the requests.
+	 */
+	std::vector<Result> fetch(const std::vector<Fetch>& requests);
+};
+
+}
+
+#endif //TLHTTP_MULTICLIENT_H
@@ -0,0 +1,340 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "Parser.h"
+#include "Scanner.h"
+
+using namespace tlhttp;
+
+namespace
+{
+bool isToken(const char* begin, const char* end)
+{
+	return begin != end && Scanner::findNonToken(begin, end - begin) == size_t(end - begin);
+}
+
+// Targets and reasons may contain anything but control characters
+bool isText(const char* begin, const char* end)
+{
+	return Scanner::findControl(begin, end - begin) == size_t(end - begin);
+}
+
+bool isVersion(const char* begin, const char* end)
+{
+	return end - begin == 8 && !memcmp(begin, "HTTP/", 5)
+		&& begin[5] >= '0' && begin[5] <= '9' && begin[6] == '.' && begin[7] >= '0' && begin[7] <= '9';
+}
+}
+
+void Parser::reset()
+{
+	uint64_t maxBodySize = m_maxBodySize;
+	*this = Parser(m_response);
+	m_maxBodySize = maxBodySize;
+}
+
+void Parser::checkBodySize(uint64_t size)
+{
+	if(size <= m_maxBodySize)
+		return;
+
+	m_bodyTooLarge = true;
+	throw std::runtime_error("Invalid HTTP message: Body is too large!");
+}
+
+Parser::Result Parser::parse(const char* data, size_t size)
+{
+	m_data = data;
+	while(m_state == State::StartLine)
+	{
+		const char* lf = (const char*) memchr(data + m_position, '\n', size - m_position);
+		if(!lf)
+		{
+			m_position = size;
+			if(size > MAX_HEADER_SIZE)
+				throw std::runtime_error("Invalid HTTP header: Header is too large!");
+
+			return Result::NeedMore;
+		}
+
+		// Bare LF line endings are accepted as well
+		size_t end = lf - data;
+		m_position = end + 1;
+		if(end > m_lineStart && data[end - 1] == '\r')
+			end--;
+
+		if(m_position > MAX_HEADER_SIZE)
+			throw std::runtime_error("Invalid HTTP header: Header is too large!");
+
+		// Empty lines in front of a request are ignored (RFC 7230, section 3.5)
+		if(end != m_lineStart)
+		{
+			parseStartLine(end);
+			m_state = State::FieldName;
+		}
+
+		m_lineStart = m_position;
+	}
+
+	if(m_state == State::Done)
+		return Result::Done;
+
+	if(!parseFields(std::min(size, MAX_HEADER_SIZE)))
+	{
+		if(m_position >= MAX_HEADER_SIZE)
+			throw std::runtime_error("Invalid HTTP header: Header is too large!");
+
+		return Result::NeedMore;
+	}
+
+	checkFraming();
+	return Result::Done;
+}
+
+void Parser::checkFraming() const
+{
+	if(m_response || !m_hasTransferEncoding)
+		return;
+
+	// Requests which could be framed in two ways are a smuggling vector
+	// (RFC 7230, section 3.3.3)
+	if(!m_chunked)
+		throw std::runtime_error("Invalid HTTP header: Unsupported transfer coding!");
+
+	if(m_hasContentLength)
+		throw std::runtime_error("Invalid HTTP header: Content-Length with Transfer-Encoding!");
+}
+
+bool Parser::parseFields(size_t size)
+{
+	const char* data = m_data;
+	while(m_position < size)
+	{
+		switch(m_state)
+		{
+			case State::FieldName:
+			{
+				size_t end = m_position + Scanner::findNonToken(data + m_position, size - m_position);
+				if(end == size)
+				{
+					m_position = end;
+					return false;
+				}
+
+				char c = data[end];
+				if(end == m_lineStart)
+				{
+					// The empty line ends the header
+					if(c == '\r')
+						m_state = State::HeaderEnd;
+					else if(c == '\n')
+						m_state = State::Done;
+					else if(c == ' ' || c == '\t')
+						throw std::runtime_error("Invalid HTTP header: Folded header lines are not supported!");
+					else
+						throw std::runtime_error("Invalid HTTP header: Field name is invalid!");
+
+					m_position = end + 1;
+					if(m_state == State::Done)
+						return true;
+
+					break;
+				}
+
+				if(c != ':')
+					throw std::runtime_error("Invalid HTTP header: Field name is invalid!");
+
+				m_fieldName = {uint32_t(m_lineStart), uint32_t(end - m_lineStart)};
+				m_valueStart = end + 1;
+				m_position = end + 1;
+				m_state = State::FieldValue;
+				break;
+			}
+
+			case State::FieldValue:
+			{
+				size_t end = m_position + Scanner::findControl(data + m_position, size - m_position);
+				if(end == size)
+				{
+					m_position = end;
+					return false;
+				}
+
+				m_valueEnd = end;
+				m_position = end + 1;
+				if(data[end] == '\r')
+					m_state = State::FieldLineEnd;
+				else if(data[end] == '\n')
+					addField();
+				else
+					throw std::runtime_error("Invalid HTTP header: Field value is invalid!");
+
+				break;
+			}
+
+			case State::FieldLineEnd:
+			case State::HeaderEnd:
+				if(data[m_position] != '\n')
+					throw std::runtime_error("Invalid HTTP header: Expected line feed!");
+
+				m_position++;
+				if(m_state == State::HeaderEnd)
+				{
+					m_state = State::Done;
+					return true;
+				}
+
+				addField();
+				break;
+
+			default:
+				return true;
+		}
+	}
+
+	return m_state == State::Done;
+}
+
+void Parser::parseStartLine(size_t end)
+{
+	if(m_response)
+		parseStatusLine(end);
+	else
+		parseRequestLine(end);
+}
+
+void Parser::parseRequestLine(size_t end)
+{
+	const char* begin = m_data + m_lineStart;
+	const char* last = m_data + end;
+
+	const char* methodEnd = (const char*) memchr(begin, ' ', last - begin);
+	const char* targetEnd = methodEnd ? (const char*) memchr(methodEnd + 1, ' ', last - methodEnd - 1) : nullptr;
+	if(!methodEnd || !targetEnd)
+		throw std::runtime_error("Invalid HTTP header: URL is invalid!");
+
+	if(!isToken(begin, methodEnd))
+		throw std::runtime_error("Invalid HTTP header: Method is invalid!");
+
+	if(!isText(methodEnd + 1, targetEnd) || memchr(methodEnd + 1, '\t', targetEnd - methodEnd - 1))
+		throw std::runtime_error("Invalid HTTP header: URL is invalid!");
+
+	if(!isVersion(targetEnd + 1, last))
+		throw std::runtime_error("Invalid HTTP header: Version is invalid!");
+
+	m_method = {uint32_t(m_lineStart), uint32_t(methodEnd - begin)};
+	m_target = {uint32_t(methodEnd + 1 - m_data), uint32_t(targetEnd - methodEnd - 1)};
+	m_version = {uint32_t(targetEnd + 1 - m_data), uint32_t(last - targetEnd - 1)};
+}
+
+void Parser::parseStatusLine(size_t end)
+{
+	const char* begin = m_data + m_lineStart;
+	const char* last = m_data + end;
+
+	// HTTP/1.1 200 OK
+	if(last - begin < 12 || !isVersion(begin, begin + 8) || begin[8] != ' ' || (last - begin > 12 && begin[12] != ' '))
+		throw std::runtime_error("Invalid HTTP header: Status line is invalid!");
+
+	m_status = 0;
+	for(const char* c = begin + 9; c != begin + 12; c++)
+	{
+		if(*c < '0' || *c > '9')
+			throw std::runtime_error("Invalid HTTP header: Status code is invalid!");
+
+		m_status = m_status * 10 + (*c - '0');
+	}
+
+	const char* reason = std::min(begin + 13, last);
+	if(!isText(reason, last))
+		throw std::runtime_error("Invalid HTTP header: Status line is invalid!");
+
+	m_version = {uint32_t(m_lineStart), 8};
+	m_reason = {uint32_t(reason - m_data), uint32_t(last - reason)};
+}
+
+void Parser::addField()
+{
+	const char* value = m_data + m_valueStart;
+	const char* last = m_data + m_valueEnd;
+
+	while(value != last && (*value == ' ' || *value == '\t'))
+		value++;
+
+	while(last != value && (last[-1] == ' ' || last[-1] == '\t'))
+		last--;
+
+	if(m_fieldCount == MAX_HEADERS)
+		throw std::runtime_error("Invalid HTTP header: Too many fields!");
+
+	Field& field = m_fields[m_fieldCount++];
+	field.name = m_fieldName;
+	field.value = {uint32_t(value - m_data), uint32_t(last - value)};
+	field.id = Headers::lookup(view(field.name));
+
+	m_lineStart = m_position;
+	m_state = State::FieldName;
+
+	if(field.id == HeaderId::ContentLength)
+	{
+		uint64_t length = 0;
+		if(value == last || last - value > 18)
+			throw std::runtime_error("Invalid HTTP header: Content-Length is invalid!");
+
+		for(const char* c = value; c != last; c++)
+		{
+			if(*c < '0' || *c > '9')
+				throw std::runtime_error("Invalid HTTP header: Content-Length is invalid!");
+
+			length = length * 10 + (*c - '0');
+		}
+
+		if(m_hasContentLength && length != m_contentLength)
+			throw std::runtime_error("Invalid HTTP header: Conflicting Content-Length fields!");
+
+		m_contentLength = length;
+		m_hasContentLength = true;
+	}
+	else if(field.id == HeaderId::TransferEncoding)
+	{
+		// Only the last coding decides how the body is framed
+		std::string_view codings = view(field.value);
+		size_t comma = codings.rfind(',');
+		std::string_view coding = (comma == std::string_view::npos ? codings : codings.substr(comma + 1));
+
+		while(!coding.empty() && (coding.front() == ' ' || coding.front() == '\t'))
+			coding.remove_prefix(1);
+
+		m_chunked = Headers::equalsIgnoreCase(coding, "chunked");
+		m_hasTransferEncoding = true;
+	}
+}
+
+std::string_view Parser::getHeader(std::string_view name) const
+{
+	HeaderId id = Headers::lookup(name);
+	for(size_t i = 0; i < m_fieldCount; i++)
+	{
+		if(id != HeaderId::Unknown ? m_fields[i].id == id : Headers::equalsIgnoreCase(view(m_fields[i].name), name))
+			return view(m_fields[i].value);
+	}
+
+	return std::string_view();
+}
@@ -0,0 +1,203 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_PARSER_H
+#define TLHTTP_PARSER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "Body.h"
+#include "Chunked.h"
+#include "Headers.h"
+
+namespace tlhttp
+{
+
+/**
+ * @brief Incrementally parses the header of an HTTP message.
+ *
+ * The parser is fed the whole receive buffer whenever new data arrived and
+ * continues where the last call stopped, so no byte is looked at twice.
+ * It does not copy anything: all accessors return views into the buffer
+ * given to the last parse() call, which stay valid until the buffer is
+ * modified.
+ *
+ * Field names and values are found and validated in the same pass with
+ * the Scanner kernels.
+ */
+class Parser
+{
+public:
+	enum class Result
+	{
+		NeedMore,
+		Done
+	};
+
+	/**
+	 * @brief The longest header accepted, protects against unbounded buffering.
+	 */
+	static constexpr size_t MAX_HEADER_SIZE = 65536;
+	static constexpr size_t MAX_HEADERS = 100;
+
+private:
+	enum class State
+	{
+		StartLine,
+		FieldName,
+		FieldValue,
+		FieldLineEnd,
+		HeaderEnd,
+		Done
+	};
+
+	// Offsets into the buffer, views are created on access since the
+	// buffer may move between calls.
+	struct Span
+	{
+		uint32_t offset = 0, length = 0;
+	};
+
+	struct Field
+	{
+		Span name, value;
+		HeaderId id;
+	};
+
+	const char* m_data = nullptr;
+	State m_state = State::StartLine;
+	bool m_response;
+
+	size_t m_lineStart = 0, m_position = 0;
+
+	// The field whose value is being scanned
+	Span m_fieldName;
+	size_t m_valueStart = 0, m_valueEnd = 0;
+
+	Span m_method, m_target, m_version, m_reason;
+	uint16_t m_status = 0;
+
+	std::array<Field, MAX_HEADERS> m_fields;
+	size_t m_fieldCount = 0;
+
+	uint64_t m_contentLength = 0;
+	bool m_hasContentLength = false, m_chunked = false, m_hasTransferEncoding = false;
+
+	uint64_t m_maxBodySize = UINT64_MAX;
+	bool m_bodyTooLarge = false;
+
+	ChunkedDecoder m_decoder;
+	Body m_body;
+
+	std::string_view view(const Span& span) const { return std::string_view(m_data + span.offset, span.length); }
+
+	void parseStartLine(size_t end);
+	void parseRequestLine(size_t end);
+	void parseStatusLine(size_t end);
+	bool parseFields(size_t size);
+	void addField();
+	void checkFraming() const;
+
+public:
+	/**
+	 * @param response Whether to parse responses instead of requests.
+	 */
+	explicit Parser(bool response = false) : m_response(response) {}
+
+	/**
+	 * @brief Continues parsing the header.
+	 * @param data The start of the receive buffer.
+	 * @param size The number of bytes in the buffer, including the ones seen before.
+	 * @return Result::Done once the header is complete.
+	 * @throws std::runtime_error when the header is malformed or too large.
+	 */
+	Result parse(const char* data, size_t size);
+	Result parse(std::string_view data) { return parse(data.data(), data.size()); }
+
+	/**
+	 * @brief Prepares the parser for the next message, keeping the body limit.
+	 */
+	void reset();
+
+	/**
+	 * @brief Limits the size of message bodies, unlimited by default.
+	 */
+	void setMaxBodySize(uint64_t size) { m_maxBodySize = size; }
+	uint64_t getMaxBodySize() const { return m_maxBodySize; }
+
+	/**
+	 * @brief Checks a body size against the limit.
+	 * @param size The announced or received size of the body.
+	 * @throws std::runtime_error if the size exceeds the limit, isBodyTooLarge() is true afterwards.
+	 */
+	void checkBodySize(uint64_t size);
+
+	/**
+	 * @brief Checks if the message was rejected because of the size of its body.
+	 */
+	bool isBodyTooLarge() const { return m_bodyTooLarge; }
+
+	bool isResponse() const { return m_response; }
+	bool isDone() const { return m_state == State::Done; }
+
+	/**
+	 * @brief Returns the number of bytes in the header including the empty line.
+	 */
+	size_t getHeaderSize() const { return m_position; }
+
+	std::string_view getMethod() const { return view(m_method); }
+	std::string_view getTarget() const { return view(m_target); }
+	std::string_view getVersion() const { return view(m_version); }
+
+	uint16_t getStatus() const { return m_status; }
+	std::string_view getReason() const { return view(m_reason); }
+
+	size_t getHeaderCount() const { return m_fieldCount; }
+	std::string_view getHeaderName(size_t index) const { return view(m_fields[index].name); }
+	std::string_view getHeaderValue(size_t index) const { return view(m_fields[index].value); }
+	HeaderId getHeaderId(size_t index) const { return m_fields[index].id; }
+
+	/**
+	 * @brief Looks up a header field by its case insensitive name.
+	 * @return The value of the first matching field, empty if there is none.
+	 */
+	std::string_view getHeader(std::string_view name) const;
+
+	bool hasContentLength() const { return m_hasContentLength; }
+	uint64_t getContentLength() const { return m_contentLength; }
+
+	/**
+	 * @brief Checks if the body uses the chunked transfer coding.
+	 */
+	bool isChunked() const { return m_chunked; }
+
+	/**
+	 * @brief Returns the decoder state of a chunked body.
+	 */
+	ChunkedDecoder& getDecoder() { return m_decoder; }
+
+	/**
+	 * @brief Returns the part of the body which was received so far.
+	 */
+	Body& getBody() { return m_body; }
+};
+
+}
+
+#endif //TLHTTP_PARSER_H
@@ -0,0 +1,143 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_POOL_H
+#define TLHTTP_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace tlhttp
+{
+
+namespace detail
+{
+/**
+ * @brief Caches freed memory blocks of one size on the current thread.
+ *
+ * Blocks freed on another thread than they were allocated on simply move
+ * to that thread's cache, no locking is involved.
+ */
+template<size_t Size, size_t MaxCached = 1024>
+class FreeList
+{
+	struct Node
+	{
+		Node* next;
+	};
+
+	Node* m_head = nullptr;
+	size_t m_count = 0;
+
+public:
+	/**
+	 * @brief The number of blocks kept per thread, further ones are freed.
+	 */
+	static constexpr size_t MAX_CACHED = MaxCached;
+
+	~FreeList()
+	{
+		while(m_head)
+			::operator delete(std::exchange(m_head, m_head->next));
+	}
+
+	static FreeList& get()
+	{
+		thread_local FreeList list;
+		return list;
+	}
+
+	void* allocate()
+	{
+		if(!m_head)
+			return ::operator new(Size);
+
+		m_count--;
+		return std::exchange(m_head, m_head->next);
+	}
+
+	void deallocate(void* data)
+	{
+		if(m_count == MAX_CACHED)
+		{
+			::operator delete(data);
+			return;
+		}
+
+		m_head = new(data) Node{m_head};
+		m_count++;
+	}
+};
+}
+
+/**
+ * @brief Allocates single objects from per-thread free lists.
+ *
+ * Used with std::allocate_shared the object and its control block share
+ * one block, so a pooled object costs no heap allocation once the pool
+ * is warm.
+ */
+template<typename T>
+class PoolAllocator
+{
+	static constexpr size_t SLOT_SIZE = (sizeof(T) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+	static_assert(alignof(T) <= alignof(std::max_align_t), "Over-aligned types can't be pooled!");
+
+public:
+	typedef T value_type;
+
+	PoolAllocator() = default;
+
+	template<typename U>
+	PoolAllocator(const PoolAllocator<U>&) {}
+
+	T* allocate(size_t count)
+	{
+		if(count != 1)
+			return static_cast<T*>(::operator new(count * sizeof(T)));
+
+		return static_cast<T*>(detail::FreeList<SLOT_SIZE>::get().allocate());
+	}
+
+	void deallocate(T* data, size_t count)
+	{
+		if(count != 1)
+			::operator delete(data);
+		else
+			detail::FreeList<SLOT_SIZE>::get().deallocate(data);
+	}
+
+	template<typename U>
+	bool operator==(const PoolAllocator<U>&) const { return true; }
+
+	template<typename U>
+	bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
+
+/**
+ * @brief Creates an object owned by a std::shared_ptr from the pool.
+ */
+template<typename T, typename... Args>
+std::shared_ptr<T> makePooled(Args&&... args)
+{
+	return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
+
+}
+
+#endif //TLHTTP_POOL_H
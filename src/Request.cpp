@@ -14,87 +14,376 @@
 // You should have received a copy of the GNU Lesser General Public
 // License along with this library.
 
+#include <fcntl.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
 #include "Request.h"
 
 using namespace tlhttp;
 
 Request::Request(const std::string& host, const std::string& url, bool isPost)
-		: m_url(url), m_host(host), m_isPostRequest(isPost)
+		: m_url(url), m_host(host), m_isPostRequest(isPost), m_response(0)
+{
+	m_headers[HeaderId::Host] = host;
+	m_headers[HeaderId::UserAgent] = "TinyLittleHTTP";
+	m_headers[HeaderId::Accept] = "text/html";
+	m_headers[HeaderId::Connection] = "close";
+}
+
+namespace
+{
+struct Status
+{
+	uint16_t code;
+	const char* reason;
+};
+
+constexpr Status STATUS_CODES[] = {
+	{100, "Continue"}, {101, "Switching Protocols"},
+	{200, "OK"}, {201, "Created"}, {202, "Accepted"}, {203, "Non-Authoritative Information"},
+	{204, "No Content"}, {205, "Reset Content"}, {206, "Partial Content"},
+	{300, "Multiple Choices"}, {301, "Moved Permanently"}, {302, "Found"}, {303, "See Other"},
+	{304, "Not Modified"}, {307, "Temporary Redirect"}, {308, "Permanent Redirect"},
+	{400, "Bad Request"}, {401, "Unauthorized"}, {402, "Payment Required"}, {403, "Forbidden"},
+	{404, "Not Found"}, {405, "Method Not Allowed"}, {406, "Not Acceptable"},
+	{407, "Proxy Authentication Required"}, {408, "Request Timeout"}, {409, "Conflict"},
+	{410, "Gone"}, {411, "Length Required"}, {412, "Precondition Failed"},
+	{413, "Content Too Large"}, {414, "URI Too Long"}, {415, "Unsupported Media Type"},
+	{416, "Range Not Satisfiable"}, {417, "Expectation Failed"}, {421, "Misdirected Request"},
+	{422, "Unprocessable Content"}, {426, "Upgrade Required"}, {428, "Precondition Required"},
+	{429, "Too Many Requests"}, {431, "Request Header Fields Too Large"},
+	{500, "Internal Server Error"}, {501, "Not Implemented"}, {502, "Bad Gateway"},
+	{503, "Service Unavailable"}, {504, "Gateway Timeout"}, {505, "HTTP Version Not Supported"}
+};
+
+/**
+ * @brief The complete status lines of all known codes, built once.
+ */
+class StatusLines
+{
+	std::string m_lines[600];
+
+public:
+	StatusLines()
+	{
+		for(const Status& status : STATUS_CODES)
+			m_lines[status.code] = "HTTP/1.1 " + std::to_string(status.code) + " " + status.reason + "\r\n";
+	}
+
+	std::string_view get(uint16_t code) const
+	{
+		return code < 600 ? std::string_view(m_lines[code]) : std::string_view();
+	}
+};
+
+std::string_view getStatusLine(uint16_t code)
+{
+	static const StatusLines lines;
+	return lines.get(code);
+}
+
+/**
+ * @brief Checks if responses with a status may have a body at all.
+ */
+bool statusHasBody(uint16_t code)
 {
-	m_headers["Host"] = host;
-	m_headers["User-Agent"] = "TinyLittleHTTP";
-	m_headers["Accept"] = "text/html";
-	m_headers["Connection"] = "close";
+	return code >= 200 && code != 204 && code != 304;
+}
+}
+
+std::string_view Request::getReason(uint16_t status)
+{
+	for(const Status& known : STATUS_CODES)
+		if(known.code == status)
+			return known.reason;
+
+	return "Unknown";
+}
+
+Segment Request::getDateField()
+{
+	thread_local time_t cachedSecond = -1;
+	thread_local std::shared_ptr<const std::string> cachedField;
+
+	time_t now = time(nullptr);
+	if(now != cachedSecond || !cachedField)
+	{
+		struct tm utc;
+		gmtime_r(&now, &utc);
+
+		char buffer[64];
+		size_t length = strftime(buffer, sizeof(buffer), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &utc);
+
+		// Segments still being written keep the old field alive
+		cachedField = std::make_shared<const std::string>(buffer, length);
+		cachedSecond = now;
+	}
+
+	return Segment::fromShared(cachedField);
+}
+
+void Request::appendHeader(std::string& out, bool startLine) const
+{
+	if(startLine && m_response == 0)
+	{
+		out += (m_isPostRequest ? "POST " : "GET ");
+		out += m_url;
+		out += " HTTP/1.1\r\n";
+	}
+	else if(startLine)
+	{
+		out += "HTTP/1.1 ";
+		out += std::to_string(m_response);
+		out += " ";
+		out += getReason(m_response);
+		out += "\r\n";
+	}
+
+	m_headers.forEach([&out](std::string_view name, std::string_view value) {
+		out += name;
+		out += ": ";
+		out += value;
+		out += "\r\n";
+	});
+}
+
+std::string Request::toHeaderString() const
+{
+	std::string header;
+	appendHeader(header);
+	return header;
 }
 
 std::string Request::toString() const
 {
-	std::stringstream ss;
-	
-	if(m_response == 0)
-		ss << (m_isPostRequest ? "POST " : "GET ") << m_url << " HTTP/1.1" << "\r\n";
+	Segments segments;
+
+	// The segments don't outlive the call, so the body is not copied
+	if(m_body.isSpilled())
+		serialize(segments, {}, false, Segment::fromFile(nullptr, m_body.getFd(), 0, m_body.size()));
 	else
-		ss << "HTTP/1.1 " << m_response << " OK\r\n";
-	
-	for (auto k : m_headers)
+		serialize(segments, {}, false, Segment{{}, m_body.view().data(), m_body.size()});
+
+	return segments.str();
+}
+
+Segment Request::getBodySegment() const&
+{
+	if(!m_body.isSpilled())
+		return Segment::fromString(m_body.str());
+
+	// The segment gets its own descriptor of the spilled body
+	int fd = fcntl(m_body.getFd(), F_DUPFD_CLOEXEC, 0);
+	if(fd < 0)
+		throw std::runtime_error("Could not duplicate body file: " + std::string(strerror(errno)));
+
+	return Segment::fromFile(fd, 0, m_body.size());
+}
+
+Segment Request::getBodySegment() &&
+{
+	// The body is handed over, spilled ones are sent from their file
+	auto body = std::make_shared<Body>(std::move(m_body));
+	if(body->isSpilled())
+		return Segment::fromFile(body, body->getFd(), 0, body->size());
+
+	std::string_view view = body->view();
+	return Segment{body, view.data(), view.size()};
+}
+
+void Request::serialize(Segments& out, std::string_view fields, bool date) const&
+{
+	serialize(out, fields, date, getBodySegment());
+}
+
+void Request::serialize(Segments& out, std::string_view fields, bool date) &&
+{
+	serialize(out, fields, date, std::move(*this).getBodySegment());
+}
+
+void Request::serializeHeader(Segments& out, std::string_view fields, bool date, size_t contentLength) const
+{
+	// Known status lines are referenced instead of being formatted
+	std::string_view statusLine = (m_response ? getStatusLine(m_response) : std::string_view());
+	if(!statusLine.empty())
+		out.append(Segment::fromStatic(statusLine));
+
+	std::string header;
+	header.reserve(256);
+
+	appendHeader(header, statusLine.empty());
+	header += fields;
+
+	if(!isChunked() && (m_isPostRequest || (m_response != 0 && statusHasBody(m_response))))
 	{
-		ss << k.first << ": " << k.second << "\r\n";
+		header += "Content-Length: ";
+		header += std::to_string(contentLength);
+		header += "\r\n";
 	}
 
-	if(m_isPostRequest || m_response != 0)
+	date = date && m_response != 0 && !m_headers.contains(HeaderId::Date);
+	if(!date)
+		header += "\r\n";
+
+	out.append(std::move(header));
+	if(date)
 	{
-		if (!m_body.str().empty())
-		{
-			ss << "Content-Length: " << m_body.str().size() << "\r\n";
-			ss << "\r\n";
-			ss << m_body.str();
-		}
-		else
-			ss << "\r\n";
+		out.append(getDateField());
+		out.append(Segment::fromStatic("\r\n"));
 	}
+}
+
+void Request::serialize(Segments& out, std::string_view fields, bool date, Segment&& body) const
+{
+	serializeHeader(out, fields, date, body.size);
+	if(m_response != 0 && !statusHasBody(m_response))
+		return;
+
+	if(!isChunked())
+	{
+		if(m_isPostRequest || m_response != 0)
+			out.append(std::move(body));
 
-	ss << "\r\n";
-	return ss.str();
+		return;
+	}
+
+	if(body.size)
+	{
+		char size[20];
+		int length = snprintf(size, sizeof(size), "%zx\r\n", body.size);
+		out.append(std::string(size, length));
+		out.append(std::move(body));
+		out.append(Segment::fromStatic("\r\n"));
+	}
+
+	out.append(Segment::fromStatic(ChunkedDecoder::LAST_CHUNK));
+}
+
+bool Request::isChunked() const
+{
+	std::string_view codings = m_headers.get(HeaderId::TransferEncoding);
+	while(!codings.empty() && (codings.back() == ' ' || codings.back() == '\t'))
+		codings.remove_suffix(1);
+
+	return codings.size() >= 7 && Headers::equalsIgnoreCase(codings.substr(codings.size() - 7), "chunked");
 }
 
 Request Request::parse(const std::string& str)
 {
+	// Responses start with the version instead of a method
+	Parser parser(str.compare(0, 5, "HTTP/") == 0);
+	if(parser.parse(str) != Parser::Result::Done)
+		throw std::runtime_error("Given string has no valid HTTP header!");
+
 	Request ret;
+	ret.assign(parser);
+	ret.m_body << std::string_view(str).substr(parser.getHeaderSize());
+	return ret;
+}
 
-	size_t headerEnd = str.find("\r\n\r\n");
-	if(headerEnd == std::string::npos)
-		throw std::runtime_error("Given string has no valid HTTP header!");
+void Request::assign(const Parser& parser)
+{
+	if(parser.isResponse())
+		m_response = parser.getStatus();
+	else
+	{
+		m_method = parser.getMethod();
+		m_url = parser.getTarget();
+	}
 
-	ret.getBody() << str.substr(headerEnd + 4);
+	m_version = parser.getVersion();
 
-	std::string header = str;
-	header.erase(headerEnd);
-	header.erase(std::remove(header.begin(), header.end(), '\r'), header.end());
+	for(size_t i = 0; i < parser.getHeaderCount(); i++)
+		m_headers.add(parser.getHeaderId(i), parser.getHeaderName(i), parser.getHeaderValue(i));
+}
+
+bool Request::extract(std::string& buffer, Request& message, bool response, bool eof)
+{
+	Parser parser(response);
+	return extract(buffer, parser, message, eof);
+}
 
-	std::stringstream ss(header);
-	std::string key, value, version;
+bool Request::extract(std::string& buffer, Parser& parser, Request& message, bool eof)
+{
+	return extractFrom(buffer, parser, message, eof);
+}
+
+bool Request::extract(IoBuffer& buffer, Parser& parser, Request& message, bool eof)
+{
+	return extractFrom(buffer, parser, message, eof);
+}
+
+template<typename Buffer>
+bool Request::extractFrom(Buffer& buffer, Parser& parser, Request& message, bool eof)
+{
+	if(parser.parse(buffer.data(), buffer.size()) != Parser::Result::Done)
+		return false;
 
-	std::getline(ss, version, '\n');
-	
+	// The body is moved out of the buffer as it arrives, so only the
+	// parser's body has to hold it and may spill it to disk.
+	size_t bodyStart = parser.getHeaderSize();
+	Body& body = parser.getBody();
+	bool complete;
+
+	if(parser.isResponse() && !statusHasBody(parser.getStatus()))
+		complete = true;
+	else if(parser.isChunked())
 	{
-		size_t urlstart = version.find(" ");
-		size_t urlend = version.find(" ", urlstart + 1);
-		if(urlstart == std::string::npos || urlend == std::string::npos)
-			throw std::runtime_error("Invalid HTTP header: URL is invalid!");
-		
-		++urlstart;
-		ret.m_url = version.substr(urlstart, urlend - urlstart);
+		ChunkedDecoder& decoder = parser.getDecoder();
+		buffer.erase(bodyStart, decoder.decode(buffer.data() + bodyStart, buffer.size() - bodyStart, body));
+		parser.checkBodySize(body.size());
+
+		complete = decoder.isDone();
+		if(!complete && eof)
+			throw std::runtime_error("Connection closed in the middle of a chunked body!");
 	}
-	while(ss)
+	else if(parser.hasContentLength() || !parser.isResponse())
 	{
-		std::getline(ss, key, ':');
-		std::getline(ss, value, '\n');
+		uint64_t length = parser.getContentLength();
+		parser.checkBodySize(length);
 
-		if(value[0] == ' ')
-			value = value.substr(1);
+		size_t count = std::min<uint64_t>(length - body.size(), buffer.size() - bodyStart);
 
-		ret.m_headers[key] = value;
+		body.append(buffer.data() + bodyStart, count);
+		buffer.erase(bodyStart, count);
+		complete = (body.size() == length);
+	}
+	else
+	{
+		// The body is delimited by the end of the connection
+		body.append(buffer.data() + bodyStart, buffer.size() - bodyStart);
+		buffer.erase(bodyStart, buffer.size() - bodyStart);
+		parser.checkBodySize(body.size());
+		complete = eof;
 	}
 
-	return ret;
+	if(!complete)
+		return false;
+
+	Request result;
+	result.assign(parser);
+	result.m_body = std::move(body);
+
+	buffer.erase(0, bodyStart);
+	parser.reset();
+
+	message = std::move(result);
+	return true;
+}
+
+bool Request::isKeepAlive() const
+{
+	// The field is a list which may carry other options like "Upgrade"
+	std::string_view connection = m_headers.get(HeaderId::Connection);
+	if(Headers::hasToken(connection, "close"))
+		return false;
+
+	if(m_version == "HTTP/1.0")
+		return Headers::hasToken(connection, "keep-alive");
+
+	return true;
 }
@@ -24,21 +24,35 @@
 #include <iostream>
 #include <algorithm>
 
+#include "Body.h"
+#include "Headers.h"
+#include "IoBuffer.h"
+#include "Parser.h"
+#include "Segments.h"
+
 namespace tlhttp
 {
 
 class Request
 {
-	std::unordered_map<std::string, std::string> m_headers;
-	std::stringstream m_body;
+	Headers m_headers;
+	Body m_body;
 	std::string m_url;
 	std::string m_host;
+	std::string m_method;
+	std::string m_version;
 	bool m_isPostRequest;
 	
 	uint16_t m_response;
+
+	void assign(const Parser& parser);
+	void appendHeader(std::string& out, bool startLine = true) const;
+
+	template<typename Buffer>
+	static bool extractFrom(Buffer& buffer, Parser& parser, Request& message, bool eof);
 public:
 
-	Request() {}
+	Request() : m_isPostRequest(false), m_response(0) {}
 	Request(const std::string& host, const std::string& url, bool isPost);
 	
 	/**
@@ -47,6 +61,18 @@ public:
 	 * @return The field.
 	 */
 	std::string& operator[](const std::string& key) { return m_headers[key]; }
+	std::string& operator[](HeaderId id) { return m_headers[id]; }
+
+	/**
+	 * @brief Looks up a field from the header without inserting it.
+	 * @param key The case insensitive field name.
+	 * @return The field, empty if it is not set.
+	 */
+	std::string_view getHeader(std::string_view key) const { return m_headers.get(key); }
+	std::string_view getHeader(HeaderId id) const { return m_headers.get(id); }
+
+	Headers& getHeaders() { return m_headers; }
+	const Headers& getHeaders() const { return m_headers; }
 
 	/**
 	 * @brief Builds a string from the headers.
@@ -54,26 +80,131 @@ public:
 	 * @return The string representation of the HTTP header.
 	 */
 	std::string toString() const;
+
+	/**
+	 * @brief Builds the start line and the fields without the empty line ending the header.
+	 *
+	 * Used to start responses whose body is streamed.
+	 */
+	std::string toHeaderString() const;
+
+	/**
+	 * @brief Checks if the Transfer-Encoding field ends with the chunked coding.
+	 *
+	 * toString() then encodes the body as one chunk instead of adding a
+	 * Content-Length field.
+	 */
+	bool isChunked() const;
+
+	/**
+	 * @brief Serializes the message for a vectored write.
+	 *
+	 * The start line of a response comes from a precomputed table and the
+	 * fields are built as one block, so a message takes only a few segments.
+	 * The body is copied into the segments, a spilled one is referenced
+	 * through a duplicated file descriptor.
+	 *
+	 * @param out Receives the segments.
+	 * @param fields Additional fields, each ending with CRLF.
+	 * @param date Whether to add a Date field unless one is set.
+	 */
+	void serialize(Segments& out, std::string_view fields = {}, bool date = false) const&;
+
+	/**
+	 * @brief Serializes the message and moves the body into the segments.
+	 *
+	 * Bodies kept in memory are referenced in place instead of being copied,
+	 * spilled ones are sent from their file.
+	 */
+	void serialize(Segments& out, std::string_view fields = {}, bool date = false) &&;
+
+	/**
+	 * @brief Serializes the message with a body given as a segment.
+	 *
+	 * The own body is ignored, e.g. to send a region of a file.
+	 */
+	void serialize(Segments& out, std::string_view fields, bool date, Segment&& body) const;
+
+	/**
+	 * @brief Serializes the header only, ending with the empty line.
+	 * @param contentLength The length announced for an unchunked body.
+	 */
+	void serializeHeader(Segments& out, std::string_view fields, bool date, size_t contentLength) const;
+
+	/**
+	 * @brief Returns the reason phrase of a status code.
+	 */
+	static std::string_view getReason(uint16_t status);
+
+	/**
+	 * @brief Returns a Date field for the current second.
+	 *
+	 * The field is formatted at most once per second on every thread.
+	 */
+	static Segment getDateField();
 	
 	/**
-	 * @brief Returns the stream of the request body.
-	 * @return The read-only request body stream
+	 * @brief Returns the request body.
+	 * @return The read-only request body
 	 */
-	const std::stringstream& getBody() const { return m_body; }
+	const Body& getBody() const { return m_body; }
 	
 	/**
-	 * @brief Returns the stream of the request body.
-	 * @return The write enabled request body stream
+	 * @brief Returns the request body.
+	 * @return The write enabled request body
+	 */
+	Body& getBody() { return m_body; }
+
+	/**
+	 * @brief Returns the body for a vectored write.
+	 *
+	 * A body kept in memory is copied, a spilled one is referenced through
+	 * a duplicated file descriptor.
+	 *
+	 * @throws std::runtime_error if the descriptor can not be duplicated.
+	 */
+	Segment getBodySegment() const&;
+
+	/**
+	 * @brief Moves the body into a segment without copying it.
 	 */
-	std::stringstream& getBody() { return m_body; }
+	Segment getBodySegment() &&;
 
 	/**
 	 * @brief Returns the request URL without the host.
 	 * @return The URL.
 	 */
-	std::string getUrl() { return m_url; }
+	const std::string& getUrl() const { return m_url; }
+	void setUrl(const std::string& url) { m_url = url; }
+
+	/**
+	 * @brief Returns the method of a parsed request, e.g. "GET".
+	 */
+	const std::string& getMethod() const { return m_method; }
+	void setMethod(const std::string& method) { m_method = method; }
+
+	/**
+	 * @brief Returns the protocol version of a parsed request, e.g. "HTTP/1.1".
+	 *
+	 * Requests received over HTTP/2 have the version "HTTP/2".
+	 */
+	const std::string& getVersion() const { return m_version; }
+	void setVersion(const std::string& version) { m_version = version; }
+
+	/**
+	 * @brief Checks if the sender wants to keep the connection open.
+	 *
+	 * HTTP/1.1 connections are persistent unless "Connection: close" is given,
+	 * HTTP/1.0 ones only with "Connection: keep-alive".
+	 */
+	bool isKeepAlive() const;
 
 	void setResponse(uint16_t v) { m_response = v; }
+
+	/**
+	 * @brief Returns the status code of a response, 0 for requests.
+	 */
+	uint16_t getResponse() const { return m_response; }
 	
 	/**
 	 * @brief Parses an HTTP request and builds an object out of it.
@@ -81,6 +212,37 @@ public:
 	 * @return The constructed Request.
 	 */
 	static Request parse(const std::string& str);
+
+	/**
+	 * @brief Takes one complete message off the front of a buffer.
+	 *
+	 * The body is framed by Content-Length. Responses without one end
+	 * when the connection is closed.
+	 *
+	 * @param buffer The received data, the message is removed from it.
+	 * @param message Receives the parsed message.
+	 * @param response Whether the buffer contains responses instead of requests.
+	 * @param eof Whether the connection was closed.
+	 * @return false if the buffer does not contain a complete message yet.
+	 * @throws std::runtime_error when the header can not be parsed.
+	 */
+	static bool extract(std::string& buffer, Request& message, bool response = false, bool eof = false);
+
+	/**
+	 * @brief Takes one complete message off the front of a buffer.
+	 *
+	 * Continues where the last call with the same parser stopped, so the
+	 * header is only scanned once no matter how it is split up.
+	 *
+	 * @param buffer The received data, the message is removed from it.
+	 * @param parser The parser state of the buffer, reset once a message was taken.
+	 * @param message Receives the parsed message.
+	 * @param eof Whether the connection was closed.
+	 * @return false if the buffer does not contain a complete message yet.
+	 * @throws std::runtime_error when the header can not be parsed.
+	 */
+	static bool extract(std::string& buffer, Parser& parser, Request& message, bool eof = false);
+	static bool extract(IoBuffer& buffer, Parser& parser, Request& message, bool eof = false);
 };
 
 /**
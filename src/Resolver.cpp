@@ -0,0 +1,363 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+
+#include <condition_variable>
+#include <cstring>
+#include <stdexcept>
+
+#include "Resolver.h"
+
+using namespace tlhttp;
+
+uint16_t Address::getPort() const
+{
+	if(getFamily() == AF_INET)
+		return ntohs(reinterpret_cast<const struct sockaddr_in*>(&storage)->sin_port);
+
+	if(getFamily() == AF_INET6)
+		return ntohs(reinterpret_cast<const struct sockaddr_in6*>(&storage)->sin6_port);
+
+	return 0;
+}
+
+void Address::setPort(uint16_t port)
+{
+	if(getFamily() == AF_INET)
+		reinterpret_cast<struct sockaddr_in*>(&storage)->sin_port = htons(port);
+	else if(getFamily() == AF_INET6)
+		reinterpret_cast<struct sockaddr_in6*>(&storage)->sin6_port = htons(port);
+}
+
+std::string Address::toString() const
+{
+	char buffer[INET6_ADDRSTRLEN] = {0};
+	if(getFamily() == AF_INET)
+		inet_ntop(AF_INET, &reinterpret_cast<const struct sockaddr_in*>(&storage)->sin_addr, buffer, sizeof(buffer));
+	else if(getFamily() == AF_INET6)
+		inet_ntop(AF_INET6, &reinterpret_cast<const struct sockaddr_in6*>(&storage)->sin6_addr, buffer, sizeof(buffer));
+
+	return buffer;
+}
+
+namespace
+{
+/**
+ * @brief Checks if a failed lookup is an answer rather than a transient error.
+ */
+bool isDefinite(int error)
+{
+#ifdef EAI_NODATA
+	if(error == EAI_NODATA)
+		return true;
+#endif
+	return error == EAI_NONAME;
+}
+
+std::runtime_error resolveError(const std::string& host, int error)
+{
+	return std::runtime_error("Could not resolve " + host + ": " + gai_strerror(error));
+}
+
+/**
+ * @brief Suspends a coroutine until a lookup is done and resumes it on the loop thread.
+ */
+struct LookupAwaiter
+{
+	Resolver& resolver;
+	EventLoop& loop;
+	const std::string& host;
+	uint16_t port;
+
+	Addresses& addresses;
+	int& error;
+
+	bool await_ready() noexcept { return false; }
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		resolver.resolve(host, port, [this, handle](Addresses&& result, int code) {
+			addresses = std::move(result);
+			error = code;
+			loop.post([handle]() { handle.resume(); });
+		});
+	}
+
+	void await_resume() noexcept {}
+};
+}
+
+Resolver::Resolver(unsigned int threads, const Lookup& lookup)
+	: m_lookup(lookup), m_executor(threads ? threads : 1)
+{
+}
+
+Resolver& Resolver::getDefault()
+{
+	static Resolver resolver;
+	return resolver;
+}
+
+int Resolver::systemLookup(const std::string& host, Addresses& addresses, std::chrono::milliseconds&)
+{
+	// getaddrinfo() does not report the time to live, the default is kept
+	struct addrinfo hints, *result;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	int error = getaddrinfo(host.c_str(), nullptr, &hints, &result);
+	if(error)
+		return error;
+
+	for(struct addrinfo* info = result; info; info = info->ai_next)
+	{
+		if(info->ai_addrlen > sizeof(Address::storage))
+			continue;
+
+		Address address;
+		memcpy(&address.storage, info->ai_addr, info->ai_addrlen);
+		address.length = info->ai_addrlen;
+		addresses.push_back(address);
+	}
+
+	freeaddrinfo(result);
+	return 0;
+}
+
+bool Resolver::parseNumeric(const std::string& host, uint16_t port, Address& address)
+{
+	address = Address();
+
+	auto* v4 = reinterpret_cast<struct sockaddr_in*>(&address.storage);
+	if(inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1)
+	{
+		v4->sin_family = AF_INET;
+		v4->sin_port = htons(port);
+		address.length = sizeof(struct sockaddr_in);
+		return true;
+	}
+
+	auto* v6 = reinterpret_cast<struct sockaddr_in6*>(&address.storage);
+	if(inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1)
+	{
+		v6->sin6_family = AF_INET6;
+		v6->sin6_port = htons(port);
+		address.length = sizeof(struct sockaddr_in6);
+		return true;
+	}
+
+	return false;
+}
+
+Addresses Resolver::interleave(const Addresses& addresses)
+{
+	if(addresses.empty())
+		return addresses;
+
+	Addresses first, second;
+	for(const Address& address : addresses)
+		(address.getFamily() == addresses[0].getFamily() ? first : second).push_back(address);
+
+	Addresses result;
+	result.reserve(addresses.size());
+	for(size_t i = 0; i < first.size() || i < second.size(); i++)
+	{
+		if(i < first.size())
+			result.push_back(first[i]);
+
+		if(i < second.size())
+			result.push_back(second[i]);
+	}
+
+	return result;
+}
+
+bool Resolver::find(const std::string& host, uint16_t port, Addresses& addresses, int& error)
+{
+	auto entry = m_cache.find(host);
+	if(entry == m_cache.end())
+		return false;
+
+	if(entry->second.expires <= Clock::now())
+	{
+		m_cache.erase(entry);
+		return false;
+	}
+
+	addresses = entry->second.addresses;
+	for(Address& address : addresses)
+		address.setPort(port);
+
+	error = entry->second.error;
+	return true;
+}
+
+void Resolver::finish(const std::string& host, Entry&& entry)
+{
+	std::vector<std::pair<uint16_t, Callback>> waiters;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if(m_cache.size() >= m_maxEntries)
+		{
+			auto now = Clock::now();
+			for(auto iter = m_cache.begin(); iter != m_cache.end();)
+				iter = (iter->second.expires <= now ? m_cache.erase(iter) : std::next(iter));
+
+			if(m_cache.size() >= m_maxEntries)
+				m_cache.erase(m_cache.begin());
+		}
+
+		if(entry.error == 0 || isDefinite(entry.error))
+			m_cache[host] = entry;
+
+		auto inflight = m_inflight.find(host);
+		waiters.swap(inflight->second);
+		m_inflight.erase(inflight);
+	}
+
+	for(auto& waiter : waiters)
+	{
+		Addresses addresses = entry.addresses;
+		for(Address& address : addresses)
+			address.setPort(waiter.first);
+
+		waiter.second(std::move(addresses), entry.error);
+	}
+}
+
+void Resolver::resolve(const std::string& host, uint16_t port, const Callback& callback)
+{
+	Addresses addresses(1);
+	if(parseNumeric(host, port, addresses[0]))
+	{
+		callback(std::move(addresses), 0);
+		return;
+	}
+
+	std::chrono::milliseconds ttl, negativeTtl;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		int error = 0;
+		if(find(host, port, addresses, error))
+		{
+			lock.unlock();
+			callback(std::move(addresses), error);
+			return;
+		}
+
+		// Only the first one asking for a name starts the lookup
+		auto& waiters = m_inflight[host];
+		waiters.emplace_back(port, callback);
+		if(waiters.size() > 1)
+			return;
+
+		ttl = m_ttl;
+		negativeTtl = m_negativeTtl;
+	}
+
+	m_executor.submit([this, host, ttl, negativeTtl]() {
+		Entry entry;
+		std::chrono::milliseconds recordTtl = ttl;
+
+		entry.error = m_lookup(host, entry.addresses, recordTtl);
+		if(entry.error == 0 && entry.addresses.empty())
+			entry.error = EAI_NONAME;
+
+		entry.expires = Clock::now() + (entry.error ? negativeTtl : std::min(recordTtl, ttl));
+		finish(host, std::move(entry));
+	});
+}
+
+Addresses Resolver::resolve(const std::string& host, uint16_t port)
+{
+	std::mutex mutex;
+	std::condition_variable done;
+	bool finished = false;
+
+	Addresses result;
+	int error = 0;
+
+	resolve(host, port, [&](Addresses&& addresses, int code) {
+		std::lock_guard<std::mutex> lock(mutex);
+		result = std::move(addresses);
+		error = code;
+		finished = true;
+		done.notify_one();
+	});
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while(!done.wait_for(lock, std::chrono::milliseconds(100), [&finished]() { return finished; }));
+	}
+
+	if(error)
+		throw resolveError(host, error);
+
+	return result;
+}
+
+Task<Addresses> Resolver::asyncResolve(EventLoop& loop, const std::string& host, uint16_t port)
+{
+	Addresses addresses(1);
+	if(parseNumeric(host, port, addresses[0]))
+		co_return addresses;
+
+	int error = 0;
+	bool cached;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		cached = find(host, port, addresses, error);
+	}
+
+	// Cache hits don't take a round through the loop
+	if(!cached)
+		co_await LookupAwaiter{*this, loop, host, port, addresses, error};
+
+	if(error)
+		throw resolveError(host, error);
+
+	co_return addresses;
+}
+
+void Resolver::setTtl(std::chrono::milliseconds ttl)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_ttl = ttl;
+}
+
+void Resolver::setNegativeTtl(std::chrono::milliseconds ttl)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_negativeTtl = ttl;
+}
+
+void Resolver::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_cache.clear();
+}
+
+size_t Resolver::getCacheSize() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_cache.size();
+}
@@ -0,0 +1,200 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_RESOLVER_H
+#define TLHTTP_RESOLVER_H
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "EventLoop.h"
+#include "Executor.h"
+#include "Task.h"
+
+namespace tlhttp
+{
+
+/**
+ * @brief A socket address of any family.
+ */
+struct Address
+{
+	struct sockaddr_storage storage = {};
+	socklen_t length = 0;
+
+	int getFamily() const { return storage.ss_family; }
+	const struct sockaddr* get() const { return reinterpret_cast<const struct sockaddr*>(&storage); }
+
+	uint16_t getPort() const;
+	void setPort(uint16_t port);
+
+	/**
+	 * @brief Formats the address without the port, e.g. for error messages.
+	 */
+	std::string toString() const;
+};
+
+typedef std::vector<Address> Addresses;
+
+/**
+ * @brief Resolves host names with an in-process cache.
+ *
+ * Lookups run on a small thread pool, so neither event loops nor callers of
+ * the asynchronous methods block on the system resolver. Concurrent lookups
+ * of the same name share one query. Results, failures included, are cached
+ * per host name until their time to live ends, numeric addresses are parsed
+ * without a lookup.
+ *
+ * All addresses are returned in the order of the lookup, which is the order
+ * of RFC 6724 for the system resolver.
+ */
+class Resolver
+{
+public:
+	/**
+	 * @brief Looks up all addresses of a host name.
+	 * @param host The host name.
+	 * @param addresses Receives the addresses, the ports are ignored.
+	 * @param ttl The time the result may be cached, preset to the default.
+	 * @return 0 on success, an EAI_* error code otherwise.
+	 * @note Called on the resolver's threads.
+	 */
+	typedef std::function<int(const std::string& host, Addresses& addresses, std::chrono::milliseconds& ttl)> Lookup;
+
+	/**
+	 * @brief Receives the result of resolve().
+	 * @param addresses The addresses with the requested port.
+	 * @param error 0 on success, an EAI_* error code otherwise.
+	 */
+	typedef std::function<void(Addresses&& addresses, int error)> Callback;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Entry
+	{
+		Addresses addresses;
+		int error = 0;
+		Clock::time_point expires;
+	};
+
+	Lookup m_lookup;
+	std::chrono::milliseconds m_ttl{60000}, m_negativeTtl{5000};
+	size_t m_maxEntries = 4096;
+
+	mutable std::mutex m_mutex;
+	std::unordered_map<std::string, Entry> m_cache;
+	std::unordered_map<std::string, std::vector<std::pair<uint16_t, Callback>>> m_inflight;
+
+	// Declared last so the workers are joined before anything else goes away
+	WorkStealingExecutor m_executor;
+
+	/**
+	 * @brief Looks up an unexpired cache entry, m_mutex has to be held.
+	 */
+	bool find(const std::string& host, uint16_t port, Addresses& addresses, int& error);
+
+	/**
+	 * @brief Caches the result of a lookup and passes it to the waiting callbacks.
+	 */
+	void finish(const std::string& host, Entry&& entry);
+
+public:
+	/**
+	 * @param threads The number of lookups which may run at the same time.
+	 * @param lookup The function doing the actual lookups, e.g. a stub for tests.
+	 */
+	explicit Resolver(unsigned int threads = 2, const Lookup& lookup = systemLookup);
+
+	Resolver(const Resolver&) = delete;
+	Resolver& operator=(const Resolver&) = delete;
+
+	/**
+	 * @brief Returns the resolver used by connections.
+	 */
+	static Resolver& getDefault();
+
+	/**
+	 * @brief Looks up host names with getaddrinfo().
+	 */
+	static int systemLookup(const std::string& host, Addresses& addresses, std::chrono::milliseconds& ttl);
+
+	/**
+	 * @brief Parses a numeric IPv4 or IPv6 address.
+	 * @return false if the host is a name.
+	 */
+	static bool parseNumeric(const std::string& host, uint16_t port, Address& address);
+
+	/**
+	 * @brief Orders addresses for connection racing as in RFC 8305.
+	 *
+	 * The families alternate, starting with the family of the first
+	 * address. The order within each family is kept.
+	 */
+	static Addresses interleave(const Addresses& addresses);
+
+	/**
+	 * @brief Resolves a host, blocking until the lookup is done.
+	 * @return All addresses of the host with the given port.
+	 * @throws std::runtime_error if the host can not be resolved.
+	 */
+	Addresses resolve(const std::string& host, uint16_t port);
+
+	/**
+	 * @brief Resolves a host without blocking.
+	 *
+	 * The callback runs immediately for cached and numeric hosts, on a
+	 * resolver thread otherwise.
+	 */
+	void resolve(const std::string& host, uint16_t port, const Callback& callback);
+
+	/**
+	 * @brief Resolves a host and resumes the awaiting coroutine on the loop thread.
+	 * @throws std::runtime_error if the host can not be resolved.
+	 */
+	Task<Addresses> asyncResolve(EventLoop& loop, const std::string& host, uint16_t port);
+
+	/**
+	 * @brief Sets how long successful lookups are cached at most.
+	 *
+	 * Lookups reporting a shorter time to live are cached for that long.
+	 */
+	void setTtl(std::chrono::milliseconds ttl);
+
+	/**
+	 * @brief Sets how long failed lookups are cached.
+	 */
+	void setNegativeTtl(std::chrono::milliseconds ttl);
+
+	/**
+	 * @brief Removes all cached results.
+	 */
+	void clear();
+
+	size_t getCacheSize() const;
+};
+
+}
+
+#endif //TLHTTP_RESOLVER_H
@@ -0,0 +1,326 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+
+#include "ResponseCache.h"
+
+using namespace tlhttp;
+
+namespace
+{
+bool startsWithIgnoreCase(std::string_view str, std::string_view prefix)
+{
+	return str.size() >= prefix.size() && Headers::equalsIgnoreCase(str.substr(0, prefix.size()), prefix);
+}
+
+/**
+ * @brief Finds out how long a response may be cached.
+ * @return The lifetime in seconds, -1 if the response must not be stored.
+ */
+long getLifetime(const Request& response)
+{
+	// Only statuses which are cacheable by default
+	switch(response.getResponse())
+	{
+		case 200: case 203: case 300: case 301: case 308:
+		case 404: case 405: case 410: case 414: case 501:
+			break;
+
+		default:
+			return -1;
+	}
+
+	if(response.getHeaders().contains(HeaderId::SetCookie) || response.isChunked())
+		return -1;
+
+	long maxAge = -1, sharedMaxAge = -1;
+	bool forbidden = false;
+
+	Headers::forEachToken(response.getHeader(HeaderId::CacheControl), [&](std::string_view directive) {
+		if(Headers::equalsIgnoreCase(directive, "no-store") || Headers::equalsIgnoreCase(directive, "no-cache")
+				|| Headers::equalsIgnoreCase(directive, "private"))
+			forbidden = true;
+		else if(startsWithIgnoreCase(directive, "max-age="))
+			maxAge = strtol(std::string(directive.substr(8)).c_str(), nullptr, 10);
+		else if(startsWithIgnoreCase(directive, "s-maxage="))
+			sharedMaxAge = strtol(std::string(directive.substr(9)).c_str(), nullptr, 10);
+	});
+
+	if(forbidden)
+		return -1;
+
+	long lifetime = (sharedMaxAge >= 0 ? sharedMaxAge : maxAge);
+	return lifetime > 0 ? lifetime : -1;
+}
+
+/**
+ * @brief Checks if a request asks to bypass shared caches.
+ */
+bool bypassesCache(const Request& request)
+{
+	// Responses to authorized requests must not be shared
+	if(request.getHeaders().contains(HeaderId::Authorization))
+		return true;
+
+	bool bypass = false;
+	Headers::forEachToken(request.getHeader(HeaderId::CacheControl), [&bypass](std::string_view directive) {
+		if(Headers::equalsIgnoreCase(directive, "no-cache") || Headers::equalsIgnoreCase(directive, "no-store"))
+			bypass = true;
+	});
+
+	return bypass || Headers::equalsIgnoreCase(request.getHeader(HeaderId::Pragma), "no-cache");
+}
+
+std::string makeKey(const Request& request)
+{
+	std::string_view host = request.getHeader(HeaderId::Host);
+	const std::string& url = request.getUrl();
+
+	std::string key;
+	key.reserve(host.size() + url.size() + 1);
+	key.append(host);
+	key += ' ';
+	key.append(url);
+	return key;
+}
+}
+
+ResponseCache::ResponseCache(const Server::AsyncHandler& handler, size_t budget, size_t shards)
+	: m_handler(handler), m_shardBudget(budget / std::max<size_t>(shards, 1)), m_shards(std::max<size_t>(shards, 1)) {}
+
+ResponseCache::Shard& ResponseCache::getShard(const std::string& key)
+{
+	return m_shards[std::hash<std::string>()(key) % m_shards.size()];
+}
+
+std::shared_ptr<const ResponseCache::Entry> ResponseCache::lookup(const std::string& key, const Request& request)
+{
+	Shard& shard = getShard(key);
+	std::shared_lock<std::shared_mutex> lock(shard.mutex);
+
+	auto iter = shard.entries.find(key);
+	if(iter == shard.entries.end())
+		return nullptr;
+
+	Clock::time_point now = Clock::now();
+	for(const auto& entry : iter->second)
+	{
+		if(entry->expires <= now)
+			continue;
+
+		bool matches = std::all_of(entry->vary.begin(), entry->vary.end(), [&request](const auto& field) {
+			return request.getHeader(field.first) == field.second;
+		});
+
+		if(matches)
+		{
+			// Only a flag is set, so hits never need the exclusive lock
+			entry->referenced.store(true, std::memory_order_relaxed);
+			return entry;
+		}
+	}
+
+	return nullptr;
+}
+
+void ResponseCache::store(const std::string& key, const Request& request, const Request& response)
+{
+	long lifetime = getLifetime(response);
+	if(lifetime < 0)
+		return;
+
+	// Bodies which can never fit are not read, they may be spilled to disk
+	if(response.getBody().size() + key.size() > m_shardBudget)
+		return;
+
+	auto entry = std::make_shared<Entry>();
+	entry->key = key;
+
+	bool varies = true;
+	Headers::forEachToken(response.getHeader(HeaderId::Vary), [&](std::string_view name) {
+		if(name == "*")
+			varies = false;
+
+		entry->vary.emplace_back(std::string(name), std::string(request.getHeader(name)));
+	});
+
+	if(!varies)
+		return;
+
+	// Fields which differ per connection or per send are added by the responder
+	uint16_t status = response.getResponse();
+	std::string& data = entry->data;
+	data = "HTTP/1.1 " + std::to_string(status) + " " + std::string(Request::getReason(status)) + "\r\n";
+
+	response.getHeaders().forEach([&data](std::string_view name, std::string_view value) {
+		HeaderId id = Headers::lookup(name);
+		if(id == HeaderId::Date || id == HeaderId::Connection || id == HeaderId::Age || id == HeaderId::ContentLength)
+			return;
+
+		data.append(name);
+		data += ": ";
+		data.append(value);
+		data += "\r\n";
+	});
+
+	data += "Content-Length: " + std::to_string(response.getBody().size()) + "\r\n";
+	entry->headerSize = data.size();
+	data += response.getBody().str();
+
+	entry->stored = Clock::now();
+	entry->expires = entry->stored + std::chrono::seconds(lifetime);
+
+	size_t cost = data.size() + key.size();
+	if(cost > m_shardBudget)
+		return;
+
+	Shard& shard = getShard(key);
+	std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+	// A stored variant with the same field values is replaced
+	auto& variants = shard.entries[key];
+	for(auto iter = variants.begin(); iter != variants.end(); ++iter)
+	{
+		if((*iter)->vary == entry->vary)
+		{
+			shard.bytes -= (*iter)->data.size() + key.size();
+			shard.clock.erase(std::find(shard.clock.begin(), shard.clock.end(), *iter));
+			variants.erase(iter);
+			break;
+		}
+	}
+
+	evict(shard, cost);
+	shard.entries[key].push_back(entry);
+	shard.clock.push_back(entry);
+	shard.bytes += cost;
+}
+
+void ResponseCache::remove(Shard& shard, const std::string& key)
+{
+	auto iter = shard.entries.find(key);
+	if(iter == shard.entries.end())
+		return;
+
+	for(const auto& entry : iter->second)
+	{
+		shard.bytes -= entry->data.size() + key.size();
+		shard.clock.erase(std::find(shard.clock.begin(), shard.clock.end(), entry));
+	}
+
+	shard.entries.erase(iter);
+	shard.hand = 0;
+}
+
+void ResponseCache::evict(Shard& shard, size_t needed)
+{
+	Clock::time_point now = Clock::now();
+	while(!shard.clock.empty() && shard.bytes + needed > m_shardBudget)
+	{
+		if(shard.hand >= shard.clock.size())
+			shard.hand = 0;
+
+		// Entries used since the hand passed them get another round
+		std::shared_ptr<const Entry> entry = shard.clock[shard.hand];
+		if(entry->expires > now && entry->referenced.exchange(false, std::memory_order_relaxed))
+		{
+			shard.hand++;
+			continue;
+		}
+
+		auto& variants = shard.entries[entry->key];
+		variants.erase(std::find(variants.begin(), variants.end(), entry));
+		if(variants.empty())
+			shard.entries.erase(entry->key);
+
+		shard.bytes -= entry->data.size() + entry->key.size();
+		shard.clock[shard.hand] = std::move(shard.clock.back());
+		shard.clock.pop_back();
+	}
+}
+
+void ResponseCache::operator()(const std::shared_ptr<Request>& request, const Responder& responder)
+{
+	const std::string& method = request->getMethod();
+	if(method != "GET" && method != "HEAD")
+	{
+		// Unsafe methods invalidate what is cached for their URL
+		if(method != "OPTIONS" && method != "TRACE")
+		{
+			std::string key = makeKey(*request);
+			Shard& shard = getShard(key);
+			std::unique_lock<std::shared_mutex> lock(shard.mutex);
+			remove(shard, key);
+		}
+
+		m_handler(request, responder);
+		return;
+	}
+
+	if(bypassesCache(*request))
+	{
+		m_handler(request, responder);
+		return;
+	}
+
+	std::string key = makeKey(*request);
+	if(auto entry = lookup(key, *request))
+	{
+		auto age = std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - entry->stored).count();
+		responder.sendSerialized(Segment{entry, entry->data.data(), entry->headerSize},
+				"Age: " + std::to_string(age) + "\r\n",
+				Segment{entry, entry->data.data() + entry->headerSize, entry->data.size() - entry->headerSize});
+		return;
+	}
+
+	// HEAD responses have no body which could be stored
+	if(method == "HEAD")
+	{
+		m_handler(request, responder);
+		return;
+	}
+
+	m_handler(request, responder.observe([this, key, request](const Request& response) {
+		store(key, *request, response);
+	}));
+}
+
+void ResponseCache::clear()
+{
+	for(Shard& shard : m_shards)
+	{
+		std::unique_lock<std::shared_mutex> lock(shard.mutex);
+		shard.entries.clear();
+		shard.clock.clear();
+		shard.hand = 0;
+		shard.bytes = 0;
+	}
+}
+
+size_t ResponseCache::getBytes() const
+{
+	size_t bytes = 0;
+	for(const Shard& shard : m_shards)
+	{
+		std::shared_lock<std::shared_mutex> lock(shard.mutex);
+		bytes += shard.bytes;
+	}
+
+	return bytes;
+}
@@ -0,0 +1,107 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_RESPONSECACHE_H
+#define TLHTTP_RESPONSECACHE_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Server.h"
+
+namespace tlhttp
+{
+
+/**
+ * @brief Caches responses in front of a request handler.
+ *
+ * GET responses which allow it with Cache-Control max-age or s-maxage are
+ * kept in serialized form, so a hit sends them without running the
+ * handler or serializing again. Responses with Vary are stored per variant
+ * of the named request fields. Other methods invalidate the cached
+ * response of their URL.
+ *
+ * The cache is split into shards which are locked separately, lookups only
+ * take a shared lock. Every shard evicts with the CLOCK algorithm once it
+ * exceeds its part of the byte budget.
+ *
+ * Can be passed to Server::startAsync() with std::ref().
+ */
+class ResponseCache
+{
+	typedef std::chrono::steady_clock Clock;
+
+	struct Entry
+	{
+		std::string key;
+		std::vector<std::pair<std::string, std::string>> vary; ///< The request fields the response depends on
+		std::string data; ///< The serialized response
+		size_t headerSize;
+		Clock::time_point stored, expires;
+		mutable std::atomic<bool> referenced{true};
+	};
+
+	struct Shard
+	{
+		mutable std::shared_mutex mutex;
+		std::unordered_map<std::string, std::vector<std::shared_ptr<const Entry>>> entries;
+		std::vector<std::shared_ptr<const Entry>> clock;
+		size_t hand = 0, bytes = 0;
+	};
+
+	Server::AsyncHandler m_handler;
+	size_t m_shardBudget;
+	std::vector<Shard> m_shards;
+
+	Shard& getShard(const std::string& key);
+	std::shared_ptr<const Entry> lookup(const std::string& key, const Request& request);
+	void store(const std::string& key, const Request& request, const Request& response);
+	void remove(Shard& shard, const std::string& key);
+	void evict(Shard& shard, size_t needed);
+
+public:
+	/**
+	 * @param handler The handler producing the responses.
+	 * @param budget The maximum number of bytes of all cached responses.
+	 * @param shards The number of independently locked parts.
+	 */
+	ResponseCache(const Server::AsyncHandler& handler, size_t budget = 64 * 1024 * 1024, size_t shards = 16);
+
+	ResponseCache(const ResponseCache&) = delete;
+	ResponseCache& operator=(const ResponseCache&) = delete;
+
+	void operator()(const std::shared_ptr<Request>& request, const Responder& responder);
+
+	/**
+	 * @brief Removes all responses.
+	 */
+	void clear();
+
+	/**
+	 * @brief Returns the number of bytes of all cached responses.
+	 */
+	size_t getBytes() const;
+};
+
+}
+
+#endif //TLHTTP_RESPONSECACHE_H
@@ -0,0 +1,270 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <stdexcept>
+
+#include "Router.h"
+
+using namespace tlhttp;
+
+namespace
+{
+std::string_view stripQuery(std::string_view target)
+{
+	return target.substr(0, target.find_first_of("?#"));
+}
+}
+
+std::string_view Router::Params::get(std::string_view name) const
+{
+	for(size_t i = 0; i < m_count; i++)
+	{
+		if((*m_names)[i] == name)
+			return m_values[i];
+	}
+
+	return std::string_view();
+}
+
+uint32_t Router::insertStatic(uint32_t node, std::string_view text)
+{
+	while(!text.empty())
+	{
+		size_t position = m_nodes[node].firstChars.find(text[0]);
+		if(position == std::string::npos)
+		{
+			uint32_t child = m_nodes.size();
+			m_nodes.emplace_back();
+			m_nodes[child].label = text;
+			m_nodes[node].firstChars += text[0];
+			m_nodes[node].children.push_back(child);
+			return child;
+		}
+
+		uint32_t child = m_nodes[node].children[position];
+		const std::string& label = m_nodes[child].label;
+
+		size_t common = 0;
+		while(common < label.size() && common < text.size() && label[common] == text[common])
+			common++;
+
+		if(common < label.size())
+		{
+			// Splits the edge where the new text diverges
+			uint32_t middle = m_nodes.size();
+			m_nodes.emplace_back();
+			m_nodes[middle].label = m_nodes[child].label.substr(0, common);
+			m_nodes[child].label.erase(0, common);
+			m_nodes[middle].firstChars = m_nodes[child].label.substr(0, 1);
+			m_nodes[middle].children.push_back(child);
+			m_nodes[node].children[position] = middle;
+			child = middle;
+		}
+
+		node = child;
+		text.remove_prefix(common);
+	}
+
+	return node;
+}
+
+void Router::add(std::string_view method, std::string_view pattern, const Handler& handler)
+{
+	if(pattern.empty() || pattern[0] != '/')
+		throw std::runtime_error("Route pattern must start with '/': " + std::string(pattern));
+
+	std::vector<std::string> names;
+	std::string_view rest = pattern;
+	uint32_t node = 0;
+
+	while(!rest.empty())
+	{
+		if(rest[0] == ':')
+		{
+			size_t end = rest.find('/');
+			std::string_view name = rest.substr(1, end == std::string_view::npos ? end : end - 1);
+			if(name.empty())
+				throw std::runtime_error("Route parameter without a name: " + std::string(pattern));
+
+			names.emplace_back(name);
+			if(m_nodes[node].param == NONE)
+			{
+				m_nodes[node].param = m_nodes.size();
+				m_nodes.emplace_back();
+			}
+
+			node = m_nodes[node].param;
+			rest.remove_prefix(name.size() + 1);
+		}
+		else if(rest[0] == '*')
+		{
+			names.emplace_back(rest.substr(1));
+			if(m_nodes[node].wildcard == NONE)
+			{
+				m_nodes[node].wildcard = m_nodes.size();
+				m_nodes.emplace_back();
+			}
+
+			node = m_nodes[node].wildcard;
+			break;
+		}
+		else
+		{
+			size_t end = rest.find_first_of(":*");
+			node = insertStatic(node, rest.substr(0, end));
+			rest.remove_prefix(end == std::string_view::npos ? rest.size() : end);
+		}
+	}
+
+	if(names.size() > Params::MAX_PARAMS)
+		throw std::runtime_error("Route has too many parameters: " + std::string(pattern));
+
+	for(const Route& route : m_nodes[node].routes)
+	{
+		if(route.method == method)
+			throw std::runtime_error("Route is already registered: " + std::string(method) + " " + std::string(pattern));
+	}
+
+	m_nodes[node].routes.push_back(Route{std::string(method), handler, std::move(names)});
+}
+
+bool Router::find(uint32_t index, std::string_view path, Params& params, const Node*& result) const
+{
+	const Node& node = m_nodes[index];
+	if(path.empty() && !node.routes.empty())
+	{
+		result = &node;
+		return true;
+	}
+
+	if(!path.empty())
+	{
+		size_t position = node.firstChars.find(path[0]);
+		if(position != std::string::npos)
+		{
+			const Node& child = m_nodes[node.children[position]];
+			if(path.compare(0, child.label.size(), child.label) == 0
+					&& find(node.children[position], path.substr(child.label.size()), params, result))
+				return true;
+		}
+
+		// Backtracks to a parameter if the static text led nowhere
+		if(node.param != NONE)
+		{
+			std::string_view segment = path.substr(0, path.find('/'));
+			if(!segment.empty() && params.m_count < Params::MAX_PARAMS)
+			{
+				params.m_values[params.m_count++] = segment;
+				if(find(node.param, path.substr(segment.size()), params, result))
+					return true;
+
+				params.m_count--;
+			}
+		}
+	}
+
+	if(node.wildcard != NONE && !m_nodes[node.wildcard].routes.empty())
+	{
+		params.m_values[params.m_count++] = path;
+		result = &m_nodes[node.wildcard];
+		return true;
+	}
+
+	return false;
+}
+
+const Router::Node* Router::find(std::string_view path, Params& params) const
+{
+	params.m_count = 0;
+	params.m_names = nullptr;
+
+	const Node* result = nullptr;
+	if(!find(0, stripQuery(path), params, result))
+		return nullptr;
+
+	return result;
+}
+
+const Router::Route* Router::findRoute(const Node& node, std::string_view method)
+{
+	const Route* any = nullptr;
+	const Route* get = nullptr;
+
+	for(const Route& route : node.routes)
+	{
+		if(route.method == method)
+			return &route;
+
+		if(route.method == "*")
+			any = &route;
+		else if(route.method == "GET")
+			get = &route;
+	}
+
+	return (method == "HEAD" && get ? get : any);
+}
+
+const Router::Handler* Router::match(std::string_view method, std::string_view path, Params& params) const
+{
+	const Node* node = find(path, params);
+	if(!node)
+		return nullptr;
+
+	const Route* route = findRoute(*node, method);
+	if(!route)
+		return nullptr;
+
+	params.m_names = &route->names;
+	return &route->handler;
+}
+
+bool Router::dispatch(const std::shared_ptr<Request>& request, const Responder& responder) const
+{
+	Params params;
+	const Node* node = find(request->getUrl(), params);
+	if(!node)
+		return false;
+
+	const Route* route = findRoute(*node, request->getMethod());
+	if(!route)
+	{
+		std::string allow;
+		for(const Route& other : node->routes)
+			allow += (allow.empty() ? "" : ", ") + other.method;
+
+		Request response;
+		response.setResponse(405);
+		response["Allow"] = allow;
+		responder.send(std::move(response));
+		return true;
+	}
+
+	params.m_names = &route->names;
+	route->handler(request, responder, params);
+	return true;
+}
+
+void Router::operator()(const std::shared_ptr<Request>& request, const Responder& responder) const
+{
+	if(dispatch(request, responder))
+		return;
+
+	Request response;
+	response.setResponse(404);
+	response[HeaderId::ContentType] = "text/plain";
+	response << "Not Found";
+	responder.send(std::move(response));
+}
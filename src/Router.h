@@ -0,0 +1,154 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_ROUTER_H
+#define TLHTTP_ROUTER_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Connection.h"
+
+namespace tlhttp
+{
+
+/**
+ * @brief Dispatches requests by method and path.
+ *
+ * Patterns consist of static text, parameters like ":id" matching one
+ * path segment and an optional trailing wildcard like "*path" matching the
+ * rest of the path.
+ *
+ * All routes are compiled into one radix tree, so matching walks the path
+ * once, no matter how many routes there are. Static text takes precedence
+ * over parameters, which take precedence over wildcards. Matching does not
+ * allocate, the captured values refer to the request URL.
+ *
+ * Routes must be added before the router is used, matching is safe from
+ * several threads at once.
+ */
+class Router
+{
+public:
+	class Params;
+	typedef std::function<void(const std::shared_ptr<Request>&, const Responder&, const Params&)> Handler;
+
+	/**
+	 * @brief The values captured by the parameters of a route.
+	 *
+	 * The values are not percent-decoded.
+	 */
+	class Params
+	{
+		friend class Router;
+
+	public:
+		/**
+		 * @brief The maximum number of parameters in a route.
+		 */
+		static constexpr size_t MAX_PARAMS = 16;
+
+	private:
+		std::array<std::string_view, MAX_PARAMS> m_values;
+		size_t m_count = 0;
+		const std::vector<std::string>* m_names = nullptr;
+
+	public:
+		/**
+		 * @brief Returns the value of a parameter, an empty string if there is none.
+		 */
+		std::string_view get(std::string_view name) const;
+		std::string_view operator[](std::string_view name) const { return get(name); }
+
+		size_t size() const { return m_count; }
+		std::string_view value(size_t index) const { return m_values[index]; }
+		std::string_view name(size_t index) const { return (*m_names)[index]; }
+	};
+
+private:
+	static constexpr uint32_t NONE = UINT32_MAX;
+
+	struct Route
+	{
+		std::string method;
+		Handler handler;
+		std::vector<std::string> names;
+	};
+
+	struct Node
+	{
+		std::string label; ///< The static text leading to the node
+		std::string firstChars; ///< The first character of every static child
+		std::vector<uint32_t> children;
+		uint32_t param = NONE, wildcard = NONE;
+		std::vector<Route> routes;
+	};
+
+	// Nodes refer to each other by index, so the tree is one allocation
+	std::vector<Node> m_nodes;
+
+	uint32_t insertStatic(uint32_t node, std::string_view text);
+	bool find(uint32_t node, std::string_view path, Params& params, const Node*& result) const;
+	const Node* find(std::string_view path, Params& params) const;
+	static const Route* findRoute(const Node& node, std::string_view method);
+
+public:
+	Router() : m_nodes(1) {}
+
+	/**
+	 * @brief Adds a route.
+	 * @param method The request method, "*" matches all of them.
+	 * @param pattern The path pattern, starting with '/'.
+	 * @param handler Called for matching requests.
+	 * @throws std::runtime_error if the pattern is invalid or already taken.
+	 */
+	void add(std::string_view method, std::string_view pattern, const Handler& handler);
+
+	/**
+	 * @brief Looks up the handler of a request.
+	 *
+	 * HEAD requests use GET routes unless there is a HEAD route.
+	 *
+	 * @param method The request method.
+	 * @param path The path, a query is ignored.
+	 * @param params Receives the parameters.
+	 * @return The handler, nullptr if no route matches.
+	 */
+	const Handler* match(std::string_view method, std::string_view path, Params& params) const;
+
+	/**
+	 * @brief Calls the handler of a request.
+	 * @return false if no route matches the path, nothing was sent then.
+	 * Requests whose path matches with another method are answered with 405.
+	 */
+	bool dispatch(const std::shared_ptr<Request>& request, const Responder& responder) const;
+
+	/**
+	 * @brief Calls the handler of a request, answers with 404 if no route matches.
+	 *
+	 * Allows passing the router to Server::startAsync() with std::ref().
+	 */
+	void operator()(const std::shared_ptr<Request>& request, const Responder& responder) const;
+};
+
+}
+
+#endif //TLHTTP_ROUTER_H
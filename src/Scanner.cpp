@@ -0,0 +1,254 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TLHTTP_X86 1
+#endif
+
+#include "Scanner.h"
+
+using namespace tlhttp;
+
+namespace
+{
+constexpr std::array<bool, 256> createTokenTable()
+{
+	std::array<bool, 256> table{};
+	for(int c = '0'; c <= '9'; c++)
+		table[c] = true;
+
+	for(int c = 'a'; c <= 'z'; c++)
+		table[c] = table[c - 'a' + 'A'] = true;
+
+	for(char c : std::string_view("!#$%&'*+-.^_`|~"))
+		table[(unsigned char) c] = true;
+
+	return table;
+}
+
+constexpr std::array<bool, 256> tokenTable = createTokenTable();
+
+// A byte is a token character if the bit of its high nibble is set in the
+// entry of its low nibble. Bytes above 0x7f have no bit and never match.
+constexpr std::array<uint8_t, 16> createNibbleTable()
+{
+	std::array<uint8_t, 16> table{};
+	for(int c = 0; c < 128; c++)
+	{
+		if(tokenTable[c])
+			table[c & 15] |= 1 << (c >> 4);
+	}
+
+	return table;
+}
+
+constexpr std::array<uint8_t, 16> nibbleTable = createNibbleTable();
+
+inline bool isControl(unsigned char c)
+{
+	return (c < 0x20 && c != '\t') || c == 0x7f;
+}
+
+size_t findNonTokenScalar(const char* data, size_t size, size_t i = 0)
+{
+	for(; i < size; i++)
+	{
+		if(!tokenTable[(unsigned char) data[i]])
+			return i;
+	}
+
+	return size;
+}
+
+size_t findControlScalar(const char* data, size_t size, size_t i = 0)
+{
+	for(; i < size; i++)
+	{
+		if(isControl(data[i]))
+			return i;
+	}
+
+	return size;
+}
+
+#ifdef TLHTTP_X86
+__attribute__((target("sse4.2")))
+size_t findNonTokenSse42(const char* data, size_t size)
+{
+	const __m128i nibbles = _mm_loadu_si128((const __m128i*) nibbleTable.data());
+	const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i low = _mm_set1_epi8(0x0f);
+
+	size_t i = 0;
+	for(; i + 16 <= size; i += 16)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i*) (data + i));
+		__m128i row = _mm_shuffle_epi8(nibbles, _mm_and_si128(chunk, low));
+		__m128i column = _mm_shuffle_epi8(bits, _mm_and_si128(_mm_srli_epi16(chunk, 4), low));
+
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, column), _mm_setzero_si128()));
+		if(mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return findNonTokenScalar(data, size, i);
+}
+
+__attribute__((target("sse4.2")))
+size_t findControlSse42(const char* data, size_t size)
+{
+	// Ranges of control characters, leaving out HTAB
+	const __m128i ranges = _mm_setr_epi8(0x00, 0x08, 0x0a, 0x1f, 0x7f, 0x7f, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+	size_t i = 0;
+	for(; i + 16 <= size; i += 16)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i*) (data + i));
+		int index = _mm_cmpestri(ranges, 6, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+		if(index != 16)
+			return i + index;
+	}
+
+	return findControlScalar(data, size, i);
+}
+
+__attribute__((target("avx2")))
+size_t findNonTokenAvx2(const char* data, size_t size)
+{
+	const __m256i nibbles = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) nibbleTable.data()));
+	const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+										  1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+
+	size_t i = 0;
+	for(; i + 32 <= size; i += 32)
+	{
+		__m256i chunk = _mm256_loadu_si256((const __m256i*) (data + i));
+		__m256i row = _mm256_shuffle_epi8(nibbles, _mm256_and_si256(chunk, low));
+		__m256i column = _mm256_shuffle_epi8(bits, _mm256_and_si256(_mm256_srli_epi16(chunk, 4), low));
+
+		unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, column), _mm256_setzero_si256()));
+		if(mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return findNonTokenScalar(data, size, i);
+}
+
+__attribute__((target("avx2")))
+size_t findControlAvx2(const char* data, size_t size)
+{
+	const __m256i limit = _mm256_set1_epi8(0x1f);
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i del = _mm256_set1_epi8(0x7f);
+
+	size_t i = 0;
+	for(; i + 32 <= size; i += 32)
+	{
+		__m256i chunk = _mm256_loadu_si256((const __m256i*) (data + i));
+
+		// Unsigned chunk <= 0x1f without HTAB, or DEL
+		__m256i below = _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, limit), chunk);
+		__m256i control = _mm256_or_si256(_mm256_andnot_si256(_mm256_cmpeq_epi8(chunk, tab), below),
+										  _mm256_cmpeq_epi8(chunk, del));
+
+		unsigned mask = _mm256_movemask_epi8(control);
+		if(mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return findControlScalar(data, size, i);
+}
+#endif
+
+struct Kernels
+{
+	Scanner::Isa isa;
+	size_t (*findNonToken)(const char*, size_t);
+	size_t (*findControl)(const char*, size_t);
+};
+
+Kernels selectKernels(Scanner::Isa isa)
+{
+#ifdef TLHTTP_X86
+	switch(isa)
+	{
+		case Scanner::Isa::Avx2:
+			return {isa, findNonTokenAvx2, findControlAvx2};
+
+		case Scanner::Isa::Sse42:
+			return {isa, findNonTokenSse42, findControlSse42};
+
+		default: break;
+	}
+#endif
+
+	return {Scanner::Isa::Scalar, [](const char* data, size_t size) { return findNonTokenScalar(data, size); },
+			[](const char* data, size_t size) { return findControlScalar(data, size); }};
+}
+
+const Kernels& getKernels()
+{
+	static const Kernels kernels = selectKernels(Scanner::isSupported(Scanner::Isa::Avx2) ? Scanner::Isa::Avx2
+			: Scanner::isSupported(Scanner::Isa::Sse42) ? Scanner::Isa::Sse42 : Scanner::Isa::Scalar);
+
+	return kernels;
+}
+}
+
+bool Scanner::isSupported(Isa isa)
+{
+#ifdef TLHTTP_X86
+	switch(isa)
+	{
+		case Isa::Avx2: return __builtin_cpu_supports("avx2");
+		case Isa::Sse42: return __builtin_cpu_supports("sse4.2");
+		default: break;
+	}
+#endif
+
+	return isa == Isa::Scalar;
+}
+
+Scanner::Isa Scanner::getIsa()
+{
+	return getKernels().isa;
+}
+
+size_t Scanner::findNonToken(const char* data, size_t size)
+{
+	return getKernels().findNonToken(data, size);
+}
+
+size_t Scanner::findNonToken(Isa isa, const char* data, size_t size)
+{
+	return selectKernels(isa).findNonToken(data, size);
+}
+
+size_t Scanner::findControl(const char* data, size_t size)
+{
+	return getKernels().findControl(data, size);
+}
+
+size_t Scanner::findControl(Isa isa, const char* data, size_t size)
+{
+	return selectKernels(isa).findControl(data, size);
+}
@@ -0,0 +1,70 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_SCANNER_H
+#define TLHTTP_SCANNER_H
+
+#include <cstddef>
+
+namespace tlhttp
+{
+
+/**
+ * @brief Classifies header bytes in bulk.
+ *
+ * Each function returns the offset of the first byte which ends the
+ * current element, or the size if there is none. The SIMD kernels look
+ * at 16 (SSE4.2) or 32 (AVX2) bytes per step and are selected at runtime
+ * depending on the CPU, the scalar kernels are used everywhere else.
+ */
+class Scanner
+{
+public:
+	enum class Isa
+	{
+		Scalar,
+		Sse42,
+		Avx2
+	};
+
+	/**
+	 * @brief Returns the kernels used by the dispatching functions.
+	 */
+	static Isa getIsa();
+
+	/**
+	 * @brief Checks if the CPU can run the given kernels.
+	 */
+	static bool isSupported(Isa isa);
+
+	/**
+	 * @brief Finds the first byte which is not a token character (RFC 7230, section 3.2.6).
+	 */
+	static size_t findNonToken(const char* data, size_t size);
+	static size_t findNonToken(Isa isa, const char* data, size_t size);
+
+	/**
+	 * @brief Finds the first control character other than HTAB.
+	 *
+	 * This is the end of a field value: CR, LF or an invalid byte.
+	 */
+	static size_t findControl(const char* data, size_t size);
+	static size_t findControl(Isa isa, const char* data, size_t size);
+};
+
+}
+
+#endif //TLHTTP_SCANNER_H
@@ -0,0 +1,209 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "Segments.h"
+
+using namespace tlhttp;
+
+Segment Segment::fromString(std::string&& str)
+{
+	return fromShared(std::make_shared<const std::string>(std::move(str)));
+}
+
+Segment Segment::fromShared(const std::shared_ptr<const std::string>& str)
+{
+	Segment segment;
+	segment.data = str->data();
+	segment.size = str->size();
+	segment.owner = str;
+	return segment;
+}
+
+Segment Segment::fromStatic(std::string_view str)
+{
+	Segment segment;
+	segment.data = str.data();
+	segment.size = str.size();
+	return segment;
+}
+
+Segment Segment::fromFile(std::shared_ptr<const void> owner, int fd, off_t offset, size_t size)
+{
+	Segment segment;
+	segment.owner = std::move(owner);
+	segment.fd = fd;
+	segment.offset = offset;
+	segment.size = size;
+	return segment;
+}
+
+Segment Segment::fromFile(int fd, off_t offset, size_t size)
+{
+	auto owner = std::shared_ptr<const int>(new int(fd), [](const int* fd) {
+		::close(*fd);
+		delete fd;
+	});
+
+	return fromFile(owner, fd, offset, size);
+}
+
+void Segments::append(Segment&& segment)
+{
+	if(!segment.size)
+		return;
+
+	m_size += segment.size;
+	m_segments.push_back(std::move(segment));
+}
+
+void Segments::append(Segments&& segments)
+{
+	if(m_segments.empty())
+	{
+		swap(segments);
+		return;
+	}
+
+	for(auto& segment : segments.m_segments)
+		append(std::move(segment));
+
+	segments.clear();
+}
+
+void Segments::clear()
+{
+	m_segments.clear();
+	m_size = 0;
+}
+
+void Segments::swap(Segments& segments)
+{
+	m_segments.swap(segments.m_segments);
+	std::swap(m_size, segments.m_size);
+}
+
+Segments Segments::take(size_t size)
+{
+	Segments result;
+	size_t count = 0;
+	for(; size > 0 && count < m_segments.size(); count++)
+	{
+		Segment& segment = m_segments[count];
+		if(segment.size <= size)
+		{
+			size -= segment.size;
+			result.append(std::move(segment));
+			continue;
+		}
+
+		Segment front = segment;
+		front.size = size;
+		result.append(std::move(front));
+
+		if(segment.isFile())
+			segment.offset += size;
+		else
+			segment.data += size;
+
+		segment.size -= size;
+		break;
+	}
+
+	m_segments.erase(m_segments.begin(), m_segments.begin() + count);
+	m_size -= result.size();
+	return result;
+}
+
+const Segment& Segments::locate(size_t& offset) const
+{
+	for(const Segment& segment : m_segments)
+	{
+		if(offset < segment.size)
+			return segment;
+
+		offset -= segment.size;
+	}
+
+	throw std::out_of_range("Offset is beyond the end of the segments!");
+}
+
+size_t Segments::fill(size_t offset, struct iovec* iov, size_t max) const
+{
+	size_t count = 0;
+	for(const Segment& segment : m_segments)
+	{
+		if(count == max)
+			break;
+
+		if(offset >= segment.size)
+		{
+			offset -= segment.size;
+			continue;
+		}
+
+		if(segment.isFile())
+			break;
+
+		iov[count].iov_base = const_cast<char*>(segment.data + offset);
+		iov[count].iov_len = segment.size - offset;
+		count++;
+		offset = 0;
+	}
+
+	return count;
+}
+
+std::string Segments::str() const
+{
+	std::string result;
+	result.reserve(m_size);
+
+	for(const Segment& segment : m_segments)
+	{
+		if(!segment.isFile())
+		{
+			result.append(segment.data, segment.size);
+			continue;
+		}
+
+		size_t start = result.size();
+		result.resize(start + segment.size);
+
+		size_t done = 0;
+		while(done < segment.size)
+		{
+			ssize_t count = pread(segment.fd, &result[start + done], segment.size - done, segment.offset + done);
+			if(count < 0 && errno == EINTR)
+				continue;
+
+			if(count < 0)
+				throw std::runtime_error("Could not read file segment: " + std::string(strerror(errno)));
+
+			if(count == 0)
+				throw std::runtime_error("File segment is beyond the end of the file!");
+
+			done += count;
+		}
+	}
+
+	return result;
+}
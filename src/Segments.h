@@ -0,0 +1,141 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_SEGMENTS_H
+#define TLHTTP_SEGMENTS_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tlhttp
+{
+
+/**
+ * @brief A piece of data referenced in place.
+ *
+ * The owner keeps the data alive, it is empty for static data. Segments
+ * with a file descriptor refer to a region of a file instead of memory,
+ * which is sent with sendfile() without passing through user space.
+ */
+struct Segment
+{
+	std::shared_ptr<const void> owner;
+	const char* data = nullptr;
+	size_t size = 0;
+	int fd = -1;
+	off_t offset = 0;
+
+	/**
+	 * @brief Takes over a string without copying its contents.
+	 */
+	static Segment fromString(std::string&& str);
+	static Segment fromShared(const std::shared_ptr<const std::string>& str);
+
+	/**
+	 * @brief References data which lives as long as the program.
+	 */
+	static Segment fromStatic(std::string_view str);
+
+	/**
+	 * @brief References a region of a file.
+	 * @param owner Keeps the file descriptor open.
+	 */
+	static Segment fromFile(std::shared_ptr<const void> owner, int fd, off_t offset, size_t size);
+
+	/**
+	 * @brief References a region of a file and closes it once the segment is gone.
+	 */
+	static Segment fromFile(int fd, off_t offset, size_t size);
+
+	bool isFile() const { return fd >= 0; }
+};
+
+/**
+ * @brief A list of segments which are written with one vectored write.
+ */
+class Segments
+{
+	std::vector<Segment> m_segments;
+	size_t m_size = 0;
+
+public:
+	/**
+	 * @brief The number of vectors passed to one write, larger lists take several.
+	 */
+	static constexpr size_t IOV_BATCH = 64;
+
+	Segments() = default;
+	Segments(std::string&& str) { append(std::move(str)); }
+
+	void append(Segment&& segment);
+	void append(std::string&& str) { append(Segment::fromString(std::move(str))); }
+	void append(Segments&& segments);
+
+	/**
+	 * @brief Returns the number of bytes in all segments.
+	 */
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	size_t count() const { return m_segments.size(); }
+	const Segment& operator[](size_t index) const { return m_segments[index]; }
+
+	void clear();
+	void swap(Segments& segments);
+
+	/**
+	 * @brief Moves the first bytes into new segments without copying them.
+	 *
+	 * A segment crossing the boundary is split, both parts share its owner.
+	 *
+	 * @param size The number of bytes, at most size().
+	 */
+	Segments take(size_t size);
+
+	/**
+	 * @brief Finds the segment containing an offset.
+	 * @param offset The offset into all segments, receives the offset into the segment.
+	 * @note The offset must be less than size().
+	 */
+	const Segment& locate(size_t& offset) const;
+
+	/**
+	 * @brief Describes the data after an offset for writev or sendmsg.
+	 *
+	 * Stops at the first file segment, which has to be sent with sendfile().
+	 *
+	 * @param offset The number of bytes already written.
+	 * @param iov Receives the vectors.
+	 * @param max The number of vectors iov has room for.
+	 * @return The number of vectors filled.
+	 */
+	size_t fill(size_t offset, struct iovec* iov, size_t max) const;
+
+	/**
+	 * @brief Concatenates all segments, file regions are read.
+	 * @throws std::runtime_error if a file can not be read.
+	 */
+	std::string str() const;
+};
+
+}
+
+#endif //TLHTTP_SEGMENTS_H
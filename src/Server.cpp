@@ -15,18 +15,33 @@
 // License along with this library.
 
 #include "Server.h"
+#include "Pool.h"
 #include <memory>
 #include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
 
 using namespace tlhttp;
 
-void Server::start(const std::function<bool(const std::shared_ptr<Connection>&)>& requestHandler)
+namespace
 {
-	if(m_running)
-		throw std::runtime_error("Server is already running on one thread!");
-
-	m_running = true;
+void setSocketTimeout(int fd, int option, std::chrono::milliseconds timeout)
+{
+	struct timeval value;
+	value.tv_sec = timeout.count() / 1000;
+	value.tv_usec = (timeout.count() % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, option, &value, sizeof(value));
+}
+}
 
+int Server::createListener(bool reusePort)
+{
 	struct addrinfo hints, *sockaddr;
 	memset(&hints, 0, sizeof(struct addrinfo));
 	hints.ai_family = AF_UNSPEC;
@@ -35,39 +50,359 @@ void Server::start(const std::function<bool(const std::shared_ptr<Connection>&)>
 	hints.ai_protocol = 0;
 
 	m_socket = getaddrinfo(m_address.c_str(), std::to_string(m_port).c_str(), &hints, &sockaddr);
+	if(m_socket != 0)
+		throw std::runtime_error("Could not resolve " + m_address + ": " + gai_strerror(m_socket));
+
+	int fd = socket(sockaddr->ai_family, sockaddr->ai_socktype, sockaddr->ai_protocol);
+	if(fd < 0)
+	{
+		freeaddrinfo(sockaddr);
+		throw std::runtime_error("Could not create socket to " + m_address + ": " + strerror(errno));
+	}
+
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if(reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+	{
+		int error = errno;
+		freeaddrinfo(sockaddr);
+		close(fd);
+		throw std::runtime_error(std::string("Could not enable SO_REUSEPORT: ") + strerror(error));
+	}
+
+	if(m_fastOpenQueue > 0)
+		setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &m_fastOpenQueue, sizeof(m_fastOpenQueue));
+
+	if(bind(fd, sockaddr->ai_addr, sockaddr->ai_addrlen) < 0 || listen(fd, SOMAXCONN) < 0)
+	{
+		int error = errno;
+		freeaddrinfo(sockaddr);
+		close(fd);
+		throw std::runtime_error("Could not listen on " + m_address + ": " + strerror(error));
+	}
+
+	freeaddrinfo(sockaddr);
+	return fd;
+}
 
-	m_socketFd = socket(sockaddr->ai_family, sockaddr->ai_socktype, sockaddr->ai_protocol);
-	if(m_socketFd < 0)
-		throw std::runtime_error("Could not create socket to " + m_address + ": " + gai_strerror(m_socketFd));
+void Server::start(const std::function<bool(const std::shared_ptr<Connection>&)>& requestHandler)
+{
+	if(m_running)
+		throw std::runtime_error("Server is already running on one thread!");
 
-	bind(m_socketFd, sockaddr->ai_addr, sockaddr->ai_addrlen);
-	listen(m_socketFd, -1);
+	m_running = true;
+	m_socketFd = createListener();
 
-	struct sockaddr* clientAddr = new struct sockaddr;
+	struct sockaddr_storage clientAddr;
 	while(m_running)
 	{
-		int fd = ::accept(m_socketFd, clientAddr, &hints.ai_addrlen);
+		socklen_t addrlen = sizeof(clientAddr);
+		int fd = ::accept(m_socketFd, (struct sockaddr*) &clientAddr, &addrlen);
 		if(fd == -1)
-			throw std::runtime_error(std::string("Could not create socket to client: ") + gai_strerror(fd));
+			throw std::runtime_error(std::string("Could not create socket to client: ") + strerror(errno));
+
+		// Blocking reads and writes fail instead of hanging on a silent client
+		setSocketTimeout(fd, SO_RCVTIMEO, m_timeouts.header);
+		setSocketTimeout(fd, SO_SNDTIMEO, m_timeouts.write);
 
-		auto conn = std::shared_ptr<Connection>(new Connection(fd));
-		if(!requestHandler(conn))
+		auto conn = makePooled<Connection>(fd);
+		bool handled;
+		try
+		{
+			handled = requestHandler(conn);
+		}
+		catch(std::exception&)
+		{
+			// A client which timed out or went away only loses its own connection
+			continue;
+		}
+
+		if(!handled)
 		{
 			throw std::runtime_error("Request handler failed!");
 		}
 	}
+}
 
-	delete clientAddr;
-	freeaddrinfo(sockaddr);
+void Server::startAsync(const AsyncHandler& requestHandler)
+{
+	runReactors(std::make_shared<AsyncHandler>(requestHandler), nullptr);
+}
+
+void Server::startCoroutine(const CoroutineHandler& connectionHandler)
+{
+	runReactors(nullptr, std::make_shared<CoroutineHandler>(connectionHandler));
+}
+
+void Server::runReactors(const std::shared_ptr<const AsyncHandler>& requestHandler,
+						 const std::shared_ptr<const CoroutineHandler>& connectionHandler)
+{
+	if(m_running)
+		throw std::runtime_error("Server is already running on one thread!");
+
+	// Only the CPUs in the affinity mask of the process are used
+	cpu_set_t affinity;
+	std::vector<int> cpus;
+	if(pthread_getaffinity_np(pthread_self(), sizeof(affinity), &affinity) == 0)
+	{
+		for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if(CPU_ISSET(cpu, &affinity))
+				cpus.push_back(cpu);
+	}
+
+	unsigned int count = m_threadCount;
+	if(count == 0)
+		count = cpus.empty() ? std::max(1u, std::thread::hardware_concurrency()) : cpus.size();
+
+	bool pin = m_pinThreads && !cpus.empty();
+
+	{
+		std::lock_guard<std::mutex> lock(m_reactorMutex);
+		m_running = true;
+		m_handler = requestHandler;
+		m_coroutineHandler = connectionHandler;
+
+		// Coroutine handlers read HTTP/1 requests themselves
+		if(m_tls && m_http2 && m_handler)
+			m_tls->setAlpnProtocols({"h2", "http/1.1"});
+
+		try
+		{
+			for(unsigned int i = 0; i < count; i++)
+			{
+				std::unique_ptr<Reactor> reactor(new Reactor);
+				reactor->loop = EventLoop::create(m_backend);
+				reactor->listenFd = createListener(count > 1);
+				m_reactors.push_back(std::move(reactor));
+			}
+		}
+		catch(...)
+		{
+			for(auto& reactor : m_reactors)
+				close(reactor->listenFd);
+
+			m_reactors.clear();
+			m_running = false;
+			throw;
+		}
+
+		// The calling thread runs the first reactor itself
+		for(unsigned int i = 1; i < count; i++)
+		{
+			Reactor& reactor = *m_reactors[i];
+			int cpu = pin ? cpus[i % cpus.size()] : -1;
+			reactor.thread = std::thread([this, &reactor, cpu]() {
+				runReactor(reactor, cpu);
+			});
+		}
+	}
+
+	runReactor(*m_reactors[0], pin ? cpus[0] : -1);
+	if(pin)
+		pthread_setaffinity_np(pthread_self(), sizeof(affinity), &affinity);
+
+	std::lock_guard<std::mutex> lock(m_reactorMutex);
+	for(auto& reactor : m_reactors)
+	{
+		reactor->loop->stop();
+		if(reactor->thread.joinable())
+			reactor->thread.join();
+	}
+
+	m_reactors.clear();
+	m_running = false;
+}
+
+void Server::runReactor(Reactor& reactor, int cpu)
+{
+	if(cpu >= 0)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	fcntl(reactor.listenFd, F_SETFL, fcntl(reactor.listenFd, F_GETFL, 0) | O_NONBLOCK);
+	reactor.loop->listen(reactor.listenFd, [this, &reactor](int fd) {
+		accept(reactor, fd);
+	});
+
+	reactor.loop->run();
+
+	for(auto& conn : std::unordered_map<int, std::shared_ptr<Connection>>(reactor.connections))
+		conn.second->close();
+	reactor.connections.clear();
+
+	reactor.loop->remove(reactor.listenFd);
+	close(reactor.listenFd);
+	reactor.listenFd = 0;
+}
+
+void Server::accept(Reactor& reactor, int fd)
+{
+	auto conn = makePooled<Connection>(fd);
+	reactor.connections[fd] = conn;
+
+	if(m_coroutineHandler)
+	{
+		attach(reactor, conn, nullptr);
+		spawn(handleConnection(m_coroutineHandler, conn));
+		return;
+	}
+
+	attach(reactor, conn, [this](const std::shared_ptr<Connection>& c) { handleData(c); });
+}
+
+void Server::attach(Reactor& reactor, const std::shared_ptr<Connection>& conn, const Connection::Callback& onData)
+{
+	int fd = conn->getSocket();
+	auto onClose = [&reactor, fd](const std::shared_ptr<Connection>&) { reactor.connections.erase(fd); };
+
+	if(m_tls)
+		conn->attachSecure(*reactor.loop, m_tls, onData, onClose);
+	else
+		conn->attach(*reactor.loop, onData, onClose);
+
+	conn->setTimeouts(m_timeouts);
+	conn->getParser().setMaxBodySize(m_maxBodySize);
+}
+
+void Server::handleData(const std::shared_ptr<Connection>& conn)
+{
+	IoBuffer& input = conn->getInput();
+
+	// Clients with prior knowledge or ALPN start with the HTTP/2 preface
+	if(m_http2 && conn->getRequestCount() == 0 && !input.empty() && Http2Session::isPreface(input.view()))
+	{
+		if(input.size() >= Http2Session::PREFACE.size())
+			startHttp2(conn, nullptr, {});
+
+		return;
+	}
+
+	while(!conn->isDraining())
+	{
+		if(conn->getPendingRequests() >= m_maxPipelineDepth)
+		{
+			// The connection resumes once responses were written
+			conn->pause();
+			return;
+		}
+
+		auto request = makePooled<Request>();
+		try
+		{
+			// Pipelined requests stay in the buffer for the next iteration
+			if(!Request::extract(input, conn->getParser(), *request))
+				return;
+		}
+		catch(std::exception&)
+		{
+			Request response;
+			response.setResponse(conn->getParser().isBodyTooLarge() ? 413 : 400);
+			Responder(conn, conn->beginRequest(true), false).send(response);
+			return;
+		}
+
+		// The upgrade is only done once earlier responses were sent
+		std::string settings;
+		if(m_http2 && !conn->getTls() && conn->getPendingRequests() == 0 && Http2Session::isUpgrade(*request, settings))
+		{
+			conn->write("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+			startHttp2(conn, request, settings);
+			return;
+		}
+
+		bool last = !request->isKeepAlive()
+				|| (m_maxRequests && conn->getRequestCount() + 1 >= m_maxRequests);
+
+		Responder responder(conn, conn->beginRequest(last), !last,
+				request->getVersion() == "HTTP/1.0", request->getMethod() == "HEAD");
+		submit(m_handler, m_executor, request, responder);
+	}
+}
+
+void Server::startHttp2(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Request>& upgrade, std::string_view settings)
+{
+	// Copy the handler since queued tasks may outlive startAsync()
+	auto handler = m_handler;
+	auto executor = m_executor;
+	auto session = std::make_shared<Http2Session>(conn, [handler, executor](const std::shared_ptr<Request>& request, const Responder& responder) {
+		submit(handler, executor, request, responder);
+	}, m_http2Settings);
+	session->setMaxBodySize(m_maxBodySize);
+
+	// The connection owns the session until it is closed
+	conn->setDataCallback([session](const std::shared_ptr<Connection>&) { session->onData(); });
+	session->start(upgrade, settings);
+
+	if(!conn->getInput().empty())
+		session->onData();
+}
+
+void Server::submit(const std::shared_ptr<const AsyncHandler>& handler, const std::shared_ptr<Executor>& executor,
+					const std::shared_ptr<Request>& request, const Responder& responder)
+{
+	if(!executor)
+	{
+		dispatch(*handler, request, responder);
+		return;
+	}
+
+	executor->submit([handler, request, responder]() {
+		dispatch(*handler, request, responder);
+	});
+}
+
+Task<void> Server::handleConnection(std::shared_ptr<const CoroutineHandler> handler, std::shared_ptr<Connection> conn)
+{
+	try
+	{
+		co_await (*handler)(conn);
+	}
+	catch(std::exception&)
+	{
+	}
+
+	// Lets the handler return early without leaking the socket
+	if(conn->getSocket())
+		conn->closeAfterWrite();
+}
+
+void Server::dispatch(const AsyncHandler& requestHandler, const std::shared_ptr<Request>& request, const Responder& responder)
+{
+	try
+	{
+		requestHandler(request, responder);
+	}
+	catch(std::exception&)
+	{
+		Request response;
+		response.setResponse(500);
+		responder.send(response);
+	}
 }
 
 void Server::stop()
 {
 	m_running = false;
 
+	{
+		std::lock_guard<std::mutex> lock(m_reactorMutex);
+		if(!m_reactors.empty())
+		{
+			for(auto& reactor : m_reactors)
+				reactor->loop->stop();
+
+			return;
+		}
+	}
+
 	if(m_socketFd)
 	{
 		close(m_socketFd);
+		m_socketFd = 0;
 	}
 }
 
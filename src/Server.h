@@ -17,26 +17,111 @@
 #ifndef TLHTTP_SERVER_H
 #define TLHTTP_SERVER_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include "Connection.h"
+#include "EventLoop.h"
+#include "Executor.h"
+#include "Http2.h"
+#include "Tls.h"
 
 namespace tlhttp
 {
 class Server
 {
-	bool m_running;
+public:
+	/**
+	 * @brief Handles a request on an asynchronous server.
+	 *
+	 * The handler may return before the response is sent, the responder
+	 * can be kept around to complete the request later.
+	 */
+	typedef std::function<void(const std::shared_ptr<Request>&, const Responder&)> AsyncHandler;
+
+	/**
+	 * @brief Serves a whole connection as a coroutine.
+	 *
+	 * Use Connection::readRequest() and Connection::asyncSend() to talk
+	 * to the client. The connection is closed once the task finished.
+	 */
+	typedef std::function<Task<void>(std::shared_ptr<Connection>)> CoroutineHandler;
+
+	/**
+	 * @brief The default limit of request bodies, larger ones could fill the disk once spilled.
+	 */
+	static constexpr uint64_t DEFAULT_MAX_BODY_SIZE = 64 * 1024 * 1024;
+
+private:
+	std::atomic<bool> m_running;
 
 	uint16_t m_port;
 	std::string m_address;
 	int m_socket, m_socketFd;
 
+	/**
+	 * @brief One event loop thread with its own listening socket.
+	 *
+	 * Connections never leave the reactor which accepted them.
+	 */
+	struct Reactor
+	{
+		std::unique_ptr<EventLoop> loop;
+		int listenFd = 0;
+		std::unordered_map<int, std::shared_ptr<Connection>> connections;
+		std::thread thread;
+	};
+
+	unsigned int m_threadCount;
+	bool m_pinThreads;
+	EventLoop::Backend m_backend = EventLoop::Backend::Auto;
+
+	uint64_t m_maxRequests = 0, m_maxPipelineDepth = 16;
+	uint64_t m_maxBodySize = DEFAULT_MAX_BODY_SIZE;
+	int m_fastOpenQueue = 0;
+	bool m_http2 = true;
+	Http2Session::Settings m_http2Settings;
+	Connection::Timeouts m_timeouts = {std::chrono::seconds(30), std::chrono::seconds(60),
+										std::chrono::seconds(60), std::chrono::seconds(60)};
+
+	std::shared_ptr<const AsyncHandler> m_handler;
+	std::shared_ptr<const CoroutineHandler> m_coroutineHandler;
+	std::shared_ptr<Executor> m_executor;
+	std::shared_ptr<TlsContext> m_tls;
+
+	std::mutex m_reactorMutex;
+	std::vector<std::unique_ptr<Reactor>> m_reactors;
+
+	int createListener(bool reusePort = false);
+	void runReactors(const std::shared_ptr<const AsyncHandler>& requestHandler,
+					 const std::shared_ptr<const CoroutineHandler>& connectionHandler);
+	void runReactor(Reactor& reactor, int cpu);
+	void accept(Reactor& reactor, int fd);
+	void attach(Reactor& reactor, const std::shared_ptr<Connection>& conn, const Connection::Callback& onData);
+	void handleData(const std::shared_ptr<Connection>& conn);
+	void startHttp2(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Request>& upgrade, std::string_view settings);
+	static Task<void> handleConnection(std::shared_ptr<const CoroutineHandler> handler, std::shared_ptr<Connection> conn);
+	static void dispatch(const AsyncHandler& requestHandler, const std::shared_ptr<Request>& request, const Responder& responder);
+
+	/**
+	 * @brief Runs the handler inline or hands it to the executor.
+	 */
+	static void submit(const std::shared_ptr<const AsyncHandler>& handler, const std::shared_ptr<Executor>& executor,
+					   const std::shared_ptr<Request>& request, const Responder& responder);
+
 public:
 	Server(const std::string& address, uint16_t port)
 		: m_port(port),
 		  m_address(address),
 		  m_running(false),
-		  m_socket(0), m_socketFd(0) {}
+		  m_socket(0), m_socketFd(0),
+		  m_threadCount(1), m_pinThreads(false) {}
 
 	~Server()
 	{
@@ -45,6 +130,184 @@ public:
 	}
 
 	void start(const std::function<bool(const std::shared_ptr<Connection>&)>& requestHandler);
+
+	/**
+	 * @brief Serves requests on non-blocking event loops.
+	 *
+	 * All sockets are non-blocking, so a slow client does not stall the
+	 * others. Blocks until stop() is called.
+	 *
+	 * @param requestHandler Called on the loop thread for every complete request.
+	 * @throws std::runtime_error on failure.
+	 */
+	void startAsync(const AsyncHandler& requestHandler);
+
+	/**
+	 * @brief Serves every accepted connection with a coroutine.
+	 *
+	 * Uses the same reactors as startAsync() and blocks until stop() is called.
+	 *
+	 * @param connectionHandler Started on the loop thread for every new connection.
+	 * @throws std::runtime_error on failure.
+	 */
+	void startCoroutine(const CoroutineHandler& connectionHandler);
+
+	/**
+	 * @brief Sets the number of reactor threads used by startAsync().
+	 *
+	 * Every reactor listens on its own SO_REUSEPORT socket, so the kernel
+	 * spreads new connections across them without a shared lock.
+	 *
+	 * @param count The number of threads, 0 uses one per core available to the process.
+	 */
+	void setThreadCount(unsigned int count) { m_threadCount = count; }
+	unsigned int getThreadCount() const { return m_threadCount; }
+
+	/**
+	 * @brief Selects the I/O backend of the reactors.
+	 *
+	 * The default uses io_uring when the kernel supports it and falls
+	 * back to epoll otherwise.
+	 */
+	void setBackend(EventLoop::Backend backend) { m_backend = backend; }
+
+	/**
+	 * @brief Enables pinning reactor threads to a CPU core each.
+	 *
+	 * Reactors are spread over the CPUs the process is allowed to run on.
+	 * The calling thread runs the first reactor, its affinity is restored
+	 * once the server stopped. Off by default.
+	 */
+	void setPinThreads(bool value) { m_pinThreads = value; }
+
+	/**
+	 * @brief Runs request handlers on an executor instead of the reactor threads.
+	 *
+	 * Reactors only parse requests and hand them over, responses are sent
+	 * back to the reactor owning the connection. Useful for CPU heavy
+	 * handlers which would otherwise block the I/O of other connections.
+	 *
+	 * @param executor The executor to use, nullptr runs handlers inline.
+	 * @note Must be set before startAsync() is called.
+	 */
+	void setExecutor(const std::shared_ptr<Executor>& executor) { m_executor = executor; }
+
+	/**
+	 * @brief Serves HTTPS with the given certificate.
+	 *
+	 * All reactors share one context, so sessions resumed with a ticket or
+	 * from the session cache work no matter which reactor accepts them.
+	 * Only used by startAsync() and startCoroutine().
+	 *
+	 * @param certificateFile The PEM file with the certificate chain.
+	 * @param keyFile The PEM file with the private key.
+	 * @throws std::runtime_error if the files can not be loaded.
+	 */
+	void setCertificate(const std::string& certificateFile, const std::string& keyFile)
+	{
+		m_tls = TlsContext::createServer(certificateFile, keyFile);
+	}
+
+	/**
+	 * @brief Serves HTTPS with a context configured by the caller.
+	 * @param context The context, nullptr serves plain HTTP.
+	 */
+	void setTlsContext(const std::shared_ptr<TlsContext>& context) { m_tls = context; }
+	const std::shared_ptr<TlsContext>& getTlsContext() const { return m_tls; }
+
+	/**
+	 * @brief Accepts TCP Fast Open, so requests may arrive with the SYN.
+	 *
+	 * Ignored if the kernel does not support it. Must be called before
+	 * the server is started.
+	 *
+	 * @param queueLength The number of pending Fast Open handshakes, 0 disables it.
+	 */
+	void setFastOpen(int queueLength) { m_fastOpenQueue = queueLength; }
+
+	/**
+	 * @brief Enables HTTP/2 for startAsync(), which is the default.
+	 *
+	 * Plain connections switch to HTTP/2 when they start with the client
+	 * preface or ask for an h2c upgrade, TLS connections offer "h2" with
+	 * ALPN. Streams are passed to the same handler as HTTP/1 requests.
+	 *
+	 * @note Must be set before the server is started.
+	 */
+	void setHttp2(bool enabled) { m_http2 = enabled; }
+	bool isHttp2() const { return m_http2; }
+
+	/**
+	 * @brief Sets the limits announced to HTTP/2 clients.
+	 */
+	void setHttp2Settings(const Http2Session::Settings& settings) { m_http2Settings = settings; }
+	const Http2Session::Settings& getHttp2Settings() const { return m_http2Settings; }
+
+	/**
+	 * @brief Limits the size of request bodies.
+	 *
+	 * Larger requests are answered with 413 and the connection is closed,
+	 * which is checked against the Content-Length field before the body is
+	 * read and against the decoded size of chunked bodies. HTTP/2 streams
+	 * are answered with 413 as well, the connection stays open then.
+	 *
+	 * @param size The maximum number of bytes, DEFAULT_MAX_BODY_SIZE by default.
+	 */
+	void setMaxBodySize(uint64_t size) { m_maxBodySize = size; }
+	uint64_t getMaxBodySize() const { return m_maxBodySize; }
+
+	/**
+	 * @brief Limits how many requests are served on one persistent connection.
+	 * @param count The maximum number of requests, 0 means unlimited.
+	 */
+	void setMaxRequestsPerConnection(uint64_t count) { m_maxRequests = count; }
+
+	/**
+	 * @brief Limits how many pipelined requests may wait for their response.
+	 *
+	 * Further requests are only read once earlier responses were written.
+	 */
+	void setMaxPipelineDepth(uint64_t count) { m_maxPipelineDepth = std::max<uint64_t>(count, 1); }
+
+	/**
+	 * @brief Sets after how long a persistent connection without pending
+	 * requests is closed.
+	 * @param timeout The timeout, 0 keeps idle connections open forever.
+	 */
+	void setIdleTimeout(std::chrono::milliseconds timeout) { m_timeouts.idle = timeout; }
+
+	/**
+	 * @brief Sets how long a client may take to send a complete request header.
+	 *
+	 * The time counts from the first byte of the request, sending the
+	 * header slowly does not extend it.
+	 *
+	 * @param timeout The timeout, 0 waits forever.
+	 */
+	void setHeaderTimeout(std::chrono::milliseconds timeout) { m_timeouts.header = timeout; }
+
+	/**
+	 * @brief Sets how long a client may pause while sending a request body.
+	 * @param timeout The timeout, 0 waits forever.
+	 */
+	void setBodyTimeout(std::chrono::milliseconds timeout) { m_timeouts.body = timeout; }
+
+	/**
+	 * @brief Sets how long writing a batch of responses may take.
+	 *
+	 * Protects against clients which stop reading. Also used as the send
+	 * timeout of the blocking start().
+	 *
+	 * @param timeout The timeout, 0 waits forever.
+	 */
+	void setWriteTimeout(std::chrono::milliseconds timeout) { m_timeouts.write = timeout; }
+
+	const Connection::Timeouts& getTimeouts() const { return m_timeouts; }
+
+	/**
+	 * @brief Stops the server.
+	 * @note May be called from any thread.
+	 */
 	void stop();
 };
 }
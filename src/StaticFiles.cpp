@@ -0,0 +1,568 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+
+#include "StaticFiles.h"
+
+using namespace tlhttp;
+
+namespace
+{
+const uint32_t WATCH_EVENTS = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+		| IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+int hexValue(char c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+
+	if(c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+/**
+ * @brief Extracts the decoded path of a request target.
+ *
+ * Empty and "." segments are removed, so every spelling of a file maps to
+ * the same cache entry.
+ *
+ * @return false if the path could leave the served directory.
+ */
+bool decodePath(std::string_view target, std::string& path)
+{
+	target = target.substr(0, target.find_first_of("?#"));
+	if(target.empty() || target[0] != '/')
+		return false;
+
+	std::string decoded;
+	decoded.reserve(target.size());
+	for(size_t i = 0; i < target.size(); i++)
+	{
+		char c = target[i];
+		if(c == '%')
+		{
+			if(i + 2 >= target.size() || hexValue(target[i + 1]) < 0 || hexValue(target[i + 2]) < 0)
+				return false;
+
+			c = char(hexValue(target[i + 1]) * 16 + hexValue(target[i + 2]));
+			i += 2;
+		}
+
+		if(c == '\0')
+			return false;
+
+		decoded += c;
+	}
+
+	// Checked after decoding, so "%2e%2e" is caught as well
+	path.clear();
+	path.reserve(decoded.size());
+	std::string_view segment;
+	for(size_t start = 1; start <= decoded.size(); start += segment.size() + 1)
+	{
+		segment = std::string_view(decoded).substr(start, decoded.find('/', start) - start);
+		if(segment == "..")
+			return false;
+
+		if(!segment.empty() && segment != ".")
+			(path += '/').append(segment);
+	}
+
+	// A trailing "/" or "." still names the directory
+	if(path.empty() || segment.empty() || segment == ".")
+		path += '/';
+
+	return true;
+}
+
+std::string formatDate(time_t time)
+{
+	struct tm utc;
+	gmtime_r(&time, &utc);
+
+	char buffer[64];
+	size_t length = strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &utc);
+	return std::string(buffer, length);
+}
+
+bool parseDate(std::string_view value, time_t& time)
+{
+	std::string str(value);
+	struct tm utc = {};
+	const char* end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &utc);
+	if(!end || *end)
+		return false;
+
+	time = timegm(&utc);
+	return true;
+}
+
+/**
+ * @brief Checks if an entity tag is in a list, with the weak comparison.
+ */
+bool matchesEtag(std::string_view list, std::string_view etag)
+{
+	while(!list.empty())
+	{
+		size_t end = list.find(',');
+		std::string_view candidate = list.substr(0, end);
+		list = (end == std::string_view::npos ? std::string_view() : list.substr(end + 1));
+
+		while(!candidate.empty() && (candidate.front() == ' ' || candidate.front() == '\t'))
+			candidate.remove_prefix(1);
+
+		while(!candidate.empty() && (candidate.back() == ' ' || candidate.back() == '\t'))
+			candidate.remove_suffix(1);
+
+		if(candidate.substr(0, 2) == "W/")
+			candidate.remove_prefix(2);
+
+		if(candidate == "*" || candidate == etag)
+			return true;
+	}
+
+	return false;
+}
+
+enum class Range
+{
+	None,
+	Satisfiable,
+	Unsatisfiable
+};
+
+bool parseNumber(std::string_view str, uint64_t& value)
+{
+	if(str.empty() || str.size() > 18)
+		return false;
+
+	value = 0;
+	for(char c : str)
+	{
+		if(c < '0' || c > '9')
+			return false;
+
+		value = value * 10 + (c - '0');
+	}
+
+	return true;
+}
+
+/**
+ * @brief Parses a Range field with a single byte range.
+ *
+ * Anything else is ignored, so the whole file is sent.
+ *
+ * @param start Receives the first byte.
+ * @param end Receives the byte after the last one.
+ */
+Range parseRange(std::string_view value, uint64_t size, uint64_t& start, uint64_t& end)
+{
+	if(value.substr(0, 6) != "bytes=" || value.find(',') != std::string_view::npos)
+		return Range::None;
+
+	value.remove_prefix(6);
+	size_t dash = value.find('-');
+	if(dash == std::string_view::npos)
+		return Range::None;
+
+	std::string_view first = value.substr(0, dash), last = value.substr(dash + 1);
+	uint64_t from, to;
+
+	if(first.empty())
+	{
+		// A suffix of the file
+		if(!parseNumber(last, to))
+			return Range::None;
+
+		if(to == 0 || size == 0)
+			return Range::Unsatisfiable;
+
+		start = (to < size ? size - to : 0);
+		end = size;
+		return Range::Satisfiable;
+	}
+
+	if(!parseNumber(first, from))
+		return Range::None;
+
+	if(last.empty())
+		to = UINT64_MAX - 1;
+	else if(!parseNumber(last, to) || to < from)
+		return Range::None;
+
+	if(from >= size)
+		return Range::Unsatisfiable;
+
+	start = from;
+	end = std::min(to + 1, size);
+	return Range::Satisfiable;
+}
+}
+
+StaticFiles::StaticFiles(const std::string& root, size_t cacheSize, size_t maxCachedFile)
+	: m_root(root), m_cacheSize(cacheSize), m_maxCachedFile(maxCachedFile)
+{
+	struct stat info;
+	if(stat(root.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+		throw std::runtime_error("Could not open directory to serve: " + root);
+
+	while(m_root.size() > 1 && m_root.back() == '/')
+		m_root.pop_back();
+
+	m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	m_stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if(m_inotifyFd >= 0 && m_stopFd >= 0)
+	{
+		m_watcher = std::thread(&StaticFiles::watch, this);
+		return;
+	}
+
+	// Without change notifications the cache could serve stale files
+	if(m_inotifyFd >= 0)
+		close(m_inotifyFd);
+
+	if(m_stopFd >= 0)
+		close(m_stopFd);
+
+	m_inotifyFd = m_stopFd = -1;
+	m_cacheSize = 0;
+}
+
+StaticFiles::~StaticFiles()
+{
+	if(!m_watcher.joinable())
+		return;
+
+	uint64_t value = 1;
+	if(::write(m_stopFd, &value, sizeof(value)) < 0)
+		perror("Could not stop file watcher");
+
+	m_watcher.join();
+	close(m_inotifyFd);
+	close(m_stopFd);
+}
+
+void StaticFiles::watch()
+{
+	alignas(struct inotify_event) char buffer[4096];
+	struct pollfd fds[2] = {{m_inotifyFd, POLLIN, 0}, {m_stopFd, POLLIN, 0}};
+
+	while(true)
+	{
+		if(poll(fds, 2, -1) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+
+			return;
+		}
+
+		if(fds[1].revents)
+			return;
+
+		ssize_t length;
+		while((length = read(m_inotifyFd, buffer, sizeof(buffer))) > 0)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for(char* position = buffer; position < buffer + length;)
+			{
+				auto event = reinterpret_cast<const struct inotify_event*>(position);
+				position += sizeof(struct inotify_event) + event->len;
+
+				// Lost events may have concerned any file
+				if(event->mask & IN_Q_OVERFLOW)
+				{
+					clear();
+					continue;
+				}
+
+				auto directory = m_watches.find(event->wd);
+				if(directory == m_watches.end())
+					continue;
+
+				if(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+					clear();
+				else if(event->len)
+					invalidate(directory->second + "/" + event->name);
+
+				if(event->mask & IN_IGNORED)
+					m_watches.erase(directory);
+			}
+		}
+	}
+}
+
+void StaticFiles::invalidate(const std::string& path)
+{
+	auto iter = m_cache.find(path);
+	if(iter == m_cache.end())
+		return;
+
+	m_cachedBytes -= (*iter->second)->size;
+	m_lru.erase(iter->second);
+	m_cache.erase(iter);
+}
+
+void StaticFiles::clear()
+{
+	m_lru.clear();
+	m_cache.clear();
+	m_cachedBytes = 0;
+}
+
+std::shared_ptr<const StaticFiles::Entry> StaticFiles::find(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto iter = m_cache.find(path);
+	if(iter == m_cache.end())
+		return nullptr;
+
+	m_lru.splice(m_lru.begin(), m_lru, iter->second);
+	return *iter->second;
+}
+
+std::shared_ptr<const StaticFiles::Entry> StaticFiles::load(const std::string& path, int& fd)
+{
+	fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return nullptr;
+
+	struct stat info;
+	if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+	{
+		close(fd);
+		fd = -1;
+		return nullptr;
+	}
+
+	char etag[64];
+	snprintf(etag, sizeof(etag), "\"%llx-%llx\"", (unsigned long long) info.st_mtim.tv_sec * 1000000000ull + info.st_mtim.tv_nsec,
+			 (unsigned long long) info.st_size);
+
+	auto entry = std::make_shared<Entry>();
+	entry->path = path;
+	entry->size = info.st_size;
+	entry->modified = info.st_mtim.tv_sec;
+	entry->etag = etag;
+	entry->lastModified = formatDate(info.st_mtim.tv_sec);
+	entry->contentType = getContentType(path);
+
+	if(entry->size > m_maxCachedFile || entry->size > m_cacheSize)
+		return entry;
+
+	{
+		// Watched before reading, so no change can go unnoticed
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::string directory = path.substr(0, path.rfind('/'));
+		int wd = inotify_add_watch(m_inotifyFd, directory.c_str(), WATCH_EVENTS);
+		if(wd < 0)
+			return entry;
+
+		m_watches[wd] = directory;
+	}
+
+	auto content = std::make_shared<std::string>(entry->size, '\0');
+	size_t offset = 0;
+	while(offset < content->size())
+	{
+		ssize_t count = pread(fd, &(*content)[offset], content->size() - offset, offset);
+		if(count < 0 && errno == EINTR)
+			continue;
+
+		if(count <= 0)
+			return entry;
+
+		offset += count;
+	}
+
+	// A file which changed while it was read is sent from disk
+	struct stat after;
+	if(fstat(fd, &after) != 0 || after.st_size != info.st_size
+			|| after.st_mtim.tv_sec != info.st_mtim.tv_sec || after.st_mtim.tv_nsec != info.st_mtim.tv_nsec)
+		return entry;
+
+	close(fd);
+	fd = -1;
+
+	entry->content = content;
+	insert(entry);
+	return entry;
+}
+
+void StaticFiles::insert(const std::shared_ptr<const Entry>& entry)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	invalidate(entry->path);
+
+	while(!m_lru.empty() && m_cachedBytes + entry->size > m_cacheSize)
+		invalidate(m_lru.back()->path);
+
+	m_lru.push_front(entry);
+	m_cache[entry->path] = m_lru.begin();
+	m_cachedBytes += entry->size;
+}
+
+size_t StaticFiles::getCachedBytes() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_cachedBytes;
+}
+
+bool StaticFiles::serve(const Request& request, const Responder& responder)
+{
+	const std::string& method = request.getMethod();
+	if(method != "GET" && method != "HEAD")
+		return false;
+
+	std::string path;
+	if(!decodePath(request.getUrl(), path))
+		return false;
+
+	path.insert(0, m_root);
+	if(path.back() == '/')
+		path += "index.html";
+
+	int fd = -1;
+	auto entry = find(path);
+	if(!entry)
+		entry = load(path, fd);
+
+	if(!entry)
+		return false;
+
+	// Closes the descriptor unless it is handed to the response
+	Segment file;
+	if(fd >= 0)
+		file = Segment::fromFile(fd, 0, entry->size);
+
+	Request response;
+	response[HeaderId::ETag] = entry->etag;
+	response[HeaderId::LastModified] = entry->lastModified;
+	response[HeaderId::AcceptRanges] = "bytes";
+
+	// If-None-Match takes precedence over If-Modified-Since
+	std::string_view noneMatch = request.getHeader(HeaderId::IfNoneMatch);
+	std::string_view modifiedSince = request.getHeader(HeaderId::IfModifiedSince);
+	time_t since;
+
+	if(!noneMatch.empty() ? matchesEtag(noneMatch, entry->etag)
+			: (!modifiedSince.empty() && parseDate(modifiedSince, since) && entry->modified <= since))
+	{
+		response.setResponse(304);
+		responder.send(response);
+		return true;
+	}
+
+	uint64_t start = 0, end = entry->size;
+	Range range = Range::None;
+
+	// A Range only applies to the representation named by If-Range
+	std::string_view ifRange = request.getHeader(HeaderId::IfRange);
+	if(ifRange.empty() || ifRange == entry->etag || ifRange == entry->lastModified)
+		range = parseRange(request.getHeader(HeaderId::Range), entry->size, start, end);
+
+	if(range == Range::Unsatisfiable)
+	{
+		response.setResponse(416);
+		response[HeaderId::ContentRange] = "bytes */" + std::to_string(entry->size);
+		responder.send(response);
+		return true;
+	}
+
+	response[HeaderId::ContentType] = entry->contentType;
+	if(range == Range::Satisfiable)
+	{
+		response.setResponse(206);
+		response[HeaderId::ContentRange] = "bytes " + std::to_string(start) + "-" + std::to_string(end - 1)
+				+ "/" + std::to_string(entry->size);
+	}
+	else
+		response.setResponse(200);
+
+	Segment body;
+	if(entry->content)
+		body = Segment{entry, entry->content->data() + start, size_t(end - start)};
+	else
+	{
+		body = std::move(file);
+		body.offset = start;
+		body.size = end - start;
+	}
+
+	responder.send(response, std::move(body));
+	return true;
+}
+
+void StaticFiles::operator()(const std::shared_ptr<Request>& request, const Responder& responder)
+{
+	if(serve(*request, responder))
+		return;
+
+	Request response;
+	response.setResponse(404);
+	response[HeaderId::ContentType] = "text/plain";
+	response << "Not Found";
+	responder.send(std::move(response));
+}
+
+std::string_view StaticFiles::getContentType(std::string_view path)
+{
+	static const std::pair<std::string_view, std::string_view> TYPES[] = {
+		{"html", "text/html; charset=utf-8"}, {"htm", "text/html; charset=utf-8"},
+		{"css", "text/css; charset=utf-8"}, {"js", "text/javascript; charset=utf-8"},
+		{"mjs", "text/javascript; charset=utf-8"}, {"json", "application/json"},
+		{"txt", "text/plain; charset=utf-8"}, {"xml", "application/xml"},
+		{"svg", "image/svg+xml"}, {"png", "image/png"}, {"jpg", "image/jpeg"},
+		{"jpeg", "image/jpeg"}, {"gif", "image/gif"}, {"webp", "image/webp"},
+		{"avif", "image/avif"}, {"ico", "image/x-icon"}, {"woff", "font/woff"},
+		{"woff2", "font/woff2"}, {"ttf", "font/ttf"}, {"wasm", "application/wasm"},
+		{"pdf", "application/pdf"}, {"zip", "application/zip"}, {"gz", "application/gzip"},
+		{"mp4", "video/mp4"}, {"webm", "video/webm"}, {"mp3", "audio/mpeg"}, {"ogg", "audio/ogg"}
+	};
+
+	size_t dot = path.rfind('.');
+	size_t slash = path.rfind('/');
+	if(dot == std::string_view::npos || (slash != std::string_view::npos && dot < slash))
+		return "application/octet-stream";
+
+	std::string_view extension = path.substr(dot + 1);
+	for(const auto& type : TYPES)
+	{
+		if(Headers::equalsIgnoreCase(extension, type.first))
+			return type.second;
+	}
+
+	return "application/octet-stream";
+}
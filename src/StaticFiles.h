@@ -0,0 +1,122 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_STATICFILES_H
+#define TLHTTP_STATICFILES_H
+
+#include <sys/types.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "Connection.h"
+
+namespace tlhttp
+{
+
+/**
+ * @brief Serves the files below a directory.
+ *
+ * Files are sent with sendfile(), so their contents never pass through
+ * user space. Small files which are requested are kept in memory instead,
+ * which saves opening them for every request. The cache is invalidated
+ * through inotify as soon as a file changes.
+ *
+ * Supports single byte ranges, conditional requests with If-None-Match and
+ * If-Modified-Since, and HEAD requests.
+ *
+ * Can be passed to Server::startAsync() with std::ref() and is safe to use
+ * from several reactors at once.
+ */
+class StaticFiles
+{
+	struct Entry
+	{
+		std::string path;
+		std::shared_ptr<const std::string> content; ///< nullptr for files which are not cached
+		uint64_t size;
+		time_t modified;
+		std::string etag, lastModified;
+		std::string_view contentType;
+	};
+
+	typedef std::list<std::shared_ptr<const Entry>> EntryList;
+
+	std::string m_root;
+	size_t m_cacheSize, m_maxCachedFile;
+
+	mutable std::mutex m_mutex;
+	EntryList m_lru; ///< The most recently used entry first
+	std::unordered_map<std::string, EntryList::iterator> m_cache;
+	std::unordered_map<int, std::string> m_watches;
+	size_t m_cachedBytes = 0;
+
+	int m_inotifyFd, m_stopFd;
+	std::thread m_watcher;
+
+	std::shared_ptr<const Entry> find(const std::string& path);
+	std::shared_ptr<const Entry> load(const std::string& path, int& fd);
+	void insert(const std::shared_ptr<const Entry>& entry);
+	void watch();
+
+	// Called with the mutex locked
+	void invalidate(const std::string& path);
+	void clear();
+
+public:
+	/**
+	 * @param root The directory to serve.
+	 * @param cacheSize The number of bytes kept in memory for all files.
+	 * @param maxCachedFile Larger files are always sent from disk.
+	 * @throws std::runtime_error if the directory can not be opened.
+	 */
+	StaticFiles(const std::string& root, size_t cacheSize = 64 * 1024 * 1024, size_t maxCachedFile = 256 * 1024);
+	~StaticFiles();
+
+	StaticFiles(const StaticFiles&) = delete;
+	StaticFiles& operator=(const StaticFiles&) = delete;
+
+	/**
+	 * @brief Answers a request for a file.
+	 * @return false if the request is not a GET or HEAD request for an
+	 * existing file, nothing was sent then.
+	 */
+	bool serve(const Request& request, const Responder& responder);
+
+	/**
+	 * @brief Answers a request, with 404 if there is no such file.
+	 */
+	void operator()(const std::shared_ptr<Request>& request, const Responder& responder);
+
+	/**
+	 * @brief Guesses the media type from the file extension.
+	 */
+	static std::string_view getContentType(std::string_view path);
+
+	/**
+	 * @brief Returns the number of bytes of all cached files.
+	 */
+	size_t getCachedBytes() const;
+};
+
+}
+
+#endif //TLHTTP_STATICFILES_H
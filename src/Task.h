@@ -0,0 +1,246 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_TASK_H
+#define TLHTTP_TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "EventLoop.h"
+
+namespace tlhttp
+{
+
+template<typename T = void>
+class Task;
+
+namespace detail
+{
+class TaskPromiseBase
+{
+	struct FinalAwaiter
+	{
+		bool await_ready() noexcept { return false; }
+
+		template<typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+		{
+			TaskPromiseBase& promise = handle.promise();
+			if(promise.m_continuation)
+				return promise.m_continuation;
+
+			if(promise.m_detached)
+				handle.destroy();
+
+			return std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+public:
+	std::coroutine_handle<> m_continuation;
+	std::exception_ptr m_exception;
+	bool m_detached = false;
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	FinalAwaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() { m_exception = std::current_exception(); }
+};
+
+template<typename T>
+class TaskPromise : public TaskPromiseBase
+{
+public:
+	std::optional<T> m_value;
+
+	Task<T> get_return_object();
+
+	template<typename U>
+	void return_value(U&& value) { m_value.emplace(std::forward<U>(value)); }
+
+	T result()
+	{
+		if(m_exception)
+			std::rethrow_exception(m_exception);
+
+		return std::move(*m_value);
+	}
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+	Task<void> get_return_object();
+
+	void return_void() {}
+
+	void result()
+	{
+		if(m_exception)
+			std::rethrow_exception(m_exception);
+	}
+};
+}
+
+/**
+ * @brief A lazily started coroutine.
+ *
+ * The coroutine starts running when the task is awaited and resumes the
+ * awaiting coroutine when it is done. Exceptions are rethrown to the awaiting
+ * coroutine. Use spawn() to start a task nobody waits for.
+ */
+template<typename T>
+class Task
+{
+public:
+	typedef detail::TaskPromise<T> promise_type;
+
+private:
+	std::coroutine_handle<promise_type> m_handle;
+
+	struct Awaiter
+	{
+		std::coroutine_handle<promise_type> handle;
+
+		bool await_ready() noexcept { return false; }
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			handle.promise().m_continuation = awaiting;
+			return handle;
+		}
+
+		T await_resume() { return handle.promise().result(); }
+	};
+
+public:
+	explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+	Task(Task&& task) noexcept : m_handle(std::exchange(task.m_handle, nullptr)) {}
+
+	Task& operator=(Task&& task) noexcept
+	{
+		if(this != &task)
+		{
+			if(m_handle)
+				m_handle.destroy();
+
+			m_handle = std::exchange(task.m_handle, nullptr);
+		}
+
+		return *this;
+	}
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	~Task()
+	{
+		if(m_handle)
+			m_handle.destroy();
+	}
+
+	Awaiter operator co_await() && { return Awaiter{m_handle}; }
+
+	/**
+	 * @brief Starts the coroutine and lets it destroy itself when done.
+	 *
+	 * Exceptions thrown by a detached task are discarded.
+	 */
+	void detach()
+	{
+		auto handle = std::exchange(m_handle, nullptr);
+		handle.promise().m_detached = true;
+		handle.resume();
+	}
+};
+
+namespace detail
+{
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object()
+{
+	return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object()
+{
+	return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+}
+
+/**
+ * @brief Starts a task without waiting for it.
+ * @param task The task to run, it destroys itself once finished.
+ */
+inline void spawn(Task<void>&& task)
+{
+	task.detach();
+}
+
+/**
+ * @brief Runs an event loop until a task completed.
+ *
+ * Useful to drive asynchronous code from a thread which is not running
+ * an event loop already.
+ *
+ * @param loop The loop which is not running yet.
+ * @param task The task to run on the loop thread.
+ * @return The result of the task.
+ * @throws Any exception thrown by the task.
+ */
+template<typename T>
+T syncWait(EventLoop& loop, Task<T>&& task)
+{
+	std::exception_ptr exception;
+	std::optional<typename std::conditional<std::is_void<T>::value, bool, T>::type> result;
+
+	auto wrapper = [&]() -> Task<void> {
+		try
+		{
+			if constexpr(std::is_void<T>::value)
+			{
+				co_await std::move(task);
+				result.emplace(true);
+			}
+			else
+				result.emplace(co_await std::move(task));
+		}
+		catch(...)
+		{
+			exception = std::current_exception();
+		}
+
+		loop.stop();
+	};
+
+	loop.post([&wrapper]() { spawn(wrapper()); });
+	loop.run();
+
+	if(exception)
+		std::rethrow_exception(exception);
+
+	if constexpr(!std::is_void<T>::value)
+		return std::move(*result);
+}
+
+}
+
+#endif //TLHTTP_TASK_H
@@ -0,0 +1,161 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <algorithm>
+
+#include "TimerWheel.h"
+
+using namespace tlhttp;
+
+void Timer::cancel()
+{
+	if(m_wheel)
+		m_wheel->unlink(*this);
+}
+
+TimerWheel::TimerWheel(std::chrono::milliseconds resolution)
+	: m_resolution(std::max(resolution, std::chrono::milliseconds(1))), m_start(Clock::now())
+{
+}
+
+TimerWheel::~TimerWheel()
+{
+	// Timers may outlive the wheel, they must not point to it anymore
+	for(auto& level : m_slots)
+	{
+		for(Timer*& slot : level)
+		{
+			while(slot)
+				unlink(*slot);
+		}
+	}
+}
+
+uint64_t TimerWheel::getTick(Clock::time_point now) const
+{
+	if(now <= m_start)
+		return 0;
+
+	return std::chrono::duration_cast<std::chrono::milliseconds>(now - m_start).count() / m_resolution.count();
+}
+
+void TimerWheel::insert(Timer& timer)
+{
+	// Timers which are due already go into the current slot
+	uint64_t delta = timer.m_expiry > m_current ? timer.m_expiry - m_current : 0;
+	if(!delta)
+		timer.m_expiry = m_current;
+
+	unsigned int level = 0;
+	while(level + 1 < LEVELS && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1))))
+		level++;
+
+	Timer*& head = m_slots[level][(timer.m_expiry >> (SLOT_BITS * level)) & (SLOTS - 1)];
+	timer.m_wheel = this;
+	timer.m_head = &head;
+	timer.m_prev = nullptr;
+	timer.m_next = head;
+
+	if(head)
+		head->m_prev = &timer;
+
+	head = &timer;
+	m_count++;
+}
+
+void TimerWheel::unlink(Timer& timer)
+{
+	if(timer.m_prev)
+		timer.m_prev->m_next = timer.m_next;
+	else
+		*timer.m_head = timer.m_next;
+
+	if(timer.m_next)
+		timer.m_next->m_prev = timer.m_prev;
+
+	timer.m_wheel = nullptr;
+	timer.m_head = nullptr;
+	timer.m_prev = timer.m_next = nullptr;
+	m_count--;
+}
+
+void TimerWheel::cascade(unsigned int level)
+{
+	// Every timer of the slot is due within the range of the levels below
+	Timer*& slot = m_slots[level][(m_current >> (SLOT_BITS * level)) & (SLOTS - 1)];
+	while(slot)
+	{
+		Timer& timer = *slot;
+		unlink(timer);
+		insert(timer);
+	}
+}
+
+void TimerWheel::schedule(Timer& timer, std::chrono::milliseconds delay, Clock::time_point now)
+{
+	timer.cancel();
+
+	// Nothing can expire while the wheel is empty, so it may skip ahead
+	uint64_t tick = getTick(now);
+	if(!m_count && tick > m_current)
+		m_current = tick;
+
+	uint64_t ticks = (std::max<std::chrono::milliseconds::rep>(delay.count(), 0) + m_resolution.count() - 1) / m_resolution.count();
+	uint64_t range = (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+
+	timer.m_expiry = std::max(tick, m_current) + std::max<uint64_t>(ticks, 1);
+	timer.m_expiry = std::min(timer.m_expiry, m_current + range);
+	insert(timer);
+}
+
+size_t TimerWheel::advance(Clock::time_point now)
+{
+	uint64_t tick = getTick(now);
+	size_t expired = 0;
+
+	while(m_current < tick)
+	{
+		if(!m_count)
+		{
+			m_current = tick;
+			break;
+		}
+
+		m_current++;
+
+		// Higher levels first, their timers may have to move down twice
+		for(unsigned int level = LEVELS - 1; level > 0; level--)
+		{
+			if((m_current & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) == 0)
+				cascade(level);
+		}
+
+		Timer*& slot = m_slots[0][m_current & (SLOTS - 1)];
+		while(slot)
+		{
+			Timer& timer = *slot;
+			unlink(timer);
+			expired++;
+
+			// The callback may destroy its own timer
+			Timer::Callback callback = timer.m_callback;
+			if(callback)
+				callback();
+		}
+	}
+
+	return expired;
+}
@@ -0,0 +1,142 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_TIMERWHEEL_H
+#define TLHTTP_TIMERWHEEL_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace tlhttp
+{
+
+class TimerWheel;
+
+/**
+ * @brief A timer which can be armed on a TimerWheel.
+ *
+ * Timers are linked into the wheel in place, arming and cancelling them
+ * never allocates. A timer is cancelled when it is destroyed.
+ */
+class Timer
+{
+public:
+	typedef std::function<void()> Callback;
+
+private:
+	friend class TimerWheel;
+
+	TimerWheel* m_wheel = nullptr;
+	Timer** m_head = nullptr;
+	Timer* m_prev = nullptr;
+	Timer* m_next = nullptr;
+	uint64_t m_expiry = 0;
+	Callback m_callback;
+
+public:
+	Timer() = default;
+	explicit Timer(const Callback& callback) : m_callback(callback) {}
+	~Timer() { cancel(); }
+
+	Timer(const Timer&) = delete;
+	Timer& operator=(const Timer&) = delete;
+
+	/**
+	 * @brief Sets the function called when the timer expires.
+	 */
+	void setCallback(const Callback& callback) { m_callback = callback; }
+
+	bool isArmed() const { return m_wheel != nullptr; }
+
+	/**
+	 * @brief Disarms the timer, does nothing if it is not armed.
+	 */
+	void cancel();
+};
+
+/**
+ * @brief Runs timers after a delay with a fixed resolution.
+ *
+ * The wheel has several levels of slots, each level covering a range 256
+ * times larger than the one below. Timers are put into the slot of their
+ * expiry on the lowest level which reaches that far and move down a level
+ * whenever the level below wrapped around. Arming, cancelling and expiring
+ * a timer are O(1), no matter how many timers are armed.
+ *
+ * The wheel is not thread-safe, it belongs to the thread advancing it.
+ */
+class TimerWheel
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	static constexpr unsigned int LEVELS = 4;
+	static constexpr unsigned int SLOT_BITS = 8;
+	static constexpr unsigned int SLOTS = 1u << SLOT_BITS;
+
+private:
+	friend class Timer;
+
+	std::chrono::milliseconds m_resolution;
+	Clock::time_point m_start;
+	uint64_t m_current = 0;
+	size_t m_count = 0;
+	Timer* m_slots[LEVELS][SLOTS] = {};
+
+	uint64_t getTick(Clock::time_point now) const;
+	void insert(Timer& timer);
+	void unlink(Timer& timer);
+	void cascade(unsigned int level);
+
+public:
+	/**
+	 * @param resolution The length of one tick, timers expire on tick boundaries.
+	 */
+	explicit TimerWheel(std::chrono::milliseconds resolution = std::chrono::milliseconds(10));
+	~TimerWheel();
+
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	/**
+	 * @brief Arms a timer, replacing an earlier expiry.
+	 *
+	 * The timer expires on the first tick at least delay after now.
+	 * Delays beyond the range of the wheel are shortened to it.
+	 */
+	void schedule(Timer& timer, std::chrono::milliseconds delay, Clock::time_point now = Clock::now());
+
+	/**
+	 * @brief Expires all timers which are due.
+	 *
+	 * Timers are disarmed before their callback runs, so the callback may
+	 * arm them again.
+	 *
+	 * @return The number of expired timers.
+	 */
+	size_t advance(Clock::time_point now = Clock::now());
+
+	size_t size() const { return m_count; }
+	bool empty() const { return m_count == 0; }
+
+	std::chrono::milliseconds getResolution() const { return m_resolution; }
+};
+
+}
+
+#endif //TLHTTP_TIMERWHEEL_H
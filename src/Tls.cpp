@@ -0,0 +1,512 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+
+#include "Tls.h"
+
+using namespace tlhttp;
+
+TlsContext::~TlsContext()
+{
+	for(auto& session : m_sessions)
+		SSL_SESSION_free(session.second);
+
+	SSL_CTX_free(m_context);
+}
+
+std::string TlsContext::getError()
+{
+	unsigned long error = ERR_get_error();
+	ERR_clear_error();
+	if(!error)
+		return "Unknown error";
+
+	char buffer[256];
+	ERR_error_string_n(error, buffer, sizeof(buffer));
+	return buffer;
+}
+
+std::string TlsContext::getHandshakeError(SSL* ssl)
+{
+	long result = SSL_get_verify_result(ssl);
+	if(result != X509_V_OK)
+	{
+		ERR_clear_error();
+		return std::string("Certificate verification failed: ") + X509_verify_cert_error_string(result);
+	}
+
+	return getError();
+}
+
+std::shared_ptr<TlsContext> TlsContext::createServer(const std::string& certificateFile, const std::string& keyFile)
+{
+	SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+	if(!ctx)
+		throw std::runtime_error("Could not create TLS context: " + getError());
+
+	auto context = std::make_shared<TlsContext>(ctx);
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+	uint64_t options = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE;
+#ifdef SSL_OP_ENABLE_KTLS
+	options |= SSL_OP_ENABLE_KTLS;
+#endif
+	SSL_CTX_set_options(ctx, options);
+
+	if(SSL_CTX_use_certificate_chain_file(ctx, certificateFile.c_str()) != 1)
+		throw std::runtime_error("Could not load certificate " + certificateFile + ": " + getError());
+
+	if(SSL_CTX_use_PrivateKey_file(ctx, keyFile.c_str(), SSL_FILETYPE_PEM) != 1)
+		throw std::runtime_error("Could not load private key " + keyFile + ": " + getError());
+
+	if(SSL_CTX_check_private_key(ctx) != 1)
+		throw std::runtime_error("Private key does not match the certificate: " + getError());
+
+	// Resumed handshakes skip the key exchange and the certificate, tickets
+	// work for TLS 1.3 and the cache covers TLS 1.2 clients without them.
+	static const unsigned char sessionContext[] = "tlhttp";
+	SSL_CTX_set_session_id_context(ctx, sessionContext, sizeof(sessionContext) - 1);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(ctx, 20480);
+	SSL_CTX_set_num_tickets(ctx, 1);
+
+	return context;
+}
+
+std::shared_ptr<TlsContext> TlsContext::createClient(bool verifyPeer)
+{
+	SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+	if(!ctx)
+		throw std::runtime_error("Could not create TLS context: " + getError());
+
+	auto context = std::make_shared<TlsContext>(ctx);
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+	// Many servers close without close_notify, messages are framed by HTTP
+	SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+
+	if(verifyPeer)
+	{
+		if(SSL_CTX_set_default_verify_paths(ctx) != 1)
+			throw std::runtime_error("Could not load the trusted certificates: " + getError());
+
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+	}
+
+	// New sessions are reported through the callback, TLS 1.3 tickets
+	// only arrive after the handshake
+	SSL_CTX_set_app_data(ctx, context.get());
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, onNewSession);
+
+	return context;
+}
+
+const std::shared_ptr<TlsContext>& TlsContext::getDefaultClient()
+{
+	static const std::shared_ptr<TlsContext> context = createClient();
+	return context;
+}
+
+int TlsContext::getSessionKeyIndex()
+{
+	static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr,
+		[](void*, void* key, CRYPTO_EX_DATA*, int, long, void*) {
+			delete static_cast<std::string*>(key);
+		});
+
+	return index;
+}
+
+void TlsContext::prepareClient(SSL* ssl, const std::string& host, uint16_t port)
+{
+	unsigned char address[sizeof(struct in6_addr)];
+	bool numeric = inet_pton(AF_INET, host.c_str(), address) == 1 || inet_pton(AF_INET6, host.c_str(), address) == 1;
+
+	// Server names must not be IP addresses
+	if(!numeric)
+		SSL_set_tlsext_host_name(ssl, host.c_str());
+
+	if(SSL_get_verify_mode(ssl) & SSL_VERIFY_PEER)
+	{
+		if(numeric)
+			X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host.c_str());
+		else
+			SSL_set1_host(ssl, host.c_str());
+	}
+
+	std::string key = host + ":" + std::to_string(port);
+	SSL_set_ex_data(ssl, getSessionKeyIndex(), new std::string(key));
+
+	std::lock_guard<std::mutex> lock(m_sessionMutex);
+	auto iter = m_sessions.find(key);
+	if(iter != m_sessions.end())
+		SSL_set_session(ssl, iter->second);
+}
+
+int TlsContext::onNewSession(SSL* ssl, SSL_SESSION* session)
+{
+	auto context = static_cast<TlsContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+	auto key = static_cast<const std::string*>(SSL_get_ex_data(ssl, getSessionKeyIndex()));
+	if(!context || !key)
+		return 0;
+
+	std::lock_guard<std::mutex> lock(context->m_sessionMutex);
+	auto iter = context->m_sessions.find(*key);
+	if(iter != context->m_sessions.end())
+	{
+		SSL_SESSION_free(iter->second);
+		iter->second = session;
+		return 1;
+	}
+
+	if(context->m_sessions.size() >= MAX_SESSIONS)
+	{
+		SSL_SESSION_free(context->m_sessions.begin()->second);
+		context->m_sessions.erase(context->m_sessions.begin());
+	}
+
+	// Returning 1 keeps the reference
+	context->m_sessions.emplace(*key, session);
+	return 1;
+}
+
+void TlsContext::setAlpnProtocols(const std::vector<std::string>& protocols)
+{
+	m_alpn.clear();
+	for(const std::string& protocol : protocols)
+	{
+		if(protocol.empty() || protocol.size() > 255)
+			throw std::runtime_error("Invalid ALPN protocol name: " + protocol);
+
+		m_alpn += char(protocol.size());
+		m_alpn += protocol;
+	}
+
+	// Returns 0 on success unlike most of OpenSSL
+	if(SSL_CTX_set_alpn_protos(m_context, reinterpret_cast<const unsigned char*>(m_alpn.data()), m_alpn.size()) != 0)
+		throw std::runtime_error("Could not set ALPN protocols: " + getError());
+
+	SSL_CTX_set_alpn_select_cb(m_context, m_alpn.empty() ? nullptr : onAlpnSelect, this);
+}
+
+int TlsContext::onAlpnSelect(SSL*, const unsigned char** out, unsigned char* outLength,
+							 const unsigned char* in, unsigned int inLength, void* arg)
+{
+	auto context = static_cast<const TlsContext*>(arg);
+	auto protocols = reinterpret_cast<const unsigned char*>(context->m_alpn.data());
+
+	// The first protocol of the server which the client offers as well
+	unsigned char* selected;
+	if(SSL_select_next_proto(&selected, outLength, protocols, context->m_alpn.size(), in, inLength) != OPENSSL_NPN_NEGOTIATED)
+		return SSL_TLSEXT_ERR_NOACK;
+
+	*out = selected;
+	return SSL_TLSEXT_ERR_OK;
+}
+
+size_t TlsContext::getSessionCount() const
+{
+	std::lock_guard<std::mutex> lock(m_sessionMutex);
+	return m_sessions.size();
+}
+
+std::string_view TlsStream::getAlpnProtocol() const
+{
+	const unsigned char* protocol;
+	unsigned int length;
+	SSL_get0_alpn_selected(m_ssl, &protocol, &length);
+
+	return std::string_view(reinterpret_cast<const char*>(protocol), length);
+}
+
+TlsStream::TlsStream(const std::shared_ptr<TlsContext>& context, int fd, bool server)
+	: m_context(context), m_ssl(SSL_new(context->get())), m_fd(fd)
+{
+	if(!m_ssl)
+		throw std::runtime_error("Could not create TLS session: " + TlsContext::getError());
+
+	// The handshake uses the socket, so OpenSSL can enable kernel TLS
+	SSL_set_fd(m_ssl, fd);
+	if(server)
+		SSL_set_accept_state(m_ssl);
+	else
+		SSL_set_connect_state(m_ssl);
+}
+
+TlsStream::~TlsStream()
+{
+	SSL_free(m_ssl);
+}
+
+void TlsStream::handshake(EventLoop& loop, const std::weak_ptr<EventLoop::SocketHandler>& handler,
+						  const HandshakeCallback& callback)
+{
+	m_loop = &loop;
+	m_handler = handler;
+	m_onHandshake = callback;
+
+	std::weak_ptr<TlsStream> weak = shared_from_this();
+	loop.add(m_fd, EPOLLIN, [weak](uint32_t) {
+		if(auto stream = weak.lock())
+			stream->continueHandshake();
+	});
+
+	continueHandshake();
+}
+
+void TlsStream::continueHandshake()
+{
+	if(!m_onHandshake)
+		return;
+
+	ERR_clear_error();
+	int result = SSL_do_handshake(m_ssl);
+	if(result == 1)
+	{
+		finishHandshake(true);
+		return;
+	}
+
+	switch(SSL_get_error(m_ssl, result))
+	{
+		case SSL_ERROR_WANT_READ:
+			if(m_waitingForWrite)
+				m_loop->modify(m_fd, EPOLLIN);
+
+			m_waitingForWrite = false;
+			break;
+
+		case SSL_ERROR_WANT_WRITE:
+			if(!m_waitingForWrite)
+				m_loop->modify(m_fd, EPOLLIN | EPOLLOUT);
+
+			m_waitingForWrite = true;
+			break;
+
+		default:
+			// The error queue is left for getHandshakeError()
+			finishHandshake(false);
+	}
+}
+
+void TlsStream::finishHandshake(bool success)
+{
+	HandshakeCallback callback;
+	std::swap(callback, m_onHandshake);
+	m_loop->remove(m_fd);
+
+	if(success)
+	{
+		m_established = true;
+
+#ifndef OPENSSL_NO_KTLS
+		m_kernelSend = BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+		m_kernelReceive = BIO_get_ktls_recv(SSL_get_rbio(m_ssl));
+#endif
+
+		if(m_kernelSend && m_kernelReceive)
+			m_loop->attach(m_fd, m_handler);
+		else
+		{
+			// The remaining records go through memory buffers, so the loop
+			// keeps doing the actual I/O with either backend
+			BIO* socket = SSL_get_rbio(m_ssl);
+			SSL_set_bio(m_ssl, m_kernelReceive ? socket : BIO_new(BIO_s_mem()),
+						m_kernelSend ? socket : BIO_new(BIO_s_mem()));
+
+			m_buffer.resize(16384);
+			m_loop->attach(m_fd, std::weak_ptr<EventLoop::SocketHandler>(shared_from_this()));
+		}
+	}
+
+	callback(success);
+}
+
+bool TlsStream::readCipher(std::string& out)
+{
+	BIO* bio = SSL_get_wbio(m_ssl);
+	size_t pending = BIO_ctrl_pending(bio);
+	if(!pending)
+		return true;
+
+	size_t start = out.size();
+	out.resize(start + pending);
+	return BIO_read(bio, &out[start], pending) == int(pending);
+}
+
+void TlsStream::send(const std::shared_ptr<const Segments>& data)
+{
+	if(m_kernelSend)
+	{
+		m_loop->send(m_fd, data);
+		return;
+	}
+
+	m_plain = data;
+	m_plainOffset = 0;
+	pump();
+}
+
+void TlsStream::pump()
+{
+	if(m_sending || m_kernelSend)
+		return;
+
+	int error = 0;
+	std::string cipher;
+	if(!readCipher(cipher))
+		error = EPROTO;
+
+	while(!error && m_plain && m_plainOffset < m_plain->size() && cipher.size() < SEND_BATCH)
+	{
+		size_t offset = m_plainOffset;
+		const Segment& segment = m_plain->locate(offset);
+
+		size_t size = std::min(segment.size - offset, SEND_BATCH);
+		const char* data = segment.data + offset;
+
+		if(segment.isFile())
+		{
+			ssize_t count = pread(segment.fd, m_buffer.data(), std::min(size, m_buffer.size()), segment.offset + offset);
+			if(count < 0 && errno == EINTR)
+				continue;
+
+			if(count <= 0)
+			{
+				error = (count < 0 ? errno : EIO);
+				break;
+			}
+
+			size = count;
+			data = m_buffer.data();
+		}
+
+		ERR_clear_error();
+		if(SSL_write(m_ssl, data, size) <= 0 || !readCipher(cipher))
+		{
+			ERR_clear_error();
+			error = EPROTO;
+			break;
+		}
+
+		m_plainOffset += size;
+	}
+
+	if(!error && !cipher.empty())
+	{
+		m_sending = true;
+		m_loop->send(m_fd, std::make_shared<Segments>(std::move(cipher)));
+		return;
+	}
+
+	if(!m_plain || (!error && m_plainOffset < m_plain->size()))
+		return;
+
+	m_plain.reset();
+	if(auto handler = m_handler.lock())
+		handler->onSent(error);
+}
+
+void TlsStream::shutdown()
+{
+	if(!m_established || m_sending || m_eof)
+		return;
+
+	ERR_clear_error();
+	SSL_shutdown(m_ssl);
+
+	std::string cipher;
+	if(!m_kernelSend && readCipher(cipher) && !cipher.empty())
+		::send(m_fd, cipher.data(), cipher.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+
+	ERR_clear_error();
+	m_eof = true;
+}
+
+void TlsStream::onReceive(const char* data, size_t size)
+{
+	auto handler = m_handler.lock();
+	if(!handler)
+		return;
+
+	if(m_kernelReceive)
+	{
+		handler->onReceive(data, size);
+		return;
+	}
+
+	BIO_write(SSL_get_rbio(m_ssl), data, size);
+	while(!m_eof)
+	{
+		ERR_clear_error();
+		int count = SSL_read(m_ssl, m_buffer.data(), m_buffer.size());
+		if(count > 0)
+		{
+			handler->onReceive(m_buffer.data(), count);
+			continue;
+		}
+
+		// Anything but a partial record is a close_notify or a broken stream
+		if(SSL_get_error(m_ssl, count) != SSL_ERROR_WANT_READ)
+		{
+			ERR_clear_error();
+			m_eof = true;
+		}
+
+		break;
+	}
+}
+
+void TlsStream::onReceiveDone(bool eof)
+{
+	auto self = shared_from_this();
+
+	// Reading may have produced records to send, like a key update
+	pump();
+
+	if(auto handler = m_handler.lock())
+		handler->onReceiveDone(eof || m_eof);
+}
+
+void TlsStream::onSent(int error)
+{
+	auto self = shared_from_this();
+	m_sending = false;
+
+	if(!error && !m_kernelSend)
+	{
+		pump();
+		return;
+	}
+
+	if(m_kernelSend || m_plain)
+	{
+		m_plain.reset();
+		if(auto handler = m_handler.lock())
+			handler->onSent(error);
+	}
+}
@@ -0,0 +1,256 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_TLS_H
+#define TLHTTP_TLS_H
+
+#include <openssl/ssl.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "EventLoop.h"
+
+namespace tlhttp
+{
+
+/**
+ * @brief An SSL_CTX shared by all connections using the same settings.
+ *
+ * Keeping one context makes the certificate, the session cache and the
+ * ticket keys common to all connections and reactors, so a client can
+ * resume its session on any of them.
+ */
+class TlsContext
+{
+	SSL_CTX* m_context;
+
+	// Client sessions by host and port, handed out for resumption
+	mutable std::mutex m_sessionMutex;
+	std::unordered_map<std::string, SSL_SESSION*> m_sessions;
+
+	// The ALPN protocols in wire format, by preference
+	std::string m_alpn;
+
+	static int getSessionKeyIndex();
+	static int onNewSession(SSL* ssl, SSL_SESSION* session);
+	static int onAlpnSelect(SSL* ssl, const unsigned char** out, unsigned char* outLength,
+							const unsigned char* in, unsigned int inLength, void* arg);
+
+public:
+	/**
+	 * @brief The number of hosts sessions are kept for.
+	 */
+	static constexpr size_t MAX_SESSIONS = 1024;
+
+	/**
+	 * @brief Takes over a configured context.
+	 */
+	explicit TlsContext(SSL_CTX* context) : m_context(context) {}
+	~TlsContext();
+
+	TlsContext(const TlsContext&) = delete;
+	TlsContext& operator=(const TlsContext&) = delete;
+
+	/**
+	 * @brief Creates a context for a server.
+	 *
+	 * Sessions are resumed with tickets and through a server side cache.
+	 * Kernel TLS is enabled where OpenSSL and the kernel support it.
+	 *
+	 * @param certificateFile The PEM file with the certificate chain.
+	 * @param keyFile The PEM file with the private key.
+	 * @throws std::runtime_error if the files can not be loaded.
+	 */
+	static std::shared_ptr<TlsContext> createServer(const std::string& certificateFile, const std::string& keyFile);
+
+	/**
+	 * @brief Creates a context for clients.
+	 *
+	 * The last session of every host is kept, so reconnecting resumes it
+	 * instead of doing a full handshake.
+	 *
+	 * @param verifyPeer Whether to check the certificate against the
+	 * system's trust store and the host name.
+	 * @throws std::runtime_error on failure.
+	 */
+	static std::shared_ptr<TlsContext> createClient(bool verifyPeer = true);
+
+	/**
+	 * @brief Returns the client context used when none is given.
+	 *
+	 * It is created on first use and verifies peers.
+	 */
+	static const std::shared_ptr<TlsContext>& getDefaultClient();
+
+	/**
+	 * @brief Prepares a client session for connecting to a host.
+	 *
+	 * Sets the server name and the name to verify, and offers the last
+	 * session of the host for resumption.
+	 */
+	void prepareClient(SSL* ssl, const std::string& host, uint16_t port);
+
+	/**
+	 * @brief Sets the application protocols negotiated with ALPN.
+	 *
+	 * Clients offer them, servers pick the first one the client offers as
+	 * well and continue without ALPN if there is none.
+	 *
+	 * @param protocols The protocol names by preference, e.g. "h2".
+	 * @note Must be called before the context is used.
+	 */
+	void setAlpnProtocols(const std::vector<std::string>& protocols);
+
+	/**
+	 * @brief Returns the number of hosts with a resumable session.
+	 */
+	size_t getSessionCount() const;
+
+	SSL_CTX* get() const { return m_context; }
+
+	/**
+	 * @brief Returns the last OpenSSL error as a string and clears the queue.
+	 */
+	static std::string getError();
+
+	/**
+	 * @brief Describes why a handshake failed, including verification errors.
+	 */
+	static std::string getHandshakeError(SSL* ssl);
+};
+
+/**
+ * @brief The TLS state of one non-blocking socket.
+ *
+ * The handshake reads and writes the socket directly, so OpenSSL can
+ * hand the connection over to kernel TLS afterwards. The socket is then
+ * used like a plain one and files can still be sent with sendfile().
+ *
+ * Otherwise records are processed in user space: the stream is attached
+ * to the event loop in place of the socket handler, decrypts what the loop
+ * receives and encrypts what is sent in batches.
+ */
+class TlsStream : public EventLoop::SocketHandler, public std::enable_shared_from_this<TlsStream>
+{
+public:
+	typedef std::function<void(bool)> HandshakeCallback;
+
+	/**
+	 * @brief The amount of plain data encrypted before it is sent.
+	 */
+	static constexpr size_t SEND_BATCH = 256 * 1024;
+
+private:
+	std::shared_ptr<TlsContext> m_context;
+	SSL* m_ssl;
+	int m_fd;
+
+	EventLoop* m_loop = nullptr;
+	std::weak_ptr<EventLoop::SocketHandler> m_handler;
+	HandshakeCallback m_onHandshake;
+	bool m_established = false, m_eof = false, m_waitingForWrite = false;
+	bool m_kernelSend = false, m_kernelReceive = false;
+
+	// The data being encrypted and how much of it was passed to OpenSSL
+	std::shared_ptr<const Segments> m_plain;
+	size_t m_plainOffset = 0;
+	bool m_sending = false;
+	std::vector<char> m_buffer;
+
+	void continueHandshake();
+	void finishHandshake(bool success);
+	void pump();
+	bool readCipher(std::string& out);
+
+	void onReceive(const char* data, size_t size) override;
+	void onReceiveDone(bool eof) override;
+	void onSent(int error) override;
+
+public:
+	/**
+	 * @param context The shared context.
+	 * @param fd The connected, non-blocking socket.
+	 * @param server Whether to accept the handshake instead of initiating it.
+	 * @throws std::runtime_error if OpenSSL fails.
+	 */
+	TlsStream(const std::shared_ptr<TlsContext>& context, int fd, bool server);
+	~TlsStream();
+
+	TlsStream(const TlsStream&) = delete;
+	TlsStream& operator=(const TlsStream&) = delete;
+
+	/**
+	 * @brief Performs the handshake without blocking the loop.
+	 *
+	 * The socket is watched until the handshake finished and is then
+	 * attached to the loop again, either directly with kernel TLS or
+	 * through the stream.
+	 *
+	 * @param loop The loop the socket belongs to.
+	 * @param handler Receives the decrypted data afterwards.
+	 * @param callback Called with the result once the handshake finished.
+	 * @note Must be called on the loop thread.
+	 */
+	void handshake(EventLoop& loop, const std::weak_ptr<EventLoop::SocketHandler>& handler,
+				   const HandshakeCallback& callback);
+
+	/**
+	 * @brief Encrypts and writes data.
+	 *
+	 * The handler's onSent() is called once everything was written, only
+	 * one send may be in flight. With kernel TLS the data is handed to
+	 * the loop unchanged.
+	 */
+	void send(const std::shared_ptr<const Segments>& data);
+
+	/**
+	 * @brief Sends a close_notify alert if nothing else is being written.
+	 *
+	 * Peers only resume sessions which were closed properly. The alert is
+	 * written without waiting, the socket is closed afterwards anyway.
+	 */
+	void shutdown();
+
+	bool isEstablished() const { return m_established; }
+	bool isHandshaking() const { return m_onHandshake != nullptr; }
+
+	/**
+	 * @brief Checks if records are sent and received by the kernel.
+	 */
+	bool isKernelTls() const { return m_kernelSend && m_kernelReceive; }
+
+	/**
+	 * @brief Checks if the handshake resumed an earlier session.
+	 */
+	bool isResumed() const { return SSL_session_reused(m_ssl); }
+
+	/**
+	 * @brief Returns the protocol negotiated with ALPN, empty if there is none.
+	 */
+	std::string_view getAlpnProtocol() const;
+
+	SSL* getHandle() const { return m_ssl; }
+};
+
+}
+
+#endif //TLHTTP_TLS_H
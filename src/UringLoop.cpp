@@ -0,0 +1,702 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "UringLoop.h"
+
+using namespace tlhttp;
+
+namespace
+{
+const unsigned SUBMISSION_ENTRIES = 256;
+const unsigned COMPLETION_ENTRIES = 4096;
+
+// Receive buffers shared by all sockets of the loop
+const unsigned BUFFER_COUNT = 128;
+const unsigned BUFFER_SIZE = 16384;
+const uint16_t BUFFER_GROUP = 0;
+
+int uringSetup(unsigned entries, struct io_uring_params* params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int uringEnter(int fd, unsigned submit, unsigned wait, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0);
+}
+
+int uringRegister(int fd, unsigned opcode, void* arg, unsigned count)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+int setupRing(struct io_uring_params& params)
+{
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+	params.cq_entries = COMPLETION_ENTRIES;
+
+	int fd = uringSetup(SUBMISSION_ENTRIES, &params);
+	if(fd < 0 && errno == EINVAL)
+	{
+		// Cooperative task running needs Linux 5.19
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE;
+		params.cq_entries = COMPLETION_ENTRIES;
+		fd = uringSetup(SUBMISSION_ENTRIES, &params);
+	}
+
+	return fd;
+}
+}
+
+bool UringLoop::isSupported()
+{
+	static const bool supported = []() {
+		struct io_uring_params params;
+		int fd = setupRing(params);
+		if(fd < 0)
+			return false;
+
+		bool result = (params.features & IORING_FEAT_NODROP);
+
+		// Check the opcodes the loop relies on
+		const size_t probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+		std::unique_ptr<char[]> buffer(new char[probeSize]());
+		auto probe = reinterpret_cast<struct io_uring_probe*>(buffer.get());
+
+		if(result && uringRegister(fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+		{
+			for(int op : {IORING_OP_POLL_ADD, IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_ASYNC_CANCEL})
+			{
+				if(op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+					result = false;
+			}
+		}
+		else
+			result = false;
+
+		close(fd);
+		return result;
+	}();
+
+	return supported;
+}
+
+UringLoop::UringLoop()
+	: m_ringFd(-1), m_sqRing(MAP_FAILED), m_cqRing(MAP_FAILED), m_sqes((struct io_uring_sqe*) MAP_FAILED),
+	  m_toSubmit(0), m_bufferRing((struct io_uring_buf_ring*) MAP_FAILED), m_buffers((char*) MAP_FAILED),
+	  m_bufferTail(0), m_multishotAccept(true), m_multishotReceive(true), m_nextOperation(1)
+{
+	struct io_uring_params params;
+	m_ringFd = setupRing(params);
+	if(m_ringFd < 0)
+		throw std::runtime_error(std::string("Could not set up io_uring: ") + strerror(errno));
+
+	try
+	{
+		if(!(params.features & IORING_FEAT_NODROP))
+			throw std::runtime_error("io_uring is too old, IORING_FEAT_NODROP is missing");
+
+		m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+		if(params.features & IORING_FEAT_SINGLE_MMAP)
+			m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+		m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+		if(m_sqRing == MAP_FAILED)
+			throw std::runtime_error(std::string("Could not map submission ring: ") + strerror(errno));
+
+		if(params.features & IORING_FEAT_SINGLE_MMAP)
+			m_cqRing = m_sqRing;
+		else
+		{
+			m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+			if(m_cqRing == MAP_FAILED)
+				throw std::runtime_error(std::string("Could not map completion ring: ") + strerror(errno));
+		}
+
+		m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+		m_sqes = (struct io_uring_sqe*) mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+		if(m_sqes == MAP_FAILED)
+			throw std::runtime_error(std::string("Could not map submission entries: ") + strerror(errno));
+
+		char* sq = (char*) m_sqRing;
+		m_sqHead = (unsigned*)(sq + params.sq_off.head);
+		m_sqTail = (unsigned*)(sq + params.sq_off.tail);
+		m_sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+		m_sqEntries = *(unsigned*)(sq + params.sq_off.ring_entries);
+
+		// Submission entries are always used in ring order
+		unsigned* array = (unsigned*)(sq + params.sq_off.array);
+		for(unsigned i = 0; i < m_sqEntries; i++)
+			array[i] = i;
+
+		char* cq = (char*) m_cqRing;
+		m_cqHead = (unsigned*)(cq + params.cq_off.head);
+		m_cqTail = (unsigned*)(cq + params.cq_off.tail);
+		m_cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+		m_cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+		// Provided buffer ring for receives, needs Linux 5.19
+		m_bufferRing = (struct io_uring_buf_ring*) mmap(nullptr, BUFFER_COUNT * sizeof(struct io_uring_buf),
+				PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		m_buffers = (char*) mmap(nullptr, BUFFER_COUNT * BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(m_bufferRing == MAP_FAILED || m_buffers == MAP_FAILED)
+			throw std::runtime_error(std::string("Could not allocate receive buffers: ") + strerror(errno));
+
+		// Fault the ring in first, the kernel pins its pages on registration
+		memset(m_bufferRing, 0, BUFFER_COUNT * sizeof(struct io_uring_buf));
+
+		struct io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = (uint64_t) m_bufferRing;
+		reg.ring_entries = BUFFER_COUNT;
+		reg.bgid = BUFFER_GROUP;
+
+		if(uringRegister(m_ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+			throw std::runtime_error(std::string("Could not register receive buffers: ") + strerror(errno));
+
+		for(unsigned i = 0; i < BUFFER_COUNT; i++)
+			recycleBuffer(i);
+
+		add(m_wakeFd, EPOLLIN, [this](uint32_t) { handleWakeup(); });
+	}
+	catch(...)
+	{
+		release();
+		throw;
+	}
+}
+
+UringLoop::~UringLoop()
+{
+	release();
+}
+
+void UringLoop::release()
+{
+	if(m_buffers != MAP_FAILED)
+		munmap(m_buffers, BUFFER_COUNT * BUFFER_SIZE);
+
+	if(m_bufferRing != MAP_FAILED)
+		munmap(m_bufferRing, BUFFER_COUNT * sizeof(struct io_uring_buf));
+
+	if(m_sqes != MAP_FAILED)
+		munmap(m_sqes, m_sqesSize);
+
+	if(m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+		munmap(m_cqRing, m_cqRingSize);
+
+	if(m_sqRing != MAP_FAILED)
+		munmap(m_sqRing, m_sqRingSize);
+
+	if(m_ringFd >= 0)
+		close(m_ringFd);
+
+	m_buffers = (char*) MAP_FAILED;
+	m_bufferRing = (struct io_uring_buf_ring*) MAP_FAILED;
+	m_sqes = (struct io_uring_sqe*) MAP_FAILED;
+	m_cqRing = m_sqRing = MAP_FAILED;
+	m_ringFd = -1;
+}
+
+struct io_uring_sqe* UringLoop::getSqe()
+{
+	unsigned tail = *m_sqTail;
+	while(tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+	{
+		// The ring is full, hand everything to the kernel first
+		if(enter(m_toSubmit, 0) >= 0)
+			continue;
+
+		if(errno == EBUSY)
+			reap();
+		else if(errno != EINTR && errno != EAGAIN)
+			throw std::runtime_error(std::string("Could not submit to io_uring: ") + strerror(errno));
+	}
+
+	struct io_uring_sqe* sqe = &m_sqes[tail & m_sqMask];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+void UringLoop::commitSqe()
+{
+	__atomic_store_n(m_sqTail, *m_sqTail + 1, __ATOMIC_RELEASE);
+	m_toSubmit++;
+}
+
+int UringLoop::enter(unsigned submit, unsigned wait)
+{
+	int result = uringEnter(m_ringFd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+	if(result > 0)
+		m_toSubmit -= std::min<unsigned>(result, m_toSubmit);
+
+	return result;
+}
+
+uint64_t UringLoop::createOperation(OperationType type, int fd)
+{
+	uint64_t id = m_nextOperation++;
+	Operation& op = m_operations[id];
+	op.type = type;
+	op.fd = fd;
+	return id;
+}
+
+void UringLoop::submitPoll(uint64_t id, int fd, uint32_t events)
+{
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events & ~EPOLLET;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = id;
+	commitSqe();
+}
+
+void UringLoop::submitAccept(uint64_t id, int fd)
+{
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->ioprio = m_multishotAccept ? IORING_ACCEPT_MULTISHOT : 0;
+	sqe->user_data = id;
+	commitSqe();
+}
+
+void UringLoop::submitReceive(uint64_t id, int fd)
+{
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = BUFFER_GROUP;
+	sqe->ioprio = m_multishotReceive ? IORING_RECV_MULTISHOT : 0;
+	sqe->user_data = id;
+	commitSqe();
+}
+
+void UringLoop::submitSend(uint64_t id, Operation& op)
+{
+	size_t offset = op.sent;
+	const Segment* segment = &op.data->locate(offset);
+
+	// There is no sendfile operation, files are sent right away and only
+	// the wait for a writable socket goes through the ring
+	while(segment->isFile())
+	{
+		off_t position = segment->offset + offset;
+		ssize_t count = sendfile(op.fd, segment->fd, &position, segment->size - offset);
+		if(count < 0 && errno == EINTR)
+			continue;
+
+		if(count < 0 && errno == EAGAIN)
+		{
+			struct io_uring_sqe* sqe = getSqe();
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = op.fd;
+			sqe->poll32_events = POLLOUT;
+			sqe->user_data = id;
+			commitSqe();
+
+			op.polling = true;
+			return;
+		}
+
+		if(count <= 0)
+		{
+			// A truncated file can't be sent completely
+			completeSend(id, op, count < 0 ? -errno : -EIO);
+			return;
+		}
+
+		op.sent += count;
+		if(op.sent == op.data->size())
+		{
+			completeSend(id, op, 0);
+			return;
+		}
+
+		offset = op.sent;
+		segment = &op.data->locate(offset);
+	}
+
+	op.iov.resize(std::min(op.data->count(), Segments::IOV_BATCH));
+	op.iov.resize(op.data->fill(op.sent, op.iov.data(), op.iov.size()));
+
+	op.message = {};
+	op.message.msg_iov = op.iov.data();
+	op.message.msg_iovlen = op.iov.size();
+
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = op.fd;
+	sqe->addr = (uint64_t)&op.message;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = id;
+	commitSqe();
+}
+
+void UringLoop::submitCancel(uint64_t id)
+{
+	struct io_uring_sqe* sqe = getSqe();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = id;
+
+	// Completions of cancel requests are ignored
+	sqe->user_data = 0;
+	commitSqe();
+}
+
+void UringLoop::recycleBuffer(unsigned id)
+{
+	// The ring is indexed by hand since the flexible array member of
+	// io_uring_buf_ring has a different offset when compiled as C++.
+	// The tail overlays the reserved field of the first entry.
+	struct io_uring_buf* bufs = (struct io_uring_buf*) m_bufferRing;
+	struct io_uring_buf* buf = &bufs[m_bufferTail & (BUFFER_COUNT - 1)];
+	buf->addr = (uint64_t)(m_buffers + id * BUFFER_SIZE);
+	buf->len = BUFFER_SIZE;
+	buf->bid = id;
+
+	m_bufferTail++;
+	__atomic_store_n(&bufs[0].resv, (uint16_t) m_bufferTail, __ATOMIC_RELEASE);
+}
+
+void UringLoop::add(int fd, uint32_t events, const Callback& callback)
+{
+	Watch& watch = m_watches[fd];
+	watch.events = events;
+	watch.callback = callback;
+	watch.operation = createOperation(OperationType::Poll, fd);
+	submitPoll(watch.operation, fd, events);
+}
+
+void UringLoop::modify(int fd, uint32_t events)
+{
+	auto iter = m_watches.find(fd);
+	if(iter == m_watches.end())
+		throw std::runtime_error("Could not modify file descriptor: Not watched");
+
+	Watch& watch = iter->second;
+	submitCancel(watch.operation);
+
+	watch.events = events;
+	watch.operation = createOperation(OperationType::Poll, fd);
+	submitPoll(watch.operation, fd, events);
+}
+
+void UringLoop::remove(int fd)
+{
+	auto iter = m_watches.find(fd);
+	if(iter == m_watches.end())
+		return;
+
+	if(iter->second.operation)
+		submitCancel(iter->second.operation);
+
+	if(iter->second.sendOperation)
+		submitCancel(iter->second.sendOperation);
+
+	m_watches.erase(iter);
+}
+
+void UringLoop::listen(int fd, const AcceptCallback& callback)
+{
+	Watch& watch = m_watches[fd];
+	watch.accept = callback;
+	watch.operation = createOperation(OperationType::Accept, fd);
+	submitAccept(watch.operation, fd);
+}
+
+void UringLoop::attach(int fd, const std::weak_ptr<SocketHandler>& handler)
+{
+	Watch& watch = m_watches[fd];
+	watch.handler = handler;
+	watch.operation = createOperation(OperationType::Receive, fd);
+	submitReceive(watch.operation, fd);
+}
+
+void UringLoop::setReceiving(int fd, bool enabled)
+{
+	auto iter = m_watches.find(fd);
+	if(iter == m_watches.end() || iter->second.receiving == enabled)
+		return;
+
+	Watch& watch = iter->second;
+	watch.receiving = enabled;
+
+	// The cancelled receive stays current, data it still reports is delivered
+	// and its last completion re-arms it if receiving was enabled again.
+	if(!enabled && watch.operation)
+		submitCancel(watch.operation);
+	else if(enabled && !watch.operation)
+	{
+		watch.operation = createOperation(OperationType::Receive, fd);
+		submitReceive(watch.operation, fd);
+	}
+}
+
+void UringLoop::send(int fd, const std::shared_ptr<const Segments>& data)
+{
+	auto iter = m_watches.find(fd);
+	if(iter == m_watches.end())
+		return;
+
+	uint64_t id = createOperation(OperationType::Send, fd);
+	Operation& op = m_operations[id];
+	op.data = data;
+
+	iter->second.sendOperation = id;
+	submitSend(id, op);
+}
+
+void UringLoop::reap()
+{
+	unsigned head = *m_cqHead;
+	while(head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+	{
+		struct io_uring_cqe* cqe = &m_cqes[head & m_cqMask];
+		uint64_t id = cqe->user_data;
+		int result = cqe->res;
+		uint32_t flags = cqe->flags;
+
+		// Free the slot before handling, handlers may submit new requests
+		__atomic_store_n(m_cqHead, ++head, __ATOMIC_RELEASE);
+		handleCompletion(id, result, flags);
+	}
+}
+
+void UringLoop::handleCompletion(uint64_t id, int result, uint32_t flags)
+{
+	auto iter = m_operations.find(id);
+	if(iter == m_operations.end())
+	{
+		if(flags & IORING_CQE_F_BUFFER)
+			recycleBuffer(flags >> IORING_CQE_BUFFER_SHIFT);
+
+		return;
+	}
+
+	// Map references stay valid while handlers add more operations
+	Operation& op = iter->second;
+	switch(op.type)
+	{
+		case OperationType::Poll:
+			completePoll(id, op, result, flags & IORING_CQE_F_MORE);
+			break;
+
+		case OperationType::Accept:
+			completeAccept(id, op, result, flags & IORING_CQE_F_MORE);
+			break;
+
+		case OperationType::Receive:
+			completeReceive(id, op, result, flags);
+			break;
+
+		case OperationType::Send:
+			completeSend(id, op, result);
+			break;
+	}
+}
+
+void UringLoop::completePoll(uint64_t id, Operation& op, int result, bool more)
+{
+	int fd = op.fd;
+	if(!more)
+		m_operations.erase(id);
+
+	auto iter = m_watches.find(fd);
+	if(iter == m_watches.end() || iter->second.operation != id)
+		return;
+
+	if(!more)
+	{
+		// Poll requests end on errors or when the kernel runs out of resources
+		iter->second.operation = createOperation(OperationType::Poll, fd);
+		submitPoll(iter->second.operation, fd, iter->second.events);
+	}
+
+	if(result > 0)
+	{
+		// The callback may remove the watch
+		Callback callback = iter->second.callback;
+		callback(result);
+	}
+}
+
+void UringLoop::completeAccept(uint64_t id, Operation& op, int result, bool more)
+{
+	int fd = op.fd;
+	if(!more)
+		m_operations.erase(id);
+
+	auto iter = m_watches.find(fd);
+	if(iter == m_watches.end() || iter->second.operation != id)
+	{
+		if(result >= 0)
+			close(result);
+
+		return;
+	}
+
+	if(result == -EINVAL && m_multishotAccept)
+		m_multishotAccept = false;
+
+	if(!more)
+	{
+		iter->second.operation = createOperation(OperationType::Accept, fd);
+		submitAccept(iter->second.operation, fd);
+	}
+
+	// Errors like EMFILE are temporary, the listener stays armed
+	if(result >= 0)
+	{
+		AcceptCallback callback = iter->second.accept;
+		callback(result);
+	}
+}
+
+void UringLoop::completeReceive(uint64_t id, Operation& op, int result, uint32_t flags)
+{
+	int fd = op.fd;
+	bool more = flags & IORING_CQE_F_MORE;
+	if(!more)
+		m_operations.erase(id);
+
+	const char* data = nullptr;
+	unsigned buffer = 0;
+	if(flags & IORING_CQE_F_BUFFER)
+	{
+		buffer = flags >> IORING_CQE_BUFFER_SHIFT;
+		data = m_buffers + buffer * BUFFER_SIZE;
+	}
+
+	auto iter = m_watches.find(fd);
+	std::shared_ptr<SocketHandler> handler;
+	if(iter != m_watches.end() && iter->second.operation == id)
+		handler = iter->second.handler.lock();
+
+	if(!handler)
+	{
+		if(data)
+			recycleBuffer(buffer);
+
+		return;
+	}
+
+	bool rearm = !more;
+	if(result > 0)
+	{
+		handler->onReceive(data, result);
+		recycleBuffer(buffer);
+		handler->onReceiveDone(false);
+	}
+	else
+	{
+		if(data)
+			recycleBuffer(buffer);
+
+		if(result == -EINVAL && m_multishotReceive)
+			m_multishotReceive = false;
+		else if(result != -ENOBUFS && result != -EINTR && result != -EAGAIN && result != -ECANCELED)
+		{
+			// End of stream or a socket error
+			rearm = false;
+			handler->onReceiveDone(true);
+		}
+	}
+
+	// The handler may have closed the socket
+	iter = m_watches.find(fd);
+	if(rearm && iter != m_watches.end() && iter->second.operation == id)
+	{
+		// A paused socket is re-armed by setReceiving()
+		if(!iter->second.receiving)
+			iter->second.operation = 0;
+		else
+		{
+			iter->second.operation = createOperation(OperationType::Receive, fd);
+			submitReceive(iter->second.operation, fd);
+		}
+	}
+}
+
+void UringLoop::completeSend(uint64_t id, Operation& op, int result)
+{
+	int fd = op.fd;
+	auto iter = m_watches.find(fd);
+	bool current = (iter != m_watches.end() && iter->second.sendOperation == id);
+
+	// The socket became writable for a file segment, nothing was sent yet
+	if(op.polling)
+	{
+		op.polling = false;
+		result = std::min(result, 0);
+	}
+
+	if(current && (result == -EINTR || result == -EAGAIN || (result >= 0 && op.sent + result < op.data->size())))
+	{
+		// Continue a partial write
+		op.sent += std::max(result, 0);
+		submitSend(id, op);
+		return;
+	}
+
+	m_operations.erase(id);
+	if(!current)
+		return;
+
+	iter->second.sendOperation = 0;
+	if(auto handler = iter->second.handler.lock())
+		handler->onSent(result < 0 ? -result : 0);
+}
+
+void UringLoop::run()
+{
+	beginRun();
+
+	while(m_running)
+	{
+		if(enter(m_toSubmit, 1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			throw std::runtime_error(std::string("Could not wait for io_uring completions: ") + strerror(errno));
+
+		reap();
+	}
+
+	endRun();
+}
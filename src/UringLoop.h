@@ -0,0 +1,160 @@
+// TinyLittleHTTP
+// Copyright (c) 2017-2018 Yannick Pflanzer, All rights reserved.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 3.0 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library.
+
+#ifndef TLHTTP_URINGLOOP_H
+#define TLHTTP_URINGLOOP_H
+
+#include <sys/socket.h>
+
+#include <unordered_map>
+
+#include "EventLoop.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+namespace tlhttp
+{
+
+/**
+ * @brief Implements the event loop with io_uring.
+ *
+ * Listeners use multishot accept and attached sockets multishot receives
+ * into a ring of provided buffers, so a busy connection needs no syscall
+ * of its own for receiving. All submissions made while handling a batch of
+ * completions are sent to the kernel with the next wait, which batches the
+ * sends of all connections into a single io_uring_enter.
+ *
+ * Plain file descriptors are watched with multishot poll requests.
+ * Kernels without multishot accept or receive support fall back to
+ * re-arming single shot requests.
+ */
+class UringLoop : public EventLoop
+{
+	enum class OperationType
+	{
+		Poll,
+		Accept,
+		Receive,
+		Send
+	};
+
+	struct Operation
+	{
+		OperationType type;
+		int fd;
+		std::shared_ptr<const Segments> data;
+		size_t sent = 0;
+		bool polling = false;
+
+		// Operations are never moved, so the kernel may keep pointers to these
+		std::vector<struct iovec> iov;
+		struct msghdr message;
+	};
+
+	struct Watch
+	{
+		uint32_t events = 0;
+		Callback callback;
+		AcceptCallback accept;
+		std::weak_ptr<SocketHandler> handler;
+
+		// The poll, accept or receive request of the descriptor
+		uint64_t operation = 0;
+		uint64_t sendOperation = 0;
+		bool receiving = true;
+	};
+
+	int m_ringFd;
+
+	void* m_sqRing;
+	void* m_cqRing;
+	size_t m_sqRingSize, m_cqRingSize;
+	unsigned* m_sqHead;
+	unsigned* m_sqTail;
+	unsigned m_sqMask, m_sqEntries;
+	struct io_uring_sqe* m_sqes;
+	size_t m_sqesSize;
+	unsigned m_toSubmit;
+
+	unsigned* m_cqHead;
+	unsigned* m_cqTail;
+	unsigned m_cqMask;
+	struct io_uring_cqe* m_cqes;
+
+	struct io_uring_buf_ring* m_bufferRing;
+	char* m_buffers;
+	unsigned m_bufferTail;
+
+	bool m_multishotAccept, m_multishotReceive;
+
+	uint64_t m_nextOperation;
+	std::unordered_map<uint64_t, Operation> m_operations;
+	std::unordered_map<int, Watch> m_watches;
+
+	void release();
+
+	struct io_uring_sqe* getSqe();
+	void commitSqe();
+	int enter(unsigned submit, unsigned wait);
+	void reap();
+
+	uint64_t createOperation(OperationType type, int fd);
+	void submitPoll(uint64_t id, int fd, uint32_t events);
+	void submitAccept(uint64_t id, int fd);
+	void submitReceive(uint64_t id, int fd);
+	void submitSend(uint64_t id, Operation& op);
+	void submitCancel(uint64_t id);
+	void recycleBuffer(unsigned id);
+
+	void handleCompletion(uint64_t id, int result, uint32_t flags);
+	void completePoll(uint64_t id, Operation& op, int result, bool more);
+	void completeAccept(uint64_t id, Operation& op, int result, bool more);
+	void completeReceive(uint64_t id, Operation& op, int result, uint32_t flags);
+	void completeSend(uint64_t id, Operation& op, int result);
+
+public:
+	/**
+	 * @brief Sets up the ring and registers the receive buffers.
+	 * @throws std::runtime_error if io_uring is not available.
+	 */
+	UringLoop();
+	~UringLoop();
+
+	/**
+	 * @brief Checks if the kernel supports everything the loop needs.
+	 */
+	static bool isSupported();
+
+	Backend getBackend() const override { return Backend::IoUring; }
+
+	void add(int fd, uint32_t events, const Callback& callback) override;
+	void modify(int fd, uint32_t events) override;
+	void remove(int fd) override;
+
+	void listen(int fd, const AcceptCallback& callback) override;
+	void attach(int fd, const std::weak_ptr<SocketHandler>& handler) override;
+	void setReceiving(int fd, bool enabled) override;
+	using EventLoop::send;
+	void send(int fd, const std::shared_ptr<const Segments>& data) override;
+
+	void run() override;
+};
+
+}
+
+#endif //TLHTTP_URINGLOOP_H
@@ -18,6 +18,36 @@
 #include "../src/Connection.h"
 #include "../src/Server.h"
 #include "../src/Request.h"
+#include "../src/Executor.h"
+#include "../src/EpollLoop.h"
+#include "../src/Scanner.h"
+#include "../src/Arena.h"
+#include "../src/Pool.h"
+#include "../src/IoBuffer.h"
+#include "../src/StaticFiles.h"
+#include "../src/Router.h"
+#include "../src/ResponseCache.h"
+#include "../src/TimerWheel.h"
+#include "../src/Tls.h"
+#include "../src/ConnectionPool.h"
+#include "../src/Resolver.h"
+#include "../src/MultiClient.h"
+#include "../src/Hpack.h"
+
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <thread>
 
 /*
 TEST(test, test)
@@ -108,3 +138,2266 @@ TEST(Header, Corrupt2)
 {
 	EXPECT_ANY_THROW(tlhttp::Request::parse(testCorrupt2));
 }
+
+TEST(Header, CaseInsensitive)
+{
+	auto req = tlhttp::Request::parse("GET / HTTP/1.1\r\ncontent-length: 0\r\nX-Trace-Id: abc\r\n\r\n");
+	EXPECT_EQ("0", req.getHeader("Content-Length"));
+	EXPECT_EQ("0", req.getHeader(tlhttp::HeaderId::ContentLength));
+	EXPECT_EQ("abc", req.getHeader("x-trace-id"));
+
+	// Lookups do not insert missing fields
+	EXPECT_EQ("", req.getHeader("Missing"));
+	EXPECT_EQ(2u, req.getHeaders().size());
+	EXPECT_NE(std::string::npos, req.toString().find("Content-Length: 0\r\n"));
+}
+
+TEST(Header, KeepAlive)
+{
+	auto keepAlive = [](const char* version, const char* connection) {
+		return tlhttp::Request::parse(std::string("GET / ") + version + "\r\nConnection: " + connection + "\r\n\r\n").isKeepAlive();
+	};
+
+	// The field is a case insensitive list of options
+	EXPECT_FALSE(keepAlive("HTTP/1.1", "Close"));
+	EXPECT_FALSE(keepAlive("HTTP/1.1", "Upgrade, close"));
+	EXPECT_TRUE(keepAlive("HTTP/1.1", "Upgrade, HTTP2-Settings"));
+	EXPECT_TRUE(keepAlive("HTTP/1.0", "Keep-Alive, Upgrade"));
+	EXPECT_FALSE(keepAlive("HTTP/1.0", "Upgrade"));
+	EXPECT_FALSE(keepAlive("HTTP/1.0", "keep-alive, close"));
+
+	EXPECT_TRUE(tlhttp::Headers::hasToken("no-cache ,\tMax-Age=0", "max-age=0"));
+	EXPECT_FALSE(tlhttp::Headers::hasToken("no-cache, max-age=0", "max-age"));
+}
+
+TEST(Header, Storage)
+{
+	static_assert(tlhttp::Headers::lookup("transfer-ENCODING") == tlhttp::HeaderId::TransferEncoding);
+	static_assert(tlhttp::Headers::lookup("X-Content-Length") == tlhttp::HeaderId::Unknown);
+
+	tlhttp::Headers headers;
+	for(int i = 0; i < 20; i++)
+		headers.add("X-Field-" + std::to_string(i), std::to_string(i));
+
+	headers.add("Set-Cookie", "a=1");
+	headers.add("set-cookie", "b=2");
+	headers["Host"] = "localhost";
+
+	EXPECT_EQ(23u, headers.size());
+	EXPECT_EQ("19", headers.get("x-field-19"));
+	EXPECT_EQ("a=1", headers.get(tlhttp::HeaderId::SetCookie));
+	EXPECT_EQ("localhost", headers.get("HOST"));
+
+	EXPECT_TRUE(headers.erase("Set-Cookie"));
+	EXPECT_TRUE(headers.erase("X-Field-3"));
+	EXPECT_FALSE(headers.erase("X-Field-3"));
+	EXPECT_EQ(20u, headers.size());
+	EXPECT_FALSE(headers.contains(tlhttp::HeaderId::SetCookie));
+	EXPECT_EQ("localhost", headers.get(tlhttp::HeaderId::Host));
+	EXPECT_EQ("Host", headers.field(19).getName());
+}
+
+TEST(Parser, Incremental)
+{
+	std::string message = "GET /index.html HTTP/1.1\r\nHost: localhost\r\ncontent-length: 4\r\nX-Empty:\r\n\r\nBODY";
+	size_t headerSize = message.find("BODY");
+
+	// Feed the header one byte at a time
+	tlhttp::Parser parser;
+	std::string buffer;
+	for(size_t i = 0; i < headerSize - 1; i++)
+	{
+		buffer += message[i];
+		EXPECT_EQ(tlhttp::Parser::Result::NeedMore, parser.parse(buffer));
+	}
+
+	buffer += message.substr(headerSize - 1);
+	ASSERT_EQ(tlhttp::Parser::Result::Done, parser.parse(buffer));
+	EXPECT_EQ(headerSize, parser.getHeaderSize());
+	EXPECT_EQ("GET", parser.getMethod());
+	EXPECT_EQ("/index.html", parser.getTarget());
+	EXPECT_EQ("HTTP/1.1", parser.getVersion());
+	EXPECT_EQ("localhost", parser.getHeader("HOST"));
+	EXPECT_EQ("", parser.getHeader("X-Empty"));
+	EXPECT_EQ(3u, parser.getHeaderCount());
+	EXPECT_TRUE(parser.hasContentLength());
+	EXPECT_EQ(4u, parser.getContentLength());
+
+	tlhttp::Request request;
+	parser.reset();
+	ASSERT_TRUE(tlhttp::Request::extract(buffer, parser, request));
+	EXPECT_EQ("BODY", request.getBody().str());
+	EXPECT_TRUE(buffer.empty());
+}
+
+TEST(Parser, Response)
+{
+	tlhttp::Parser parser(true);
+	ASSERT_EQ(tlhttp::Parser::Result::Done, parser.parse("HTTP/1.0 404 Not Found\nTransfer-Encoding: gzip, chunked\n\n"));
+	EXPECT_EQ(404, parser.getStatus());
+	EXPECT_EQ("Not Found", parser.getReason());
+	EXPECT_EQ("HTTP/1.0", parser.getVersion());
+	EXPECT_TRUE(parser.isChunked());
+}
+
+TEST(Parser, Invalid)
+{
+	const char* messages[] = {
+		"GET / HTTP/1.1\r\nHost: a\r\n folded\r\n\r\n",
+		"GET / HTTP/1.1\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n",
+		"GET / HTTP/1.1\r\nContent-Length: -1\r\n\r\n",
+		"GET / HTTP/1.1\r\nBad Name: a\r\n\r\n",
+		"G(T / HTTP/1.1\r\n\r\n",
+		"GET / HTTP/1.1 \r\n\r\n"
+	};
+
+	for(const char* message : messages)
+	{
+		tlhttp::Parser parser;
+		EXPECT_ANY_THROW(parser.parse(message)) << message;
+	}
+
+	tlhttp::Parser parser;
+	EXPECT_ANY_THROW(parser.parse("GET /" + std::string(tlhttp::Parser::MAX_HEADER_SIZE, 'a')));
+}
+
+TEST(Parser, Chunked)
+{
+	std::string message = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+			"5;name=value\r\nhello\r\n1\r\n \r\nA\r\n0123456789\r\n0\r\nX-Trailer: 1\r\n\r\n"
+			"HTTP/1.1 204 OK\r\nContent-Length: 0\r\n\r\n";
+
+	// Every split point has to give the same result
+	for(size_t split = 0; split < message.size(); split += 3)
+	{
+		tlhttp::Parser parser(true);
+		tlhttp::Request response;
+		std::string buffer = message.substr(0, split);
+
+		bool done = tlhttp::Request::extract(buffer, parser, response);
+		buffer += message.substr(split);
+		if(!done)
+		{
+			ASSERT_TRUE(tlhttp::Request::extract(buffer, parser, response));
+		}
+
+		EXPECT_EQ("hello 0123456789", response.getBody().str());
+		EXPECT_TRUE(buffer.compare(0, 12, "HTTP/1.1 204") == 0);
+	}
+
+	std::string invalid[] = {
+		"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nz\r\n",
+		"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nabc\r\n",
+		"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 3\r\n\r\n",
+		"POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n"
+	};
+
+	for(auto& buffer : invalid)
+	{
+		tlhttp::Request request;
+		EXPECT_ANY_THROW(tlhttp::Request::extract(buffer, request)) << buffer;
+	}
+
+	tlhttp::Request request("localhost", "/upload", true);
+	request["Transfer-Encoding"] = "chunked";
+	request << "data";
+	std::string serialized = request.toString();
+	EXPECT_EQ(std::string::npos, serialized.find("Content-Length"));
+
+	tlhttp::Request parsed;
+	ASSERT_TRUE(tlhttp::Request::extract(serialized, parsed));
+	EXPECT_EQ("data", parsed.getBody().str());
+}
+
+TEST(Request, Serialize)
+{
+	tlhttp::Request response;
+	response.setResponse(404);
+	response["Content-Type"] = "text/plain";
+	response << std::string(1000, 'x');
+
+	tlhttp::Segments segments;
+	response.serialize(segments, "Connection: close\r\n", true);
+
+	std::string data = segments.str();
+	EXPECT_EQ(0u, data.find("HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nConnection: close\r\n"));
+	EXPECT_NE(std::string::npos, data.find("\r\nDate: "));
+	EXPECT_NE(std::string::npos, data.find("GMT\r\n\r\n" + std::string(1000, 'x')));
+	EXPECT_EQ(data.size(), segments.size());
+
+	// Without extra fields the segments match the string form
+	tlhttp::Segments plain;
+	response.serialize(plain);
+	EXPECT_EQ(response.toString(), plain.str());
+
+	// Moving the response hands the body over without copying it
+	const char* body = response.getBody().view().data();
+	tlhttp::Segments moved;
+	std::move(response).serialize(moved);
+	EXPECT_EQ(body, moved[moved.count() - 1].data);
+	EXPECT_EQ(plain.str(), moved.str());
+
+	tlhttp::Request chunked;
+	chunked.setResponse(200);
+	chunked["Transfer-Encoding"] = "chunked";
+	chunked << "hello";
+
+	tlhttp::Segments chunkedSegments;
+	std::move(chunked).serialize(chunkedSegments);
+	EXPECT_EQ("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n", chunkedSegments.str());
+
+	// The vectors continue in the middle of a partially written segment
+	struct iovec iov[tlhttp::Segments::IOV_BATCH];
+	size_t count = chunkedSegments.fill(chunkedSegments.size() - 6, iov, tlhttp::Segments::IOV_BATCH);
+	ASSERT_EQ(2u, count);
+	EXPECT_EQ("\n", std::string((const char*) iov[0].iov_base, iov[0].iov_len));
+	EXPECT_EQ("0\r\n\r\n", std::string((const char*) iov[1].iov_base, iov[1].iov_len));
+}
+
+TEST(Arena, Reset)
+{
+	tlhttp::Arena arena(256, 1024);
+
+	void* first = arena.allocate(100);
+	void* second = arena.allocate(200, 8);
+	ASSERT_NE(nullptr, first);
+	ASSERT_NE(nullptr, second);
+	EXPECT_TRUE(arena.owns(first));
+	EXPECT_TRUE(arena.owns(second));
+	EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(second) % 8);
+
+	// Resetting hands out the same memory again without growing
+	size_t capacity = arena.getCapacity();
+	arena.reset();
+	EXPECT_EQ(first, arena.allocate(100));
+	EXPECT_EQ(second, arena.allocate(200, 8));
+	EXPECT_EQ(capacity, arena.getCapacity());
+
+	// Beyond the limit containers fall back to the heap
+	EXPECT_EQ(nullptr, arena.allocate(2048));
+
+	int local = 0;
+	EXPECT_FALSE(arena.owns(&local));
+
+	std::map<int, std::string, std::less<int>, tlhttp::ArenaAllocator<std::pair<const int, std::string>>> map{
+		tlhttp::ArenaAllocator<std::pair<const int, std::string>>(&arena)};
+
+	for(int i = 0; i < 100; i++)
+		map[i] = std::to_string(i);
+
+	EXPECT_EQ("42", map[42]);
+	EXPECT_GE(1024u, arena.getCapacity());
+}
+
+TEST(Pool, ReusesObjects)
+{
+	const tlhttp::Request* address;
+	{
+		auto request = tlhttp::makePooled<tlhttp::Request>();
+		(*request)["Host"] = "example.com";
+		address = request.get();
+	}
+
+	// The freed block is handed out again on the same thread
+	auto request = tlhttp::makePooled<tlhttp::Request>();
+	EXPECT_EQ(address, request.get());
+	EXPECT_TRUE(request->getHeader("Host").empty());
+
+	std::thread thread([request]() mutable { request.reset(); });
+	request.reset();
+	thread.join();
+}
+
+TEST(IoBuffer, Compaction)
+{
+	tlhttp::IoBuffer buffer;
+	const char binary[] = {'a', '\0', 'b', '\0'};
+	buffer.append(binary, sizeof(binary));
+	EXPECT_EQ(std::string_view(binary, sizeof(binary)), buffer.view());
+	EXPECT_EQ(tlhttp::SlabPool::MIN_SIZE, buffer.getCapacity());
+
+	// Consumed space at the front is reused instead of growing
+	buffer.consume(2);
+	buffer.prepare(buffer.getCapacity() - 2);
+	EXPECT_EQ(tlhttp::SlabPool::MIN_SIZE, buffer.getCapacity());
+	EXPECT_EQ("b", std::string(buffer.data(), 1));
+
+	buffer.append(std::string(tlhttp::SlabPool::MIN_SIZE, 'x'));
+	EXPECT_EQ(2 * tlhttp::SlabPool::MIN_SIZE, buffer.getCapacity());
+
+	buffer.erase(1, 1);
+	EXPECT_EQ(tlhttp::SlabPool::MIN_SIZE + 1, buffer.size());
+
+	// Empty buffers give their slab back
+	buffer.consume(buffer.size());
+	EXPECT_EQ(0u, buffer.getCapacity());
+}
+
+TEST(Router, Match)
+{
+	tlhttp::Router router;
+	std::string called;
+	auto handler = [&called](const std::string& name) {
+		return [&called, name](const std::shared_ptr<tlhttp::Request>&, const tlhttp::Responder&, const tlhttp::Router::Params&) {
+			called = name;
+		};
+	};
+
+	router.add("GET", "/", handler("root"));
+	router.add("GET", "/users", handler("users"));
+	router.add("GET", "/users/new", handler("new"));
+	router.add("GET", "/users/:id", handler("user"));
+	router.add("POST", "/users/:id", handler("update"));
+	router.add("GET", "/users/:id/posts/:post", handler("post"));
+	router.add("GET", "/user-settings", handler("settings"));
+	router.add("GET", "/static/*path", handler("static"));
+	router.add("*", "/any", handler("any"));
+
+	EXPECT_THROW(router.add("GET", "/users/:name", handler("duplicate")), std::runtime_error);
+	EXPECT_THROW(router.add("GET", "users", handler("relative")), std::runtime_error);
+
+	tlhttp::Router::Params params;
+	auto match = [&](std::string_view method, std::string_view path) -> std::string {
+		const tlhttp::Router::Handler* found = router.match(method, path, params);
+		if(!found)
+			return "";
+
+		called.clear();
+		(*found)(nullptr, tlhttp::Responder(nullptr, 0, false), params);
+		return called;
+	};
+
+	EXPECT_EQ("root", match("GET", "/"));
+	EXPECT_EQ("users", match("GET", "/users?page=2"));
+	EXPECT_EQ("new", match("GET", "/users/new"));
+	EXPECT_EQ("settings", match("GET", "/user-settings"));
+
+	EXPECT_EQ("user", match("GET", "/users/42"));
+	EXPECT_EQ("42", params["id"]);
+	EXPECT_EQ("update", match("POST", "/users/42"));
+	EXPECT_EQ("user", match("HEAD", "/users/42"));
+
+	// Static text which leads nowhere falls back to the parameter
+	EXPECT_EQ("post", match("GET", "/users/new/posts/7"));
+	EXPECT_EQ("new", params["id"]);
+	EXPECT_EQ("7", params["post"]);
+	EXPECT_EQ(2u, params.size());
+
+	EXPECT_EQ("static", match("GET", "/static/css/site.css"));
+	EXPECT_EQ("css/site.css", params["path"]);
+	EXPECT_EQ("any", match("DELETE", "/any"));
+
+	EXPECT_EQ("", match("DELETE", "/users/42"));
+	EXPECT_EQ("", match("GET", "/users/42/"));
+	EXPECT_EQ("", match("GET", "/missing"));
+	EXPECT_EQ("", match("GET", "/users/"));
+}
+
+namespace
+{
+std::string fromHex(std::string_view hex)
+{
+	std::string result;
+	for(size_t i = 0; i + 1 < hex.size(); i += 2)
+		result += char(std::stoi(std::string(hex.substr(i, 2)), nullptr, 16));
+	return result;
+}
+
+std::vector<tlhttp::HeaderField> decodeBlock(tlhttp::HpackDecoder& decoder, const std::string& block)
+{
+	std::vector<tlhttp::HeaderField> fields;
+	decoder.decode(reinterpret_cast<const uint8_t*>(block.data()), block.size(), fields);
+	return fields;
+}
+}
+
+TEST(Hpack, Examples)
+{
+	// The requests of RFC 7541 C.4, sharing one dynamic table
+	tlhttp::HpackDecoder decoder;
+	auto fields = decodeBlock(decoder, fromHex("828684418cf1e3c2e5f23a6ba0ab90f4ff"));
+	ASSERT_EQ(4u, fields.size());
+	EXPECT_EQ(":method", fields[0].name);
+	EXPECT_EQ("GET", fields[0].value);
+	EXPECT_EQ(":path", fields[2].name);
+	EXPECT_EQ("/", fields[2].value);
+	EXPECT_EQ(":authority", fields[3].name);
+	EXPECT_EQ("www.example.com", fields[3].value);
+	EXPECT_EQ(57u, decoder.getTable().getSize());
+
+	fields = decodeBlock(decoder, fromHex("828684be5886a8eb10649cbf"));
+	ASSERT_EQ(5u, fields.size());
+	EXPECT_EQ("www.example.com", fields[3].value);
+	EXPECT_EQ("cache-control", fields[4].name);
+	EXPECT_EQ("no-cache", fields[4].value);
+
+	fields = decodeBlock(decoder, fromHex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"));
+	ASSERT_EQ(5u, fields.size());
+	EXPECT_EQ("https", fields[1].value);
+	EXPECT_EQ("/index.html", fields[2].value);
+	EXPECT_EQ("custom-key", fields[4].name);
+	EXPECT_EQ("custom-value", fields[4].value);
+	EXPECT_EQ(3u, decoder.getTable().count());
+	EXPECT_EQ(164u, decoder.getTable().getSize());
+
+	std::string encoded;
+	tlhttp::Huffman::encode("no-cache", encoded);
+	EXPECT_EQ(fromHex("a8eb10649cbf"), encoded);
+
+	// Padding longer than seven bits and references past the table are errors
+	std::string decoded;
+	EXPECT_THROW(tlhttp::Huffman::decode(reinterpret_cast<const uint8_t*>("\xff\xff"), 2, decoded), std::runtime_error);
+	EXPECT_THROW(decodeBlock(decoder, fromHex("c5")), std::runtime_error);
+}
+
+TEST(Hpack, RoundTrip)
+{
+	tlhttp::HpackEncoder encoder;
+	tlhttp::HpackDecoder decoder;
+
+	std::vector<tlhttp::HeaderField> fields = {
+		{":status", "200"}, {"content-type", "text/html"}, {"x-binary", std::string("a\0b\xff", 4)},
+		{"set-cookie", "id=42"}, {"x-long", std::string(5000, 'z')}
+	};
+
+	for(int i = 0; i < 3; i++)
+	{
+		// Shrinking the table evicts everything and is announced first
+		if(i == 2)
+			encoder.setMaxTableSize(100);
+
+		std::string block;
+		encoder.begin(block);
+		for(auto& field : fields)
+			encoder.encode(block, field.name, field.value, field.name != "set-cookie");
+
+		auto decoded = decodeBlock(decoder, block);
+		ASSERT_EQ(fields.size(), decoded.size());
+		for(size_t j = 0; j < fields.size(); j++)
+		{
+			EXPECT_EQ(fields[j].name, decoded[j].name);
+			EXPECT_EQ(fields[j].value, decoded[j].value);
+		}
+
+		EXPECT_EQ(encoder.getTable().getSize(), decoder.getTable().getSize());
+		EXPECT_EQ(encoder.getTable().count(), decoder.getTable().count());
+	}
+
+	EXPECT_EQ(100u, decoder.getTable().getMaxSize());
+	EXPECT_LE(decoder.getTable().getSize(), 100u);
+}
+
+TEST(Hpack, ListSizeLimit)
+{
+	tlhttp::HpackEncoder encoder;
+	tlhttp::HpackDecoder decoder;
+
+	// Every single byte references the large entry again
+	std::string block;
+	encoder.begin(block);
+	encoder.encode(block, "x-large", std::string(4000, 'x'));
+	block += std::string(10000, '\xbe');
+
+	std::vector<tlhttp::HeaderField> fields;
+	size_t listSize = decoder.decode(reinterpret_cast<const uint8_t*>(block.data()), block.size(), fields, 16384);
+	EXPECT_EQ(10001u * (7 + 4000 + 32), listSize);
+	EXPECT_EQ(4u, fields.size());
+
+	// The table is still usable by later blocks
+	block.clear();
+	encoder.begin(block);
+	encoder.encode(block, "x-large", std::string(4000, 'x'));
+	fields = decodeBlock(decoder, block);
+	ASSERT_EQ(1u, fields.size());
+	EXPECT_EQ(std::string(4000, 'x'), fields[0].value);
+	EXPECT_EQ(encoder.getTable().getSize(), decoder.getTable().getSize());
+}
+
+TEST(TimerWheel, Expiry)
+{
+	using std::chrono::milliseconds;
+
+	tlhttp::TimerWheel wheel(milliseconds(10));
+	auto start = tlhttp::TimerWheel::Clock::now();
+
+	// Delays spread over all levels expire on the right tick
+	const long delays[] = {5, 95, 2560, 2600, 700000, 200000000};
+	std::vector<std::unique_ptr<tlhttp::Timer>> timers;
+	std::vector<long> fired;
+
+	for(long delay : delays)
+	{
+		timers.push_back(std::make_unique<tlhttp::Timer>());
+		timers.back()->setCallback([&fired, delay]() { fired.push_back(delay); });
+		wheel.schedule(*timers.back(), milliseconds(delay), start);
+	}
+
+	tlhttp::Timer cancelled([&fired]() { fired.push_back(-1); });
+	wheel.schedule(cancelled, milliseconds(50), start);
+	cancelled.cancel();
+	EXPECT_EQ(6u, wheel.size());
+
+	for(long delay : delays)
+	{
+		size_t before = fired.size();
+		// Ticks are not aligned with the start, so expiry is exact to one tick
+		wheel.advance(start + milliseconds(delay - 10));
+		EXPECT_EQ(before, fired.size());
+
+		wheel.advance(start + milliseconds(delay + 10));
+		ASSERT_EQ(before + 1, fired.size());
+		EXPECT_EQ(delay, fired.back());
+	}
+
+	EXPECT_TRUE(wheel.empty());
+
+	// Re-arming moves the timer, callbacks may arm their own timer again
+	int count = 0;
+	tlhttp::Timer periodic;
+	periodic.setCallback([&]() {
+		if(++count < 3)
+			wheel.schedule(periodic, milliseconds(10), start + milliseconds(count * 10));
+	});
+
+	start += milliseconds(delays[5] + 100);
+	wheel.schedule(periodic, milliseconds(1000), start);
+	wheel.schedule(periodic, milliseconds(10), start);
+	EXPECT_EQ(1u, wheel.size());
+
+	wheel.advance(start + milliseconds(100));
+	EXPECT_EQ(3, count);
+	EXPECT_FALSE(periodic.isArmed());
+}
+
+TEST(Body, Spill)
+{
+	tlhttp::Body body;
+	body.setMemoryLimit(16);
+	body << "0123456789";
+	EXPECT_FALSE(body.isSpilled());
+	EXPECT_EQ("0123456789", body.view());
+
+	body << "abcdefghij" << 42;
+	EXPECT_TRUE(body.isSpilled());
+	EXPECT_EQ(22u, body.size());
+	EXPECT_EQ("0123456789abcdefghij42", body.str());
+
+	char buffer[4];
+	EXPECT_EQ(4u, body.read(10, buffer, sizeof(buffer)));
+	EXPECT_EQ("abcd", std::string(buffer, 4));
+	EXPECT_EQ(2u, body.read(20, buffer, sizeof(buffer)));
+
+	std::string collected;
+	body.forEach([&collected](const char* data, size_t size) { collected.append(data, size); });
+	EXPECT_EQ(body.str(), collected);
+
+	std::string directory = tlhttp::Body::getSpillDirectory();
+	tlhttp::Body::setSpillDirectory("");
+
+	tlhttp::Body limited;
+	limited.setMemoryLimit(4);
+	EXPECT_ANY_THROW(limited << "too large");
+
+	tlhttp::Body::setSpillDirectory(directory);
+}
+
+TEST(Body, StreamedUpload)
+{
+	size_t limit = tlhttp::Body::getDefaultMemoryLimit();
+	tlhttp::Body::setDefaultMemoryLimit(1024);
+
+	tlhttp::Parser parser;
+	tlhttp::Request request;
+	std::string buffer = "POST /upload HTTP/1.1\r\nContent-Length: 100000\r\n\r\n";
+
+	// The receive buffer never holds more than one piece of the body
+	std::string piece(1000, 'x');
+	for(int i = 0; i < 100; i++)
+	{
+		ASSERT_FALSE(tlhttp::Request::extract(buffer, parser, request));
+		EXPECT_LT(buffer.size(), 100u);
+		buffer += piece;
+	}
+
+	buffer += "GET / HTTP/1.1\r\n\r\n";
+	ASSERT_TRUE(tlhttp::Request::extract(buffer, parser, request));
+	EXPECT_EQ(100000u, request.getBody().size());
+	EXPECT_TRUE(request.getBody().isSpilled());
+	EXPECT_EQ("GET / HTTP/1.1\r\n\r\n", buffer);
+
+	tlhttp::Body::setDefaultMemoryLimit(limit);
+}
+
+TEST(Parser, ScannerKernels)
+{
+	const tlhttp::Scanner::Isa isas[] = {tlhttp::Scanner::Isa::Sse42, tlhttp::Scanner::Isa::Avx2};
+
+	// Plant every possible byte at every position of a 70 byte run, which
+	// covers the vector loops as well as the scalar tail.
+	std::string token(70, 'a'), text(70, ' ');
+	for(int c = 0; c < 256; c++)
+	{
+		for(size_t position = 0; position < token.size(); position += 7)
+		{
+			std::string tokenInput = token, textInput = text;
+			tokenInput[position] = textInput[position] = char(c);
+
+			size_t tokenEnd = tlhttp::Scanner::findNonToken(tlhttp::Scanner::Isa::Scalar, tokenInput.data(), tokenInput.size());
+			size_t textEnd = tlhttp::Scanner::findControl(tlhttp::Scanner::Isa::Scalar, textInput.data(), textInput.size());
+
+			for(auto isa : isas)
+			{
+				if(!tlhttp::Scanner::isSupported(isa))
+					continue;
+
+				ASSERT_EQ(tokenEnd, tlhttp::Scanner::findNonToken(isa, tokenInput.data(), tokenInput.size())) << c;
+				ASSERT_EQ(textEnd, tlhttp::Scanner::findControl(isa, textInput.data(), textInput.size())) << c;
+			}
+		}
+	}
+
+	EXPECT_EQ(3u, tlhttp::Scanner::findNonToken("Foo: bar", 8));
+	EXPECT_EQ(3u, tlhttp::Scanner::findControl("bar\r\n", 5));
+}
+
+TEST(Connection, SplitHeader)
+{
+	int fds[2];
+	ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+	std::thread thread([fds]() {
+		const char* pieces[] = {"HTTP/1.1 200 OK\r\nContent-Le", "ngth: 5\r", "\n\r\nhel", "lo"};
+		for(const char* piece : pieces)
+		{
+			::send(fds[1], piece, strlen(piece), 0);
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+
+		::close(fds[1]);
+	});
+
+	tlhttp::Connection connection(fds[0]);
+	tlhttp::Request response = connection.get();
+	EXPECT_EQ("hello", response.getBody().str());
+
+	thread.join();
+}
+
+namespace
+{
+// Connects to a server which is started on another thread.
+void connectRetry(tlhttp::Connection& connection, uint16_t port)
+{
+	for(int i = 0; i < 100; i++)
+	{
+		try
+		{
+			connection.connect("127.0.0.1", port);
+			return;
+		}
+		catch(std::exception&)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+
+	connection.connect("127.0.0.1", port);
+}
+}
+
+TEST(Server, AsyncResponse)
+{
+	tlhttp::Server server("127.0.0.1", 18080);
+	std::thread thread([&server]() {
+		server.startAsync([](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+			tlhttp::Request response;
+			response.setResponse(200);
+			response << "Hello " + request->getUrl();
+			responder.send(response);
+		});
+	});
+
+	tlhttp::Connection connection;
+	connectRetry(connection, 18080);
+	auto result = connection.get("/index.html", "");
+	EXPECT_EQ("Hello /index.html", result.getBody().str());
+
+	server.stop();
+	thread.join();
+}
+
+TEST(Server, StalledClient)
+{
+	tlhttp::Server server("127.0.0.1", 18081);
+	std::thread thread([&server]() {
+		server.startAsync([](const std::shared_ptr<tlhttp::Request>&, const tlhttp::Responder& responder) {
+			// Answer later from another thread
+			std::thread([responder]() {
+				tlhttp::Request response;
+				response.setResponse(200);
+				response << "Late";
+				responder.send(response);
+			}).detach();
+		});
+	});
+
+	// Never completes its request
+	tlhttp::Connection stalled;
+	connectRetry(stalled, 18081);
+	stalled.send("GET / HTTP/1.1\r\n");
+
+	tlhttp::Connection connection;
+	connectRetry(connection, 18081);
+	auto result = connection.get("/", "");
+	EXPECT_EQ("Late", result.getBody().str());
+
+	server.stop();
+	thread.join();
+}
+
+TEST(Server, MultipleReactors)
+{
+	tlhttp::Server server("127.0.0.1", 18082);
+	server.setThreadCount(4);
+	server.setPinThreads(true);
+
+	// The thread running the first reactor gets its affinity back
+	bool restored = false;
+	std::thread thread([&server, &restored]() {
+		cpu_set_t before, after;
+		pthread_getaffinity_np(pthread_self(), sizeof(before), &before);
+
+		server.startAsync([](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+			tlhttp::Request response;
+			response.setResponse(200);
+			response << request->getUrl();
+			responder.send(response);
+		});
+
+		pthread_getaffinity_np(pthread_self(), sizeof(after), &after);
+		restored = CPU_EQUAL(&before, &after);
+	});
+
+	for(int i = 0; i < 16; i++)
+	{
+		tlhttp::Connection connection;
+		connectRetry(connection, 18082);
+		auto result = connection.get("/" + std::to_string(i), "");
+		EXPECT_EQ("/" + std::to_string(i), result.getBody().str());
+	}
+
+	server.stop();
+	thread.join();
+	EXPECT_TRUE(restored);
+}
+
+TEST(Executor, RunsAllTasks)
+{
+	std::atomic<int> count(0);
+	{
+		tlhttp::WorkStealingExecutor executor(4);
+		for(int i = 0; i < 1000; i++)
+		{
+			executor.submit([&count, &executor]() {
+				// Tasks submitted by workers stay on their own deque
+				executor.submit([&count]() { count++; });
+				count++;
+			});
+		}
+	}
+
+	EXPECT_EQ(2000, count);
+}
+
+TEST(Server, Executor)
+{
+	tlhttp::Server server("127.0.0.1", 18083);
+	server.setExecutor(std::make_shared<tlhttp::WorkStealingExecutor>(2));
+
+	std::thread thread([&server]() {
+		server.startAsync([](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+			if(request->getUrl() == "/throw")
+				throw std::runtime_error("Handler failed");
+
+			tlhttp::Request response;
+			response.setResponse(200);
+			response << "Worker";
+			responder.send(response);
+		});
+	});
+
+	tlhttp::Connection connection;
+	connectRetry(connection, 18083);
+	EXPECT_EQ("Worker", connection.get("/", "").getBody().str());
+
+	tlhttp::Connection failing;
+	connectRetry(failing, 18083);
+	failing.send(tlhttp::Request("127.0.0.1", "/throw", false).toString());
+	EXPECT_NE(std::string::npos, failing.receive().find("500"));
+
+	server.stop();
+	thread.join();
+}
+
+TEST(Server, Pipelining)
+{
+	tlhttp::Server server("127.0.0.1", 18084);
+	server.setExecutor(std::make_shared<tlhttp::WorkStealingExecutor>(2));
+
+	std::thread thread([&server]() {
+		server.startAsync([](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+			// Complete the first request last
+			if(request->getUrl() == "/slow")
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+			tlhttp::Request response;
+			response.setResponse(200);
+			response << request->getUrl();
+			responder.send(response);
+		});
+	});
+
+	tlhttp::Connection connection;
+	connectRetry(connection, 18084);
+	connection.send("GET /slow HTTP/1.1\r\nHost: localhost\r\n\r\n"
+			"GET /fast HTTP/1.1\r\nHost: localhost\r\n\r\n"
+			"GET /last HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n");
+
+	std::string result = connection.receive();
+	size_t slow = result.find("/slow"), fast = result.find("/fast"), last = result.find("/last");
+	ASSERT_NE(std::string::npos, slow);
+	ASSERT_NE(std::string::npos, fast);
+	ASSERT_NE(std::string::npos, last);
+	EXPECT_LT(slow, fast);
+	EXPECT_LT(fast, last);
+	EXPECT_NE(std::string::npos, result.find("Connection: close"));
+
+	server.stop();
+	thread.join();
+}
+
+TEST(Server, PipelineBackpressure)
+{
+	std::vector<tlhttp::EventLoop::Backend> backends = {tlhttp::EventLoop::Backend::Epoll};
+	if(tlhttp::EventLoop::isUringSupported())
+		backends.push_back(tlhttp::EventLoop::Backend::IoUring);
+
+	uint16_t port = 18110;
+	for(auto backend : backends)
+	{
+		tlhttp::Server server("127.0.0.1", port);
+		server.setBackend(backend);
+		server.setMaxPipelineDepth(4);
+
+		// No request is answered, the connection stays at its pipeline depth
+		std::mutex mutex;
+		std::vector<tlhttp::Responder> held;
+		std::thread thread([&server, &mutex, &held]() {
+			server.startAsync([&mutex, &held](const std::shared_ptr<tlhttp::Request>&, const tlhttp::Responder& responder) {
+				std::lock_guard<std::mutex> lock(mutex);
+				held.push_back(responder);
+			});
+		});
+
+		tlhttp::Connection connection;
+		connectRetry(connection, port++);
+		int fd = connection.getSocket();
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+		// A paused connection must stop reading the requests as well
+		std::string requests;
+		while(requests.size() < 65536)
+			requests += "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+		// Sending stops once the socket buffers stayed full for a while
+		size_t sent = 0;
+		int stalled = 0;
+		while(sent < 64 * 1024 * 1024 && stalled < 200)
+		{
+			ssize_t count = ::send(fd, requests.data(), requests.size(), MSG_NOSIGNAL);
+			if(count > 0)
+			{
+				sent += count;
+				stalled = 0;
+				continue;
+			}
+
+			stalled++;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		// Only the socket buffers are filled
+		EXPECT_LT(sent, 32u * 1024 * 1024);
+
+		server.stop();
+		thread.join();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		EXPECT_EQ(4u, held.size());
+	}
+}
+
+TEST(Server, KeepAliveLimits)
+{
+	tlhttp::Server server("127.0.0.1", 18085);
+	server.setMaxRequestsPerConnection(2);
+	server.setIdleTimeout(std::chrono::milliseconds(50));
+	server.setMaxBodySize(16);
+
+	std::thread thread([&server]() {
+		server.startAsync([](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+			tlhttp::Request response;
+			response.setResponse(200);
+			response << request->getUrl();
+			responder.send(response);
+		});
+	});
+
+	// The second request is the last one, the third is never answered
+	tlhttp::Connection limited;
+	connectRetry(limited, 18085);
+	limited.send("GET /1 HTTP/1.1\r\n\r\nGET /2 HTTP/1.1\r\n\r\nGET /3 HTTP/1.1\r\n\r\n");
+
+	std::string result = limited.receive();
+	EXPECT_NE(std::string::npos, result.find("/2"));
+	EXPECT_EQ(std::string::npos, result.find("/3"));
+
+	// The idle connection is closed by the server
+	tlhttp::Connection idle;
+	connectRetry(idle, 18085);
+	idle.send("GET /idle HTTP/1.1\r\n\r\n");
+	EXPECT_NE(std::string::npos, idle.receive().find("/idle"));
+
+	// Bodies above the limit are refused before or while they are read
+	auto post = [](const std::string& message) {
+		tlhttp::Connection connection;
+		connection.connect("127.0.0.1", 18085);
+		connection.send(message);
+		return connection.receive();
+	};
+
+	EXPECT_NE(std::string::npos, post("POST /small HTTP/1.1\r\nContent-Length: 16\r\nConnection: close\r\n\r\n"
+									  "0123456789abcdef").find("/small"));
+	EXPECT_EQ(0u, post("POST /large HTTP/1.1\r\nContent-Length: 1000000000\r\n\r\n").find("HTTP/1.1 413"));
+	EXPECT_EQ(0u, post("POST /chunked HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+					   "10\r\n0123456789abcdef\r\n1\r\nx\r\n").find("HTTP/1.1 413"));
+
+	server.stop();
+	thread.join();
+}
+
+TEST(Server, Backends)
+{
+	std::vector<tlhttp::EventLoop::Backend> backends = {tlhttp::EventLoop::Backend::Epoll};
+	if(tlhttp::EventLoop::isUringSupported())
+		backends.push_back(tlhttp::EventLoop::Backend::IoUring);
+
+	uint16_t port = 18086;
+	for(auto backend : backends)
+	{
+		tlhttp::Server server("127.0.0.1", port);
+		server.setBackend(backend);
+
+		std::thread thread([&server]() {
+			server.startAsync([](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+				tlhttp::Request response;
+				response.setResponse(200);
+				response << std::string(100000, 'x') + request->getUrl();
+				responder.send(response);
+			});
+		});
+
+		tlhttp::Connection connection;
+		connectRetry(connection, port++);
+		connection.send("GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+		std::string result = connection.receive();
+		EXPECT_LT(200000u, result.size());
+		EXPECT_LT(result.find("/a"), result.find("/b"));
+
+		server.stop();
+		thread.join();
+	}
+}
+
+TEST(Coroutine, AsyncGet)
+{
+	tlhttp::Server server("127.0.0.1", 18088);
+	std::thread thread([&server]() {
+		server.startAsync([](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+			tlhttp::Request response;
+			response.setResponse(200);
+			response << request->getUrl() << ":" << request->getBody().str();
+			responder.send(response);
+		});
+	});
+
+	tlhttp::EpollLoop loop;
+	auto client = [&loop]() -> tlhttp::Task<std::string> {
+		auto connection = std::make_shared<tlhttp::Connection>();
+		for(int i = 0;; i++)
+		{
+			try
+			{
+				co_await connection->asyncConnect(loop, "127.0.0.1", 18088);
+				break;
+			}
+			catch(std::runtime_error&)
+			{
+				if(i == 50)
+					throw;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+
+		// Both requests use the same persistent connection
+		tlhttp::Request first = co_await connection->asyncGet("/first", "one");
+		tlhttp::Request second = co_await connection->asyncGet("/second", "two");
+		connection->close();
+
+		co_return first.getBody().str() + " " + second.getBody().str();
+	};
+
+	EXPECT_EQ("/first:one /second:two", tlhttp::syncWait(loop, client()));
+
+	server.stop();
+	thread.join();
+}
+
+TEST(Coroutine, Server)
+{
+	tlhttp::Server server("127.0.0.1", 18089);
+	std::thread thread([&server]() {
+		server.startCoroutine([](std::shared_ptr<tlhttp::Connection> conn) -> tlhttp::Task<void> {
+			int count = 0;
+			while(auto request = co_await conn->readRequest())
+			{
+				tlhttp::Request response;
+				response.setResponse(200);
+				response << request->getUrl() << " " << std::to_string(++count);
+				co_await conn->asyncSend(response.toString());
+
+				if(!request->isKeepAlive())
+					break;
+			}
+		});
+	});
+
+	tlhttp::Connection connection;
+	connectRetry(connection, 18089);
+	connection.send("GET /a HTTP/1.1\r\nHost: localhost\r\n\r\n"
+			"GET /b HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n");
+
+	std::string result = connection.receive();
+	EXPECT_NE(std::string::npos, result.find("/a 1"));
+	EXPECT_NE(std::string::npos, result.find("/b 2"));
+
+	server.stop();
+	thread.join();
+}
+
+TEST(Server, StreamedResponse)
+{
+	tlhttp::Server server("127.0.0.1", 18090);
+	server.setExecutor(std::make_shared<tlhttp::WorkStealingExecutor>(2));
+
+	std::thread thread([&server]() {
+		server.startAsync([](const std::shared_ptr<tlhttp::Request>&, const tlhttp::Responder& responder) {
+			tlhttp::Request response;
+			response.setResponse(200);
+			response << "first ";
+			responder.begin(response);
+
+			// The size is not known in advance
+			for(int i = 0; i < 3; i++)
+				responder.write(std::to_string(i));
+
+			responder.end();
+		});
+	});
+
+	tlhttp::Connection connection;
+	connectRetry(connection, 18090);
+	connection.send("GET /a HTTP/1.1\r\nHost: localhost\r\n\r\nGET /b HTTP/1.1\r\nHost: localhost\r\n\r\n");
+
+	// Both responses arrive on the same connection
+	for(int i = 0; i < 2; i++)
+	{
+		tlhttp::Request response = connection.get();
+		EXPECT_EQ("first 012", response.getBody().str());
+		EXPECT_TRUE(response.isChunked());
+	}
+
+	connection.send("GET /c HTTP/1.0\r\nHost: localhost\r\n\r\n");
+	std::string legacy = connection.receive();
+	EXPECT_EQ(std::string::npos, legacy.find("chunked"));
+	EXPECT_NE(std::string::npos, legacy.find("\r\n\r\nfirst 012"));
+
+	// The chunks are decoded when sending the request as well
+	tlhttp::Connection second;
+	second.connect("127.0.0.1", 18090);
+	EXPECT_EQ("first 012", second.get("/d", "").getBody().str());
+
+	server.stop();
+	thread.join();
+}
+
+TEST(Server, VectoredWrite)
+{
+	std::vector<tlhttp::EventLoop::Backend> backends = {tlhttp::EventLoop::Backend::Epoll};
+	if(tlhttp::EventLoop::isUringSupported())
+		backends.push_back(tlhttp::EventLoop::Backend::IoUring);
+
+	uint16_t port = 18091;
+	for(auto backend : backends)
+	{
+		tlhttp::Server server("127.0.0.1", port);
+		server.setBackend(backend);
+
+		std::thread thread([&server]() {
+			server.startAsync([](const std::shared_ptr<tlhttp::Request>&, const tlhttp::Responder& responder) {
+				tlhttp::Request response;
+				response.setResponse(200);
+				responder.begin(response);
+
+				// More chunks than fit into one batch of vectors
+				for(int i = 0; i < 500; i++)
+					responder.write(std::string(1000, 'a' + i % 26));
+
+				responder.end();
+			});
+		});
+
+		tlhttp::Connection connection;
+		connectRetry(connection, port++);
+		connection.send("GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+
+		std::string result = connection.receive();
+		tlhttp::Request response;
+		ASSERT_TRUE(tlhttp::Request::extract(result, response, true, true));
+		EXPECT_FALSE(response.getHeader("Date").empty());
+
+		std::string body = response.getBody().str();
+		ASSERT_EQ(500000u, body.size());
+		for(int i = 0; i < 500; i++)
+			EXPECT_EQ(std::string(1000, 'a' + i % 26), body.substr(i * 1000, 1000));
+
+		server.stop();
+		thread.join();
+	}
+}
+
+TEST(Server, ZerocopyWrite)
+{
+	// Binary data above the zerocopy threshold, sent with one write
+	auto payload = std::make_shared<std::string>(4 * tlhttp::EpollLoop::ZEROCOPY_THRESHOLD, '\0');
+	for(size_t i = 0; i < payload->size(); i++)
+		(*payload)[i] = char(i * 7 % 251);
+
+	tlhttp::Server server("127.0.0.1", 18107);
+	server.setBackend(tlhttp::EventLoop::Backend::Epoll);
+
+	std::thread thread([&server, payload]() {
+		server.startAsync([payload](const std::shared_ptr<tlhttp::Request>&, const tlhttp::Responder& responder) {
+			tlhttp::Request response;
+			response.setResponse(200);
+			response.getBody() << *payload;
+			responder.send(std::move(response));
+		});
+	});
+
+	tlhttp::Connection connection;
+	connectRetry(connection, 18107);
+
+	for(int i = 0; i < 3; i++)
+	{
+		connection.send("GET / HTTP/1.1\r\n\r\n");
+		tlhttp::Request response = connection.get();
+		EXPECT_TRUE(*payload == response.getBody().str());
+	}
+
+	// The server closes while the last write still waits for the window of a slow reader
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int size = 65536;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	timeval timeout = {5, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	tlhttp::Address address;
+	tlhttp::Resolver::parseNumeric("127.0.0.1", 18107, address);
+	ASSERT_EQ(0, ::connect(fd, address.get(), address.length));
+
+	std::string request = "GET / HTTP/1.1\r\nConnection: close\r\n\r\n";
+	ASSERT_EQ(ssize_t(request.size()), ::send(fd, request.data(), request.size(), 0));
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	std::string received;
+	char buffer[16384];
+	ssize_t count;
+	while((count = ::recv(fd, buffer, sizeof(buffer), 0)) > 0)
+		received.append(buffer, count);
+
+	::close(fd);
+	EXPECT_EQ(0, count);
+	ASSERT_GE(received.size(), payload->size());
+	EXPECT_EQ(0, received.compare(received.size() - payload->size(), payload->size(), *payload));
+
+	server.stop();
+	thread.join();
+}
+
+TEST(Server, StaticFiles)
+{
+	char directory[] = "/tmp/tlhttp-static-XXXXXX";
+	ASSERT_NE(nullptr, mkdtemp(directory));
+
+	std::string root = directory;
+	std::string big(300000, '\0');
+	for(size_t i = 0; i < big.size(); i++)
+		big[i] = char('a' + i % 26);
+
+	std::ofstream(root + "/small.txt") << "hello world";
+	std::ofstream(root + "/big.bin") << big;
+
+	std::vector<tlhttp::EventLoop::Backend> backends = {tlhttp::EventLoop::Backend::Epoll};
+	if(tlhttp::EventLoop::isUringSupported())
+		backends.push_back(tlhttp::EventLoop::Backend::IoUring);
+
+	uint16_t port = 18093;
+	for(auto backend : backends)
+	{
+		// Files above 4 KiB are sent from disk
+		tlhttp::StaticFiles files(root, 1024 * 1024, 4096);
+		tlhttp::Server server("127.0.0.1", port);
+		server.setBackend(backend);
+
+		std::thread thread([&server, &files]() { server.startAsync(std::ref(files)); });
+
+		auto fetch = [port](const std::string& request) {
+			tlhttp::Connection connection;
+			connectRetry(connection, port);
+			connection.send(request);
+			return connection.receive();
+		};
+
+		auto get = [&fetch](const std::string& target, const std::string& fields = "") {
+			std::string data = fetch("GET " + target + " HTTP/1.1\r\nConnection: close\r\n" + fields + "\r\n");
+			tlhttp::Request response;
+			EXPECT_TRUE(tlhttp::Request::extract(data, response, true, true));
+			return response;
+		};
+
+		tlhttp::Request small = get("/small.txt");
+		EXPECT_EQ("hello world", small.getBody().str());
+		EXPECT_EQ("text/plain; charset=utf-8", small.getHeader("Content-Type"));
+		ASSERT_FALSE(small.getHeader("ETag").empty());
+		ASSERT_FALSE(small.getHeader("Last-Modified").empty());
+
+		std::string etag(small.getHeader("ETag"));
+		EXPECT_EQ(304, std::stoi(get("/small.txt", "If-None-Match: \"x\", " + etag + "\r\n").toHeaderString().substr(9, 3)));
+		EXPECT_EQ(304, std::stoi(get("/small.txt", "If-Modified-Since: " + std::string(small.getHeader("Last-Modified")) + "\r\n")
+				.toHeaderString().substr(9, 3)));
+
+		tlhttp::Request whole = get("/big.bin");
+		EXPECT_EQ(big, whole.getBody().str());
+
+		tlhttp::Request part = get("/big.bin", "Range: bytes=1000-1999\r\n");
+		EXPECT_EQ(0u, part.toHeaderString().find("HTTP/1.1 206"));
+		EXPECT_EQ("bytes 1000-1999/300000", part.getHeader("Content-Range"));
+		EXPECT_EQ(big.substr(1000, 1000), part.getBody().str());
+
+		EXPECT_EQ("world", get("/small.txt", "Range: bytes=-5\r\n").getBody().str());
+		EXPECT_EQ(0u, get("/big.bin", "Range: bytes=300000-\r\n").toHeaderString().find("HTTP/1.1 416"));
+
+		// A stale If-Range sends the whole file
+		EXPECT_EQ(big, get("/big.bin", "Range: bytes=0-9\r\nIf-Range: \"stale\"\r\n").getBody().str());
+
+		EXPECT_EQ(0u, get("/../etc/passwd").toHeaderString().find("HTTP/1.1 404"));
+		EXPECT_EQ(0u, get("/%2e%2e/etc/passwd").toHeaderString().find("HTTP/1.1 404"));
+		EXPECT_EQ(0u, get("/missing").toHeaderString().find("HTTP/1.1 404"));
+
+		std::string head = fetch("HEAD /small.txt HTTP/1.1\r\nConnection: close\r\n\r\n");
+		EXPECT_NE(std::string::npos, head.find("Content-Length: 11\r\n"));
+		EXPECT_EQ(head.size() - 4, head.find("\r\n\r\n"));
+
+		// Other spellings of a path share its cache entry
+		EXPECT_EQ("hello world", get("//small.txt").getBody().str());
+		EXPECT_EQ("hello world", get("/./small.txt").getBody().str());
+
+		// Changing a cached file invalidates it
+		EXPECT_EQ(11u, files.getCachedBytes());
+		std::ofstream(root + "/small.txt") << "changed";
+
+		std::string body;
+		for(int i = 0; i < 100 && body != "changed"; i++)
+		{
+			body = get("/small.txt").getBody().str();
+			if(body != "changed")
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		EXPECT_EQ("changed", body);
+		EXPECT_EQ("changed", get("/./small.txt").getBody().str());
+		std::ofstream(root + "/small.txt") << "hello world";
+
+		server.stop();
+		thread.join();
+		port++;
+	}
+
+	unlink((root + "/small.txt").c_str());
+	unlink((root + "/big.bin").c_str());
+	rmdir(directory);
+}
+
+TEST(Server, ResponseCache)
+{
+	std::atomic<int> calls(0);
+	tlhttp::ResponseCache cache([&calls](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+		tlhttp::Request response;
+		response.setResponse(200);
+		response["Cache-Control"] = (request->getUrl() == "/private" ? "no-store" : "max-age=60");
+		if(request->getUrl() == "/vary")
+		{
+			response["Vary"] = "Accept-Language";
+			response << std::string(request->getHeader("Accept-Language"));
+		}
+
+		response << std::string(request->getUrl() == "/large" ? 1500 : 1, 'x') + std::to_string(calls++);
+		responder.send(std::move(response));
+	}, 2000, 1);
+
+	tlhttp::Server server("127.0.0.1", 18095);
+	std::thread thread([&server, &cache]() { server.startAsync(std::ref(cache)); });
+
+	auto get = [](const std::string& method, const std::string& target, const std::string& fields = "") {
+		tlhttp::Connection connection;
+		connectRetry(connection, 18095);
+		connection.send(method + " " + target + " HTTP/1.1\r\nHost: test\r\nConnection: close\r\n" + fields + "\r\n");
+
+		std::string data = connection.receive();
+		tlhttp::Request response;
+		EXPECT_TRUE(tlhttp::Request::extract(data, response, true, true));
+		return response;
+	};
+
+	tlhttp::Request first = get("GET", "/a");
+	tlhttp::Request second = get("GET", "/a");
+	EXPECT_EQ("x0", first.getBody().str());
+	EXPECT_EQ("x0", second.getBody().str());
+	EXPECT_FALSE(second.getHeader("Age").empty());
+	EXPECT_FALSE(second.getHeader("Date").empty());
+	EXPECT_EQ("max-age=60", second.getHeader("Cache-Control"));
+	EXPECT_EQ(1, calls);
+
+	// The client can ask for a fresh response
+	EXPECT_EQ("x1", get("GET", "/a", "Cache-Control: no-cache\r\n").getBody().str());
+
+	// Unsafe methods invalidate the URL
+	get("POST", "/a", "Content-Length: 0\r\n");
+	EXPECT_EQ("x3", get("GET", "/a").getBody().str());
+	EXPECT_EQ("x3", get("GET", "/a").getBody().str());
+
+	EXPECT_EQ("enx4", get("GET", "/vary", "Accept-Language: en\r\n").getBody().str());
+	EXPECT_EQ("dex5", get("GET", "/vary", "Accept-Language: de\r\n").getBody().str());
+	EXPECT_EQ("enx4", get("GET", "/vary", "Accept-Language: en\r\n").getBody().str());
+
+	EXPECT_EQ("x6", get("GET", "/private").getBody().str());
+	EXPECT_EQ("x7", get("GET", "/private").getBody().str());
+
+	// The budget is kept by evicting older responses
+	get("GET", "/large");
+	EXPECT_GE(2000u, cache.getBytes());
+	EXPECT_EQ(std::string(1500, 'x') + "8", get("GET", "/large").getBody().str());
+
+	server.stop();
+	thread.join();
+}
+
+TEST(Server, Timeouts)
+{
+	tlhttp::Server server("127.0.0.1", 18096);
+	server.setHeaderTimeout(std::chrono::milliseconds(200));
+	server.setIdleTimeout(std::chrono::milliseconds(200));
+
+	std::thread thread([&server]() {
+		server.startAsync([](const std::shared_ptr<tlhttp::Request>&, const tlhttp::Responder& responder) {
+			tlhttp::Request response;
+			response.setResponse(200);
+			responder.send(response);
+		});
+	});
+
+	// A client which never sends anything is closed
+	tlhttp::Connection silent;
+	connectRetry(silent, 18096);
+	auto start = std::chrono::steady_clock::now();
+	EXPECT_EQ("", silent.receive());
+	EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+
+	// Trickling in the header does not extend its timeout
+	tlhttp::Connection slow;
+	connectRetry(slow, 18096);
+	start = std::chrono::steady_clock::now();
+
+	bool closed = false;
+	for(int i = 0; i < 40 && !closed; i++)
+	{
+		closed = ::send(slow.getSocket(), "X", 1, MSG_NOSIGNAL) < 0;
+		std::this_thread::sleep_for(std::chrono::milliseconds(25));
+	}
+
+	EXPECT_TRUE(closed);
+	EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(900));
+
+	server.stop();
+	thread.join();
+}
+
+// Writes a self-signed certificate for localhost
+void createCertificate(const std::string& certificateFile, const std::string& keyFile)
+{
+	EVP_PKEY* key = EVP_EC_gen("P-256");
+	X509* certificate = X509_new();
+	ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+	X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+	X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+	X509_set_pubkey(certificate, key);
+
+	X509_NAME* name = X509_get_subject_name(certificate);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*) "localhost", -1, -1, 0);
+	X509_set_issuer_name(certificate, name);
+
+	X509_EXTENSION* names = X509V3_EXT_conf_nid(nullptr, nullptr, NID_subject_alt_name, "DNS:localhost,IP:127.0.0.1");
+	X509_add_ext(certificate, names, -1);
+	X509_EXTENSION_free(names);
+	X509_sign(certificate, key, EVP_sha256());
+
+	FILE* file = fopen(certificateFile.c_str(), "w");
+	PEM_write_X509(file, certificate);
+	fclose(file);
+
+	file = fopen(keyFile.c_str(), "w");
+	PEM_write_PrivateKey(file, key, nullptr, nullptr, 0, nullptr, nullptr);
+	fclose(file);
+
+	X509_free(certificate);
+	EVP_PKEY_free(key);
+}
+
+TEST(Server, Tls)
+{
+	createCertificate("/tmp/tlhttp_cert.pem", "/tmp/tlhttp_key.pem");
+
+	std::string content(400000, 'f');
+	for(size_t i = 0; i < content.size(); i += 1000)
+		content[i] = 'a' + (i / 1000) % 26;
+
+	std::ofstream("/tmp/tlhttp_tls.bin", std::ios::binary) << content;
+
+	SSL_CTX* client = SSL_CTX_new(TLS_client_method());
+	uint16_t port = 18097;
+
+	for(auto backend : {tlhttp::EventLoop::Backend::Epoll, tlhttp::EventLoop::Backend::IoUring})
+	{
+		if(backend == tlhttp::EventLoop::Backend::IoUring && !tlhttp::EventLoop::isUringSupported())
+			continue;
+
+		tlhttp::Server server("127.0.0.1", port);
+		server.setBackend(backend);
+		server.setCertificate("/tmp/tlhttp_cert.pem", "/tmp/tlhttp_key.pem");
+
+		std::thread thread([&server]() {
+			server.startAsync([](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+				tlhttp::Request response;
+				response.setResponse(200);
+
+				// Files are read and encrypted in batches unless the kernel does it
+				if(request->getUrl() == "/file")
+				{
+					int fd = open("/tmp/tlhttp_tls.bin", O_RDONLY | O_CLOEXEC);
+					responder.send(response, tlhttp::Segment::fromFile(fd, 0, 400000));
+					return;
+				}
+
+				response << "secure " << request->getUrl();
+				responder.send(response);
+			});
+		});
+
+		auto get = [&](const std::string& url, SSL_SESSION*& session) {
+			tlhttp::Connection connection;
+			connectRetry(connection, port);
+
+			SSL* ssl = SSL_new(client);
+			SSL_set_fd(ssl, connection.getSocket());
+			if(session)
+				SSL_set_session(ssl, session);
+
+			EXPECT_EQ(1, SSL_connect(ssl));
+			std::string request = "GET " + url + " HTTP/1.1\r\nConnection: close\r\n\r\n";
+			SSL_write(ssl, request.data(), request.size());
+
+			std::string response;
+			char buffer[4096];
+			int count;
+			while((count = SSL_read(ssl, buffer, sizeof(buffer))) > 0)
+				response.append(buffer, count);
+
+			bool resumed = SSL_session_reused(ssl);
+			SSL_SESSION_free(session);
+			session = SSL_get1_session(ssl);
+
+			// Sessions of connections which were not shut down can't be resumed
+			SSL_shutdown(ssl);
+			SSL_free(ssl);
+
+			return std::make_pair(tlhttp::Request::parse(response), resumed);
+		};
+
+		SSL_SESSION* session = nullptr;
+		auto first = get("/a", session);
+		EXPECT_EQ(200, first.first.getResponse());
+		EXPECT_EQ("secure /a", first.first.getBody().str());
+		EXPECT_FALSE(first.second);
+
+		// The second handshake resumes the session
+		auto second = get("/file", session);
+		EXPECT_TRUE(second.second);
+		EXPECT_EQ(content, second.first.getBody().str());
+
+		SSL_SESSION_free(session);
+		server.stop();
+		thread.join();
+		port++;
+	}
+
+	SSL_CTX_free(client);
+}
+
+TEST(Connection, Tls)
+{
+	createCertificate("/tmp/tlhttp_cert.pem", "/tmp/tlhttp_key.pem");
+
+	tlhttp::Server server("127.0.0.1", 18099);
+	server.setCertificate("/tmp/tlhttp_cert.pem", "/tmp/tlhttp_key.pem");
+
+	std::thread thread([&server]() {
+		server.startAsync([](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+			tlhttp::Request response;
+			response.setResponse(200);
+			response << "secure " << request->getUrl();
+			responder.send(response);
+		});
+	});
+
+	tlhttp::Connection probe;
+	connectRetry(probe, 18099);
+
+	// The default context verifies peers, the test certificate is not trusted
+	tlhttp::SSLConnection untrusted;
+	EXPECT_THROW(untrusted.connect("127.0.0.1", 18099), std::runtime_error);
+
+	auto context = tlhttp::TlsContext::createClient();
+	SSL_CTX_load_verify_locations(context->get(), "/tmp/tlhttp_cert.pem", nullptr);
+
+	// The server prefers h2 but falls back to what the client offers
+	context->setAlpnProtocols({"http/1.1"});
+
+	{
+		tlhttp::SSLConnection first(context);
+		first.connect("127.0.0.1", 18099);
+		EXPECT_FALSE(first.isResumed());
+		EXPECT_EQ("secure /a", first.get("/a", "").getBody().str());
+	}
+
+	EXPECT_EQ(1u, context->getSessionCount());
+
+	// Reconnecting resumes the session of the host
+	tlhttp::SSLConnection second(context);
+	second.connect("127.0.0.1", 18099);
+	EXPECT_TRUE(second.isResumed());
+	EXPECT_EQ("secure /b", second.get("/b", "").getBody().str());
+
+	tlhttp::EpollLoop loop;
+	auto client = [&loop, &context]() -> tlhttp::Task<std::string> {
+		auto connection = std::make_shared<tlhttp::Connection>();
+		co_await connection->asyncConnectSecure(loop, "127.0.0.1", 18099, context);
+
+		bool resumed = connection->getTls()->isResumed();
+		EXPECT_EQ("http/1.1", connection->getTls()->getAlpnProtocol());
+		tlhttp::Request first = co_await connection->asyncGet("/c", "");
+		tlhttp::Request second = co_await connection->asyncGet("/d", "");
+		connection->close();
+
+		co_return (resumed ? "resumed " : "full ") + first.getBody().str() + " " + second.getBody().str();
+	};
+
+	EXPECT_EQ("resumed secure /c secure /d", tlhttp::syncWait(loop, client()));
+
+	server.stop();
+	thread.join();
+}
+
+TEST(ConnectionPool, Reuse)
+{
+	std::string target;
+	auto endpoint = tlhttp::Endpoint::fromUrl("https://[::1]:8443/a?b=c#d", target);
+	EXPECT_EQ("https", endpoint.scheme);
+	EXPECT_EQ("::1", endpoint.host);
+	EXPECT_EQ(8443, endpoint.port);
+	EXPECT_EQ("/a?b=c", target);
+	EXPECT_NE(std::string::npos, tlhttp::ConnectionPool::formatRequest(endpoint, target, "").find("Host: [::1]:8443\r\n"));
+
+	endpoint = tlhttp::Endpoint::fromUrl("http://[::1]/", target);
+	EXPECT_NE(std::string::npos, tlhttp::ConnectionPool::formatRequest(endpoint, target, "").find("Host: [::1]\r\n"));
+
+	endpoint = tlhttp::Endpoint::fromUrl("http://example.com", target);
+	EXPECT_EQ(80, endpoint.port);
+	EXPECT_EQ("/", target);
+	EXPECT_THROW(tlhttp::Endpoint::fromUrl("example.com/a", target), std::runtime_error);
+
+	tlhttp::Server server("127.0.0.1", 18100);
+	server.setIdleTimeout(std::chrono::milliseconds(100));
+
+	std::thread thread([&server]() {
+		server.startAsync([](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+			// Tells how many requests were served on the connection
+			tlhttp::Request response;
+			response.setResponse(200);
+			response << request->getUrl() << ":" << request->getBody().str() << ":"
+					 << std::to_string(responder.getConnection()->getRequestCount());
+			responder.send(response);
+		});
+	});
+
+	tlhttp::Connection probe;
+	connectRetry(probe, 18100);
+	probe.send("GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+	probe.receive();
+
+	tlhttp::ConnectionPool pool;
+	EXPECT_EQ("/a::1", pool.get("http://127.0.0.1:18100/a").getBody().str());
+	EXPECT_EQ("/b:body:2", pool.get("http://127.0.0.1:18100/b", "body").getBody().str());
+	EXPECT_EQ("/c::3", pool.get("http://127.0.0.1:18100/c").getBody().str());
+	EXPECT_EQ(1u, pool.getIdleCount());
+
+	// The server closed the idle connection meanwhile, a new one is made
+	std::this_thread::sleep_for(std::chrono::milliseconds(300));
+	EXPECT_EQ("/d::1", pool.get("http://127.0.0.1:18100/d").getBody().str());
+
+	pool.clear();
+	EXPECT_EQ(0u, pool.getIdleCount());
+
+	// A reservation whose connect failed is given back without a connection
+	bool reserved = false;
+	auto unused = tlhttp::Endpoint::fromUrl("http://127.0.0.1:1/", target);
+	EXPECT_EQ(nullptr, pool.tryAcquire(unused, reserved));
+	EXPECT_TRUE(reserved);
+	pool.release(unused, nullptr, true);
+	EXPECT_EQ(0u, pool.getIdleCount());
+
+	server.stop();
+	thread.join();
+}
+
+TEST(Resolver, Cache)
+{
+	std::atomic<int> lookups(0);
+	tlhttp::Resolver resolver(2, [&lookups](const std::string& host, tlhttp::Addresses& addresses, std::chrono::milliseconds& ttl) {
+		lookups++;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		if(host != "stub.test")
+			return EAI_NONAME;
+
+		addresses.resize(2);
+		tlhttp::Resolver::parseNumeric("::1", 0, addresses[0]);
+		tlhttp::Resolver::parseNumeric("127.0.0.1", 0, addresses[1]);
+		ttl = std::chrono::milliseconds(200);
+		return 0;
+	});
+
+	// Concurrent lookups of one name share a query
+	std::atomic<int> done(0);
+	for(uint16_t port : {80, 443})
+		resolver.resolve("stub.test", port, [&done, port](tlhttp::Addresses&& addresses, int error) {
+			EXPECT_EQ(0, error);
+			ASSERT_EQ(2u, addresses.size());
+			EXPECT_EQ(port, addresses[1].getPort());
+			done++;
+		});
+
+	tlhttp::Addresses addresses = resolver.resolve("stub.test", 8080);
+	ASSERT_EQ(2u, addresses.size());
+	EXPECT_EQ("::1", addresses[0].toString());
+	EXPECT_EQ("127.0.0.1", addresses[1].toString());
+	EXPECT_EQ(8080, addresses[0].getPort());
+	EXPECT_EQ(2, done);
+	EXPECT_EQ(1, lookups);
+
+	// Numeric hosts and cached failures need no lookup
+	EXPECT_EQ("10.0.0.1", resolver.resolve("10.0.0.1", 80)[0].toString());
+	EXPECT_THROW(resolver.resolve("missing.test", 80), std::runtime_error);
+	EXPECT_THROW(resolver.resolve("missing.test", 80), std::runtime_error);
+	EXPECT_EQ(2, lookups);
+
+	// The time to live of the lookup is shorter than the resolver's
+	tlhttp::EpollLoop loop;
+	EXPECT_EQ(2u, tlhttp::syncWait(loop, resolver.asyncResolve(loop, "stub.test", 80)).size());
+	EXPECT_EQ(2, lookups);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(250));
+	EXPECT_EQ(2u, tlhttp::syncWait(loop, resolver.asyncResolve(loop, "stub.test", 80)).size());
+	EXPECT_EQ(3, lookups);
+
+	// The system resolver answers from /etc/hosts, connecting tries all addresses
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int enable = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+	tlhttp::Address local;
+	tlhttp::Resolver::parseNumeric("127.0.0.1", 18101, local);
+	ASSERT_EQ(0, bind(listener, local.get(), local.length));
+	ASSERT_EQ(0, listen(listener, 4));
+
+	tlhttp::Connection connection;
+	connection.connect("localhost", 18101);
+
+	auto client = [&loop]() -> tlhttp::Task<void> {
+		auto connection = std::make_shared<tlhttp::Connection>();
+		co_await connection->asyncConnect(loop, "localhost", 18101);
+		connection->close();
+	};
+
+	EXPECT_NO_THROW(tlhttp::syncWait(loop, client()));
+	EXPECT_GE(tlhttp::Resolver::getDefault().getCacheSize(), 1u);
+	::close(listener);
+}
+
+TEST(Connection, HappyEyeballs)
+{
+	auto parse = [](const char* host) {
+		tlhttp::Address address;
+		tlhttp::Resolver::parseNumeric(host, 0, address);
+		return address;
+	};
+
+	tlhttp::Addresses order = tlhttp::Resolver::interleave({parse("::1"), parse("::2"), parse("10.0.0.1")});
+	EXPECT_EQ("::1", order[0].toString());
+	EXPECT_EQ("10.0.0.1", order[1].toString());
+	EXPECT_EQ("::2", order[2].toString());
+
+	auto listenOn = [&parse](const char* host, int backlog) {
+		int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		tlhttp::Address address = parse(host);
+		address.setPort(18102);
+		EXPECT_EQ(0, bind(fd, address.get(), address.length));
+		EXPECT_EQ(0, listen(fd, backlog));
+		return fd;
+	};
+
+	// A full accept queue drops SYNs like an unreachable route
+	int blackhole = listenOn("127.0.0.2", 0);
+	int listener = listenOn("127.0.0.1", 16);
+	tlhttp::Connection filler;
+	filler.connect("127.0.0.2", 18102);
+
+	tlhttp::Resolver resolver(1, [&parse](const std::string& host, tlhttp::Addresses& addresses, std::chrono::milliseconds&) {
+		addresses.push_back(parse("127.0.0.2"));
+		if(host == "race.test")
+			addresses.push_back(parse("127.0.0.1"));
+
+		return 0;
+	});
+
+	tlhttp::Connection::ConnectOptions options;
+	options.attemptDelay = std::chrono::milliseconds(50);
+	options.timeout = std::chrono::seconds(5);
+	options.resolver = &resolver;
+
+	auto start = std::chrono::steady_clock::now();
+	tlhttp::Connection connection;
+	connection.setConnectOptions(options);
+	connection.connect("race.test", 18102);
+	EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+	tlhttp::EpollLoop loop;
+	auto client = [&loop, &options](std::string host) -> tlhttp::Task<void> {
+		auto connection = std::make_shared<tlhttp::Connection>();
+		connection->setConnectOptions(options);
+		co_await connection->asyncConnect(loop, host, 18102);
+		connection->close();
+	};
+
+	start = std::chrono::steady_clock::now();
+	EXPECT_NO_THROW(tlhttp::syncWait(loop, client("race.test")));
+	EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+	// Only the dead address is left, the deadline ends the connect
+	options.timeout = std::chrono::milliseconds(100);
+	start = std::chrono::steady_clock::now();
+	connection.setConnectOptions(options);
+	EXPECT_THROW(connection.connect("dead.test", 18102), std::runtime_error);
+	EXPECT_THROW(tlhttp::syncWait(loop, client("dead.test")), std::runtime_error);
+	EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+
+	::close(listener);
+	::close(blackhole);
+
+	// Fast Open falls back to a regular handshake without a cookie
+	tlhttp::Server server("127.0.0.1", 18103);
+	server.setFastOpen(16);
+	std::thread thread([&server]() {
+		server.startAsync([](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+			tlhttp::Request response;
+			response.setResponse(200);
+			response << request->getUrl();
+			responder.send(response);
+		});
+	});
+
+	tlhttp::Connection probe;
+	connectRetry(probe, 18103);
+
+	options = tlhttp::Connection::ConnectOptions();
+	options.fastOpen = true;
+	tlhttp::ConnectionPool pool;
+	pool.setConnectOptions(options);
+	EXPECT_EQ("/fast", pool.get("http://127.0.0.1:18103/fast").getBody().str());
+	EXPECT_EQ("/open", pool.get("http://127.0.0.1:18103/open").getBody().str());
+
+	server.stop();
+	thread.join();
+}
+
+TEST(MultiClient, Batch)
+{
+	auto handler = [](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+		tlhttp::Request response;
+		response.setResponse(200);
+		response << request->getUrl() << ":" << request->getBody().str() << ":"
+				 << std::to_string(responder.getConnection()->getRequestCount());
+		responder.send(response);
+	};
+
+	tlhttp::Server first("127.0.0.1", 18104), second("127.0.0.1", 18105);
+	std::thread firstThread([&]() { first.startAsync(handler); });
+	std::thread secondThread([&]() { second.startAsync(handler); });
+
+	tlhttp::Connection probe;
+	connectRetry(probe, 18104);
+	tlhttp::Connection secondProbe;
+	connectRetry(secondProbe, 18105);
+
+	std::vector<tlhttp::MultiClient::Fetch> batch;
+	for(int i = 0; i < 20; i++)
+		batch.emplace_back("http://127.0.0.1:18104/" + std::to_string(i));
+
+	batch.emplace_back("http://127.0.0.1:18105/post", "body");
+	batch.emplace_back("http://127.0.0.1:18105/get");
+	batch.emplace_back("no url");
+	batch.emplace_back("http://127.0.0.1:18106/refused");
+
+	tlhttp::MultiClient::Options options;
+	options.concurrency = 8;
+	options.pipelineDepth = 4;
+
+	tlhttp::ConnectionPool::Limits limits;
+	limits.maxPerHost = 2;
+
+	tlhttp::EpollLoop loop;
+	tlhttp::MultiClient client(loop, options, limits);
+
+	auto results = client.fetch(batch);
+	ASSERT_EQ(batch.size(), results.size());
+
+	// Two connections served 20 requests, so they were reused and pipelined
+	uint64_t maxCount = 0;
+	for(int i = 0; i < 20; i++)
+	{
+		ASSERT_TRUE(results[i].isSuccess()) << results[i].error;
+		std::string body = results[i].response.getBody().str();
+		EXPECT_EQ("/" + std::to_string(i) + "::", body.substr(0, body.rfind(':') + 1));
+		maxCount = std::max<uint64_t>(maxCount, std::stoull(body.substr(body.rfind(':') + 1)));
+	}
+
+	EXPECT_GE(maxCount, 10u);
+	EXPECT_EQ("/post:body:", results[20].response.getBody().str().substr(0, 11));
+	EXPECT_EQ("/get::", results[21].response.getBody().str().substr(0, 6));
+	EXPECT_FALSE(results[22].isSuccess());
+	EXPECT_FALSE(results[23].isSuccess());
+	EXPECT_EQ(4u, client.getPool().getIdleCount());
+
+	// The next batch continues on the pooled connections, results arrive as they complete
+	size_t count = 0;
+	std::string body;
+	tlhttp::syncWait(loop, client.run({tlhttp::MultiClient::Fetch("http://127.0.0.1:18105/again")},
+									   [&count, &body](tlhttp::MultiClient::Result&& result) {
+		count++;
+		body = result.response.getBody().str();
+	}));
+
+	EXPECT_EQ(1u, count);
+	EXPECT_NE("/again::1", body);
+
+	first.stop();
+	second.stop();
+	firstThread.join();
+	secondThread.join();
+}
+
+namespace
+{
+struct Frame
+{
+	uint8_t type = 0, flags = 0;
+	uint32_t stream = 0;
+	std::string payload;
+};
+
+void sendFrame(int fd, uint8_t type, uint8_t flags, uint32_t stream, const std::string& payload = "")
+{
+	std::string frame = {char(payload.size() >> 16), char(payload.size() >> 8), char(payload.size()), char(type), char(flags),
+						 char(stream >> 24), char(stream >> 16), char(stream >> 8), char(stream)};
+	frame += payload;
+	::send(fd, frame.data(), frame.size(), MSG_NOSIGNAL);
+}
+
+bool receiveExactly(int fd, char* buffer, size_t size)
+{
+	return size == 0 || ::recv(fd, buffer, size, MSG_WAITALL) == ssize_t(size);
+}
+
+Frame receiveFrame(int fd)
+{
+	uint8_t header[9];
+	if(!receiveExactly(fd, reinterpret_cast<char*>(header), sizeof(header)))
+		throw std::runtime_error("Connection closed");
+
+	Frame frame;
+	frame.type = header[3];
+	frame.flags = header[4];
+	frame.stream = (uint32_t(header[5] & 0x7f) << 24) | (header[6] << 16) | (header[7] << 8) | header[8];
+	frame.payload.resize((header[0] << 16) | (header[1] << 8) | header[2]);
+	if(!receiveExactly(fd, frame.payload.data(), frame.payload.size()))
+		throw std::runtime_error("Connection closed");
+
+	return frame;
+}
+
+std::string encodeUint32(uint32_t value)
+{
+	return {char(value >> 24), char(value >> 16), char(value >> 8), char(value)};
+}
+
+struct StreamResult
+{
+	std::string status, body;
+	bool complete = false;
+};
+
+// Reads responses until the given streams are complete, returning window as data arrives
+std::vector<uint32_t> receiveResponses(int fd, tlhttp::HpackDecoder& decoder, std::map<uint32_t, StreamResult>& streams)
+{
+	std::vector<uint32_t> order;
+	while(order.size() < streams.size())
+	{
+		Frame frame = receiveFrame(fd);
+		if(frame.type == 0x4 && !(frame.flags & 0x1))
+			sendFrame(fd, 0x4, 0x1, 0);
+		else if(frame.type == 0x7)
+			throw std::runtime_error("GOAWAY received");
+		else if(frame.type == 0x1)
+		{
+			for(auto& field : decodeBlock(decoder, frame.payload))
+				if(field.name == ":status")
+					streams[frame.stream].status = field.value;
+		}
+		else if(frame.type == 0x0)
+		{
+			streams[frame.stream].body += frame.payload;
+			if(!frame.payload.empty())
+			{
+				sendFrame(fd, 0x8, 0, 0, encodeUint32(frame.payload.size()));
+				sendFrame(fd, 0x8, 0, frame.stream, encodeUint32(frame.payload.size()));
+			}
+		}
+
+		if((frame.type == 0x0 || frame.type == 0x1) && (frame.flags & 0x1))
+		{
+			streams[frame.stream].complete = true;
+			order.push_back(frame.stream);
+		}
+	}
+
+	return order;
+}
+}
+
+TEST(Server, Http2)
+{
+	tlhttp::Server server("127.0.0.1", 18108);
+	server.setMaxBodySize(16);
+	auto echoed = std::make_shared<std::atomic<bool>>(false);
+	std::thread thread([&server, echoed]() {
+		server.startAsync([echoed](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+			tlhttp::Request response;
+			response.setResponse(200);
+
+			if(request->getUrl() == "/large")
+			{
+				// Exceeds the initial window of the client
+				response << std::string(200000, 'l');
+				responder.send(response);
+				return;
+			}
+
+			std::string body = request->getMethod() + " " + request->getUrl() + " " + (*request)["Host"] + " "
+							   + request->getBody().str();
+			if(request->getUrl() != "/slow")
+			{
+				response << body;
+				responder.send(response);
+				if(request->getUrl() == "/echo")
+					*echoed = true;
+				return;
+			}
+
+			std::thread([responder, body, echoed]() {
+				while(!*echoed)
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+				tlhttp::Request response;
+				response.setResponse(200);
+				response << body;
+				responder.send(response);
+			}).detach();
+		});
+	});
+
+	tlhttp::Connection connection;
+	connectRetry(connection, 18108);
+	int fd = connection.getSocket();
+
+	timeval timeout = {5, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	connection.send(std::string(tlhttp::Http2Session::PREFACE));
+	sendFrame(fd, 0x4, 0, 0);
+
+	tlhttp::HpackEncoder encoder;
+	auto sendRequest = [fd, &encoder](uint32_t stream, const std::string& method, const std::string& path, bool endStream) {
+		std::string block;
+		encoder.begin(block);
+		encoder.encode(block, ":method", method);
+		encoder.encode(block, ":scheme", "http");
+		encoder.encode(block, ":path", path);
+		encoder.encode(block, ":authority", "example.com");
+		sendFrame(fd, 0x1, 0x4 | (endStream ? 0x1 : 0), stream, block);
+	};
+
+	// All requests share the connection, the slow one waits for a later one
+	sendRequest(1, "GET", "/slow", true);
+	sendRequest(3, "GET", "/large", true);
+	sendRequest(5, "POST", "/echo", false);
+	sendFrame(fd, 0x0, 0, 5, "hel");
+	sendFrame(fd, 0x0, 0x1, 5, "lo");
+
+	tlhttp::HpackDecoder decoder;
+	std::map<uint32_t, StreamResult> streams = {{1, {}}, {3, {}}, {5, {}}};
+	auto order = receiveResponses(fd, decoder, streams);
+
+	ASSERT_EQ(3u, order.size());
+	EXPECT_LT(std::find(order.begin(), order.end(), 5), std::find(order.begin(), order.end(), 1));
+	EXPECT_EQ("200", streams[1].status);
+	EXPECT_EQ("GET /slow example.com ", streams[1].body);
+	EXPECT_EQ(std::string(200000, 'l'), streams[3].body);
+	EXPECT_EQ("POST /echo example.com hello", streams[5].body);
+
+	// Bodies above the limit are refused, announced or not
+	sendRequest(7, "POST", "/upload", false);
+	sendFrame(fd, 0x0, 0, 7, std::string(17, 'x'));
+
+	std::string block;
+	encoder.begin(block);
+	encoder.encode(block, ":method", "POST");
+	encoder.encode(block, ":scheme", "http");
+	encoder.encode(block, ":path", "/announced");
+	encoder.encode(block, "content-length", "17");
+	sendFrame(fd, 0x1, 0x4, 9, block);
+
+	std::map<uint32_t, StreamResult> refused = {{7, {}}, {9, {}}};
+	receiveResponses(fd, decoder, refused);
+	EXPECT_EQ("413", refused[7].status);
+	EXPECT_EQ("413", refused[9].status);
+
+	// Indexed references to a large entry count against the header list size
+	block.clear();
+	encoder.begin(block);
+	encoder.encode(block, ":method", "GET");
+	encoder.encode(block, ":scheme", "http");
+	encoder.encode(block, ":path", "/bomb");
+	encoder.encode(block, "x-bomb", std::string(4000, 'b'));
+	block += std::string(30000, '\xbe');
+	for(size_t offset = 0; offset < block.size(); offset += 16384)
+	{
+		bool last = offset + 16384 >= block.size();
+		sendFrame(fd, offset ? 0x9 : 0x1, (offset ? 0 : 0x1) | (last ? 0x4 : 0), 11, block.substr(offset, 16384));
+	}
+
+	std::map<uint32_t, StreamResult> bombed = {{11, {}}};
+	receiveResponses(fd, decoder, bombed);
+	EXPECT_EQ("431", bombed[11].status);
+
+	// Streams initiated by the server are a protocol error
+	sendRequest(12, "GET", "/", true);
+	Frame frame;
+	do
+		frame = receiveFrame(fd);
+	while(frame.type != 0x7);
+	EXPECT_EQ(encodeUint32(11) + encodeUint32(1), frame.payload);
+
+	// An HTTP/1.1 request can upgrade a plain connection
+	tlhttp::Connection upgraded;
+	connectRetry(upgraded, 18108);
+	fd = upgraded.getSocket();
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	upgraded.send("GET /upgraded HTTP/1.1\r\nHost: localhost\r\nConnection: Upgrade, HTTP2-Settings\r\n"
+				  "Upgrade: h2c\r\nHTTP2-Settings: AAMAAABk\r\n\r\n");
+
+	std::string switching;
+	while(switching.find("\r\n\r\n") == std::string::npos)
+	{
+		char c;
+		ASSERT_TRUE(receiveExactly(fd, &c, 1));
+		switching += c;
+	}
+
+	EXPECT_EQ(0u, switching.find("HTTP/1.1 101"));
+	upgraded.send(std::string(tlhttp::Http2Session::PREFACE));
+	sendFrame(fd, 0x4, 0, 0);
+
+	tlhttp::HpackDecoder upgradeDecoder;
+	std::map<uint32_t, StreamResult> upgradeStreams = {{1, {}}};
+	receiveResponses(fd, upgradeDecoder, upgradeStreams);
+	EXPECT_EQ("200", upgradeStreams[1].status);
+	EXPECT_EQ("GET /upgraded localhost ", upgradeStreams[1].body);
+
+	server.stop();
+	thread.join();
+}
+
+TEST(Server, Http2Reset)
+{
+	tlhttp::Http2Session::Settings settings;
+	settings.maxConcurrentStreams = 2;
+	settings.maxResets = 3;
+
+	tlhttp::Server server("127.0.0.1", 18109);
+	server.setHttp2Settings(settings);
+
+	// Requests to "/hold" are answered by the test
+	std::mutex mutex;
+	std::vector<tlhttp::Responder> held;
+	std::thread thread([&server, &mutex, &held]() {
+		server.startAsync([&mutex, &held](const std::shared_ptr<tlhttp::Request>& request, const tlhttp::Responder& responder) {
+			if(request->getUrl() == "/hold")
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				held.push_back(responder);
+				return;
+			}
+
+			tlhttp::Request response;
+			response.setResponse(200);
+			responder.send(response);
+		});
+	});
+
+	auto answerHeld = [&mutex, &held](size_t count) {
+		for(int i = 0; i < 500; i++)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if(held.size() >= count)
+					break;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		ASSERT_EQ(count, held.size());
+		for(auto& responder : held)
+		{
+			tlhttp::Request response;
+			response.setResponse(200);
+			responder.send(response);
+		}
+
+		held.clear();
+	};
+
+	tlhttp::Connection connection;
+	connectRetry(connection, 18109);
+	int fd = connection.getSocket();
+
+	timeval timeout = {5, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	connection.send(std::string(tlhttp::Http2Session::PREFACE));
+	sendFrame(fd, 0x4, 0, 0);
+
+	tlhttp::HpackEncoder encoder;
+	auto sendRequest = [fd, &encoder](uint32_t stream, const std::string& path) {
+		std::string block;
+		encoder.begin(block);
+		encoder.encode(block, ":method", "GET");
+		encoder.encode(block, ":scheme", "http");
+		encoder.encode(block, ":path", path);
+		sendFrame(fd, 0x1, 0x5, stream, block);
+	};
+
+	// Skips frames until one of the type arrives
+	auto receiveType = [fd](uint8_t type) {
+		Frame frame;
+		do
+			frame = receiveFrame(fd);
+		while(frame.type != type);
+		return frame;
+	};
+
+	// Reset streams keep their slot while the handler still runs
+	sendRequest(1, "/hold");
+	sendRequest(3, "/hold");
+	sendFrame(fd, 0x3, 0, 1, encodeUint32(8));
+	sendFrame(fd, 0x3, 0, 3, encodeUint32(8));
+	sendRequest(5, "/");
+
+	Frame refused = receiveType(0x3);
+	EXPECT_EQ(5u, refused.stream);
+	EXPECT_EQ(encodeUint32(7), refused.payload);
+
+	// Once answered, nothing is sent on them and the slots are free again
+	answerHeld(2);
+	sendRequest(7, "/");
+	Frame headers = receiveType(0x1);
+	EXPECT_EQ(7u, headers.stream);
+
+	// Too many resets close the connection
+	sendRequest(9, "/hold");
+	sendFrame(fd, 0x3, 0, 9, encodeUint32(8));
+	sendRequest(11, "/hold");
+	sendFrame(fd, 0x3, 0, 11, encodeUint32(8));
+
+	Frame goAway = receiveType(0x7);
+	EXPECT_EQ(encodeUint32(11) + encodeUint32(11), goAway.payload);
+
+	answerHeld(2);
+	server.stop();
+	thread.join();
+}